@@ -196,6 +196,170 @@ int dservapi_send_to_dataserver(int fd, const char *var,
 }
 
 
+/*
+ * Shared memory ring (src/shmring.h)
+ *
+ *  dservapi_shm_open asks the dserv listening on port for a ring over
+ * its unix socket, maps what comes back and keeps the connection open:
+ * closing it (dservapi_shm_close, or the process exiting) tells dserv
+ * to take what's left and let the ring go.
+ */
+#ifdef __linux__
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <shmring.h>
+
+struct dservapi_shm_s {
+  int sock;
+  int evfd;
+  dserv_shmring_t *ring;
+  size_t maplen;
+};
+
+dservapi_shm_t *dservapi_shm_open(int port, const char *name,
+				  unsigned int bytes)
+{
+  struct sockaddr_un addr;
+  char path[64], request[128], reply[64];
+  char cbuf[CMSG_SPACE(2 * sizeof(int))];
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  int fds[2], sock, len, n;
+  unsigned long size;
+  size_t maplen;
+  void *map;
+  dservapi_shm_t *shm;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  len = snprintf(path, sizeof(path), "dserv-shm.%d", port);
+  memcpy(addr.sun_path + 1, path, len);	/* abstract: leading nul */
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    return NULL;
+  if (connect(sock, (struct sockaddr *) &addr,
+	      offsetof(struct sockaddr_un, sun_path) + 1 + len) < 0) {
+    close(sock);
+    return NULL;
+  }
+
+  n = snprintf(request, sizeof(request), "ring %s %u\n", name, bytes);
+  if (n >= (int) sizeof(request) || write(sock, request, n) != n) {
+    close(sock);
+    return NULL;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  memset(cbuf, 0, sizeof(cbuf));
+  iov.iov_base = reply;
+  iov.iov_len = sizeof(reply) - 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  if ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) <= 0) {
+    close(sock);
+    return NULL;
+  }
+  reply[n] = '\0';
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    fprintf(stderr, "dservapi_shm_open: %s", reply);
+    close(sock);
+    return NULL;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  if (sscanf(reply, "1 %lu", &size) != 1) {
+    close(fds[0]);
+    close(fds[1]);
+    close(sock);
+    return NULL;
+  }
+  maplen = sizeof(dserv_shmring_t) + size;
+  map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  close(fds[0]);
+  if (map == MAP_FAILED ||
+      ((dserv_shmring_t *) map)->magic != DSERV_SHMRING_MAGIC ||
+      ((dserv_shmring_t *) map)->version != DSERV_SHMRING_VERSION) {
+    if (map != MAP_FAILED) munmap(map, maplen);
+    close(fds[1]);
+    close(sock);
+    return NULL;
+  }
+
+  shm = (dservapi_shm_t *) malloc(sizeof(dservapi_shm_t));
+  if (!shm) {
+    munmap(map, maplen);
+    close(fds[1]);
+    close(sock);
+    return NULL;
+  }
+  shm->sock = sock;
+  shm->evfd = fds[1];
+  shm->ring = (dserv_shmring_t *) map;
+  shm->maplen = maplen;
+  return shm;
+}
+
+/* 1 if written, 0 if it didn't fit (counted: dservapi_shm_dropped) */
+int dservapi_shm_write(dservapi_shm_t *shm, const char *varname,
+		       int dtype, int len, void *data)
+{
+  size_t varlen = strlen(varname);
+  uint64_t one = 1;
+  int rc;
+
+  if (!shm || len < 0 || varlen < 1 || varlen > DSERV_MAX_VARNAME_LEN)
+    return 0;
+  rc = dserv_shmring_put(shm->ring, varname, varlen, dtype, len, data, 0);
+  if (rc == 2 && write(shm->evfd, &one, sizeof(one)) < 0) {}
+  return rc != 0;
+}
+
+unsigned long dservapi_shm_dropped(dservapi_shm_t *shm)
+{
+  return shm ? __atomic_load_n(&shm->ring->dropped, __ATOMIC_RELAXED) : 0;
+}
+
+void dservapi_shm_close(dservapi_shm_t *shm)
+{
+  if (!shm) return;
+  munmap(shm->ring, shm->maplen);
+  close(shm->evfd);
+  close(shm->sock);
+  free(shm);
+}
+
+#else
+
+dservapi_shm_t *dservapi_shm_open(int port, const char *name,
+				  unsigned int bytes)
+{
+  return NULL;
+}
+
+int dservapi_shm_write(dservapi_shm_t *shm, const char *varname,
+		       int dtype, int len, void *data)
+{
+  return 0;
+}
+
+unsigned long dservapi_shm_dropped(dservapi_shm_t *shm)
+{
+  return 0;
+}
+
+void dservapi_shm_close(dservapi_shm_t *shm) {}
+
+#endif
+
+
 #ifdef STAND_ALONE
 int main(int argc, char *argv[])
 {
@@ -21,3 +21,18 @@ int dservapi_write_to_dataserver(int fd,
 int dservapi_send_to_dataserver(int fd, const char *var,
 				int dtype, int n, void *data);
 
+/*
+ * shared memory ring to a dserv on this host (see src/shmring.h):
+ * dservapi_shm_write takes the arguments dservapi_write_to_dataserver
+ * does, without its 128 byte limit and without a syscall per point.
+ * Linux only; dservapi_shm_open returns NULL elsewhere.
+ */
+typedef struct dservapi_shm_s dservapi_shm_t;
+
+dservapi_shm_t *dservapi_shm_open(int port, const char *name,
+				  unsigned int bytes);
+int dservapi_shm_write(dservapi_shm_t *shm, const char *varname,
+		       int dtype, int len, void *data);
+unsigned long dservapi_shm_dropped(dservapi_shm_t *shm);
+void dservapi_shm_close(dservapi_shm_t *shm);
+
@@ -0,0 +1,188 @@
+/*
+ * datapoint table contention: N writer threads update() points while M
+ * reader threads read them, against the old single-mutex table (getcopy
+ * under the lock) and the sharded table (snapshot, no copy).
+ *
+ *   c++ -O2 -std=c++20 -Isrc -o dptable_bench scripts/timing/dptable_bench.cpp \
+ *       src/Datapoint.c src/Base64.c -ljansson -lpthread
+ *   ./dptable_bench [writers readers keys payload_bytes seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+extern "C" {
+#include "Datapoint.h"
+}
+#include "DatapointTable.h"
+
+/* the table as it was: one map, one mutex, copy on every read */
+class LegacyTable
+{
+  std::unordered_map<std::string, ds_datapoint_t *> map_;
+  std::mutex mutex_;
+public:
+  ~LegacyTable() { for (auto &kv : map_) dpoint_free(kv.second); }
+  int update(ds_datapoint_t *d)
+  {
+    std::string key{d->varname};
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter != map_.end()) {
+      ds_datapoint_t *old = iter->second;
+      if (old->data.type == d->data.type && old->data.len == d->data.len) {
+	old->timestamp = d->timestamp;
+	old->flags = d->flags;
+	memcpy(old->data.buf, d->data.buf, old->data.len);
+	return 1;
+      }
+      dpoint_free(old);
+    }
+    map_[key] = d;
+    return 0;
+  }
+  ds_datapoint_t *getcopy(std::string key)
+  {
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter != map_.end()) return dpoint_copy(iter->second);
+    return nullptr;
+  }
+};
+
+struct Config { int writers, readers, keys, bytes; double seconds; };
+
+static std::vector<std::string> make_names(int n)
+{
+  std::vector<std::string> names;
+  for (int i = 0; i < n; i++) names.push_back("bench/point" + std::to_string(i));
+  return names;
+}
+
+static ds_datapoint_t *make_point(const std::string &name, int bytes,
+				  uint64_t ts)
+{
+  std::vector<unsigned char> buf(bytes, (unsigned char) ts);
+  return dpoint_new((char *) name.c_str(), ts, DSERV_BYTE, bytes, buf.data());
+}
+
+/* one checksum byte per read so the compiler can't drop the access */
+static inline unsigned sum_point(const ds_datapoint_t *dp)
+{
+  return dp->data.buf[0] + dp->data.buf[dp->data.len-1] + (unsigned) dp->timestamp;
+}
+
+template <typename Write, typename Read>
+static void run(const char *label, const Config &c,
+		const std::vector<std::string> &names, Write wr, Read rd)
+{
+  std::atomic<bool> go{false}, stop{false};
+  std::vector<unsigned long> wcount(c.writers), rcount(c.readers);
+  std::vector<std::thread> threads;
+  std::atomic<unsigned> sink{0};
+
+  for (int w = 0; w < c.writers; w++)
+    threads.emplace_back([&, w] {
+      while (!go) ;
+      unsigned long n = 0;
+      /* each writer owns a stripe of keys, like separate acquire modules */
+      for (uint64_t i = 0; !stop; i++, n++)
+	wr(names[(w + i * c.writers) % names.size()], i);
+      wcount[w] = n;
+    });
+  for (int r = 0; r < c.readers; r++)
+    threads.emplace_back([&, r] {
+      while (!go) ;
+      unsigned long n = 0;
+      unsigned s = 0;
+      for (uint64_t i = r; !stop; i += 7, n++)
+	s += rd(names[i % names.size()]);
+      rcount[r] = n;
+      sink += s;
+    });
+
+  go = true;
+  std::this_thread::sleep_for(std::chrono::duration<double>(c.seconds));
+  stop = true;
+  for (auto &t : threads) t.join();
+
+  unsigned long wt = 0, rt = 0;
+  for (auto n : wcount) wt += n;
+  for (auto n : rcount) rt += n;
+  printf("  %-24s writes %10.0f/s   reads %10.0f/s\n", label,
+	 wt / c.seconds, rt / c.seconds);
+}
+
+int main(int argc, char *argv[])
+{
+  Config c = { 4, 4, 256, 64, 2.0 };
+  if (argc > 1) c.writers = atoi(argv[1]);
+  if (argc > 2) c.readers = atoi(argv[2]);
+  if (argc > 3) c.keys = atoi(argv[3]);
+  if (argc > 4) c.bytes = atoi(argv[4]);
+  if (argc > 5) c.seconds = atof(argv[5]);
+  if (c.keys < 1 || c.bytes < 1 || c.seconds <= 0) {
+    fprintf(stderr, "usage: %s [writers readers keys payload_bytes seconds]\n",
+	    argv[0]);
+    return 1;
+  }
+
+  auto names = make_names(c.keys);
+  printf("datapoint table: %d writers, %d readers, %d keys, %d byte payloads, %.1fs\n",
+	 c.writers, c.readers, c.keys, c.bytes, c.seconds);
+
+  {
+    LegacyTable t;
+    for (auto &n : names) t.update(make_point(n, c.bytes, 1));
+    run("single mutex + copy", c, names,
+	[&](const std::string &n, uint64_t i) {
+	  ds_datapoint_t *d = make_point(n, c.bytes, i);
+	  if (t.update(d)) dpoint_free(d);
+	},
+	[&](const std::string &n) {
+	  ds_datapoint_t *d = t.getcopy(n);
+	  unsigned s = sum_point(d);
+	  dpoint_free(d);
+	  return s;
+	});
+  }
+
+  {
+    DatapointTable t;
+    for (auto &n : names) t.update(make_point(n, c.bytes, 1));
+    run("sharded + copy", c, names,
+	[&](const std::string &n, uint64_t i) {
+	  ds_datapoint_t *d = make_point(n, c.bytes, i);
+	  if (t.update(d)) dpoint_free(d);
+	},
+	[&](const std::string &n) {
+	  ds_datapoint_t *d = t.getcopy(n);
+	  unsigned s = sum_point(d);
+	  dpoint_free(d);
+	  return s;
+	});
+  }
+
+  {
+    DatapointTable t;
+    for (auto &n : names) t.update(make_point(n, c.bytes, 1));
+    run("sharded + snapshot", c, names,
+	[&](const std::string &n, uint64_t i) {
+	  ds_datapoint_t *d = make_point(n, c.bytes, i);
+	  if (t.update(d)) dpoint_free(d);
+	},
+	[&](const std::string &n) {
+	  DatapointSnapshot s = t.snapshot(n);
+	  return sum_point(s.get());
+	});
+  }
+
+  return 0;
+}
@@ -0,0 +1,327 @@
+/*
+ * fanout load: register many subscribers with a dserv, push points to
+ * it from one producer connection, and count what it costs dserv to
+ * deliver them -- context switches per point delivered, and threads.
+ *
+ * The subscribers are this program: each registers itself as a binary
+ * send client (%reg/%match, the way an extio box does) for all of fanload/,
+ * on its own port from listen_port up, so every point pushed is
+ * delivered once to each of them.  With -P, the status of each of
+ * dserv's threads (/proc/<pid>/task/<tid>/status) is read before and
+ * after the run and their voluntary and involuntary context switches
+ * summed.
+ *
+ * Reported: points/s pushed and delivered, dserv's context switches
+ * per point delivered and its thread count while the subscribers are
+ * registered.  Run it against dserv --fanout-threads 0 (a thread per
+ * subscriber) and --fanout-threads N (epoll) to compare the two.
+ *
+ *   c++ -O2 -std=c++20 -o fanout_load scripts/timing/fanout_load.cpp -lpthread
+ *   ./fanout_load [-h host] [-p port] [-n subscribers] [-r rate]
+ *                 [-b frames/write] [-s seconds] [-l listen_port] [-P pid]
+ *
+ * rate 0 is flat out.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int FRAME = 128;		/* DPOINT_BINARY_FIXED_LENGTH */
+static const uint32_t DSERV_INT = 5;
+
+static std::atomic<bool> running{true};
+static std::atomic<uint64_t> sent{0};
+static std::atomic<uint64_t> delivered{0};
+
+static inline uint64_t mono_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int connect_to(const char *host, int port)
+{
+  struct sockaddr_in addr;
+  int on = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, host, &addr.sin_addr);
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t n)
+{
+  while (n) {
+    ssize_t w = write(fd, buf, n);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return -1;
+    buf += w;
+    n -= w;
+  }
+  return 0;
+}
+
+/* a '%' command and its one line reply */
+static std::string command(int fd, const std::string &cmd)
+{
+  std::string reply;
+  char c;
+  if (write_all(fd, cmd.c_str(), cmd.size())) return "";
+  while (read(fd, &c, 1) == 1 && c != '\n') reply += c;
+  return reply;
+}
+
+/* '>' varlen(u16) varname ts(u64) type(u32) len(u32) data, padded */
+static void make_frame(char *f, const std::string &name, uint64_t ts,
+		       int32_t value)
+{
+  uint16_t varlen = name.size();
+  uint32_t type = DSERV_INT, len = sizeof(value);
+  char *p = f;
+
+  memset(f, 0, FRAME);
+  *p++ = '>';
+  memcpy(p, &varlen, sizeof(varlen));  p += sizeof(varlen);
+  memcpy(p, name.data(), varlen);      p += varlen;
+  memcpy(p, &ts, sizeof(ts));          p += sizeof(ts);
+  memcpy(p, &type, sizeof(type));      p += sizeof(type);
+  memcpy(p, &len, sizeof(len));        p += sizeof(len);
+  memcpy(p, &value, sizeof(value));
+}
+
+static void sender(int fd, double rate, int batch)
+{
+  std::vector<char> buf((size_t) FRAME * batch);
+  uint64_t interval = rate > 0 ? (uint64_t) (1e6 * batch / rate) : 0;
+  uint64_t next = mono_us();
+  int32_t value = 0;
+
+  while (running) {
+    for (int b = 0; b < batch; b++, value++)
+      make_frame(&buf[(size_t) b * FRAME],
+		 "fanload/" + std::to_string(value % 16), mono_us(), value);
+    if (write_all(fd, buf.data(), buf.size())) {
+      fprintf(stderr, "fanout_load: write failed: %s\n", strerror(errno));
+      running = false;
+      return;
+    }
+    sent += batch;
+    if (interval) {
+      next += interval;
+      uint64_t now = mono_us();
+      if (next > now) usleep(next - now);
+      else next = now;
+    }
+  }
+}
+
+/* all subscriber connections, on one epoll set; frames are only counted */
+static void receiver(std::vector<int> listen_fds)
+{
+  int nsubs = listen_fds.size();
+  int epfd = epoll_create1(0);
+  std::vector<size_t> have(nsubs);
+  std::vector<int> fds;
+
+  for (int i = 0; i < nsubs; i++) {
+    int fd = accept(listen_fds[i], NULL, NULL);
+    if (fd < 0) return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = fds.size();
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    fds.push_back(fd);
+  }
+
+  char buf[FRAME * 512];
+  struct epoll_event events[64];
+  int open = nsubs;
+  while (open) {
+    int n = epoll_wait(epfd, events, 64, 200);
+    if (n <= 0) {
+      if (!running) break;
+      continue;
+    }
+    for (int i = 0; i < n; i++) {
+      int s = events[i].data.u32;
+      ssize_t r = read(fds[s], buf, sizeof(buf));
+      if (r <= 0) {
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fds[s], NULL);
+	open--;
+	continue;
+      }
+      /* frames are fixed size, so only the count matters */
+      have[s] += r;
+      delivered += have[s] / FRAME;
+      have[s] %= FRAME;
+    }
+  }
+  for (int fd : fds) close(fd);
+  close(epfd);
+}
+
+/* summed context switches of every thread of pid; threads in *nthreads */
+static uint64_t context_switches(int pid, int *nthreads)
+{
+  char path[64];
+  uint64_t total = 0;
+  int n = 0;
+
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  DIR *dir = opendir(path);
+  if (!dir) return 0;
+  struct dirent *d;
+  while ((d = readdir(dir))) {
+    if (d->d_name[0] == '.') continue;
+    char status[300], line[256];
+    snprintf(status, sizeof(status), "/proc/%d/task/%s/status", pid, d->d_name);
+    FILE *fp = fopen(status, "r");
+    if (!fp) continue;
+    while (fgets(line, sizeof(line), fp)) {
+      unsigned long long v;
+      if (sscanf(line, "voluntary_ctxt_switches: %llu", &v) == 1 ||
+	  sscanf(line, "nonvoluntary_ctxt_switches: %llu", &v) == 1)
+	total += v;
+    }
+    fclose(fp);
+    n++;
+  }
+  closedir(dir);
+  if (nthreads) *nthreads = n;
+  return total;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *host = "127.0.0.1";
+  int port = 4620, nsubs = 20, batch = 1, seconds = 5;
+  int listen_port = 4699, pid = 0;
+  double rate = 2000;
+  int c;
+
+  while ((c = getopt(argc, argv, "h:p:n:r:b:s:l:P:")) != -1) {
+    switch (c) {
+    case 'h': host = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'n': nsubs = std::max(1, atoi(optarg)); break;
+    case 'r': rate = atof(optarg); break;
+    case 'b': batch = std::max(1, atoi(optarg)); break;
+    case 's': seconds = atoi(optarg); break;
+    case 'l': listen_port = atoi(optarg); break;
+    case 'P': pid = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-h host] [-p port] [-n subscribers] "
+	      "[-r rate] [-b frames/write] [-s seconds] [-l listen_port] "
+	      "[-P pid]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  /* where dserv will send our points: a port per subscriber, since
+     dserv keys send clients by host:port */
+  std::vector<int> listen_fds;
+  for (int i = 0; i < nsubs; i++) {
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(listen_port + i);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	listen(fd, 1) < 0) {
+      perror("fanout_load: listen");
+      return 1;
+    }
+    listen_fds.push_back(fd);
+  }
+  std::thread recv_thread(receiver, listen_fds);
+
+  int ctl = connect_to(host, port);
+  if (ctl < 0) {
+    fprintf(stderr, "fanout_load: can't connect to %s:%d\n", host, port);
+    return 1;
+  }
+  char cmd[256];
+  for (int i = 0; i < nsubs; i++) {
+    snprintf(cmd, sizeof(cmd), "%%reg 127.0.0.1 %d 1\n", listen_port + i);
+    command(ctl, cmd);
+    snprintf(cmd, sizeof(cmd), "%%match 127.0.0.1 %d fanload/* 1\n",
+	     listen_port + i);
+    command(ctl, cmd);
+  }
+
+  int prod = connect_to(host, port);
+  if (prod < 0) {
+    fprintf(stderr, "fanout_load: can't connect to %s:%d\n", host, port);
+    return 1;
+  }
+
+  printf("%d subscribers, %s, %d frame%s per write, %d s\n", nsubs,
+	 rate > 0 ? (std::to_string((int) rate) + " points/s").c_str()
+	 : "flat out", batch, batch == 1 ? "" : "s", seconds);
+
+  int threads = 0;
+  uint64_t switches = pid ? context_switches(pid, &threads) : 0;
+  uint64_t start = mono_us();
+  std::thread send_thread(sender, prod, rate, batch);
+
+  sleep(seconds);
+  running = false;
+  send_thread.join();
+
+  /* let the deliveries catch up */
+  uint64_t last = 0;
+  for (int i = 0; i < 50 && delivered != last; i++) {
+    last = delivered;
+    usleep(100000);
+  }
+  uint64_t elapsed = mono_us() - start;
+  if (pid) switches = context_switches(pid, NULL) - switches;
+
+  for (int i = 0; i < nsubs; i++) {
+    snprintf(cmd, sizeof(cmd), "%%unreg 127.0.0.1 %d\n", listen_port + i);
+    command(ctl, cmd);
+  }
+  recv_thread.join();
+
+  printf("  pushed    %10llu  %9.0f points/s\n",
+	 (unsigned long long) sent.load(), sent / (elapsed / 1e6));
+  printf("  delivered %10llu  %9.0f points/s  (%.1f%% of %d x pushed)\n",
+	 (unsigned long long) delivered.load(), delivered / (elapsed / 1e6),
+	 sent ? 100.0 * delivered / ((double) sent * nsubs) : 0.0, nsubs);
+  if (pid)
+    printf("  dserv: %d threads, %llu context switches, %.3f per point "
+	   "delivered\n", threads, (unsigned long long) switches,
+	   delivered ? (double) switches / delivered : 0.0);
+
+  close(prod);
+  close(ctl);
+  for (int fd : listen_fds) close(fd);
+  return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * ingest load: open many producer connections to a dserv's dataserver
+ * port, push '>' frames down all of them, and time each point from the
+ * moment it was written to the moment dserv notified a subscriber of
+ * it.
+ *
+ * The subscriber is this program: it registers itself as a binary send
+ * client (%reg/%match, the way an extio box does) for all of loadgen/, so
+ * every point pushed comes back once.  Points carry the sender's
+ * CLOCK_MONOTONIC as their timestamp and dserv keeps a producer's
+ * timestamp, so the latency is just now - timestamp on arrival.
+ *
+ * Reported: points/s written and notified, and p50/p99/max latency.
+ * Run it against dserv --ingest-threads 0 (a thread per connection)
+ * and --ingest-threads N (epoll) to compare the two.
+ *
+ *   c++ -O2 -std=c++20 -o ingest_load scripts/timing/ingest_load.cpp -lpthread
+ *   ./ingest_load [-h host] [-p port] [-c connections] [-r rate/conn]
+ *                 [-b frames/write] [-s seconds] [-t threads] [-l listen_port]
+ *
+ * rate 0 is flat out: each sender thread writes as fast as its sockets
+ * take frames.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int FRAME = 128;		/* DPOINT_BINARY_FIXED_LENGTH */
+static const uint32_t DSERV_INT = 5;
+
+static std::atomic<bool> running{true};
+static std::atomic<uint64_t> sent{0};
+
+static inline uint64_t mono_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int connect_to(const char *host, int port)
+{
+  struct sockaddr_in addr;
+  int on = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, host, &addr.sin_addr);
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t n)
+{
+  while (n) {
+    ssize_t w = write(fd, buf, n);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return -1;
+    buf += w;
+    n -= w;
+  }
+  return 0;
+}
+
+/* a '%' command and its one line reply */
+static std::string command(int fd, const std::string &cmd)
+{
+  std::string reply;
+  char c;
+  if (write_all(fd, cmd.c_str(), cmd.size())) return "";
+  while (read(fd, &c, 1) == 1 && c != '\n') reply += c;
+  return reply;
+}
+
+/* '>' varlen(u16) varname ts(u64) type(u32) len(u32) data, padded */
+static void make_frame(char *f, const std::string &name, uint64_t ts,
+		       int32_t value)
+{
+  uint16_t varlen = name.size();
+  uint32_t type = DSERV_INT, len = sizeof(value);
+  char *p = f;
+
+  memset(f, 0, FRAME);
+  *p++ = '>';
+  memcpy(p, &varlen, sizeof(varlen));  p += sizeof(varlen);
+  memcpy(p, name.data(), varlen);      p += varlen;
+  memcpy(p, &ts, sizeof(ts));          p += sizeof(ts);
+  memcpy(p, &type, sizeof(type));      p += sizeof(type);
+  memcpy(p, &len, sizeof(len));        p += sizeof(len);
+  memcpy(p, &value, sizeof(value));
+}
+
+static void sender(std::vector<int> fds, std::vector<std::string> names,
+		   double rate, int batch)
+{
+  std::vector<char> buf((size_t) FRAME * batch);
+  /* rate is per connection: one pass writes batch frames to each */
+  uint64_t interval = rate > 0 ? (uint64_t) (1e6 * batch / rate) : 0;
+  uint64_t next = mono_us();
+  int32_t value = 0;
+
+  while (running) {
+    for (size_t i = 0; i < fds.size(); i++) {
+      for (int b = 0; b < batch; b++)
+	make_frame(&buf[(size_t) b * FRAME], names[i], mono_us(), value++);
+      if (write_all(fds[i], buf.data(), buf.size())) {
+	fprintf(stderr, "ingest_load: write failed: %s\n", strerror(errno));
+	running = false;
+	return;
+      }
+      sent += batch;
+    }
+    if (interval) {
+      next += interval;
+      uint64_t now = mono_us();
+      if (next > now) usleep(next - now);
+      else next = now;
+    }
+  }
+}
+
+static void receiver(int listen_fd, std::vector<uint32_t> *latencies,
+		     std::atomic<uint64_t> *received)
+{
+  int fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) return;
+
+  struct timeval tv = { 0, 200000 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  char buf[FRAME * 256];
+  size_t have = 0;
+  while (running || have) {
+    ssize_t n = read(fd, buf + have, sizeof(buf) - have);
+    if (n <= 0) {
+      if (n < 0 && (errno == EAGAIN || errno == EINTR) && running) continue;
+      break;
+    }
+    have += n;
+    uint64_t now = mono_us();
+    size_t off = 0;
+    for (; off + FRAME <= have; off += FRAME) {
+      uint16_t varlen;
+      uint64_t ts;
+      memcpy(&varlen, buf + off + 1, sizeof(varlen));
+      memcpy(&ts, buf + off + 3 + varlen, sizeof(ts));
+      latencies->push_back((uint32_t) std::min<uint64_t>(now - ts, UINT32_MAX));
+      (*received)++;
+    }
+    memmove(buf, buf + off, have - off);
+    have -= off;
+  }
+  close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *host = "127.0.0.1";
+  int port = 4620, nconn = 200, batch = 1, seconds = 5, nthreads = 4;
+  int listen_port = 4699;
+  double rate = 500;
+  int c;
+
+  while ((c = getopt(argc, argv, "h:p:c:r:b:s:t:l:")) != -1) {
+    switch (c) {
+    case 'h': host = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'c': nconn = atoi(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 'b': batch = std::max(1, atoi(optarg)); break;
+    case 's': seconds = atoi(optarg); break;
+    case 't': nthreads = std::max(1, atoi(optarg)); break;
+    case 'l': listen_port = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-h host] [-p port] [-c connections] "
+	      "[-r rate/conn] [-b frames/write] [-s seconds] [-t threads] "
+	      "[-l listen_port]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  /* where dserv will send our points back */
+  int on = 1;
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(listen_port);
+  addr.sin_addr.s_addr = INADDR_ANY;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(listen_fd, 1) < 0) {
+    perror("ingest_load: listen");
+    return 1;
+  }
+
+  std::vector<uint32_t> latencies;
+  latencies.reserve(1 << 24);
+  std::atomic<uint64_t> received{0};
+  std::thread recv_thread(receiver, listen_fd, &latencies, &received);
+
+  int ctl = connect_to(host, port);
+  if (ctl < 0) {
+    fprintf(stderr, "ingest_load: can't connect to %s:%d\n", host, port);
+    return 1;
+  }
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "%%reg 127.0.0.1 %d 1\n", listen_port);
+  command(ctl, cmd);
+  snprintf(cmd, sizeof(cmd), "%%match 127.0.0.1 %d loadgen/* 1\n", listen_port);
+  command(ctl, cmd);
+
+  std::vector<std::vector<int>> fds(nthreads);
+  std::vector<std::vector<std::string>> names(nthreads);
+  for (int i = 0; i < nconn; i++) {
+    int fd = connect_to(host, port);
+    if (fd < 0) {
+      fprintf(stderr, "ingest_load: connection %d failed\n", i);
+      return 1;
+    }
+    fds[i % nthreads].push_back(fd);
+    names[i % nthreads].push_back("loadgen/" + std::to_string(i));
+  }
+
+  printf("%d connections, %s, %d frame%s per write, %d s\n", nconn,
+	 rate > 0 ? (std::to_string((int) rate) + " points/s each").c_str()
+	 : "flat out", batch, batch == 1 ? "" : "s", seconds);
+
+  uint64_t start = mono_us();
+  std::vector<std::thread> senders;
+  for (int t = 0; t < nthreads; t++)
+    senders.emplace_back(sender, fds[t], names[t], rate, batch);
+
+  sleep(seconds);
+  running = false;
+  for (auto &t : senders) t.join();
+  uint64_t elapsed = mono_us() - start;
+
+  /* let the notifications catch up, then stop listening */
+  uint64_t last = 0;
+  for (int i = 0; i < 50 && received != last; i++) {
+    last = received;
+    usleep(100000);
+  }
+  snprintf(cmd, sizeof(cmd), "%%unreg 127.0.0.1 %d\n", listen_port);
+  command(ctl, cmd);
+  recv_thread.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto pct = [&](double p) {
+    return latencies.empty() ? 0 :
+      latencies[(size_t) (p * (latencies.size() - 1))];
+  };
+  printf("  sent     %10llu  %9.0f points/s\n",
+	 (unsigned long long) sent.load(), sent / (elapsed / 1e6));
+  printf("  notified %10llu  %9.0f points/s\n",
+	 (unsigned long long) received.load(), received / (elapsed / 1e6));
+  printf("  ingest->notify  p50 %u us  p99 %u us  max %u us\n",
+	 pct(0.5), pct(0.99), latencies.empty() ? 0 : latencies.back());
+
+  for (auto &v : fds) for (int fd : v) close(fd);
+  close(ctl);
+  close(listen_fd);
+  return 0;
+}
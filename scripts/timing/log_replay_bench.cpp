@@ -0,0 +1,185 @@
+/*
+ * logger throughput: replay a recorded session through a LogClient, as
+ * the logger thread would feed it, at 10x the recorded rate and then
+ * flat out, uncompressed and at a couple of zlib levels.
+ *
+ * For each run: points/s and MB/s actually written, the compression
+ * ratio, the writer thread's CPU time, and how far the writer was
+ * behind when the replay finished (the queue it still had to drain).
+ * A writer that keeps up at 10x has that much headroom on a rig.
+ *
+ * With no log given, a session is synthesized: 1 kHz 8 channel ain,
+ * 500 Hz em, a trickle of events and a stimdg now and then.
+ *
+ *   cc -O2 -c -Isrc src/Datapoint.c src/Base64.c src/dslog_index.c
+ *   c++ -O2 -std=c++20 -Isrc -o log_replay_bench \
+ *       scripts/timing/log_replay_bench.cpp src/LogClient.cpp \
+ *       src/LogTable.cpp Datapoint.o Base64.o dslog_index.o \
+ *       -ljansson -lz -lpthread
+ *   ./log_replay_bench [session.ds [speedup [outdir]]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "Datapoint.h"
+#include "LogMatchDict.h"
+#include "LogTable.h"
+#include "LogClient.h"
+#include "dslog_index.h"
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void sleep_until_ns(uint64_t t)
+{
+  struct timespec ts = { (time_t) (t / 1000000000ull),
+			 (long) (t % 1000000000ull) };
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static int load_record(const dslog_record_t *rec, void *clientdata)
+{
+  auto *points = (std::vector<ds_datapoint_t *> *) clientdata;
+  ds_datapoint_t *d = dpoint_new((char *) rec->varname, rec->timestamp,
+				 DSERV_BYTE, rec->len,
+				 (unsigned char *) rec->data);
+  d->data.type = (ds_datatype_t) rec->type;
+  d->flags = rec->flags;
+  points->push_back(d);
+  return 0;
+}
+
+static void synthesize(std::vector<ds_datapoint_t *> &points, int seconds)
+{
+  uint64_t t0 = 1700000000000000ull;
+  short ain[8];
+  float em[4];
+  std::vector<unsigned char> dg(200000);
+  int evt = 0;
+
+  for (uint64_t us = 0; us < (uint64_t) seconds * 1000000; us += 1000) {
+    for (int c = 0; c < 8; c++) ain[c] = (short) (2048 + (us / 1000 + c * 37) % 400);
+    points.push_back(dpoint_new((char *) "ain/vals", t0 + us, DSERV_SHORT,
+				sizeof(ain), (unsigned char *) ain));
+    if (us % 2000 == 0) {
+      for (int c = 0; c < 4; c++) em[c] = (float) ((us / 2000) % 100) * 0.01f + c;
+      points.push_back(dpoint_new((char *) "em/sampler/vals", t0 + us,
+				  DSERV_FLOAT, sizeof(em), (unsigned char *) em));
+    }
+    if (us % 50000 == 0) {
+      evt++;
+      points.push_back(dpoint_new((char *) "eventlog/events", t0 + us,
+				  DSERV_INT, sizeof(evt), (unsigned char *) &evt));
+    }
+    if (us % 5000000 == 0) {
+      for (size_t i = 0; i < dg.size(); i++) dg[i] = (unsigned char) (i * 7 + us);
+      points.push_back(dpoint_new((char *) "stimdg", t0 + us, DSERV_DG,
+				  dg.size(), dg.data()));
+    }
+  }
+}
+
+static void replay(const char *label, std::vector<ds_datapoint_t *> &points,
+		   double speedup, int level, const std::string &path)
+{
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { perror(path.c_str()); exit(1); }
+
+  LogTable table;
+  LogClient *lc = new LogClient(path, fd, 3, level);
+  lc->log_table = &table;
+  table.insert(path, lc);
+  std::thread writer(&LogClient::log_client_process, lc);
+
+  uint64_t first = points.front()->timestamp;
+  uint64_t start = now_ns();
+  for (auto d : points) {
+    if (speedup > 0)
+      sleep_until_ns(start + (uint64_t) ((d->timestamp - first) * 1000 / speedup));
+    lc->dpoint_queue.push_back(dpoint_copy(d));
+  }
+  uint64_t fed = now_ns();
+
+  /* caught up once every point is staged and the last flush is out */
+  log_client_io_t info;
+  do {
+    usleep(200);
+    table.buffering(path, -1, -1, &info);
+  } while (info.points < points.size());
+  usleep((info.flush_ms + 5) * 1000);
+  uint64_t done = now_ns();
+  table.buffering(path, -1, -1, &info);
+
+  lc->dpoint_queue.push_back(&lc->shutdown_dpoint);
+  writer.join();			/* lc deletes itself */
+
+  struct stat st;
+  stat(path.c_str(), &st);
+  double secs = (done - start - (info.flush_ms + 5) * 1000000ull) / 1e9;
+  printf("  %-16s %9.0f pts/s %7.1f MB/s out  ratio %5.2f  writer cpu %6.0f ms"
+	 "  drain %6.1f ms\n",
+	 label, points.size() / secs, st.st_size / secs / 1e6,
+	 info.bytes ? (double) info.raw_bytes / info.bytes : 1.0,
+	 info.cpu_us / 1000.0, secs * 1e3 - (fed - start) / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+  std::vector<ds_datapoint_t *> points;
+  double speedup = argc > 2 ? atof(argv[2]) : 10;
+  std::string outdir = argc > 3 ? argv[3] : "/tmp";
+
+  if (argc > 1) {
+    int err;
+    dslog_file_t *f = dslog_open(argv[1], &err);
+    if (!f) {
+      fprintf(stderr, "%s: can't read %s (%d)\n", argv[0], argv[1], err);
+      return 1;
+    }
+    dslog_read_range(f, DSLOG_HEADER_SIZE, 0, load_record, &points);
+    dslog_close(f);
+  }
+  else {
+    synthesize(points, 60);
+  }
+  if (points.empty()) {
+    fprintf(stderr, "%s: no records\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t raw = 0;
+  for (auto d : points) raw += DSLOG_RECORD_HEADER(d->varlen) + d->data.len;
+  double span = (points.back()->timestamp - points.front()->timestamp) / 1e6;
+  printf("%zu points, %.1f MB, %.1f s recorded\n", points.size(), raw / 1e6, span);
+
+  std::string path = outdir + "/log_replay_bench.ds";
+  const int levels[] = { 0, 1, 6 };
+  char label[64];
+  printf("\nreplay at %.0fx (%.1f s)\n", speedup, span / speedup);
+  for (int level : levels) {
+    snprintf(label, sizeof(label), level ? "zlib %d" : "uncompressed", level);
+    replay(label, points, speedup, level, path);
+  }
+  printf("\nflat out\n");
+  for (int level : levels) {
+    snprintf(label, sizeof(label), level ? "zlib %d" : "uncompressed", level);
+    replay(label, points, 0, level, path);
+  }
+
+  unlink(path.c_str());
+  for (auto d : points) dpoint_free(d);
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * subscription matching: the per-client MatchDict scan forward_dpoint
+ * used to do (FastWildCompare over every pattern of every client) vs one
+ * MatchIndex lookup shared by all clients.
+ *
+ * The pattern set is a rig's worth of subscribers: stim/ess/ain/em
+ * browsers, loggers and tools, each with a few dozen patterns, mostly
+ * exact names and "system/" style prefixes with a few real globs.  The
+ * point names are drawn from the same namespaces, plus misses.  Both
+ * matchers are run over the same stream and their hit sets compared.
+ *
+ *   c++ -O2 -std=c++20 -Isrc -o match_bench scripts/timing/match_bench.cpp
+ *   ./match_bench [clients patterns_per_client points]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+#include "MatchIndex.h"
+
+static inline double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *spaces[] = {
+  "ess", "ain", "em", "eventlog", "system", "graphics", "stim", "juice",
+  "rmt", "openiris", "print", "sound", "touch", "mtouch", "joystick",
+  "planko", "gpio", "qpcs", "dserv", "trialdg",
+};
+static const int nspaces = sizeof(spaces) / sizeof(spaces[0]);
+
+static const char *leaves[] = {
+  "vals", "state", "status", "events", "init_error", "params", "obs_id",
+  "obs_active", "block_id", "stiminfo", "settings", "name", "subject",
+  "trial", "reward", "position", "pressure", "touchvals", "em_pos", "debug",
+};
+static const int nleaves = sizeof(leaves) / sizeof(leaves[0]);
+
+struct Client {
+  std::vector<std::string> patterns;
+  std::vector<int> count;		/* per pattern, as MatchSpec::count */
+};
+
+static std::string make_pattern(std::mt19937 &rng)
+{
+  const char *ns = spaces[rng() % nspaces];
+  const char *leaf = leaves[rng() % nleaves];
+  switch (rng() % 10) {
+  case 0: case 1: case 2: case 3: case 4:
+    return std::string(ns) + "/" + leaf;		/* exact */
+  case 5: case 6: case 7:
+    return std::string(ns) + "/*";			/* prefix */
+  case 8:
+    return std::string("*/") + leaf;		/* suffix glob */
+  default:
+    return std::string(ns) + "/?_*";		/* other glob */
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int nclients = 40, npatterns = 30, npoints = 200000;
+  if (argc > 1) nclients = atoi(argv[1]);
+  if (argc > 2) npatterns = atoi(argv[2]);
+  if (argc > 3) npoints = atoi(argv[3]);
+  if (nclients < 1 || npatterns < 1 || npoints < 1) {
+    fprintf(stderr, "usage: %s [clients patterns_per_client points]\n", argv[0]);
+    return 1;
+  }
+
+  std::mt19937 rng(17);
+  std::vector<Client> clients(nclients);
+  MatchIndex<int> index;
+
+  for (int c = 0; c < nclients; c++) {
+    for (int p = 0; p < npatterns; p++) {
+      std::string m = make_pattern(rng);
+      if (std::find(clients[c].patterns.begin(), clients[c].patterns.end(), m)
+	  != clients[c].patterns.end()) continue;
+      clients[c].patterns.push_back(m);
+      clients[c].count.push_back(0);
+      index.insert(c, m, false);
+    }
+  }
+
+  std::vector<std::string> names;
+  for (int i = 0; i < 4096; i++) {
+    if (i % 8 == 7)
+      names.push_back("acq/ch" + std::to_string(i));	/* nobody wants it */
+    else
+      names.push_back(std::string(spaces[rng() % nspaces]) + "/" +
+		      (i % 5 ? leaves[rng() % nleaves] : "a_x"));
+  }
+
+  printf("%d clients, %d patterns each, %d points\n",
+	 nclients, npatterns, npoints);
+
+  /* the old loop: every pattern of every client, every point */
+  std::vector<std::vector<int>> legacy_hits(names.size());
+  long legacy_total = 0;
+  double t0 = now_s();
+  for (int i = 0; i < npoints; i++) {
+    char *name = (char *) names[i % names.size()].c_str();
+    std::vector<int> *record = i < (int) names.size() ? &legacy_hits[i] : nullptr;
+    for (int c = 0; c < nclients; c++) {
+      bool hit = false;
+      Client &cl = clients[c];
+      for (size_t p = 0; p < cl.patterns.size(); p++) {
+	if (FastWildCompare((char *) cl.patterns[p].c_str(), name) &&
+	    !(cl.count[p]++ % 1))
+	  hit = true;
+      }
+      if (hit) {
+	legacy_total++;
+	if (record) record->push_back(c);
+      }
+    }
+  }
+  double legacy = now_s() - t0;
+
+  std::vector<int> hits;
+  long index_total = 0, mismatches = 0;
+  t0 = now_s();
+  for (int i = 0; i < npoints; i++) {
+    hits.clear();
+    index_total += index.match(names[i % names.size()].c_str(), hits);
+    if (i < (int) names.size()) {
+      std::sort(hits.begin(), hits.end());
+      if (hits != legacy_hits[i]) mismatches++;
+    }
+  }
+  double indexed = now_s() - t0;
+
+  printf("  %-22s %8.0f ns/point  %ld deliveries\n", "per-client scan",
+	 legacy * 1e9 / npoints, legacy_total);
+  printf("  %-22s %8.0f ns/point  %ld deliveries\n", "MatchIndex",
+	 indexed * 1e9 / npoints, index_total);
+  printf("  speedup %.1fx, %ld mismatched points\n", legacy / indexed,
+	 mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * msg pipeline: the same burst of small scripts sent to the message
+ * port (2560) three ways, to see what a round trip per query costs.
+ *
+ *   v1        one request at a time: send, wait for the reply, repeat
+ *   pipelined protocol 2 ('S' frames), up to -w requests in flight,
+ *             replies matched by id
+ *   batch     protocol 2 ('B' frames) of -b scripts, each evaluated in
+ *             one turn of the process thread
+ *
+ * Each is run for -n scripts and reported as scripts/s and mean time
+ * per script.  The script defaults to a cheap read of a datapoint
+ * (dservGet ess/state) so the numbers are mostly transport and queueing.
+ *
+ *   c++ -O2 -std=c++20 -o msg_pipeline scripts/timing/msg_pipeline.cpp
+ *   ./msg_pipeline [-h host] [-p port] [-n scripts] [-w window]
+ *                  [-b batch] [-e script]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <string>
+
+static inline uint64_t mono_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int connect_to(const char *host, int port)
+{
+  struct sockaddr_in addr;
+  int on = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, host, &addr.sin_addr);
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t n)
+{
+  while (n) {
+    ssize_t w = write(fd, buf, n);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return -1;
+    buf += w;
+    n -= w;
+  }
+  return 0;
+}
+
+static int read_all(int fd, char *buf, size_t n)
+{
+  while (n) {
+    ssize_t r = read(fd, buf, n);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return -1;
+    buf += r;
+    n -= r;
+  }
+  return 0;
+}
+
+static void put_u32(std::string &s, uint32_t v)
+{
+  v = htonl(v);
+  s.append((const char *) &v, sizeof(v));
+}
+
+static uint32_t get_u32(const char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return ntohl(v);
+}
+
+/* a v1 frame: u32 len, bytes */
+static int send_v1(int fd, const std::string &msg)
+{
+  std::string frame;
+  put_u32(frame, msg.size());
+  frame += msg;
+  return write_all(fd, frame.data(), frame.size());
+}
+
+static int recv_frame(int fd, std::string &msg)
+{
+  char len[4];
+  if (read_all(fd, len, sizeof(len))) return -1;
+  msg.resize(get_u32(len));
+  return read_all(fd, msg.data(), msg.size());
+}
+
+/* a v2 request: u32 len, u8 kind, u32 id, body */
+static void frame_v2(std::string &out, char kind, uint32_t id,
+		     const std::string &body)
+{
+  put_u32(out, 1 + 4 + body.size());
+  out.push_back(kind);
+  put_u32(out, id);
+  out += body;
+}
+
+static void report(const char *what, int n, uint64_t us, int errors)
+{
+  printf("  %-10s %8d scripts  %10.0f scripts/s  %8.2f us/script",
+	 what, n, n / (us / 1e6), (double) us / n);
+  if (errors) printf("  (%d errors)", errors);
+  printf("\n");
+}
+
+static int run_v1(int fd, const std::string &script, int n)
+{
+  std::string reply;
+  int errors = 0;
+  uint64_t start = mono_us();
+  for (int i = 0; i < n; i++) {
+    if (send_v1(fd, script) || recv_frame(fd, reply)) return -1;
+    if (reply.starts_with("!TCL_ERROR")) errors++;
+  }
+  report("v1", n, mono_us() - start, errors);
+  return 0;
+}
+
+/* n scripts as 'S' requests, window in flight; or as 'B' of batch each */
+static int run_v2(int fd, const std::string &script, int n,
+		  int window, int batch)
+{
+  std::string out, reply;
+  uint32_t next_id = 0, expect_id = 0;
+  int sent = 0, answered = 0, errors = 0, inflight = 0;
+  uint64_t start = mono_us();
+
+  while (answered < n) {
+    out.clear();
+    while (sent < n && inflight < window) {
+      if (batch) {
+	int k = std::min(batch, n - sent);
+	std::string body;
+	put_u32(body, k);
+	for (int i = 0; i < k; i++) {
+	  put_u32(body, script.size());
+	  body += script;
+	}
+	frame_v2(out, 'B', next_id++, body);
+	sent += k;
+      }
+      else {
+	frame_v2(out, 'S', next_id++, script);
+	sent++;
+      }
+      inflight++;
+    }
+    if (out.size() && write_all(fd, out.data(), out.size())) return -1;
+
+    if (recv_frame(fd, reply) || reply.size() < 5) return -1;
+    if (get_u32(&reply[1]) != expect_id++) {
+      fprintf(stderr, "msg_pipeline: reply out of order\n");
+      return -1;
+    }
+    inflight--;
+    if (reply[0] == 'S') {
+      if (reply.size() < 6) return -1;
+      if (reply[5]) errors++;
+      answered++;
+    }
+    else {
+      size_t off = 9;
+      uint32_t k = get_u32(&reply[5]);
+      for (uint32_t i = 0; i < k && off + 5 <= reply.size(); i++) {
+	if (reply[off]) errors++;
+	off += 5 + get_u32(&reply[off + 1]);
+      }
+      answered += k;
+    }
+  }
+  report(batch ? "batch" : "pipelined", n, mono_us() - start, errors);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *host = "127.0.0.1";
+  int port = 2560, n = 10000, window = 64, batch = 32;
+  std::string script = "dservGet ess/state";
+  int c;
+
+  while ((c = getopt(argc, argv, "h:p:n:w:b:e:")) != -1) {
+    switch (c) {
+    case 'h': host = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'n': n = std::max(1, atoi(optarg)); break;
+    case 'w': window = std::max(1, atoi(optarg)); break;
+    case 'b': batch = std::max(1, atoi(optarg)); break;
+    case 'e': script = optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-h host] [-p port] [-n scripts] "
+	      "[-w window] [-b batch] [-e script]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  int v1 = connect_to(host, port), v2 = connect_to(host, port);
+  if (v1 < 0 || v2 < 0) {
+    fprintf(stderr, "msg_pipeline: can't connect to %s:%d\n", host, port);
+    return 1;
+  }
+
+  std::string reply;
+  if (send_v1(v2, "%protocol 2") || recv_frame(v2, reply) || reply != "2") {
+    fprintf(stderr, "msg_pipeline: server doesn't speak protocol 2\n");
+    return 1;
+  }
+
+  printf("%s, window %d, batch %d\n", script.c_str(), window, batch);
+  if (run_v1(v1, script, n) ||
+      run_v2(v2, script, n, window, 0) ||
+      run_v2(v2, script, n, std::max(1, window / batch), batch)) {
+    fprintf(stderr, "msg_pipeline: connection lost\n");
+    return 1;
+  }
+
+  close(v1);
+  close(v2);
+  return 0;
+}
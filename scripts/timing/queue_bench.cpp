@@ -0,0 +1,129 @@
+/*
+ * SharedQueue vs MPSCRing under producer contention.
+ *
+ * throughput: P producers push as fast as they can, one consumer drains
+ *   (front/pop_front for SharedQueue, pop_all for the ring).
+ * latency: P producers each push at a paced rate (default 2 kHz, an
+ *   eye/ain stream), and the consumer records push -> pop time, so the
+ *   cost of waking a sleeping consumer is included.
+ *
+ *   c++ -O2 -std=c++20 -Isrc -o queue_bench scripts/timing/queue_bench.cpp -lpthread
+ *   ./queue_bench [producers items_per_producer rate_hz]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#include "sharedqueue.h"
+#include "mpscring.h"
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void sleep_until_ns(uint64_t t)
+{
+  struct timespec ts = { (time_t) (t / 1000000000ull),
+			 (long) (t % 1000000000ull) };
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* items carry their enqueue time; 0 is the end-of-stream marker */
+template <typename Q>
+static void consume_one_at_a_time(Q &q, int producers,
+				  std::vector<uint64_t> &lat)
+{
+  int ended = 0;
+  while (ended < producers) {
+    uint64_t t = q.front();
+    q.pop_front();
+    if (!t) { ended++; continue; }
+    lat.push_back(now_ns() - t);
+  }
+}
+
+static void consume_batched(MPSCRing<uint64_t> &q, int producers,
+			    std::vector<uint64_t> &lat)
+{
+  int ended = 0;
+  std::vector<uint64_t> batch;
+  while (ended < producers) {
+    batch.clear();
+    q.pop_all(batch);
+    uint64_t now = now_ns();
+    for (auto t : batch) {
+      if (!t) { ended++; continue; }
+      lat.push_back(now - t);
+    }
+  }
+}
+
+template <typename Q, typename Consume>
+static void run(const char *label, int producers, long items, double rate,
+		Consume consume)
+{
+  Q q;
+  std::vector<uint64_t> lat;
+  lat.reserve(producers * items);
+  std::vector<std::thread> threads;
+
+  uint64_t t0 = now_ns();
+  std::thread consumer([&] { consume(q, producers, lat); });
+  for (int p = 0; p < producers; p++)
+    threads.emplace_back([&] {
+      uint64_t period = rate > 0 ? (uint64_t) (1e9 / rate) : 0;
+      uint64_t next = now_ns();
+      for (long i = 0; i < items; i++) {
+	if (period) { next += period; sleep_until_ns(next); }
+	q.push_back(now_ns());
+      }
+      q.push_back(0);
+    });
+  for (auto &t : threads) t.join();
+  consumer.join();
+  double secs = (now_ns() - t0) / 1e9;
+
+  std::sort(lat.begin(), lat.end());
+  auto pct = [&](double p) { return lat[(size_t) (p * (lat.size() - 1))] / 1000.0; };
+  printf("  %-26s %10.0f items/s   p50 %8.2f us  p99 %8.2f us  max %9.2f us\n",
+	 label, lat.size() / secs, pct(0.5), pct(0.99), pct(1.0));
+}
+
+int main(int argc, char *argv[])
+{
+  int producers = 4;
+  long items = 200000;
+  double rate = 2000;
+  if (argc > 1) producers = atoi(argv[1]);
+  if (argc > 2) items = atol(argv[2]);
+  if (argc > 3) rate = atof(argv[3]);
+  if (producers < 1 || items < 1) {
+    fprintf(stderr, "usage: %s [producers items_per_producer rate_hz]\n", argv[0]);
+    return 1;
+  }
+
+  printf("throughput: %d producers x %ld items, unpaced\n", producers, items);
+  run<SharedQueue<uint64_t>>("SharedQueue", producers, items, 0,
+			     consume_one_at_a_time<SharedQueue<uint64_t>>);
+  run<MPSCRing<uint64_t>>("MPSCRing front/pop_front", producers, items, 0,
+			  consume_one_at_a_time<MPSCRing<uint64_t>>);
+  run<MPSCRing<uint64_t>>("MPSCRing pop_all", producers, items, 0,
+			  consume_batched);
+
+  long paced = std::min(items, (long) (rate * 2));	/* ~2 s per run */
+  printf("\nlatency: %d producers x %ld items at %.0f Hz each\n",
+	 producers, paced, rate);
+  run<SharedQueue<uint64_t>>("SharedQueue", producers, paced, rate,
+			     consume_one_at_a_time<SharedQueue<uint64_t>>);
+  run<MPSCRing<uint64_t>>("MPSCRing pop_all", producers, paced, rate,
+			  consume_batched);
+  return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * shm load: push points to dserv through a shared memory ring
+ * (dservapi_shm_open, src/shmring.h) at a fixed rate and report what a
+ * write costs the producer and how many the ring had no room for.
+ *
+ * The time from a write to its point being in the table is measured by
+ * dserv itself -- the ring's records carry their CLOCK_MONOTONIC post
+ * time -- and reported by dservShmInfo (latency_mean_us,
+ * latency_max_us); with -q this asks for it on the newline port once
+ * the run is over.  Pacing is an absolute clock_nanosleep with the
+ * timer slack cut to 1 ns, so 10 kHz is 10 kHz without spinning (a
+ * spinning producer would be competing with dserv for the CPU).
+ *
+ *   cc -O2 -Iapi -Isrc -o shm_load scripts/timing/shm_load.c \
+ *      api/dservapi.c src/Base64.c
+ *   ./shm_load [-p port] [-r rate] [-s seconds] [-b ring_bytes] [-q tclport]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dservapi.h"
+
+static uint64_t mono_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* one line of Tcl on the newline port, one line back */
+static void query(int port, const char *script)
+{
+  struct sockaddr_in addr;
+  char buf[1024];
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ssize_t n;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "shm_load: can't connect to port %d\n", port);
+    if (fd >= 0) close(fd);
+    return;
+  }
+  if (write(fd, script, strlen(script)) > 0 &&
+      (n = read(fd, buf, sizeof(buf) - 1)) > 0) {
+    buf[n] = '\0';
+    printf("  dserv: %s", buf);
+  }
+  close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+  int port = 4620, seconds = 5, qport = 0, c;
+  unsigned int bytes = 1024 * 1024;
+  double rate = 10000;
+
+  while ((c = getopt(argc, argv, "p:r:s:b:q:")) != -1) {
+    switch (c) {
+    case 'p': port = atoi(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 's': seconds = atoi(optarg); break;
+    case 'b': bytes = atoi(optarg); break;
+    case 'q': qport = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-p port] [-r rate] [-s seconds] "
+	      "[-b ring_bytes] [-q tclport]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  dservapi_shm_t *shm = dservapi_shm_open(port, "shm_load", bytes);
+  if (!shm) {
+    fprintf(stderr, "shm_load: no ring from dserv on port %d\n", port);
+    return 1;
+  }
+
+  /* an eye position: two floats */
+  float xy[2] = { 0, 0 };
+  uint64_t interval = rate > 0 ? (uint64_t) (1e9 / rate) : 0;
+  uint64_t start = mono_ns(), end = start + seconds * 1000000000ull;
+  uint64_t next = start, spent = 0, worst = 0, writes = 0, written = 0;
+
+  prctl(PR_SET_TIMERSLACK, 1);
+  while (mono_ns() < end) {
+    if (interval) {
+      struct timespec ts = { (time_t) (next / 1000000000ull),
+			     (long) (next % 1000000000ull) };
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      next += interval;
+    }
+
+    xy[0] = writes % 1000;
+    xy[1] = -xy[0];
+    uint64_t t0 = mono_ns();
+    written += dservapi_shm_write(shm, "shmload/xy", DSERV_FLOAT,
+				  sizeof(xy), xy);
+    uint64_t t = mono_ns() - t0;
+    spent += t;
+    if (t > worst) worst = t;
+    writes++;
+  }
+  double elapsed = (mono_ns() - start) / 1e9;
+
+  printf("%.0f points/s for %d s, ring %u bytes\n", rate, seconds, bytes);
+  printf("  written %10llu  %9.0f points/s  dropped %lu\n",
+	 (unsigned long long) written, written / elapsed,
+	 dservapi_shm_dropped(shm));
+  printf("  write   %10.0f ns mean  %9.0f ns worst\n",
+	 writes ? (double) spent / writes : 0.0, (double) worst);
+
+  /* closing hands what's left to dserv; give it a moment */
+  dservapi_shm_close(shm);
+  usleep(100000);
+  if (qport) query(qport, "dservShmInfo\n");
+  return 0;
+}
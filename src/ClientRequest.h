@@ -1,6 +1,7 @@
 #ifndef CLIENT_REQUEST_H
 #define CLIENT_REQUEST_H
 
+#include <vector>
 #include "sharedqueue.h"
 #include "RequestTiming.h"
 
@@ -19,23 +20,52 @@
  *       producer (a SendClient) as its final act; a consumer that owns
  *       the queue may free it only after receiving this.  Consumers
  *       that never tear their queue down just ignore it.
+ *     REQ_DPOINT_BATCH: add the datapoints in dpoints, together
+ *       (Dataserver::set_batch)
+ *     REQ_SCRIPT_BATCH: the tcl scripts in scripts, in order, one
+ *       reply apiece on rqueue
  */
 
 enum request_t { REQ_SCRIPT, REQ_SCRIPT_NOREPLY,
 		 REQ_SCRIPT_WS_ASYNC,
 		 REQ_TRIGGER, REQ_DPOINT, REQ_DPOINT_SCRIPT, REQ_TIMER,
 		 REQ_REWARD_TIMER, REQ_ADC_TIMER, REQ_SHUTDOWN,
-		 REQ_QUEUE_EOS };
+		 REQ_QUEUE_EOS, REQ_DPOINT_BATCH, REQ_SCRIPT_BATCH };
+
+/*
+ * request source
+ *   who queued a request, which is what decides its lane in a
+ *   TclServer's queue (TclServer::lane_of, dservLanes):
+ *     SRC_LOCAL: this or another interp (send, eval, dserv's own calls)
+ *     SRC_DPOINT: a subscribed point's delivery (SendClient)
+ *     SRC_TIMER: dservAfter
+ *     SRC_MODULE: what modules queue: the points they set
+ *       (tclserver_set_point, tclserver_set_points) and their scripts
+ *       (tclserver_queue_script), so a callback runs after the points
+ *       set ahead of it
+ *     SRC_NEWLINE, SRC_MESSAGE: the newline and message ports
+ *     SRC_WEB: websocket and http clients
+ *   Lanes keep order within themselves only, so everything one client
+ *   sends carries the one source: a connection's requests stay in order.
+ */
+enum request_source_t { SRC_LOCAL, SRC_DPOINT, SRC_TIMER, SRC_MODULE,
+			SRC_NEWLINE, SRC_MESSAGE, SRC_WEB, SRC_NSOURCES };
+
+/* TclServer queue lanes, highest priority first */
+enum request_lane_t { LANE_REALTIME, LANE_NORMAL, LANE_BULK, LANE_NLANES };
 
 typedef struct client_request_s {
   request_t type;
   int timer_id;
   std::string script;
+  std::vector<std::string> scripts;	// REQ_SCRIPT_BATCH
   SharedQueue<std::string> *rqueue;
   ds_datapoint_t *dpoint;
+  std::vector<ds_datapoint_t *> dpoints;	// REQ_DPOINT_BATCH
   int socket_fd = -1;           // Socket FD if request came from socket (-1 if not)
   std::string websocket_id;     // WebSocket ID if request came from websocket (empty if not)
   std::string request_id;       // Client-provided request ID for async WebSocket responses
+  request_source_t source = SRC_LOCAL;
 
   // Stamped at construction, which covers the common case of building a
   // request immediately before queueing it.  IMPORTANT: the socket
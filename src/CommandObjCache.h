@@ -0,0 +1,68 @@
+#ifndef COMMANDOBJCACHE_H
+#define COMMANDOBJCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include <tcl.h>
+
+/*
+ * CommandObjCache
+ *
+ *   script -> a Tcl_Obj holding it, for the paths that run
+ *   `script name value` on every delivery (dpoint scripts, triggers).
+ *
+ *   Those used to build the command word with Tcl_NewStringObj each
+ *   time, so Tcl resolved the command name from scratch on every call.
+ *   Kept here, the object keeps the cmdName rep Tcl_EvalObjv gives it:
+ *   the lookup is done once, and Tcl itself notices (by its command
+ *   epoch) when the proc is redefined or renamed.
+ *
+ *   The entries are whatever is registered in one TriggerDict; when its
+ *   generation() moves on, the lot is dropped and rebuilt on demand, so
+ *   the cache never outgrows the registry.  Keyed by the script text,
+ *   so a lookup racing an edit still gets the right command -- the
+ *   generation only decides when to throw things away.
+ *
+ *   Tcl_Objs belong to the thread that made them: one of these lives on
+ *   each process thread, and only that thread touches it.
+ */
+
+class CommandObjCache
+{
+  std::unordered_map<std::string, Tcl_Obj *> objs_;
+  uint64_t generation_ = 0;
+
+ public:
+  CommandObjCache(void) = default;
+  CommandObjCache(const CommandObjCache &) = delete;
+  CommandObjCache &operator=(const CommandObjCache &) = delete;
+  ~CommandObjCache(void) { clear(); }
+
+  void clear(void)
+  {
+    for (auto &entry : objs_) Tcl_DecrRefCount(entry.second);
+    objs_.clear();
+  }
+
+  /* the command object for script; ours -- don't decrement it */
+  Tcl_Obj *get(const std::string &script, uint64_t generation)
+  {
+    if (generation != generation_) {
+      clear();
+      generation_ = generation;
+    }
+    auto iter = objs_.find(script);
+    if (iter != objs_.end()) return iter->second;
+
+    Tcl_Obj *obj = Tcl_NewStringObj(script.data(), script.size());
+    Tcl_IncrRefCount(obj);
+    objs_.emplace(script, obj);
+    return obj;
+  }
+
+  size_t size(void) const { return objs_.size(); }
+};
+
+#endif
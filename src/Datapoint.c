@@ -1,8 +1,41 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include "Datapoint.h"
 #include <jansson.h>		/* for JSON support */
 
+/*****************************************************************************/
+/****************************** alloc accounting *****************************/
+/*****************************************************************************/
+
+/*
+ * Relaxed counters: they only need to add up, not order anything.
+ * Read with dpoint_alloc_stats() (dservAllocStats from Tcl) around a
+ * known number of publishes to see how many copies each one costs.
+ */
+static _Atomic uint64_t n_allocs, n_copies, n_copy_bytes, n_refs, n_frees;
+
+#define COUNT(c, n) atomic_fetch_add_explicit(&(c), (n), memory_order_relaxed)
+
+void dpoint_alloc_stats(ds_dpoint_alloc_stats_t *stats)
+{
+  stats->allocs = atomic_load_explicit(&n_allocs, memory_order_relaxed);
+  stats->copies = atomic_load_explicit(&n_copies, memory_order_relaxed);
+  stats->copy_bytes = atomic_load_explicit(&n_copy_bytes, memory_order_relaxed);
+  stats->refs = atomic_load_explicit(&n_refs, memory_order_relaxed);
+  stats->frees = atomic_load_explicit(&n_frees, memory_order_relaxed);
+}
+
+void dpoint_alloc_stats_reset(void)
+{
+  atomic_store(&n_allocs, 0);
+  atomic_store(&n_copies, 0);
+  atomic_store(&n_copy_bytes, 0);
+  atomic_store(&n_refs, 0);
+  atomic_store(&n_frees, 0);
+}
+
 /*****************************************************************************/
 /*******************************dpoint helpers *******************************/
 /*****************************************************************************/
@@ -15,6 +48,7 @@ ds_datapoint_t *dpoint_set(ds_datapoint_t *dp,
 			   unsigned char *data)
 {
   dp->varlen = strlen(varname);
+  dp->storage = DPOINT_STORAGE_MALLOC;
   dp->flags = 0x00;
   dp->timestamp = timestamp;
   dp->varname = varname;
@@ -33,12 +67,14 @@ ds_datapoint_t *dpoint_new_nocopy(char *varname,
   ds_datapoint_t *new_dp = NULL;
   new_dp = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
   new_dp->varlen = strlen(varname);
+  new_dp->storage = DPOINT_STORAGE_MALLOC;
   new_dp->flags = 0x00;
   new_dp->timestamp = timestamp;
   new_dp->varname = varname;
   new_dp->data.len = len;
   new_dp->data.type = type;
   new_dp->data.buf = len ? data : NULL;
+  COUNT(n_allocs, 1);
   return new_dp;
 }
 
@@ -52,6 +88,7 @@ ds_datapoint_t *dpoint_new(char *varname,
   ds_datapoint_t *new_dp = NULL;
   new_dp = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
   new_dp->varlen = strlen(varname);
+  new_dp->storage = DPOINT_STORAGE_MALLOC;
   new_dp->flags = 0x00;
   new_dp->timestamp = timestamp;
   new_dp->varname = strdup(varname);
@@ -64,28 +101,130 @@ ds_datapoint_t *dpoint_new(char *varname,
   else {
     new_dp->data.buf = NULL;
   }
+  COUNT(n_allocs, 1);
   return new_dp;
 }
 
+/*
+ * dpoint_copy always makes a private MALLOC point, even from a shared
+ * one, so the caller is free to modify it
+ */
 ds_datapoint_t *dpoint_copy(ds_datapoint_t *d)
 {
   ds_datapoint_t *new_dp = NULL;
   if (d) {
     new_dp = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
     memcpy(new_dp, d, sizeof(ds_datapoint_t));
+    new_dp->storage = DPOINT_STORAGE_MALLOC;
     if (d->varname) new_dp->varname = strdup(d->varname);
     if (d->data.len) {
       new_dp->data.buf = (unsigned char *) malloc(d->data.len);
       memcpy(new_dp->data.buf, d->data.buf, d->data.len);
     }
     else new_dp->data.buf = NULL;
+    COUNT(n_allocs, 1);
+    COUNT(n_copies, 1);
+    COUNT(n_copy_bytes, d->data.len);
   }
   return new_dp;
 }
 
+/*
+ * Shared points
+ *
+ *  A published point used to be dpoint_copy'd once for the notify queue,
+ * once for the logger queue, once per trigger and once per matching
+ * send client -- three mallocs and a payload memcpy each, so a camera
+ * JPEG was duplicated N+3 times per set.  dpoint_share() makes ONE
+ * copy into a single allocation with a refcount in front:
+ *
+ *   [ refcount | ds_datapoint_t | data ... | varname\0 ]
+ *
+ * and every consumer after that takes a reference with dpoint_ref().
+ * Consumers still finish with dpoint_free(), which for a shared point
+ * is a release; the last one frees the block.  Shared points are
+ * immutable -- nothing may write to the struct or the payload -- which
+ * is what makes handing the same bytes to several threads safe.
+ *
+ * Data goes first (right after the struct, 16-byte aligned) so typed
+ * payloads keep the alignment malloc would have given them.
+ */
+typedef struct ds_dpoint_shared_s {
+  atomic_uint refcount;
+  ds_datapoint_t dpoint;
+} ds_dpoint_shared_t;
+
+#define SHARED_DATA_OFFSET ((sizeof(ds_dpoint_shared_t) + 15) & ~((size_t) 15))
+
+static inline ds_dpoint_shared_t *shared_block(ds_datapoint_t *d)
+{
+  return (ds_dpoint_shared_t *)
+    ((char *) d - offsetof(ds_dpoint_shared_t, dpoint));
+}
+
+ds_datapoint_t *dpoint_share(ds_datapoint_t *d)
+{
+  ds_dpoint_shared_t *blk;
+  ds_datapoint_t *new_dp;
+  const char *varname;
+  size_t varlen;
+  char *p;
+
+  if (!d) return NULL;
+  if (DPOINT_IS_SHARED(d)) return dpoint_ref(d);
+
+  varname = d->varname ? d->varname : "";
+  varlen = strlen(varname);
+
+  blk = (ds_dpoint_shared_t *)
+    malloc(SHARED_DATA_OFFSET + d->data.len + varlen + 1);
+  if (!blk) return NULL;
+  atomic_init(&blk->refcount, 1);
+
+  new_dp = &blk->dpoint;
+  memcpy(new_dp, d, sizeof(ds_datapoint_t));
+  new_dp->storage = DPOINT_STORAGE_SHARED;
+  new_dp->varlen = varlen;
+
+  p = (char *) blk + SHARED_DATA_OFFSET;
+  if (d->data.len) {
+    memcpy(p, d->data.buf, d->data.len);
+    new_dp->data.buf = (unsigned char *) p;
+  }
+  else new_dp->data.buf = NULL;
+
+  new_dp->varname = p + d->data.len;
+  memcpy(new_dp->varname, varname, varlen + 1);
+
+  COUNT(n_allocs, 1);
+  COUNT(n_copies, 1);
+  COUNT(n_copy_bytes, d->data.len);
+  return new_dp;
+}
+
+ds_datapoint_t *dpoint_ref(ds_datapoint_t *d)
+{
+  if (!d) return NULL;
+  if (!DPOINT_IS_SHARED(d)) return dpoint_copy(d);
+  atomic_fetch_add_explicit(&shared_block(d)->refcount, 1,
+			    memory_order_relaxed);
+  COUNT(n_refs, 1);
+  return d;
+}
+
 void dpoint_free(ds_datapoint_t *d)
 {
   if (d) {
+    if (DPOINT_IS_SHARED(d)) {
+      ds_dpoint_shared_t *blk = shared_block(d);
+      if (atomic_fetch_sub_explicit(&blk->refcount, 1,
+				    memory_order_release) == 1) {
+	atomic_thread_fence(memory_order_acquire);
+	free(blk);
+	COUNT(n_frees, 1);
+      }
+      return;
+    }
     if (d->varname) {
       free(d->varname);
     }
@@ -93,6 +232,7 @@ void dpoint_free(ds_datapoint_t *d)
       free(d->data.buf);
     }
     free(d);
+    COUNT(n_frees, 1);
   }
 }
 
@@ -191,6 +331,7 @@ ds_datapoint_t *dpoint_from_binary(char *buf, int buflen)
   memcpy(dpoint->data.buf, &buf[bufidx], dpoint->data.len);
   bufidx += dpoint->data.len;
 
+  COUNT(n_allocs, 1);
   return dpoint;
 }
 
@@ -370,11 +511,19 @@ ds_datapoint_t *dpoint_from_string(char *str, int len)
 
   d = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
   dpoint_set(d, varname, timestamp, datatype, datalen, databuf);
+  COUNT(n_allocs, 1);
   
   return d;
 }
   
-  char *dpoint_to_json(ds_datapoint_t *dpoint)
+/*
+ * dpoint_to_json_type - dpoint_to_json with a "type" member added
+ *
+ *  For the websocket datapoint stream, which tags every point
+ *  "type":"datapoint": set it on the object as it is built rather than
+ *  dumping, parsing and dumping again.  A NULL type adds nothing.
+ */
+char *dpoint_to_json_type(ds_datapoint_t *dpoint, const char *type)
 {
   int i;  
   int n;
@@ -612,9 +761,17 @@ ds_datapoint_t *dpoint_from_string(char *str, int len)
     }
   }
   
+  if (type)
+    json_object_set_new(json_dpoint, "type", json_string(type));
+
   json_str = json_dumps(json_dpoint, json_flags);
   json_decref(json_dpoint);
   return json_str;
 }
+
+char *dpoint_to_json(ds_datapoint_t *dpoint)
+{
+  return dpoint_to_json_type(dpoint, NULL);
+}
   
 
@@ -67,9 +67,22 @@ typedef enum {
    * deliberately no way to unset it on an existing point.
    */
   DSERV_DPOINT_PRIVATE_FLAG = 0x100,
+
+  /*
+   * COLUMNAR: set only by the logger, on a log record whose payload is
+   * a block of samples (see dslog_column.h), never on a live point.
+   */
+  DSERV_DPOINT_COLUMNAR_FLAG = 0x200,
 } ds_datapoint_flag_t;
 
 #define DSERV_DPOINT_ATTR_MASK (0xFF00)
+
+/* points that steer a queue's consumer rather than carry data: never
+   dropped, whatever the queue's bounds (MPSCRing::set_overflow_limit) */
+#define DSERV_DPOINT_MARKER_FLAGS					\
+  (DSERV_DPOINT_DONTFREE_FLAG | DSERV_DPOINT_LOGPAUSE_FLAG |		\
+   DSERV_DPOINT_LOGSTART_FLAG | DSERV_DPOINT_SHUTDOWN_FLAG |		\
+   DSERV_DPOINT_LOGFLUSH_FLAG | DSERV_DPOINT_LOGCLOSE_FLAG)
 #define DPOINT_IS_PRIVATE(dp) (((dp)->flags & DSERV_DPOINT_PRIVATE_FLAG) != 0)
   
 enum { DSERV_CREATE, DSERV_CLEAR, DSERV_SET, DSERV_GET, DSERV_GET_EVENT };
@@ -103,15 +116,41 @@ typedef struct ds_data
   unsigned char *buf;
 } ds_data_t;
 
+/*
+ * storage says how a point's memory is owned, so dpoint_free() can do
+ * the right thing.  It sits in what used to be alignment padding after
+ * varlen, so the struct's size and layout are unchanged.
+ *
+ *  MALLOC: struct, varname and data.buf are separate mallocs (every
+ *          point ever made before shared points existed; dpoint_set()
+ *          and the allocators below set it, calloc'd points are zero)
+ *  SHARED: one allocation (refcount, struct, data, varname) made by
+ *          dpoint_share(); immutable, and dpoint_free() is a release
+ */
+#define DPOINT_STORAGE_MALLOC (0)
+#define DPOINT_STORAGE_SHARED (0x5348)
+
 typedef struct ds_datapoint
 {
   uint64_t timestamp;
   uint32_t flags;
   uint16_t varlen;                  // strlen(varname) - used to aid serialization
+  uint16_t storage;		    // DPOINT_STORAGE_*
   char *varname;
   ds_data_t data;
 } ds_datapoint_t;
 
+#define DPOINT_IS_SHARED(dp) ((dp)->storage == DPOINT_STORAGE_SHARED)
+
+/* counters behind dpoint_alloc_stats(), for checking copies per publish */
+typedef struct ds_dpoint_alloc_stats_s {
+  uint64_t allocs;		/* points created, any allocator */
+  uint64_t copies;		/* of those, payload duplicates (copy/share) */
+  uint64_t copy_bytes;		/* payload bytes those copies moved */
+  uint64_t refs;		/* references taken on shared points */
+  uint64_t frees;		/* points actually freed */
+} ds_dpoint_alloc_stats_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -129,6 +168,14 @@ ds_datapoint_t *dpoint_new_nocopy(char *varname,
 				  unsigned char *data);
 ds_datapoint_t *dpoint_copy(ds_datapoint_t *d);
 
+// refcounted, immutable, single allocation; dpoint_free() releases
+ds_datapoint_t *dpoint_share(ds_datapoint_t *d);
+// another reference to a shared point (a plain copy for any other point)
+ds_datapoint_t *dpoint_ref(ds_datapoint_t *d);
+
+void dpoint_alloc_stats(ds_dpoint_alloc_stats_t *stats);
+void dpoint_alloc_stats_reset(void);
+
 // don't malloc any new data, just assign
 ds_datapoint_t *dpoint_set(ds_datapoint_t *dp,
 			   char *varname,
@@ -150,6 +197,7 @@ int dpoint_to_string(ds_datapoint_t *d, char *buf, int size);
 ds_datapoint_t *dpoint_from_string(char *str, int len);
 
 char *dpoint_to_json(ds_datapoint_t *d);
+char *dpoint_to_json_type(ds_datapoint_t *d, const char *type);
 
 #ifdef __cplusplus
 }
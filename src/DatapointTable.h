@@ -2,57 +2,194 @@
 #define DATAPOINTTABLE_H
 
 #include <unordered_map>
-#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+/*
+ * DatapointTable
+ *
+ * The table used to be one unordered_map behind one std::mutex, so every
+ * acquire thread, TCP client thread and TclServer interp serialized on a
+ * single lock for every get and set -- and every get did a full
+ * dpoint_copy() of the payload (a stimdg can be tens of MB) while
+ * holding it.
+ *
+ * Now the keyspace is hash-partitioned into NSHARDS shards, each with its
+ * own shared_mutex, so writers to different points don't contend and
+ * readers of the same point run concurrently.
+ *
+ * Points are held by shared_ptr (deleter dpoint_free), which gives readers
+ * a refcounted immutable snapshot: snapshot() copies the pointer under the
+ * shard's shared lock and returns.  The reader formats/serializes from it
+ * with no lock held and no payload copy; a writer that replaces the point
+ * meanwhile just drops the table's reference, and the old point is freed
+ * when the last snapshot goes away.
+ *
+ * The one place a point is mutated in place is update() (same type and
+ * length, the high-rate acquire path), and that is only done when the
+ * table holds the sole reference.  That check is sound under the shard's
+ * exclusive lock: new snapshots can only be taken under the shared lock,
+ * so while we hold it the count can only go down, never up.  If a
+ * snapshot is outstanding, update() installs the new point instead.
+ *
+ * Lookups take std::string_view / const char * through a transparent
+ * hash so the read path doesn't build a std::string key per call.
+ */
+
+typedef std::shared_ptr<const ds_datapoint_t> DatapointSnapshot;
 
 class DatapointTable
 {
  private:
-  std::unordered_map<std::string, ds_datapoint_t *> map_;
-  std::mutex mutex_;
-  
+  static constexpr int NSHARDS = 64;	/* power of two */
+
+  struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const noexcept
+    { return std::hash<std::string_view>{}(s); }
+    size_t operator()(const std::string &s) const noexcept
+    { return std::hash<std::string_view>{}(s); }
+    size_t operator()(const char *s) const noexcept
+    { return std::hash<std::string_view>{}(s); }
+  };
+
+  typedef std::shared_ptr<ds_datapoint_t> slot_t;
+  typedef std::unordered_map<std::string, slot_t,
+			     KeyHash, std::equal_to<>> map_t;
+
+  /* pad to a cache line so neighbouring shard locks don't false-share */
+  struct alignas(64) Shard {
+    map_t map_;
+    std::shared_mutex mutex_;
+  };
+
+  Shard shards_[NSHARDS];
+
+  Shard &shard_for(std::string_view key, size_t &h)
+  {
+    h = KeyHash{}(key);
+    /* std::hash is identity-ish for some libstdc++ types, so fold the
+       high bits in before masking */
+    return shards_[(h ^ (h >> 17)) & (NSHARDS-1)];
+  }
+
+  Shard &shard_for(std::string_view key)
+  {
+    size_t h;
+    return shard_for(key, h);
+  }
+
+  static slot_t make_slot(ds_datapoint_t *d)
+  {
+    return slot_t(d, dpoint_free);
+  }
+
  public:
   void clear()
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-
-    // free all points in the map
-    for (const auto & [ key, dpoint ] : map_) {
-      if (dpoint) dpoint_free(dpoint);
+    /*
+     * swap each shard's map out under its lock and release the points
+     * afterwards, so readers aren't held up behind the frees; points
+     * still referenced by a snapshot are freed when that snapshot is
+     */
+    for (auto &shard : shards_) {
+      map_t old;
+      {
+	std::unique_lock<std::shared_mutex> mlock(shard.mutex_);
+	old.swap(shard.map_);
+      }
     }
-
-    // clear the map
-    map_.clear ();
   }
 
-  int replace(std::string key, ds_datapoint_t *d)
+  int replace(std::string_view key, ds_datapoint_t *d)
   {
     int result = 0;
-    std::lock_guard<std::mutex> mlock(mutex_);
+    slot_t slot = make_slot(d);
+    Shard &shard = shard_for(key);
 
-    auto iter = map_.find(key);
-    if (iter != map_.end()) {
-      dpoint_free(iter->second);
+    std::unique_lock<std::shared_mutex> mlock(shard.mutex_);
+    auto iter = shard.map_.find(key);
+    if (iter != shard.map_.end()) {
+      iter->second.swap(slot);	/* old point released below, unlocked */
       result = 1;
     }
-    map_[key] = d;
+    else {
+      shard.map_.emplace(std::string(key), std::move(slot));
+    }
+    mlock.unlock();
     return result;
   }
 
+  /*
+   * replace_batch
+   *
+   *  replace() for several points at once: each shard touched is
+   * locked once for all of its points, which go in in the order given
+   * (so a varname set twice ends up with the later point).  Returns the
+   * number of varnames that were new to the table.
+   */
+  int replace_batch(const std::vector<ds_datapoint_t *> &points)
+  {
+    std::vector<std::pair<Shard *, ds_datapoint_t *>> order;
+    std::vector<slot_t> old;
+    int added = 0;
+
+    order.reserve(points.size());
+    for (auto d : points)
+      order.emplace_back(&shard_for(std::string_view{d->varname}), d);
+    std::stable_sort(order.begin(), order.end(),
+		     [](const auto &a, const auto &b)
+		     { return a.first < b.first; });
+    old.reserve(points.size());
+
+    for (size_t i = 0; i < order.size(); ) {
+      Shard &shard = *order[i].first;
+      std::unique_lock<std::shared_mutex> mlock(shard.mutex_);
+      for (; i < order.size() && order[i].first == &shard; i++) {
+	ds_datapoint_t *d = order[i].second;
+	std::string_view key{d->varname};
+	slot_t slot = make_slot(d);
+	auto iter = shard.map_.find(key);
+	if (iter != shard.map_.end()) {
+	  iter->second.swap(slot);
+	  old.push_back(std::move(slot));	/* released below, unlocked */
+	}
+	else {
+	  shard.map_.emplace(std::string(key), std::move(slot));
+	  added++;
+	}
+      }
+    }
+    return added;
+  }
+
   /*
     update existing point in table
     return 1 if point updated, 0 if new point added
   */
   int update(ds_datapoint_t *d)
   {
-    ds_datapoint_t *old;
-    std::string key{d->varname};
-    
-    std::lock_guard<std::mutex> mlock(mutex_);
-    auto iter = map_.find(key);
-    if (iter != map_.end()) {	// point is in table
-      ds_datapoint_t *old = iter->second;
+    std::string_view key{d->varname};
+    Shard &shard = shard_for(key);
+    slot_t released;
+
+    std::unique_lock<std::shared_mutex> mlock(shard.mutex_);
+    auto iter = shard.map_.find(key);
+    if (iter != shard.map_.end()) {	// point is in table
+      ds_datapoint_t *old = iter->second.get();
       if (old->data.type == d->data.type &&
-	  old->data.len == d->data.len) {
+	  old->data.len == d->data.len &&
+	  !DPOINT_IS_SHARED(old) &&	/* immutable, other holders */
+	  iter->second.use_count() == 1) {
+	/* pairs with the release in the last reader's decrement, so
+	   its reads of the buffer happen before our memcpy */
+	std::atomic_thread_fence(std::memory_order_acquire);
 	old->timestamp = d->timestamp;
 	old->flags = d->flags;	/* attribute bits track the latest write,
 				   same as the timestamp */
@@ -61,115 +198,139 @@ class DatapointTable
 	/* done so can return without updating map_*/
 	return 1;
       }
-      else {			// points didn't match
-	dpoint_free(old);	// so free old one
+      else {			// points didn't match, or a reader holds it
+	released = std::move(iter->second);
+	iter->second = make_slot(d);
+	return 0;
       }
     }
-    map_[key] = d;
+    shard.map_.emplace(std::string(key), make_slot(d));
     return 0;
   }
-  
-  void insert(std::string key, ds_datapoint_t *d)
+
+  void insert(std::string_view key, ds_datapoint_t *d)
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    map_[key] = d;
+    slot_t slot = make_slot(d);
+    Shard &shard = shard_for(key);
+    std::unique_lock<std::shared_mutex> mlock(shard.mutex_);
+    shard.map_.insert_or_assign(std::string(key), std::move(slot));
   }
-  
-  void remove(std::string key)
+
+  void remove(std::string_view key)
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    map_.erase (key);
+    slot_t released;
+    Shard &shard = shard_for(key);
+    std::unique_lock<std::shared_mutex> mlock(shard.mutex_);
+    auto iter = shard.map_.find(key);
+    if (iter != shard.map_.end()) {
+      /*
+       * remove() used to erase without freeing, leaving the point to the
+       * caller; nothing relied on that, and with snapshots sharing
+       * ownership the table can't hand it back, so the table's reference
+       * is released here (freed once no snapshot holds it)
+       */
+      released = std::move(iter->second);
+      shard.map_.erase(iter);
+    }
   }
 
-  int exists(std::string key) {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    auto iter = map_.find(key);
-    return (iter != map_.end());
+  int exists(std::string_view key) {
+    Shard &shard = shard_for(key);
+    std::shared_lock<std::shared_mutex> mlock(shard.mutex_);
+    return (shard.map_.find(key) != shard.map_.end());
   }
-  
+
+  /*
+   * snapshot
+   *
+   * Zero-copy read: a reference to the current point, valid for as long
+   * as the caller holds it no matter what writers do meanwhile.  The
+   * point must be treated as read-only.  Returns an empty pointer if
+   * the key isn't in the table.
+   */
+  DatapointSnapshot snapshot(std::string_view key)
+  {
+    Shard &shard = shard_for(key);
+    std::shared_lock<std::shared_mutex> mlock(shard.mutex_);
+    auto iter = shard.map_.find(key);
+    if (iter != shard.map_.end()) return iter->second;
+    return nullptr;
+  }
+
   /*
    * getcopy
    *
    * Ensure that a valid copy of a point is returned, as the point
    * in the table can change quickly, so cannot return the pointer
-   * and expect it to still be valid.
-   * 
+   * and expect it to still be valid.  The copy is taken from a
+   * snapshot, so the payload memcpy happens with no lock held.
+   *
    */
-  ds_datapoint_t *getcopy(std::string key)
+  ds_datapoint_t *getcopy(std::string_view key)
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    auto iter = map_.find(key);
-    
-    if (iter != map_.end()) {
-      return dpoint_copy(iter->second);
-    }
-    return nullptr;
-
+    DatapointSnapshot snap = snapshot(key);
+    if (!snap) return nullptr;
+    return dpoint_copy(const_cast<ds_datapoint_t *>(snap.get()));
   }
 
-  int deletepoint(std::string key)
+  int deletepoint(std::string_view key)
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    auto iter = map_.find(key);
-    
-    if (iter != map_.end()) {
-      dpoint_free(iter->second);
-      map_.erase (key);
+    slot_t released;
+    Shard &shard = shard_for(key);
+    std::unique_lock<std::shared_mutex> mlock(shard.mutex_);
+    auto iter = shard.map_.find(key);
+
+    if (iter != shard.map_.end()) {
+      released = std::move(iter->second);
+      shard.map_.erase(iter);
+      mlock.unlock();
       return 1;
     }
 
     return 0;
   }
-    
-  bool find(std::string key, ds_datapoint_t **d)
+
+  /*
+   * find
+   *
+   * Returns the table's own pointer, which is only valid until the next
+   * write to that point.  Prefer snapshot() for anything that reads
+   * the point.
+   */
+  bool find(std::string_view key, ds_datapoint_t **d)
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    auto iter = map_.find(key);
-    
-    if (iter != map_.end()) {
-      if (d) *d = iter->second;
+    Shard &shard = shard_for(key);
+    std::shared_lock<std::shared_mutex> mlock(shard.mutex_);
+    auto iter = shard.map_.find(key);
+
+    if (iter != shard.map_.end()) {
+      if (d) *d = iter->second.get();
       return true;
     }
     return false;
   }
 
-  ds_datapoint_t *get_dpoint(std::string key)
+  ds_datapoint_t *get_dpoint(std::string_view key)
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    auto iter = map_.find(key);
-    if (iter != map_.end()) {
-      return dpoint_copy(iter->second);
-    }
-    else {
-      return nullptr;
-    }    
+    return getcopy(key);
   }
-  
-  int delete_dpoint(std::string key)
+
+  int delete_dpoint(std::string_view key)
   {
-    std::lock_guard<std::mutex> mlock(mutex_);
-    auto iter = map_.find(key);
-    if (iter != map_.end()) {
-      dpoint_free(iter->second);
-      map_.erase (key);
-      return 1;
-    }
-    else {
-      return 0;
-    }
+    return deletepoint(key);
   }
-  
+
   std::string get_keys(void)
   {
     std::vector<std::string> keys;
-    keys.reserve(map_.size());
     std::string s;
     s.clear();
-    
-    std::unique_lock<std::mutex> mlock(mutex_);
-    for (auto kv : map_) { keys.push_back(kv.first); }
-    mlock.unlock();
-    
+
+    for (auto &shard : shards_) {
+      std::shared_lock<std::shared_mutex> mlock(shard.mutex_);
+      for (auto &kv : shard.map_) { keys.push_back(kv.first); }
+    }
+
     for (std::vector<std::string>::const_iterator p = keys.begin();
 	 p != keys.end(); ++p) {
       s += *p;
@@ -178,25 +339,26 @@ class DatapointTable
     }
     return s;
   }
-  
+
   std::string get_dg_dir(void)
   {
     std::vector<std::string> entries;
 
     ds_datapoint_t *dpoint;
     std::string s, entry;
-    
-    std::unique_lock<std::mutex> mlock(mutex_);
-    for (auto kv : map_) {
-      dpoint = kv.second;
-      if (dpoint->data.e.dtype == DSERV_DG) {
-	entry.clear();
-	entry = std::string("{") + kv.first + " 0 " +
-	  std::to_string(dpoint->data.len) + "}";
-	entries.push_back(entry);
+
+    for (auto &shard : shards_) {
+      std::shared_lock<std::shared_mutex> mlock(shard.mutex_);
+      for (auto &kv : shard.map_) {
+	dpoint = kv.second.get();
+	if (dpoint->data.e.dtype == DSERV_DG) {
+	  entry.clear();
+	  entry = std::string("{") + kv.first + " 0 " +
+	    std::to_string(dpoint->data.len) + "}";
+	  entries.push_back(entry);
+	}
       }
     }
-    mlock.unlock();
 
     for (std::vector<std::string>::const_iterator p = entries.begin();
 	 p != entries.end(); ++p) {
@@ -4,14 +4,38 @@
 #include "dpoint_process.h"
 #include "socket_keepalive.h"
 #include "ListenerSocket.h"
+#include "CommandObjCache.h"
 
 static int process_requests(Dataserver *dserv);
 
-Dataserver::Dataserver(int argc, char **argv, int port): argc(argc), argv(argv)
+Dataserver::Dataserver(int argc, char **argv, int port, int ingest_threads,
+		       int fanout_threads, int shm_ingest):
+  argc(argc), argv(argv)
 {
   m_bDone = false;
   tcpport = port;
 
+#ifdef __linux__
+  if (ingest_threads > 0) ingest = new IngestServer(this, ingest_threads);
+  if (fanout_threads > 0) fanout = new FanoutServer(fanout_threads);
+  if (shm_ingest) {
+    shm = new ShmIngestServer(this, port);
+    if (!shm->running()) {
+      delete shm;
+      shm = nullptr;
+    }
+  }
+#endif
+
+  /* a stalled sender or logger thread must not grow these without bound */
+  auto discard = [](ds_datapoint_t *&dpoint) {
+    if (dpoint->flags & DSERV_DPOINT_MARKER_FLAGS) return false;
+    dpoint_free(dpoint);
+    return true;
+  };
+  notify_queue.set_overflow_limit(notify_queue.OVERFLOW_LIMIT, discard);
+  logger_queue.set_overflow_limit(logger_queue.OVERFLOW_LIMIT, discard);
+
   process_thread = std::thread(&process_requests, this);
   net_thread = std::thread(&Dataserver::start_tcp_server, this);
   send_thread = std::thread(&Dataserver::process_send_requests, this);
@@ -136,14 +160,51 @@ void Dataserver::clear()
   set_key_dpoint();
 }
 
-ds_datapoint_t *Dataserver::process(ds_datapoint_t *dpoint)
+/*
+ * Processor outputs are published after the point that produced them,
+ * from a per-thread worklist, rather than by set() calling set(): a
+ * chain of processors (or two processors feeding each other) used to
+ * recurse once per link.  Now the outermost set() on the thread drains
+ * the list, and outputs produced while draining are appended to it, so
+ * the stack stays flat and the order is breadth-first.  The cap only
+ * matters for a cycle, which would otherwise never end.
+ */
+static thread_local std::vector<ds_datapoint_t *> processed_points;
+static thread_local bool publishing_processed = false;
+static const size_t MAX_PROCESSED_CHAIN = 4096;
+
+static void keep_processed(ds_datapoint_t *out, void *)
+{
+  processed_points.push_back(dpoint_copy(out));
+}
+
+void Dataserver::process(ds_datapoint_t *dpoint)
+{
+  /* execute loaded processors for each datapoint, copying every output
+     out of the processor's buffer before anything else runs */
+  process_dpoint(dpoint, keep_processed, nullptr);
+}
+
+void Dataserver::publish_processed(void)
 {
-  ds_datapoint_t *dp;
-  /* execute loaded processors for each datapoint */
-  if (process_dpoint(dpoint, &dp) == DPOINT_PROCESS_DSERV) {
-    return dpoint_copy(dp);
+  if (publishing_processed || processed_points.empty()) return;
+  publishing_processed = true;
+
+  /* set() may append, so index rather than iterate */
+  size_t i;
+  for (i = 0; i < processed_points.size() && i < MAX_PROCESSED_CHAIN; i++)
+    set(processed_points[i]);
+
+  if (i < processed_points.size()) {
+    fprintf(stderr, "dserv: processor chain from %s exceeded %zu points, "
+	    "dropping %zu\n", processed_points[0]->varname,
+	    MAX_PROCESSED_CHAIN, processed_points.size() - i);
+    for (; i < processed_points.size(); i++)
+      dpoint_free(processed_points[i]);
   }
-  return nullptr;
+
+  processed_points.clear();
+  publishing_processed = false;
 }
 
 void Dataserver::trigger(ds_datapoint_t *dpoint)
@@ -162,7 +223,7 @@ void Dataserver::trigger(ds_datapoint_t *dpoint)
       client_request_t client_request;
       client_request.type = REQ_TRIGGER;
       client_request.script = std::move(script);
-      client_request.dpoint = dpoint_copy(dpoint);
+      client_request.dpoint = dpoint_ref(dpoint);
       queue.push_back(client_request);
     }
   }
@@ -191,14 +252,15 @@ void Dataserver::set(char *varname, char *value)
   
 void Dataserver::set(ds_datapoint_t *dpoint)
 {
-  // make a copy to share to other queue functions
-  ds_datapoint_t *dp = dpoint_copy(dpoint);
+  // the one copy made per publish: a shared, immutable point that the
+  // processors, trigger, notify and logger paths all take references to
+  ds_datapoint_t *dp = dpoint_share(dpoint);
   
   // add to datatable and note if replaced or new point name
   int replaced = add_datapoint_to_table(dpoint->varname, dpoint);
   
-  // process the new point and store result if processor generates result
-  ds_datapoint_t *processed_dpoint = process(dp);
+  // process the new point, queueing any results the processors generate
+  process(dp);
   
   // call trigger function and add to notify and logger scripts
   trigger(dp);
@@ -209,14 +271,66 @@ void Dataserver::set(ds_datapoint_t *dpoint)
   if (!replaced)
     set_key_dpoint();
 
-  if (processed_dpoint)
-    set(processed_dpoint);
+  publish_processed();
   
-  // done with copy 
+  // release our reference
   dpoint_free(dp);
   
 }
 
+/*
+ * set_batch
+ *
+ *  set() for several points that arrive together: the table shards
+ * they touch are each locked once, and notify and logger get the whole
+ * batch in one push apiece (one consumer wakeup each) instead of one
+ * per point.  Points keep their order and their own timestamps.
+ *
+ *  The table takes the whole batch first; only then does each point,
+ * in order, go through its processors and triggers.  So a trigger or
+ * dpoint script run for one point finds the later points of its batch
+ * already in the table -- as it may after a run of set()s too, since
+ * those scripts are queued and run afterwards on their interp's
+ * thread.  Outputs of processors run on the batch are published after
+ * it rather than after each point.  Takes ownership of the points;
+ * dpoints is left empty.
+ */
+void Dataserver::set_batch(std::vector<ds_datapoint_t *> &dpoints)
+{
+  if (dpoints.empty()) return;
+  if (dpoints.size() == 1) {
+    set(dpoints[0]);
+    dpoints.clear();
+    return;
+  }
+
+  std::vector<ds_datapoint_t *> shared, notify, logger;
+  shared.reserve(dpoints.size());
+  for (auto dpoint : dpoints)
+    shared.push_back(dpoint_share(dpoint));
+
+  int added = datapoint_table.replace_batch(dpoints);
+  dpoints.clear();
+
+  notify.reserve(shared.size());
+  logger.reserve(shared.size());
+  for (auto dp : shared) {
+    process(dp);
+    trigger(dp);
+    notify.push_back(dpoint_ref(dp));
+    logger.push_back(dpoint_ref(dp));
+  }
+  notify_queue.push_batch(notify);
+  logger_queue.push_batch(logger);
+
+  if (added)
+    set_key_dpoint();
+
+  publish_processed();
+
+  for (auto dp : shared) dpoint_free(dp);
+}
+
 int Dataserver::copy(char *from_varname, char *to_varname)
 {
   ds_datapoint_t *dp = get_datapoint(from_varname);
@@ -237,43 +351,53 @@ int Dataserver::copy(char *from_varname, char *to_varname)
 
 void Dataserver::update(ds_datapoint_t *dpoint)
 {
+  /*
+   * share before handing dpoint to the table: once it is in the table a
+   * later update can rewrite it in place, so the fan-out below must not
+   * read from it
+   */
+  ds_datapoint_t *dp = dpoint_share(dpoint);
+
   /*
    * if update_datapoint returns 1, then point needs to be freed
    *  because it was _not_ inserted into the table
    */
   int updated = update_datapoint(dpoint);
-  ds_datapoint_t *processed_dpoint = process(dpoint);
+  process(dp);
 
-  trigger(dpoint);
-  add_to_notify_queue(dpoint);
-  add_to_logger_queue(dpoint);
+  trigger(dp);
+  add_to_notify_queue(dp);
+  add_to_logger_queue(dp);
 
   // keep a string of keys as datapoint so clients can monitor
   if (!updated)
     set_key_dpoint();
 
-  if (processed_dpoint)
-    set(processed_dpoint);
+  publish_processed();
     
   /* free if update successful because original point not needed */
   if (updated) dpoint_free(dpoint);
+  dpoint_free(dp);
 }
 
 int Dataserver::touch(char *varname)
 {
-  ds_datapoint_t *dp = get_datapoint(varname);
+  /* share straight from the table's point: one copy, not a
+     get_datapoint() copy plus one per consumer */
+  DatapointSnapshot snap = datapoint_table.snapshot(varname);
+  ds_datapoint_t *dp =
+    snap ? dpoint_share((ds_datapoint_t *) snap.get()) : nullptr;
   int found = 0;
   if (dp) {
     found = 1;
-    ds_datapoint_t *processed_dpoint = process(dp);
+    process(dp);
     trigger(dp);
     add_to_notify_queue(dp);
     add_to_logger_queue(dp);
 
-    if (processed_dpoint)
-      set(processed_dpoint);
+    publish_processed();
 
-    // free the copy returned by get_datapoint()
+    // release our reference
     dpoint_free(dp);
   }
   return found;
@@ -306,6 +430,21 @@ int Dataserver::get(char *varname, ds_datapoint_t **dpoint)
   }
   return (dp != nullptr);
 }
+
+/*
+ * get a read-only reference to the point in the table
+ *
+ *  Same visibility rules as get(), but nothing is copied: the snapshot
+ * stays valid (and unchanged) however the point is rewritten while the
+ * caller holds it.  Use this where the point is only formatted or
+ * serialized on the way out.
+ */
+DatapointSnapshot Dataserver::get_snapshot(char *varname)
+{
+  DatapointSnapshot snap = datapoint_table.snapshot(varname);
+  if (snap && DPOINT_IS_PRIVATE(snap.get())) return nullptr;
+  return snap;
+}
   
 char *Dataserver::get_table_keys(void)
 {
@@ -340,10 +479,20 @@ void Dataserver::remove_all_triggers(void)
   trigger_scripts.clear();
 }
 
-int Dataserver::tcpip_register(char *host, int port, int flags)
+int Dataserver::tcpip_register(char *host, int port, int flags,
+			       const char *policy)
 {
+  SendPolicy p;
+  if (policy && !SendPolicy::parse(policy, &p)) return 0;
+
   /* propagate the connect result so %reg honestly reports reachability */
-  return add_new_send_client(host, port, flags);
+  if (!add_new_send_client(host, port, flags)) return 0;
+  if (policy) {
+    char key[128];
+    snprintf(key, sizeof(key), "%s:%d", host, port);
+    send_table.set_policy(key, p);
+  }
+  return 1;
 }
 
 int Dataserver::tcpip_unregister(char *host, int port)
@@ -352,17 +501,13 @@ int Dataserver::tcpip_unregister(char *host, int port)
   return 1;
 }
 
-int Dataserver::tcpip_add_match(char *host, int port, char *match, int every)
+int Dataserver::tcpip_add_match(char *host, int port, char *match, int every,
+				const char *policy)
 {
   char key[128];
   snprintf(key, sizeof(key), "%s:%d", host, port);
 
-  auto send_client = send_table.get(key);
-  if (!send_client) return 0;
-
-  MatchSpec m(match, every);
-  send_client->matches.insert(match, m);
-  return 1;
+  return client_add_match(key, match, every, policy);
 }
 
 int Dataserver::tcpip_remove_match(char *host, int port, char *match)
@@ -370,44 +515,44 @@ int Dataserver::tcpip_remove_match(char *host, int port, char *match)
   char key[128];
   snprintf(key, sizeof(key), "%s:%d", host, port);
 
-  auto send_client = send_table.get(key);
-  if (!send_client) return 0;
-  send_client->matches.remove(match);
-  return 1;
+  return send_table.remove_match(key, match);
 }
 
-int Dataserver::client_add_match(std::string key, char *match, int every)
+int Dataserver::client_add_match(std::string key, char *match, int every,
+				 const char *policy)
 {
-  auto send_client = send_table.get(key);
-  if (!send_client) return 0;
   MatchSpec m(match, every);
-  send_client->matches.insert(match, m);
-  return 1;
+  if (policy && !client_set_policy(key, policy)) return 0;
+  return send_table.add_match(key, m);
+}
+
+/*
+ * client_set_policy
+ *
+ *  How points reach client `key` when it falls behind (see SendPolicy).
+ * 0 if the policy doesn't parse or there's no such client.
+ */
+int Dataserver::client_set_policy(std::string key, const char *policy)
+{
+  SendPolicy p;
+  if (!SendPolicy::parse(policy, &p)) return 0;
+  return send_table.set_policy(key, p);
 }
 
 int Dataserver::client_add_exact_match(std::string key, char *match, int every)
 {
-  auto send_client = send_table.get(key);
-  if (!send_client) return 0;
   MatchSpec m(match, MatchSpec::MATCH_EXACT, every);
-  send_client->matches.insert(match, m);
-  return 1;
+  return send_table.add_match(key, m);
 }
 
 int Dataserver::client_remove_match(std::string key, char *match)
 {
-  auto send_client = send_table.get(key);
-  if (!send_client) return 0;
-  send_client->matches.remove(match);
-  return 1;
+  return send_table.remove_match(key, match);
 }
 
 int Dataserver::client_remove_all_matches(std::string key)
 {
-  auto send_client = send_table.get(key);
-  if (!send_client) return 0;
-  send_client->matches.clear();
-  return 1;
+  return send_table.clear_matches(key);
 }
 
 bool Dataserver::client_covers(std::string key, char *varname)
@@ -432,9 +577,10 @@ std::string Dataserver::get_logger_clients(void)
   return log_table.clients();
 }
 
-int Dataserver::logger_client_open(std::string filename, bool overwrite)
+int Dataserver::logger_client_open(std::string filename, bool overwrite,
+				   int version, int compress)
 {
-  return (add_new_log_client(filename, overwrite));
+  return (add_new_log_client(filename, overwrite, version, compress));
 }
 
 int Dataserver::logger_client_close(std::string filename)
@@ -452,10 +598,16 @@ int Dataserver::logger_client_start(std::string filename)
   return (start_log_client(filename));
 }
 
+int Dataserver::logger_client_buffering(std::string filename, int stage_size,
+					int flush_ms, log_client_io_t *info)
+{
+  return log_table.buffering(filename, stage_size, flush_ms, info);
+}
+
 int Dataserver::logger_add_match(char *path, char *match,
-				 int every, int obs, int bufsize)
+				 int every, int obs, int bufsize, int columnar)
 {
-  return (log_add_match(path, match, every, obs, bufsize));
+  return (log_add_match(path, match, every, obs, bufsize, columnar));
 }
   
 
@@ -488,12 +640,241 @@ bool Dataserver::isDone()
 /*                      Exported Tcl Bound Commands                    */
 /***********************************************************************/
 
+#if TCL_MAJOR_VERSION >= 9
+/*
+ * dpoint vectors
+ *
+ *  Under Tcl 9 an array point is passed as an abstract list (TIP 636):
+ * one copy of its samples, with an element made only when a script
+ * asks for it (lindex, foreach, lrange ...).  A script that hands the
+ * value on or looks at a few samples no longer pays for N Tcl_Objs on
+ * every delivery of ain/vals at 1 kHz.  The string rep is the one the
+ * list would have had, copies share the samples, and anything that
+ * changes the list (lset, lappend) gets Tcl to make a real list from
+ * the elements first.
+ */
+struct dpoint_vector_t {
+  size_t refcount;
+  ds_datatype_t type;
+  Tcl_Size n;
+  unsigned char *data(void) { return (unsigned char *) (this + 1); }
+};
+
+static Tcl_Size dpoint_vector_length(Tcl_Obj *obj);
+static int dpoint_vector_index(Tcl_Interp *interp, Tcl_Obj *obj,
+			       Tcl_Size index, Tcl_Obj **elemObj);
+static int dpoint_vector_slice(Tcl_Interp *interp, Tcl_Obj *obj,
+			       Tcl_Size from, Tcl_Size to, Tcl_Obj **newObj);
+static int dpoint_vector_reverse(Tcl_Interp *interp, Tcl_Obj *obj,
+				 Tcl_Obj **newObj);
+static void dpoint_vector_free(Tcl_Obj *obj);
+static void dpoint_vector_dup(Tcl_Obj *src, Tcl_Obj *dup);
+static void dpoint_vector_string(Tcl_Obj *obj);
+
+static const Tcl_ObjType dpoint_vector_type = {
+  "dpointvector",
+  dpoint_vector_free,
+  dpoint_vector_dup,
+  dpoint_vector_string,
+  NULL,				/* nothing else becomes one */
+  TCL_OBJTYPE_V2(dpoint_vector_length,
+		 dpoint_vector_index,
+		 dpoint_vector_slice,
+		 dpoint_vector_reverse,
+		 NULL,			/* getElements: a real list */
+		 NULL,			/* setElement: a real list */
+		 NULL,			/* replace: a real list */
+		 NULL)			/* in: element by element */
+};
+
+static inline dpoint_vector_t *dpoint_vector_of(Tcl_Obj *obj)
+{
+  return (dpoint_vector_t *) obj->internalRep.twoPtrValue.ptr1;
+}
+
+static size_t dpoint_vector_eltsize(ds_datatype_t type)
+{
+  switch (type) {
+  case DSERV_FLOAT: return sizeof(float);
+  case DSERV_DOUBLE: return sizeof(double);
+  case DSERV_SHORT: return sizeof(short);
+  case DSERV_INT: return sizeof(int);
+  case DSERV_INT64: return sizeof(int64_t);
+  default: return 1;
+  }
+}
+
+/* n samples of type, copied from data (or left for the caller: NULL) */
+static Tcl_Obj *dpoint_vector_new(ds_datatype_t type, Tcl_Size n,
+				  const void *data)
+{
+  size_t len = n * dpoint_vector_eltsize(type);
+  dpoint_vector_t *v =
+    (dpoint_vector_t *) Tcl_Alloc(sizeof(dpoint_vector_t) + len);
+  v->refcount = 1;
+  v->type = type;
+  v->n = n;
+  if (data) memcpy(v->data(), data, len);
+
+  Tcl_ObjInternalRep ir;
+  ir.twoPtrValue.ptr1 = v;
+  ir.twoPtrValue.ptr2 = NULL;
+  Tcl_Obj *obj = Tcl_NewObj();
+  Tcl_StoreInternalRep(obj, &dpoint_vector_type, &ir);
+  Tcl_InvalidateStringRep(obj);
+  return obj;
+}
+
+static Tcl_Obj *dpoint_vector_elt(dpoint_vector_t *v, Tcl_Size i)
+{
+  const unsigned char *p = v->data();
+  switch (v->type) {
+  case DSERV_FLOAT: return Tcl_NewDoubleObj(((const float *) p)[i]);
+  case DSERV_DOUBLE: return Tcl_NewDoubleObj(((const double *) p)[i]);
+  case DSERV_SHORT: return Tcl_NewIntObj(((const short *) p)[i]);
+  case DSERV_INT: return Tcl_NewIntObj(((const int *) p)[i]);
+  case DSERV_INT64: return Tcl_NewWideIntObj(((const int64_t *) p)[i]);
+  default: return Tcl_NewIntObj(p[i]);
+  }
+}
+
+static Tcl_Size dpoint_vector_length(Tcl_Obj *obj)
+{
+  return dpoint_vector_of(obj)->n;
+}
+
+static int dpoint_vector_index(Tcl_Interp *interp, Tcl_Obj *obj,
+			       Tcl_Size index, Tcl_Obj **elemObj)
+{
+  dpoint_vector_t *v = dpoint_vector_of(obj);
+  *elemObj = (index >= 0 && index < v->n) ? dpoint_vector_elt(v, index) : NULL;
+  return TCL_OK;
+}
+
+static int dpoint_vector_slice(Tcl_Interp *interp, Tcl_Obj *obj,
+			       Tcl_Size from, Tcl_Size to, Tcl_Obj **newObj)
+{
+  dpoint_vector_t *v = dpoint_vector_of(obj);
+  size_t eltsize = dpoint_vector_eltsize(v->type);
+
+  if (from < 0) from = 0;
+  if (to >= v->n) to = v->n - 1;
+  if (from > to) {
+    *newObj = Tcl_NewObj();
+    return TCL_OK;
+  }
+  *newObj = dpoint_vector_new(v->type, to - from + 1,
+			      v->data() + from * eltsize);
+  return TCL_OK;
+}
+
+static int dpoint_vector_reverse(Tcl_Interp *interp, Tcl_Obj *obj,
+				 Tcl_Obj **newObj)
+{
+  dpoint_vector_t *v = dpoint_vector_of(obj);
+  size_t eltsize = dpoint_vector_eltsize(v->type);
+
+  *newObj = dpoint_vector_new(v->type, v->n, NULL);
+  unsigned char *to = dpoint_vector_of(*newObj)->data();
+  for (Tcl_Size i = 0; i < v->n; i++)
+    memcpy(to + i * eltsize, v->data() + (v->n - 1 - i) * eltsize, eltsize);
+  return TCL_OK;
+}
+
+static void dpoint_vector_free(Tcl_Obj *obj)
+{
+  dpoint_vector_t *v = dpoint_vector_of(obj);
+  if (--v->refcount == 0) Tcl_Free(v);
+}
+
+static void dpoint_vector_dup(Tcl_Obj *src, Tcl_Obj *dup)
+{
+  dpoint_vector_t *v = dpoint_vector_of(src);
+  v->refcount++;
+  dup->internalRep.twoPtrValue.ptr1 = v;
+  dup->internalRep.twoPtrValue.ptr2 = NULL;
+  dup->typePtr = &dpoint_vector_type;
+}
+
+static void dpoint_vector_string(Tcl_Obj *obj)
+{
+  dpoint_vector_t *v = dpoint_vector_of(obj);
+  const unsigned char *p = v->data();
+  char buf[TCL_DOUBLE_SPACE + 1];
+  Tcl_DString ds;
+
+  Tcl_DStringInit(&ds);
+  for (Tcl_Size i = 0; i < v->n; i++) {
+    switch (v->type) {
+    case DSERV_FLOAT:
+      Tcl_PrintDouble(NULL, ((const float *) p)[i], buf);
+      break;
+    case DSERV_DOUBLE:
+      Tcl_PrintDouble(NULL, ((const double *) p)[i], buf);
+      break;
+    case DSERV_SHORT:
+      snprintf(buf, sizeof(buf), "%d", ((const short *) p)[i]);
+      break;
+    case DSERV_INT:
+      snprintf(buf, sizeof(buf), "%d", ((const int *) p)[i]);
+      break;
+    case DSERV_INT64:
+      snprintf(buf, sizeof(buf), "%lld",
+	       (long long) ((const int64_t *) p)[i]);
+      break;
+    default:
+      snprintf(buf, sizeof(buf), "%d", p[i]);
+      break;
+    }
+    if (i) Tcl_DStringAppend(&ds, " ", 1);
+    Tcl_DStringAppend(&ds, buf, -1);
+  }
+  Tcl_InitStringRep(obj, Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+  Tcl_DStringFree(&ds);
+}
+
+template <typename T>
+static Tcl_Obj *numeric_list(ds_datapoint_t *dpoint)
+{
+  return dpoint_vector_new(dpoint->data.type, dpoint->data.len / sizeof(T),
+			   dpoint->data.buf);
+}
+
+#else
+/*
+ * An array point as a list, made in one Tcl_NewListObj over all of its
+ * elements rather than grown an element at a time -- this runs for
+ * every delivery of a multi-sample point (ain/vals at 1 kHz) to a
+ * script.  (Under Tcl 9 it is a dpoint vector, above.)
+ */
+static inline Tcl_Obj *list_elt(float v) { return Tcl_NewDoubleObj(v); }
+static inline Tcl_Obj *list_elt(double v) { return Tcl_NewDoubleObj(v); }
+static inline Tcl_Obj *list_elt(short v) { return Tcl_NewIntObj(v); }
+static inline Tcl_Obj *list_elt(int v) { return Tcl_NewIntObj(v); }
+static inline Tcl_Obj *list_elt(int64_t v) { return Tcl_NewWideIntObj(v); }
+
+template <typename T>
+static Tcl_Obj *numeric_list(ds_datapoint_t *dpoint)
+{
+  Tcl_Obj *elts_small[64];
+  std::vector<Tcl_Obj *> elts_big;
+  Tcl_Obj **elts = elts_small;
+  uint32_t n = dpoint->data.len / sizeof(T);
+
+  if (n > sizeof(elts_small) / sizeof(elts_small[0])) {
+    elts_big.resize(n);
+    elts = elts_big.data();
+  }
+  const T *p = (const T *) dpoint->data.buf;
+  for (uint32_t i = 0; i < n; i++) elts[i] = list_elt(p[i]);
+  return Tcl_NewListObj(n, elts);
+}
+#endif
+
 Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
 				 ds_datapoint_t *dpoint)
 {
   Tcl_Obj *obj = NULL;
-  Tcl_Obj *elt;
-  int i, n;
     
   if (!dpoint) return NULL;
 
@@ -502,7 +883,7 @@ Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
   switch (dpoint->data.type) {
   case DSERV_BYTE:
     if (dpoint->data.len == sizeof(unsigned char)) {
-      obj = Tcl_NewIntObj(*((int *) dpoint->data.buf));
+      obj = Tcl_NewIntObj(*((unsigned char *) dpoint->data.buf));
     }
     else {
       obj = Tcl_NewByteArrayObj(dpoint->data.buf, dpoint->data.len);
@@ -517,14 +898,7 @@ Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
       obj = Tcl_NewDoubleObj(*((float *) dpoint->data.buf));
     }
     else {
-      float *p = (float *) dpoint->data.buf;
-      n = dpoint->data.len/sizeof(float);
-      elt = Tcl_NewDoubleObj(*p++);
-      obj = Tcl_NewListObj(1, &elt);
-      for (i = 1; i < n; i++) {
-	elt = Tcl_NewDoubleObj(*p++);
-	Tcl_ListObjAppendElement(interp, obj, elt);
-      }
+      obj = numeric_list<float>(dpoint);
     }
     break;
   case DSERV_DOUBLE:
@@ -532,14 +906,7 @@ Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
       obj = Tcl_NewDoubleObj(*((double *) dpoint->data.buf));
     }
     else {
-      double *p = (double *) dpoint->data.buf;
-      n = dpoint->data.len/sizeof(double);
-      elt = Tcl_NewDoubleObj(*p++);
-      obj = Tcl_NewListObj(1, &elt);
-      for (i = 1; i < n; i++) {
-	elt = Tcl_NewDoubleObj(*p++);
-	Tcl_ListObjAppendElement(interp, obj, elt);
-      }
+      obj = numeric_list<double>(dpoint);
     }
     break;
   case DSERV_SHORT:
@@ -547,14 +914,7 @@ Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
       obj = Tcl_NewIntObj(*((short *) dpoint->data.buf));
     }
     else {
-      short *p = (short *) dpoint->data.buf;
-      n = dpoint->data.len/sizeof(short);
-      elt = Tcl_NewIntObj(*p++);
-      obj = Tcl_NewListObj(1, &elt);
-      for (i = 1; i < n; i++) {
-	elt = Tcl_NewIntObj(*p++);
-	Tcl_ListObjAppendElement(interp, obj, elt);
-      }
+      obj = numeric_list<short>(dpoint);
     }
     break;
   case DSERV_INT:
@@ -562,14 +922,7 @@ Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
       obj = Tcl_NewIntObj(*((int *) dpoint->data.buf));
     }
     else {
-      int *p = (int *) dpoint->data.buf;
-      n = dpoint->data.len/sizeof(int);
-      elt = Tcl_NewIntObj(*p++);
-      obj = Tcl_NewListObj(1, &elt);
-      for (i = 1; i < n; i++) {
-	elt = Tcl_NewIntObj(*p++);
-	Tcl_ListObjAppendElement(interp, obj, elt);
-      }
+      obj = numeric_list<int>(dpoint);
     }
     break;
   case DSERV_INT64:
@@ -577,14 +930,7 @@ Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
       obj = Tcl_NewWideIntObj(*((int64_t *) dpoint->data.buf));
     }
     else {
-      int64_t *p = (int64_t *) dpoint->data.buf;
-      n = dpoint->data.len/sizeof(int64_t);
-      elt = Tcl_NewWideIntObj(*p++);
-      obj = Tcl_NewListObj(1, &elt);
-      for (i = 1; i < n; i++) {
-	elt = Tcl_NewWideIntObj(*p++);
-	Tcl_ListObjAppendElement(interp, obj, elt);
-      }
+      obj = numeric_list<int64_t>(dpoint);
     }
     break;    
   case DSERV_DG:
@@ -607,6 +953,38 @@ Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,
   return obj;
 }
 
+/*
+ * The `name value` a point's scripts are called with, each with a
+ * reference the caller drops (Tcl_DecrRefCount) when done.  Built once
+ * per delivery and shared by every script registered for the point.
+ * Events (DSERV_EVT) are named evt:TYPE:SUBTYPE and valued by their
+ * put type; a value dpoint_to_tclobj can't represent is passed as "".
+ */
+void dpoint_to_tclargs(Tcl_Interp *interp, ds_datapoint_t *dpoint,
+		       Tcl_Obj *args[2])
+{
+  if (dpoint->data.e.dtype != DSERV_EVT) {
+    args[0] = Tcl_NewStringObj(dpoint->varname, dpoint->varlen);
+    args[1] = dpoint_to_tclobj(interp, dpoint);
+  }
+  else {
+    char evt_namebuf[32];
+    snprintf(evt_namebuf, sizeof(evt_namebuf), "evt:%d:%d",
+	     dpoint->data.e.type, dpoint->data.e.subtype);
+    args[0] = Tcl_NewStringObj(evt_namebuf, -1);
+
+    /* a repackaged dpoint to pass to dpoint_to_tclobj */
+    ds_datapoint_t e_dpoint;
+    e_dpoint.data.type = (ds_datatype_t) dpoint->data.e.puttype;
+    e_dpoint.data.len = dpoint->data.len;
+    e_dpoint.data.buf = dpoint->data.buf;
+    args[1] = dpoint_to_tclobj(interp, &e_dpoint);
+  }
+  if (!args[1]) args[1] = Tcl_NewObj();
+  Tcl_IncrRefCount(args[0]);
+  Tcl_IncrRefCount(args[1]);
+}
+
 int now_command(ClientData data, Tcl_Interp * interp, int objc,
 		Tcl_Obj * const objv[])
 {
@@ -723,30 +1101,23 @@ int dserv_get_command(ClientData data, Tcl_Interp * interp, int objc,
     return TCL_ERROR;
   }
   
-  ds_datapoint_t *dpoint;
-  dpoint = ds->get_datapoint(Tcl_GetString(objv[1]));
-
-  if (dpoint && DPOINT_IS_PRIVATE(dpoint)) {
-    dpoint_free(dpoint);
-    Tcl_AppendResult(interp, "dpoint \"",
-		     Tcl_GetString(objv[1]),
-		     "\" is private", NULL);
-    return TCL_ERROR;
-  }
+  /* snapshot, not a copy: the Tcl object is built straight from the
+     table's point with no lock held */
+  DatapointSnapshot dpoint = ds->get_snapshot(Tcl_GetString(objv[1]));
 
   if (!dpoint) {
+    /* get_snapshot hides private points; say which it was */
     Tcl_AppendResult(interp, "dpoint \"",
 		     Tcl_GetString(objv[1]),
-		     "\" not found", NULL);
+		     ds->find_datapoint(Tcl_GetString(objv[1])) ?
+		     "\" is private" : "\" not found", NULL);
     return TCL_ERROR;
   }
 
-  obj = dpoint_to_tclobj(interp, dpoint);
+  obj = dpoint_to_tclobj(interp, (ds_datapoint_t *) dpoint.get());
   if (obj)
     Tcl_SetObjResult(interp, obj);
   
-  dpoint_free(dpoint);
-  
   return TCL_OK;
 }
 
@@ -757,7 +1128,7 @@ int dserv_send_clients_command(ClientData data, Tcl_Interp * interp, int objc,
   auto clients = ds->get_send_table().get_client_info();
 
   Tcl_Obj *listObj = Tcl_NewListObj(0, NULL);
-  for (auto& [key, active, queue_size, matches] : clients) {
+  for (auto& [key, active, queue_size, matches, io, policy] : clients) {
     Tcl_Obj *clientDict = Tcl_NewDictObj();
     Tcl_DictObjPut(interp, clientDict,
 		   Tcl_NewStringObj("id", -1),
@@ -771,6 +1142,24 @@ int dserv_send_clients_command(ClientData data, Tcl_Interp * interp, int objc,
     Tcl_DictObjPut(interp, clientDict,
 		   Tcl_NewStringObj("matches", -1),
 		   Tcl_NewStringObj(matches.c_str(), -1));
+    Tcl_DictObjPut(interp, clientDict,
+		   Tcl_NewStringObj("points", -1),
+		   Tcl_NewWideIntObj(io.points));
+    Tcl_DictObjPut(interp, clientDict,
+		   Tcl_NewStringObj("batches", -1),
+		   Tcl_NewWideIntObj(io.batches));
+    Tcl_DictObjPut(interp, clientDict,
+		   Tcl_NewStringObj("bytes", -1),
+		   Tcl_NewWideIntObj(io.bytes));
+    Tcl_DictObjPut(interp, clientDict,
+		   Tcl_NewStringObj("policy", -1),
+		   Tcl_NewStringObj(policy.c_str(), -1));
+    Tcl_DictObjPut(interp, clientDict,
+		   Tcl_NewStringObj("dropped", -1),
+		   Tcl_NewWideIntObj(io.dropped));
+    Tcl_DictObjPut(interp, clientDict,
+		   Tcl_NewStringObj("conflated", -1),
+		   Tcl_NewWideIntObj(io.conflated));
     Tcl_ListObjAppendElement(interp, listObj, clientDict);
   }
 
@@ -778,6 +1167,253 @@ int dserv_send_clients_command(ClientData data, Tcl_Interp * interp, int objc,
   return TCL_OK;
 }
 
+/*
+ * dservSendClientPolicy id ?policy?
+ *   A send client's delivery policy when it falls behind: all[:N],
+ *   latest or rate:N (see SendPolicy).  Returns the current policy.
+ */
+int dserv_send_client_policy_command(ClientData data, Tcl_Interp *interp,
+				     int objc, Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  SendPolicy policy;
+
+  if (objc < 2 || objc > 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "id ?all[:max]|latest|rate:hz?");
+    return TCL_ERROR;
+  }
+  if (objc > 2 && !SendPolicy::parse(Tcl_GetString(objv[2]), &policy)) {
+    Tcl_AppendResult(interp, "bad policy \"", Tcl_GetString(objv[2]),
+		     "\": should be all, all:max, latest or rate:hz", NULL);
+    return TCL_ERROR;
+  }
+  if ((objc > 2 && !ds->get_send_table().set_policy(Tcl_GetString(objv[1]),
+						      policy)) ||
+      !ds->get_send_table().get_policy(Tcl_GetString(objv[1]), &policy)) {
+    Tcl_AppendResult(interp, "send client ", Tcl_GetString(objv[1]),
+		     " not found", NULL);
+    return TCL_ERROR;
+  }
+  Tcl_SetObjResult(interp, Tcl_NewStringObj(policy.to_string().c_str(), -1));
+  return TCL_OK;
+}
+
+/*
+ * dservSendClientBuffering id ?flush_us?
+ *   Writer batching for a send client (id as in dservSendClients): the
+ *   longest a point waits to be written with others (0, the default,
+ *   writes whatever has queued as soon as the writer gets to it).
+ *   Returns the setting and the points/batches/bytes counters as a
+ *   dict.
+ */
+int dserv_send_client_buffering_command(ClientData data, Tcl_Interp *interp,
+					int objc, Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  int flush_us = -1;
+  send_client_io_t info;
+
+  if (objc < 2 || objc > 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "id ?flush_us?");
+    return TCL_ERROR;
+  }
+  if (objc > 2 &&
+      Tcl_GetIntFromObj(interp, objv[2], &flush_us) != TCL_OK)
+    return TCL_ERROR;
+
+  if (!ds->get_send_table().buffering(Tcl_GetString(objv[1]),
+				      flush_us, &info)) {
+    Tcl_AppendResult(interp, "send client ", Tcl_GetString(objv[1]),
+		     " not found", NULL);
+    return TCL_ERROR;
+  }
+
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("flush_us", -1),
+		 Tcl_NewIntObj(info.flush_us));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("points", -1),
+		 Tcl_NewWideIntObj(info.points));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("batches", -1),
+		 Tcl_NewWideIntObj(info.batches));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("bytes", -1),
+		 Tcl_NewWideIntObj(info.bytes));
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
+/*
+ * dservIngestInfo
+ *
+ *  How producer connections on the dataserver port are being served:
+ * engine (epoll or threads), and for epoll the worker count, open and
+ * total connections, and messages and bytes taken in.
+ */
+int dserv_ingest_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			      Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  IngestServer *ingest = ds->get_ingest();
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("engine", -1),
+		 Tcl_NewStringObj(ingest ? "epoll" : "threads", -1));
+  if (ingest) {
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("threads", -1),
+		   Tcl_NewIntObj(ingest->nthreads()));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("connections", -1),
+		   Tcl_NewWideIntObj(ingest->connections));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("accepted", -1),
+		   Tcl_NewWideIntObj(ingest->accepted));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("messages", -1),
+		   Tcl_NewWideIntObj(ingest->messages));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("bytes", -1),
+		   Tcl_NewWideIntObj(ingest->bytes));
+  }
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
+/*
+ * dservFanoutInfo
+ *
+ *  How send clients are being written to: engine (epoll or threads),
+ * and for epoll the worker count, clients served and worker wakeups
+ * so far.
+ */
+int dserv_fanout_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			      Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  FanoutServer *fanout = ds->get_fanout();
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("engine", -1),
+		 Tcl_NewStringObj(fanout ? "epoll" : "threads", -1));
+  if (fanout) {
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("threads", -1),
+		   Tcl_NewIntObj(fanout->nthreads()));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("clients", -1),
+		   Tcl_NewWideIntObj(fanout->clients));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("wakeups", -1),
+		   Tcl_NewWideIntObj(fanout->wakeups));
+  }
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
+static Tcl_Obj *queue_info(Tcl_Interp *interp,
+			   MPSCRing<ds_datapoint_t *> &queue)
+{
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("queued", -1),
+		 Tcl_NewIntObj(queue.size()));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("overflows", -1),
+		 Tcl_NewWideIntObj(queue.overflows()));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("dropped", -1),
+		 Tcl_NewWideIntObj(queue.dropped()));
+  return dictObj;
+}
+
+/*
+ * dservQueueInfo
+ *
+ *  The queues every set passes through on its way to the send clients
+ * (notify) and the loggers (logger): points waiting now, points that
+ * found the ring full and waited in its overflow, and points dropped
+ * because the overflow was full too.
+ */
+int dserv_queue_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			     Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("notify", -1),
+		 queue_info(interp, ds->get_notify_queue()));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("logger", -1),
+		 queue_info(interp, ds->get_logger_queue()));
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
+/*
+ * dservShmInfo
+ *
+ *  Shared memory rings for producers on this host (ShmIngestServer.h):
+ * the socket they connect to, the rings open now, records taken and
+ * dropped for want of room, worker wakeups, and the mean and worst
+ * time (us) from a producer writing a record to its point being in the
+ * table.  An empty dict if dserv isn't offering rings.
+ */
+int dserv_shm_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			   Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  ShmIngestServer *shm = ds->get_shm();
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+
+  if (shm) {
+    Tcl_Obj *rings = Tcl_NewListObj(0, NULL);
+    for (auto &name : shm->rings())
+      Tcl_ListObjAppendElement(interp, rings,
+			       Tcl_NewStringObj(name.c_str(), -1));
+    uint64_t records = shm->records;
+
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("socket", -1),
+		   Tcl_NewStringObj(("@" + shm->address).c_str(), -1));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("rings", -1), rings);
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("records", -1),
+		   Tcl_NewWideIntObj(records));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("dropped", -1),
+		   Tcl_NewWideIntObj(shm->dropped));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("wakeups", -1),
+		   Tcl_NewWideIntObj(shm->wakeups));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("latency_mean_us", -1),
+		   Tcl_NewDoubleObj(records ?
+				    shm->latency_ns / 1000.0 / records : 0.0));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("latency_max_us", -1),
+		   Tcl_NewDoubleObj(shm->latency_max_ns / 1000.0));
+  }
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
+/*
+ * dservShmPoll ?us?
+ *
+ *  How long the shared memory ring worker keeps checking the rings
+ * after the last record before it sleeps on their doorbells (see
+ * ShmIngestServer::poll_us).  Returns the setting.
+ */
+int dserv_shm_poll_command(ClientData data, Tcl_Interp * interp, int objc,
+			   Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  ShmIngestServer *shm = ds->get_shm();
+  int us;
+
+  if (objc > 2) {
+    Tcl_WrongNumArgs(interp, 1, objv, "?us?");
+    return TCL_ERROR;
+  }
+  if (!shm) {
+    Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+		     ": shared memory ingest is not running", NULL);
+    return TCL_ERROR;
+  }
+  if (objc == 2) {
+    if (Tcl_GetIntFromObj(interp, objv[1], &us) != TCL_OK) return TCL_ERROR;
+    if (us < 0 || us > 1000000) {
+      Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+		       ": us must be from 0 to 1000000", NULL);
+      return TCL_ERROR;
+    }
+    shm->poll_us = us;
+  }
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(shm->poll_us));
+  return TCL_OK;
+}
+
 int dserv_info_command(ClientData data, Tcl_Interp * interp, int objc,
                        Tcl_Obj * const objv[])
 {
@@ -969,6 +1605,83 @@ int dserv_setdata_command (ClientData data, Tcl_Interp *interp,
   return (TCL_OK);
 }
   
+/*
+ * dservSetBatch {varname value ?varname value ...?}
+ * dservSetBatch -data {{var timestamp datatype bytes} ...}
+ *
+ *  Set several points as one batch (Dataserver::set_batch), in order:
+ * string values as dservSet would, or typed binary data as
+ * dservSetData would (a timestamp of 0 means now).  Nothing is set if
+ * any entry is bad.
+ */
+int dserv_setbatch_command(ClientData data, Tcl_Interp *interp,
+			   int objc, Tcl_Obj * const objv[])
+{
+  Dataserver *ds = (Dataserver *) data;
+  Tcl_Size n;
+  Tcl_Obj **elts;
+  bool binary = false;
+
+  if (objc == 3 && !strcmp(Tcl_GetString(objv[1]), "-data"))
+    binary = true;
+  else if (objc != 2) {
+    Tcl_WrongNumArgs(interp, 1, objv,
+		     "{varname value ...} | -data {{var timestamp datatype bytes} ...}");
+    return TCL_ERROR;
+  }
+
+  if (Tcl_ListObjGetElements(interp, objv[objc-1], &n, &elts) != TCL_OK)
+    return TCL_ERROR;
+
+  std::vector<ds_datapoint_t *> dpoints;
+  int64_t now = ds->now();
+
+  if (!binary) {
+    if (n % 2) {
+      Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+		       ": expected varname value pairs", NULL);
+      return TCL_ERROR;
+    }
+    dpoints.reserve(n / 2);
+    for (Tcl_Size i = 0; i < n; i += 2) {
+      Tcl_Size len;
+      char *value = Tcl_GetStringFromObj(elts[i+1], &len);
+      dpoints.push_back(dpoint_new(Tcl_GetString(elts[i]), now,
+				   DSERV_STRING, len,
+				   (unsigned char *) value));
+    }
+  }
+  else {
+    dpoints.reserve(n);
+    for (Tcl_Size i = 0; i < n; i++) {
+      Tcl_Size m, len;
+      Tcl_Obj **fields;
+      Tcl_WideInt ts;
+      int datatype;
+      unsigned char *bytes;
+
+      if (Tcl_ListObjGetElements(interp, elts[i], &m, &fields) != TCL_OK ||
+	  m != 4 ||
+	  Tcl_GetWideIntFromObj(interp, fields[1], &ts) != TCL_OK ||
+	  Tcl_GetIntFromObj(interp, fields[2], &datatype) != TCL_OK) {
+	Tcl_ResetResult(interp);
+	Tcl_AppendResult(interp, Tcl_GetString(objv[0]), ": bad entry \"",
+			 Tcl_GetString(elts[i]),
+			 "\" (expected var timestamp datatype bytes)", NULL);
+	for (auto dp : dpoints) dpoint_free(dp);
+	return TCL_ERROR;
+      }
+      bytes = Tcl_GetByteArrayFromObj(fields[3], &len);
+      dpoints.push_back(dpoint_new(Tcl_GetString(fields[0]),
+				   ts ? ts : now,
+				   (ds_datatype_t) datatype, len, bytes));
+    }
+  }
+
+  ds->set_batch(dpoints);
+  return TCL_OK;
+}
+
 int dserv_setdata64_command (ClientData data, Tcl_Interp *interp,
 			     int objc, Tcl_Obj * const objv[])
 {
@@ -1159,8 +1872,7 @@ int process_set_param_command(ClientData data,
 			  Tcl_GetString(objv[3]),
 			  index, ds->now(), &out);
   if (ret == DPOINT_PROCESS_DSERV) {
-    ds_datapoint_t *dp = dpoint_copy(out);
-    ds->set(dp);
+    ds->set(out);
   }
   Tcl_SetObjResult(interp, Tcl_NewIntObj(ret));
   return TCL_OK;
@@ -1210,6 +1922,44 @@ static int process_attach_command(ClientData data, Tcl_Interp * interp, int objc
   else return TCL_OK;
 }
 
+/*
+ * processStats ?reset?
+ *   Per-processor counters: a dict of processor name ->
+ *   {varname calls ns}, ns being the total time spent in its process
+ *   function.
+ */
+int process_stats_command(ClientData data, Tcl_Interp * interp, int objc,
+			  Tcl_Obj * const objv[])
+{
+  if (objc > 1) {
+    if (strcmp(Tcl_GetString(objv[1]), "reset")) {
+      Tcl_WrongNumArgs(interp, 1, objv, "?reset?");
+      return TCL_ERROR;
+    }
+    process_stats_reset();
+    return TCL_OK;
+  }
+
+  std::vector<dpoint_process_stats_t> stats(process_stats(nullptr, 0));
+  int n = process_stats(stats.data(), stats.size());
+  if (n > (int) stats.size()) n = stats.size(); /* attached meanwhile */
+
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+  for (int i = 0; i < n; i++) {
+    Tcl_Obj *entry = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, entry, Tcl_NewStringObj("varname", -1),
+		   Tcl_NewStringObj(stats[i].varname, -1));
+    Tcl_DictObjPut(interp, entry, Tcl_NewStringObj("calls", -1),
+		   Tcl_NewWideIntObj(stats[i].calls));
+    Tcl_DictObjPut(interp, entry, Tcl_NewStringObj("ns", -1),
+		   Tcl_NewWideIntObj(stats[i].ns));
+    Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj(stats[i].name, -1),
+		   entry);
+  }
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
 static int trigger_add_command(ClientData data, Tcl_Interp * interp, int objc,
 			       Tcl_Obj * const objv[])
 {
@@ -1280,6 +2030,8 @@ static void add_tcl_commands(Tcl_Interp *interp, Dataserver *dserv)
 		       dserv_setdata_command, dserv, NULL);
   Tcl_CreateObjCommand(interp, "dservSetData64",
 		       dserv_setdata64_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservSetBatch",
+		       dserv_setbatch_command, dserv, NULL);
   Tcl_CreateObjCommand(interp, "dservClear",
 		       dserv_clear_command, dserv, NULL);
   Tcl_CreateObjCommand(interp, "dservKeys",
@@ -1288,11 +2040,27 @@ static void add_tcl_commands(Tcl_Interp *interp, Dataserver *dserv)
 		       dserv_dgdir_command, dserv, NULL);
   Tcl_CreateObjCommand(interp, "dservSendClients",
 		       dserv_send_clients_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservSendClientBuffering",
+		       dserv_send_client_buffering_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservSendClientPolicy",
+		       dserv_send_client_policy_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservIngestInfo",
+		       dserv_ingest_info_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservFanoutInfo",
+		       dserv_fanout_info_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservQueueInfo",
+		       dserv_queue_info_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservShmInfo",
+		       dserv_shm_info_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservShmPoll",
+		       dserv_shm_poll_command, dserv, NULL);
 
   Tcl_CreateObjCommand(interp, "processLoad",
 		       process_load_command, dserv, NULL);
   Tcl_CreateObjCommand(interp, "processAttach",
 		       process_attach_command, dserv, NULL);
+  Tcl_CreateObjCommand(interp, "processStats",
+		       process_stats_command, dserv, NULL);
   /*
    * For now we limit get/set to being called from TclServer
    *  as these are not thread safe
@@ -1398,6 +2166,7 @@ static int process_requests(Dataserver *dserv) {
 
   int retcode;
   client_request_t req;
+  CommandObjCache trigger_cmds;
     
   /* process until receive a message saying we are done */
   while (!dserv->m_bDone) {
@@ -1439,52 +2208,21 @@ static int process_requests(Dataserver *dserv) {
       break;
     case REQ_TRIGGER:
       {
-	const char *script = req.script.c_str();
-	ds_datapoint_t *dpoint = req.dpoint;
-	
+	/* the command word comes from the cache, resolved once per
+	   registration (CommandObjCache.h) */
 	Tcl_Obj *commandArray[3];
-	commandArray[0] = Tcl_NewStringObj(script, -1);
-
-	/* name of dpoint (special for DSERV_EVTs */
-	if (dpoint->data.e.dtype != DSERV_EVT) {
-	  /* point name */
-	  commandArray[1] = Tcl_NewStringObj(dpoint->varname, dpoint->varlen);
-	  /* data as Tcl_Obj */
-	  commandArray[2] = dpoint_to_tclobj(interp, dpoint);
-	}
-	else {
-	  /* convert eventlog/events -> evt:TYPE:SUBTYPE notation */
-	  char evt_namebuf[32];
-	  snprintf(evt_namebuf, sizeof(evt_namebuf), "evt:%d:%d",
-		   dpoint->data.e.type, dpoint->data.e.subtype);
-	  commandArray[1] = Tcl_NewStringObj(evt_namebuf, -1);
-	  
-	  /* create a repackaged dpoint to pass to dpoint_to_tclobj */
-	  ds_datapoint_t e_dpoint;
-	  e_dpoint.data.type = (ds_datatype_t) dpoint->data.e.puttype;
-	  e_dpoint.data.len = dpoint->data.len;
-	  e_dpoint.data.buf = dpoint->data.buf;
-	  
-	  /* data as Tcl_Obj */
-	  commandArray[2] = dpoint_to_tclobj(interp, &e_dpoint);
-	}
-
-	/* dpoint_to_tclobj returns NULL for types it can't represent
-	   (e.g. DSERV_NONE with data); substitute an empty obj rather
-	   than crash in Tcl_IncrRefCount below */
-	if (!commandArray[2]) commandArray[2] = Tcl_NewObj();
+	commandArray[0] =
+	  trigger_cmds.get(req.script, dserv->trigger_scripts.generation());
+	dpoint_to_tclargs(interp, req.dpoint, &commandArray[1]);
 
 	/* done with this point */
-	dpoint_free(dpoint);
-
-	/* incr ref count on command arguments */
-	for (int i = 0; i < 3; i++) { Tcl_IncrRefCount(commandArray[i]); }
+	dpoint_free(req.dpoint);
 
 	/* call command */
 	retcode = Tcl_EvalObjv(interp, 3, commandArray, 0);
 
-	/* decr ref count on command arguments */
-	for (int i = 0; i < 3; i++) { Tcl_DecrRefCount(commandArray[i]); }
+	Tcl_DecrRefCount(commandArray[1]);
+	Tcl_DecrRefCount(commandArray[2]);
       }
       break;
     default:
@@ -1492,6 +2230,7 @@ static int process_requests(Dataserver *dserv) {
     }
   }
 
+  trigger_cmds.clear();
   Tcl_DeleteInterp(interp);
   //  std::cout << "Dataserver process thread ended" << std::endl;
 
@@ -1525,6 +2264,11 @@ void Dataserver::start_tcp_server(void)
        ETIMEDOUT -> close_up. See socket_keepalive.h. */
     dserv_set_keepalive(new_socket_fd);
 
+    if (ingest) {
+      ingest->add(new_socket_fd);
+      continue;
+    }
+
     // Create a thread and transfer the new stream to it.
     std::thread thr(tcp_client_process, this, new_socket_fd);
     thr.detach();
@@ -1537,7 +2281,7 @@ void Dataserver::start_tcp_server(void)
 
 int Dataserver::add_to_notify_queue(ds_datapoint_t *dpoint)
 {
-  ds_datapoint_t *dp = dpoint_copy(dpoint);
+  ds_datapoint_t *dp = dpoint_ref(dpoint);
   notify_queue.push_back(dp);
   return 0;
 }
@@ -1550,25 +2294,28 @@ int Dataserver::move_to_notify_queue(ds_datapoint_t *dpoint)
 
 int Dataserver::process_send_requests(void) {
   int retcode;
-  ds_datapoint_t *dpoint;
+  std::vector<ds_datapoint_t *> batch;
   SendClient *send_client;
     
   /* process until receive a message saying we are done */
   while (!m_bDone) {
-      
-    dpoint = notify_queue.front();
-    notify_queue.pop_front();
 
-    if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
-      continue;
-    }
+    /* one wakeup drains everything queued behind it */
+    batch.clear();
+    notify_queue.pop_all(batch);
+
+    for (auto dpoint : batch) {
+      if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
+	continue;
+      }
     
-    // loop through all send_clients and decide if inactive
-    // or if point matches subscription
-    send_table.forward_dpoint(dpoint);
+      // loop through all send_clients and decide if inactive
+      // or if point matches subscription
+      send_table.forward_dpoint(dpoint);
 
-    /* dpoints need to be freed after forwarding */
-    dpoint_free(dpoint);
+      /* dpoints need to be freed after forwarding */
+      dpoint_free(dpoint);
+    }
   }
 
   // send clients are all closed in the send_table destructor
@@ -1598,12 +2345,14 @@ int Dataserver::add_new_send_client(char *host, int port, uint8_t flags)
   if (send_socket < 0)
     return 0;
 
-  // create a new entry for this client; the thread holds one
-  // shared_ptr, the table another
+  // create a new entry for this client; its fanout worker (or its
+  // own thread) holds one shared_ptr, the table another
   auto send_client = std::make_shared<SendClient>(send_socket, host,
 						  port, flags);
   send_client->key = key;
-  std::thread(&SendClient::send_client_process, send_client).detach();
+  send_client->inactive_count = send_table.inactive_counter();
+  if (!fanout || fanout->add(send_client) < 0)
+    std::thread(&SendClient::send_client_process, send_client).detach();
   send_table.insert(key, send_client);
 
   return 1;
@@ -1627,11 +2376,38 @@ std::string Dataserver::add_new_send_client(SharedQueue<client_request_t> *queue
   // just belt-and-suspenders)
   send_table.remove_and_shutdown(client_name);
 
-  // Create a new entry for this client; the thread holds one
-  // shared_ptr, the table another
+  // Create a new entry for this client; its fanout worker (or its
+  // own thread) holds one shared_ptr, the table another
   auto send_client = std::make_shared<SendClient>(queue);
   send_client->key = client_name;
-  std::thread(&SendClient::send_client_process, send_client).detach();
+  send_client->inactive_count = send_table.inactive_counter();
+  if (!fanout || fanout->add(send_client) < 0)
+    std::thread(&SendClient::send_client_process, send_client).detach();
+  send_table.insert(client_name, send_client);
+
+  return client_name;
+}
+
+/*
+ * add_new_send_client
+ *
+ *  A client whose points go to sink, called on its fanout worker (or
+ * its own thread); see SendClient.
+ */
+std::string Dataserver::add_new_send_client(std::function<void(ds_datapoint_t *)> sink)
+{
+  static std::atomic<int> client_counter{0};
+
+  char client_id[64];
+  snprintf(client_id, sizeof(client_id), "sink_%d",
+	   client_counter.fetch_add(1));
+  std::string client_name = std::string(client_id);
+
+  auto send_client = std::make_shared<SendClient>(std::move(sink));
+  send_client->key = client_name;
+  send_client->inactive_count = send_table.inactive_counter();
+  if (!fanout || fanout->add(send_client) < 0)
+    std::thread(&SendClient::send_client_process, send_client).detach();
   send_table.insert(client_name, send_client);
 
   return client_name;
@@ -1796,7 +2572,7 @@ int Dataserver::open_send_sock(char *host, int port)
 
 int Dataserver::add_to_logger_queue(ds_datapoint_t *dpoint)
 {
-  ds_datapoint_t *dp = dpoint_copy(dpoint);
+  ds_datapoint_t *dp = dpoint_ref(dpoint);
   logger_queue.push_back(dp);
   return 0;
 }
@@ -1809,7 +2585,7 @@ int Dataserver::move_to_logger_queue(ds_datapoint_t *dpoint)
 
 int Dataserver::process_log_requests(void) {
   int retcode;
-  ds_datapoint_t *dpoint;
+  std::vector<ds_datapoint_t *> batch;
   LogClient *log_client;
 
   const uint32_t log_control_flags =
@@ -1819,34 +2595,36 @@ int Dataserver::process_log_requests(void) {
   /* process until receive a message saying we are done */
   while (!m_bDone) {
 
-    dpoint = logger_queue.front();
-    logger_queue.pop_front();
+    batch.clear();
+    logger_queue.pop_all(batch);
 
-    if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
-      continue;
-    }
+    for (auto dpoint : batch) {
+      if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
+	continue;
+      }
 
-    /*
-     * per-client control (pause/start/flush/close) travels through
-     * this queue so it executes in arrival order with the data and on
-     * this thread, the sole owner of all logbuf state
-     */
-    if (dpoint->flags & log_control_flags) {
-      if (dpoint->varname)
-	log_table.control_client(dpoint->varname, dpoint->flags);
-      dpoint_free(dpoint);
-      continue;
-    }
+      /*
+       * per-client control (pause/start/flush/close) travels through
+       * this queue so it executes in arrival order with the data and on
+       * this thread, the sole owner of all logbuf state
+       */
+      if (dpoint->flags & log_control_flags) {
+	if (dpoint->varname)
+	  log_table.control_client(dpoint->varname, dpoint->flags);
+	dpoint_free(dpoint);
+	continue;
+      }
 
-    /*
-     * loop through all logger_clients and forward if subscribed
-     */
-    log_table.forward_dpoint(dpoint);
+      /*
+       * loop through all logger_clients and forward if subscribed
+       */
+      log_table.forward_dpoint(dpoint);
 
-    /* dpoints need to be freed after forwarding */
-    if (!(dpoint->flags & DSERV_DPOINT_DONTFREE_FLAG)) {
-      dpoint_free(dpoint);
-      //	std::cout << "dpoint: " << dpoint->varname << std::endl;
+      /* dpoints need to be freed after forwarding */
+      if (!(dpoint->flags & DSERV_DPOINT_DONTFREE_FLAG)) {
+	dpoint_free(dpoint);
+	//	std::cout << "dpoint: " << dpoint->varname << std::endl;
+      }
     }
   }
 
@@ -1874,7 +2652,8 @@ static int open_log_file(std::string filename, bool overwrite = false)
   return fd;
 } 
   
-int Dataserver::add_new_log_client(std::string filename, bool overwrite)
+int Dataserver::add_new_log_client(std::string filename, bool overwrite,
+				   int version, int compress)
 {
   int newentry;
   std::thread log_thread_id;
@@ -1888,7 +2667,7 @@ int Dataserver::add_new_log_client(std::string filename, bool overwrite)
   fd = open_log_file(filename, overwrite);
   if (fd < 0) return -1;
     
-  log_client = new LogClient(filename, fd);
+  log_client = new LogClient(filename, fd, version, compress);
 
   // give access to log_table so it can remove itself
   log_client->log_table = &log_table;
@@ -1951,38 +2730,14 @@ int Dataserver::start_log_client(std::string filename)
 }
 
 int Dataserver::log_add_match(std::string filename, std::string varname,
-			      int every, int obs, int buflen)
+			      int every, int obs, int buflen, int columnar)
 {
   /* executes under the LogTable lock, which excludes the client's
      writer thread from removing/deleting itself mid-call */
-  return log_table.add_match(filename, varname.c_str(), every, obs, buflen);
-}
-
-
-static int doRead(int fd, char *buf, int size)
-{
-  int rbytes = 0;
-  int n = 0;
-
-  while(rbytes < size) {
-    if((n = read(fd, buf + rbytes, size - rbytes)) < 0) {
-      perror("reading from client socket");
-      return -1;
-    }
-    if (n == 0) {	/* EOF: peer closed mid-frame, would spin forever */
-      return -1;
-    }
-
-    rbytes += n;
-  }
-  return 0;
+  return log_table.add_match(filename, varname.c_str(), every, obs, buflen,
+			     columnar);
 }
 
-static void iovSet(struct iovec *iov, char *buf, int n)
-{
-  iov->iov_base = buf;
-  iov->iov_len = n;
-}
 
 int Dataserver::tcp_process_request(Dataserver *ds,
 				    char buf[], int nbytes, int msgsock,
@@ -2048,11 +2803,16 @@ int Dataserver::tcp_process_request(Dataserver *ds,
 		 buf[1] == 'r' && buf[2] == 'e' &&
 		 buf[3] == 'g' && buf[4] == ' ') {
 	  char host[64];
+	  char policy[32];
 	  int port;
 	  int binary = 0;
 	  
 	  p = &buf[5];
-	  if (sscanf(p, "%63s %d %d", host, &port, &binary) == 3)
+	  if (sscanf(p, "%63s %d %d %31s", host, &port, &binary, policy) == 4)
+	    {
+	      status = ds->tcpip_register(host, port, binary, policy);
+	    }
+	  else if (sscanf(p, "%63s %d %d", host, &port, &binary) == 3)
 	    {
 	      status = ds->tcpip_register(host, port, binary);
 	    }
@@ -2171,18 +2931,18 @@ int Dataserver::tcp_process_request(Dataserver *ds,
 		 buf[3] == 't' && buf[4] == ' ') {
 	  char *var = &buf[5];
 
-	  status = ds->get(var, &dpoint);
+	  DatapointSnapshot snap = ds->get_snapshot(var);
+	  status = (snap != nullptr);
 
 	  if (status) {
-	    dstring_bufsize = dpoint_string_size(dpoint);
+	    ds_datapoint_t *sp = (ds_datapoint_t *) snap.get();
+	    dstring_bufsize = dpoint_string_size(sp);
 	    dstring_buf = (char *) malloc(dstring_bufsize);
 	    dstring_size =
-	      dpoint_to_string(dpoint, dstring_buf, dstring_bufsize);
+	      dpoint_to_string(sp, dstring_buf, dstring_bufsize);
 	    *repbuf = dstring_buf;
 	    *repsize = dstring_size;
 	    *repalloc = 1;
-
-	    dpoint_free(dpoint);
 	  }
 	  else {
 	    *repsize = 0;
@@ -2226,12 +2986,12 @@ int Dataserver::tcp_process_request(Dataserver *ds,
 		 buf[7] == 'e' && buf[8] == ' ') {
 	  char *var = &buf[9];
 
-	  status = ds->get(var, &dpoint);
+	  DatapointSnapshot snap = ds->get_snapshot(var);
+	  status = (snap != nullptr);
 	  
 	  if (status) {
 	    char *rep_buf = (char *) malloc(32);
-	    snprintf(rep_buf, 32, "%u", dpoint->data.len);
-	    dpoint_free(dpoint);
+	    snprintf(rep_buf, 32, "%u", snap->data.len);
 	    status = 1;
 	    *repbuf = rep_buf;
 	    *repsize = strlen(rep_buf);
@@ -2254,9 +3014,14 @@ int Dataserver::tcp_process_request(Dataserver *ds,
 	  /* these should be dynamic */
 	  char host[64];
 	  char match[128];
+	  char policy[32];
 	  int port, every;
 
-	  if (sscanf(p, "%63s %d %127s %d", host, &port, match, &every) == 4) {
+	  if (sscanf(p, "%63s %d %127s %d %31s", host, &port, match, &every,
+		     policy) == 5) {
+	    status = ds->tcpip_add_match(host, port, match, every, policy);
+	  }
+	  else if (sscanf(p, "%63s %d %127s %d", host, &port, match, &every) == 4) {
 	    status = ds->tcpip_add_match(host, port, match, every);
 	  }
 	  else if (sscanf(p, "%63s %d %127s", host, &port, match) == 3) {
@@ -2411,457 +3176,46 @@ int Dataserver::tcp_process_request(Dataserver *ds,
 }
 
   
-/* sanity bounds on client-supplied lengths in the '@' framed protocol:
-   lengths include a trailing \r\n (so >= 2), and the caps keep a
-   malformed/hostile length from driving huge allocations or the
-   out-of-bounds [len - 2] writes in the handlers below */
-/* DSERV_MAX_VARNAME_LEN / DSERV_MAX_DATA_LEN come from Datapoint.h —
-   shared with the websocket transport limits in TclServer.cpp. */
-
+/*
+ * tcp_client_process
+ *
+ *  The thread-per-connection engine (--ingest-threads 0, and anywhere
+ * without epoll).  It shares IngestConn's parser with the epoll
+ * workers: each read() takes as much as the socket has, up to
+ * READ_CHUNK, and every complete message in it is handled before the
+ * next read, so frames a box pipelines cost one syscall per batch
+ * rather than two or more per frame, and go to the table together.
+ */
 void
 Dataserver::tcp_client_process(Dataserver *ds, int sockfd)
 {
-  char buf[4096];
-  double start;
-  int rc;
-  char rcbuf[64];
-  int rcsize;
-  int rval;
-  int repalloc;
-  char *repbuf;
-  int repsize;
-  
-  char newline_buf[2] = "\n";
-  int bytes_to_send = 0;
-
-  // for creating vectored writes
-  struct iovec iovs[3];
-  
-  do
-    {
-      memset(buf, 0, sizeof(buf));
-      rc = -1;
-
-      rval = read(sockfd, buf, 1);
-
-      if (rval != 1)
-	goto close_up;
-
-      if (buf[0] == '%')
-	{
-	  if (rval == 1) {
-	    rval = read(sockfd, &buf[1], sizeof(buf) - 1);
-	    rval += 1;
-	  }
-	  repsize = repalloc = 0;
-	  // will potentially allocate reply buffer 
-	  rc = tcp_process_request(ds, buf, rval, sockfd,
-				   &repbuf, &repsize, &repalloc);
-
-	  snprintf(rcbuf, sizeof(rcbuf), "%d ", rc);
-	  rcsize = strlen(rcbuf);
-	  
-	  iovSet(&iovs[0], rcbuf, rcsize);
-	  iovSet(&iovs[1], repbuf, repsize);
-	  iovSet(&iovs[2], newline_buf, 1);
-	  bytes_to_send = rcsize + repsize + 1;
-	  
-	  rval = writev(sockfd, iovs, 3);
-
-	  // free allocated reply buffer
-	  if (repalloc)
-	    free(repbuf);
-
-	  if (rval < 0)
-	    {
-	      // perror("writing stream message");
-	      goto close_up;
-	    }
-	  else if (rval == 0)
-	    {
-	      // printf("Ending connection\n");
-	      goto close_up;
-	    }
-	  else if (rval < bytes_to_send)
-	    {
-	      // printf("incomplete transfer\n");
-	      goto close_up;
-	    }
-	}
-      else if (buf[0] == '@')
-	{
-	  unsigned int varlen, datalen, inlen, outlen;
-	  int datatype;
-	  ds_datapoint_t *dpoint;
-	  char *varname, *inbuf;
-	  unsigned char *databuf;
-
-	  if (rval == 1)
-	    {
-	      rval = read(sockfd, &buf[1], 31 - 1);
-	      rval += 1;
-	    }
-	  buf[rval] = '\0';
+  const size_t READ_CHUNK = 64*1024;
+  IngestConn conn(sockfd);
 
-	  if (rval > 5 &&
-	      buf[1] == 's' && buf[2] == 'e' &&
-	      buf[3] == 't' && buf[4] == ' ')
-	    {
-	      if (sscanf(&buf[5], "%d %d %d", &varlen,
-			 &datatype, &datalen) != 3)
-		goto close_up;
-
-	      if (varlen < 2 || varlen > DSERV_MAX_VARNAME_LEN ||
-		  datalen > DSERV_MAX_DATA_LEN)
-		goto close_up;
-
-	      // Acknowledge to prevent buffering on sender side
-	      rval = write(sockfd, newline_buf, 1);
-
-	      varname = (char *) malloc(varlen);
-	      if (!varname || doRead(sockfd, varname, varlen) < 0) {
-		free(varname);
-		goto close_up;
-	      }
-	      varname[varlen - 2] = '\0';
-	      
-	      //	      std::cerr << "point name: " << varname << std::endl;
-	      
-	      // Acknowledge and read data
-	      rval = write(sockfd, newline_buf, 1); 
-	  
-	     
-	      if (datatype == DSERV_STRING || datatype == DSERV_SCRIPT || datatype == DSERV_JSON)
-		{
-		  if (datalen < 2) {	/* includes trailing \r\n */
-		    free(varname);
-		    goto close_up;
-		  }
-		  databuf = (unsigned char *) malloc(datalen);
-		  if (!databuf || doRead(sockfd, (char *) databuf, datalen) < 0) {
-		    free(databuf);
-		    free(varname);
-		    goto close_up;
-		  }
-		  databuf[datalen - 2] = '\0';
-		  dpoint = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
-		  dpoint_set(dpoint, varname, now(),
-			     (ds_datatype_t) datatype,
-			     datalen - 2, (unsigned char *) databuf);
-		}
-	      else if (datatype != DSERV_DG)
-		{
-		  inlen = (((4 * datalen / 3) + 3) & ~3) + 2;
-		  inbuf = (char *) malloc(inlen);
-		  if (!inbuf || doRead(sockfd, inbuf, inlen) < 0) {
-		    free(inbuf);
-		    free(varname);
-		    goto close_up;
-		  }
-		  inbuf[inlen - 2] = '\0';
-
-		  databuf = (unsigned char *) malloc(datalen);
-		  if (datalen && !databuf) {
-		    free(inbuf);
-		    free(varname);
-		    goto close_up;
-		  }
-		  outlen = datalen;
-		  base64decode(inbuf, inlen - 2, databuf, &outlen);
-		  free(inbuf);
-
-		  dpoint = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
-		  dpoint_set(dpoint, varname, now(),
-			     (ds_datatype_t) datatype,
-			     datalen, (unsigned char *) databuf);
-		}
-	      else // (DG, MSGPACK, ARROW, JPEG, PPM binary formats)
-		{
-		  inlen = datalen + 2;
-		  inbuf = (char *) malloc(inlen);
-		  if (!inbuf || doRead(sockfd, inbuf, inlen) < 0) {
-		    free(inbuf);
-		    free(varname);
-		    goto close_up;
-		  }
-		  inbuf[inlen - 2] = '\0';
-
-		  outlen = (inlen * 4) / 3 + 1;
-		  databuf = (unsigned char *) malloc(outlen);
-		  if (!databuf) {
-		    free(inbuf);
-		    free(varname);
-		    goto close_up;
-		  }
-		  base64decode(inbuf, inlen - 2, databuf, &outlen);
-		  free(inbuf);
-
-		  dpoint = (ds_datapoint_t *)malloc(sizeof(ds_datapoint_t));
-		  dpoint_set(dpoint, varname, now(),
-			     (ds_datatype_t) datatype,
-			     outlen, (unsigned char *) databuf);
-		}
-
-	      // set new dpoint, memory managed by ds
-	      ds->set(dpoint);
-
-	      rc = 1;
-	      snprintf(rcbuf, sizeof(rcbuf), "%d", rc);
-	      rcsize = strlen(rcbuf);
-
-	      iovSet(&iovs[0], rcbuf, rcsize);
-	      iovSet(&iovs[1], newline_buf, 1);
-	      bytes_to_send = rcsize + 1;
-	      rval = writev(sockfd, iovs, 2);
-	    }
-
-	  else if (rval > 5 &&
-		   buf[1] == 'g' && buf[2] == 'e' &&
-		   buf[3] == 't' && buf[4] == ' ')
-	    {
-
-	      if (sscanf(&buf[5], "%d", &varlen) != 1)
-		goto close_up;
-
-	      if (varlen < 2 || varlen > DSERV_MAX_VARNAME_LEN)
-		goto close_up;
-
-	      // Acknowledge to prevent buffering on sender side
-	      rval = write(sockfd, newline_buf, 1);
-
-	      varname = (char *) malloc(varlen);
-	      if (!varname || doRead(sockfd, varname, varlen) < 0) {
-		free(varname);
-		goto close_up;
-	      }
-	      varname[varlen - 2] = '\0';
-
-	      rc = ds->get(varname, &dpoint);
-	      free(varname);
-	      if (!rc)
-		{
-		  rc = 0;
-		  snprintf(rcbuf, sizeof(rcbuf), "%d", rc);
-		  rcsize = strlen(rcbuf);
-		  iovSet(&iovs[0], rcbuf, rcsize);
-		  iovSet(&iovs[1], newline_buf, 1);
-		  bytes_to_send = rcsize + 1;
-		  rval = writev(sockfd, iovs, 2);
-		}
-	      else
-		{
-		  int dstring_bufsize = dpoint_string_size(dpoint);
-		  char *dstring_buf = (char *) malloc(dstring_bufsize);
-		  int dstring_size = dpoint_to_string(dpoint, dstring_buf,
-						      dstring_bufsize);
-		  snprintf(rcbuf, sizeof(rcbuf), "%d", dstring_size);
-		  rcsize = strlen(rcbuf);
-		  iovSet(&iovs[0], rcbuf, rcsize);
-		  iovSet(&iovs[1], newline_buf, 1);
-		  bytes_to_send = rcsize + 1;
-		  rval = writev(sockfd, iovs, 2);
-		  
-		  // ack from client
-		  if (doRead(sockfd, rcbuf, 1) < 0) {
-		    free(dstring_buf);
-		    dpoint_free(dpoint);
-		    goto close_up;
-		  }
-
-		  iovSet(&iovs[0], dstring_buf, dstring_size);
-		  iovSet(&iovs[1], newline_buf, 1);
-		  bytes_to_send = dstring_size + 1;
-		  rval = writev(sockfd, iovs, 2);
-
-		  free(dstring_buf);
-		  dpoint_free(dpoint);
-		}
-	    }
-
-	  if (rval < 0)
-	    {
-	      // perror("writing stream message");
-	      goto close_up;
-	    }
-	  else if (rval == 0)
-	    {
-	      // printf("Ending connection\n");
-	      goto close_up;
-	    }
-	  else if (rval < bytes_to_send)
-	    {
-	      // printf("incomplete transfer\n");
-	      goto close_up;
-	    }
-	}
-      
-      else if (buf[0] == '<') {
-	ds_datapoint_t *dpoint;
-	uint16_t varlen;
-	char *varname;
-
-	/* next 2 bytes are length of varname */
-	rval = read(sockfd, &varlen, sizeof(uint16_t));
-	if (rval < sizeof(uint16_t)) goto close_up;
-
-	/* next varlen bytes are varname */
-	varname = (char *) malloc(varlen+1);
-	if (varlen) read(sockfd, varname, varlen);
-
-	/* null terminate the varname string */
-	varname[varlen] = '\0';
-
-	/* lookup the varname */
-	int status = ds->get(varname, &dpoint);
-	free(varname);
-
-	if (status) {	  
-	  int point_bufsize = dpoint_binary_size(dpoint);
-	  unsigned char *point_buf = (unsigned char *) malloc(point_bufsize);
-	  int bsize = dpoint_to_binary(dpoint, point_buf, &point_bufsize);
-
-	  /* we return the size of the dpoint (int) and dpoint buffer */
-	  iovs[0].iov_base = &point_bufsize;
-	  iovs[0].iov_len = sizeof(int);
-	  iovs[1].iov_base = point_buf;
-	  iovs[1].iov_len = point_bufsize;
-	  
-	  bytes_to_send = sizeof(uint32_t)+point_bufsize;
-	  
-	  rval = writev(sockfd, iovs, 2);
-
-	  free(point_buf);
-	  
-	  dpoint_free(dpoint);
-	}
-	else {
-	  int point_bufsize = 0;
-	  write(sockfd, &point_bufsize, sizeof(int));
-	}
-      }
-      
-      else if (buf[0] == DPOINT_BINARY_MSG_CHAR)
-	{
-	  uint16_t varlen;
-	  uint32_t datalen;
-	  uint32_t datatype;
-	  uint64_t timestamp;
-		  
-	  ds_datapoint_t *dpoint;
-	  char *varname;
-	  unsigned char *databuf;
-
-	  // The fixed length buffer (including the '>') 
-	  char buffer[128];
-	  char *bufptr = &buffer[0];
-	  
-	  if (doRead(sockfd, buffer, sizeof(buffer)-1) < 0) {
-	    goto close_up;
-	  }
-
-	  varlen = *((uint16_t *) bufptr);
-	  bufptr += sizeof(uint16_t);
-
-	  /* bound the name length to the fixed 128-byte frame before copying out of it:
-	     a malformed/desynced frame must not drive an out-of-bounds read (name <= 100). */
-	  if (varlen > 100) goto close_up;
-
-	  varname = (char *) malloc(varlen+1);
-	  if (!varname) goto close_up;
-
-	  memcpy(varname, bufptr, varlen);
-	  varname[varlen] = '\0';
-	  bufptr += varlen;
-
-	  timestamp = *((uint64_t *) bufptr);
-	  bufptr += sizeof(uint64_t);
-
-	  datatype = *((uint32_t *) bufptr);
-	  bufptr += sizeof(uint32_t);
-
-	  datalen = *((uint32_t *) bufptr);
-	  bufptr += sizeof(uint32_t);
-
-	  /* bound the data length to what remains in the frame (name+data <= 109).
-	     Unsigned compare: a huge datalen must not slip through or wrap. */
-	  if (datalen > 109 || (uint32_t) varlen + datalen > 109) {
-	    free(varname);
-	    goto close_up;
-	  }
-
-	  databuf = (unsigned char *) malloc(datalen);
-	  if (!databuf) {
-	    free(varname);
-	    goto close_up;
-	  }
-
-	  memcpy(databuf, bufptr, datalen);
-
-	  dpoint = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
-	  dpoint_set(dpoint, varname, timestamp ? timestamp : now(),
-		     (ds_datatype_t) datatype,
-		     datalen, (unsigned char *) databuf);
-	  // set new dpoint, memory managed by ds
-	  ds->set(dpoint);
-	}
-
-      else if (buf[0] == DPOINT_BINARY_VAR_MSG_CHAR)
-	{
-	  // Variable-length binary datapoint push: fixed 18-byte header, then
-	  // the varname and data read by length via doRead. Same fire-and-forget
-	  // model as '>' (no reply) but with no size cap on the payload.
-	  unsigned char header[DPOINT_BINARY_VAR_HEADER_LEN];
-	  uint16_t varlen;
-	  uint32_t datatype;
-	  uint32_t datalen;
-	  uint64_t timestamp;
-	  ds_datapoint_t *dpoint;
-	  char *varname;
-	  unsigned char *databuf;
-
-	  if (doRead(sockfd, (char *) header, sizeof(header)) < 0)
-	    goto close_up;
-
-	  // memcpy out of the byte buffer (fields are not naturally aligned)
-	  memcpy(&varlen,    header + 0,  sizeof(uint16_t));
-	  memcpy(&datatype,  header + 2,  sizeof(uint32_t));
-	  memcpy(&datalen,   header + 6,  sizeof(uint32_t));
-	  memcpy(&timestamp, header + 10, sizeof(uint64_t));
-
-	  if (varlen < 1 || varlen > DSERV_MAX_VARNAME_LEN ||
-	      datalen > DSERV_MAX_DATA_LEN)
-	    goto close_up;
-
-	  varname = (char *) malloc(varlen + 1);
-	  if (!varname || doRead(sockfd, varname, varlen) < 0) {
-	    free(varname);
-	    goto close_up;
-	  }
-	  varname[varlen] = '\0';
-
-	  databuf = (unsigned char *) malloc(datalen ? datalen : 1);
-	  if (!databuf || doRead(sockfd, (char *) databuf, datalen) < 0) {
-	    free(databuf);
-	    free(varname);
-	    goto close_up;
-	  }
-
-	  dpoint = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
-	  dpoint_set(dpoint, varname, timestamp ? timestamp : now(),
-		     (ds_datatype_t) datatype,
-		     datalen, (unsigned char *) databuf);
-	  // set new dpoint, memory managed by ds
-	  ds->set(dpoint);
-	}
-
-      else
-	{
-	  // process other TCP/IP commands here
-	}
-    } while (rval > 0);
+  while (1) {
+    size_t have = conn.in.size();
+    conn.in.resize(have + READ_CHUNK);
+    ssize_t n = read(sockfd, &conn.in[have], READ_CHUNK);
+    conn.in.resize(have + (n > 0 ? n : 0));
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+
+    if (conn.parse(ds, (size_t) n < READ_CHUNK) < 0) break;
+
+    /* replies, in full; the client reads them before it sends more */
+    size_t sent = 0;
+    while (sent < conn.out.size()) {
+      ssize_t w = write(sockfd, conn.out.data() + sent,
+			conn.out.size() - sent);
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) goto close_up;
+      sent += w;
+    }
+    conn.out.clear();
+  }
 
  close_up:
   close(sockfd);
-  //  printf("closing up\n");
-
 }
+
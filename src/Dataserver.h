@@ -34,6 +34,16 @@ include <io.h>
 
 class Dataserver;		// defined below
 
+#ifdef __linux__
+#define DSERV_INGEST_THREADS 1
+#define DSERV_FANOUT_THREADS 1
+#define DSERV_SHM_INGEST 1
+#else
+#define DSERV_INGEST_THREADS 0
+#define DSERV_FANOUT_THREADS 0
+#define DSERV_SHM_INGEST 0
+#endif
+
 #include "Base64.h"
 #include "Datapoint.h"
 #include "DatapointTable.h"
@@ -41,10 +51,14 @@ class Dataserver;		// defined below
 #include "LogMatchDict.h"
 #include "TriggerDict.h"
 #include "ClientRequest.h"
+#include "mpscring.h"
 #include "SendClient.h"
 #include "SendTable.h"
 #include "LogTable.h"
 #include "LogClient.h"
+#include "IngestServer.h"
+#include "FanoutServer.h"
+#include "ShmIngestServer.h"
 
 #include <tcl.h>
 
@@ -58,7 +72,7 @@ class Dataserver
   int socket_fd;
 
   std::thread process_thread;	// main process loop
-  std::thread net_thread;	// tcpip communication
+  std::thread net_thread;	// tcpip communication (accept loop)
   std::thread send_thread;	// client subscriptions
   std::thread logger_thread;	// log to file
 
@@ -69,14 +83,28 @@ class Dataserver
   SendTable send_table;
   LogTable log_table;
 
+  // producer connections on tcpport, or NULL for a thread apiece
+  IngestServer *ingest = nullptr;
+
+  // send client writers, or NULL for a thread apiece
+  FanoutServer *fanout = nullptr;
+
+  // shared memory rings for producers on this host, or NULL
+  ShmIngestServer *shm = nullptr;
+
   // point queue for notifications
-  SharedQueue<ds_datapoint_t *> notify_queue;
+  MPSCRing<ds_datapoint_t *> notify_queue;
 
   // point queue for loggers
-  SharedQueue<ds_datapoint_t *> logger_queue;
+  MPSCRing<ds_datapoint_t *> logger_queue;
 
 public:
   SendTable& get_send_table() { return send_table; }
+  IngestServer *get_ingest(void) { return ingest; }
+  FanoutServer *get_fanout(void) { return fanout; }
+  ShmIngestServer *get_shm(void) { return shm; }
+  MPSCRing<ds_datapoint_t *> &get_notify_queue(void) { return notify_queue; }
+  MPSCRing<ds_datapoint_t *> &get_logger_queue(void) { return logger_queue; }
 
   int argc;
   char **argv;
@@ -99,7 +127,16 @@ public:
 				 char **repbuf, int *repsize, int *repalloc);
     
   
-  Dataserver(int argc, char **argv, int port=4620);
+  /* ingest_threads: epoll workers serving tcpport (IngestServer.h);
+     0 gives each connection its own thread (tcp_client_process).
+     fanout_threads: workers writing to send clients (FanoutServer.h);
+     0 gives each client its own thread (send_client_process).
+     shm_ingest: offer same-host producers shared memory rings
+     (ShmIngestServer.h) */
+  Dataserver(int argc, char **argv, int port=4620,
+	     int ingest_threads=DSERV_INGEST_THREADS,
+	     int fanout_threads=DSERV_FANOUT_THREADS,
+	     int shm_ingest=DSERV_SHM_INGEST);
   ~Dataserver();
 
   static int64_t now(void);
@@ -121,15 +158,18 @@ public:
   int delete_datapoint(char *varname);
   ds_datapoint_t *new_trigger_point(ds_datapoint_t *dpoint);
   void trigger(ds_datapoint_t *dpoint);
-  ds_datapoint_t *process(ds_datapoint_t *dpoint);
+  void process(ds_datapoint_t *dpoint);
+  void publish_processed(void);
   void set(ds_datapoint_t &dpoint);
   void set(ds_datapoint_t *dpoint);
   void set(char *varname, char *value);
+  void set_batch(std::vector<ds_datapoint_t *> &dpoints);
   int copy(char *from_varname, char *to_varname);
   
   void update(ds_datapoint_t *dpoint);
   int touch(char *varname);
   int get(char *varname, ds_datapoint_t **dpoint);
+  DatapointSnapshot get_snapshot(char *varname);
   int exists(char *varname);
   int clear(char *varname);
   void clear(void);
@@ -139,11 +179,16 @@ public:
   void add_trigger(char *match, int every, char *script) ;
   void remove_trigger(char *match);
   void remove_all_triggers(void);
-  int tcpip_register(char *host, int port, int flags);
+  /* policy, where given, is a SendPolicy string (all[:N], latest, rate:N) */
+  int tcpip_register(char *host, int port, int flags,
+		     const char *policy = nullptr);
   int tcpip_unregister(char *host, int port);
-  int tcpip_add_match(char *host, int port, char *match, int every);
+  int tcpip_add_match(char *host, int port, char *match, int every,
+		      const char *policy = nullptr);
   int tcpip_remove_match(char *host, int port, char *match);
-  int client_add_match(std::string key, char *match, int every=1);
+  int client_add_match(std::string key, char *match, int every=1,
+		       const char *policy = nullptr);
+  int client_set_policy(std::string key, const char *policy);
   int client_add_exact_match(std::string key, char *match, int every=1);
   int client_remove_match(std::string key, char *match);
   int client_remove_all_matches(std::string key);
@@ -151,12 +196,15 @@ public:
   bool client_covers(std::string key, char *varname);
   std::string get_matches(char *host, int port);
   std::string get_logger_clients(void);
-  int logger_client_open(std::string filename, bool overwrite);
+  int logger_client_open(std::string filename, bool overwrite,
+			 int version = 3, int compress = 0);
   int logger_client_close(std::string filename);
   int logger_client_pause(std::string filename);
   int logger_client_start(std::string filename);
+  int logger_client_buffering(std::string filename, int stage_size,
+			      int flush_ms, log_client_io_t *info);
   int logger_add_match(char *path, char *match,
-		       int every, int obs, int bufsize);
+		       int every, int obs, int bufsize, int columnar = 0);
   void shutdown(void);
   void shutdown_message(SharedQueue<client_request_t> *q);
 
@@ -173,6 +221,7 @@ public:
   std::string send_client_id(void);
   int remove_send_client_by_id(std::string client_id);  
   std::string add_new_send_client(SharedQueue<client_request_t> *queue);
+  std::string add_new_send_client(std::function<void(ds_datapoint_t *)> sink);
   int remove_send_client(char *host, int port);
   int open_send_sock(char *host, int port);
 
@@ -180,12 +229,13 @@ public:
   int move_to_logger_queue(ds_datapoint_t *dpoint);
   int process_log_requests(void);
   int queue_log_control(std::string filename, uint32_t flag);
-  int add_new_log_client(std::string filename, bool overwrite = false);
+  int add_new_log_client(std::string filename, bool overwrite = false,
+			 int version = 3, int compress = 0);
   int remove_log_client(std::string filename);
   int pause_log_client(std::string filename);
   int start_log_client(std::string filename);
   int log_add_match(std::string filename, std::string varname,
-		    int every, int obs, int buflen);
+		    int every, int obs, int buflen, int columnar = 0);
 };
 
 #endif  // DATASERVER_H
@@ -0,0 +1,224 @@
+/*
+ * FanoutServer.cpp - event driven delivery to send clients
+ *
+ *  A worker sleeps in epoll_wait until one of its clients is pushed a
+ * point (an eventfd, written once per empty -> non-empty ready list),
+ * a socket it is waiting on drains, or a timer it set comes due, then
+ * gives each such client a turn at SendClient::pump().  The client
+ * says what it wants next and the worker arranges it; between turns a
+ * client costs its queue and its stage, not a thread stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+#include "SendClient.h"
+#include "FanoutServer.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+FanoutServer::FanoutServer(int nthreads)
+{
+  if (nthreads < 1) nthreads = 1;
+  for (int i = 0; i < nthreads; i++) {
+    Worker *w = new Worker;
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    w->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->epfd < 0 || w->evfd < 0) {
+      perror("fanout: epoll/eventfd");
+      if (w->epfd >= 0) close(w->epfd);
+      if (w->evfd >= 0) close(w->evfd);
+      delete w;
+      continue;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;	/* the eventfd; clients have their pointer */
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev);
+    workers.push_back(w);
+
+    /* like the ingest workers, these run for the life of the process */
+    std::thread thr(&FanoutServer::worker, this, w);
+    thr.detach();
+  }
+}
+
+int FanoutServer::add(std::shared_ptr<SendClient> client)
+{
+  if (workers.empty()) return -1;
+
+  int i = next++ % workers.size();
+  Worker *w = workers[i];
+
+  /*
+   * Edge triggered EPOLLOUT: the worker hears about a socket only when
+   * it drains after a write that filled it, which is the one time it
+   * is waiting on one.
+   */
+  if (client->type == SendClient::SOCKET_CLIENT) {
+    fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.ptr = client.get();
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, client->fd, &ev) < 0) {
+      perror("fanout: epoll_ctl");
+      fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) & ~O_NONBLOCK);
+      return -1;
+    }
+  }
+
+  client->fanout = this;
+  client->worker = i;
+
+  std::lock_guard<std::mutex> lock(w->mutex);
+  w->added.push_back(client);
+  clients++;
+  return 0;
+}
+
+void FanoutServer::schedule(SendClient *client)
+{
+  Worker *w = workers[client->worker];
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    wake = w->ready.empty();
+    w->ready.push_back(client);
+  }
+  if (wake) {
+    uint64_t one = 1;
+    if (write(w->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      perror("fanout: eventfd");
+  }
+}
+
+void FanoutServer::worker(Worker *w)
+{
+  using clock = std::chrono::steady_clock;
+  const int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+
+  /*
+   * The worker's own bookkeeping, touched by nobody else.  clients
+   * holds the reference that keeps a client alive until its shutdown
+   * has been handled; everything else names clients by pointer and is
+   * checked against it, so a stale entry (a push racing the shutdown)
+   * is simply ignored.
+   */
+  std::unordered_map<SendClient *, std::shared_ptr<SendClient>> clients;
+  std::unordered_map<SendClient *, clock::time_point> timers;
+  std::vector<SendClient *> ready, again;
+  std::vector<std::shared_ptr<SendClient>> added;
+
+  while (1) {
+    int timeout = -1;
+    if (!again.empty()) timeout = 0;
+    else if (!timers.empty()) {
+      auto first = std::min_element(timers.begin(), timers.end(),
+				    [](auto &a, auto &b) {
+				      return a.second < b.second; })->second;
+      auto wait = first - clock::now();
+      timeout = wait <= clock::duration::zero() ? 0 :
+	(int) std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+    }
+
+    int nev = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+    if (nev < 0) {
+      if (errno == EINTR) continue;
+      perror("fanout: epoll_wait");
+      return;
+    }
+    wakeups++;
+
+    ready.clear();
+    added.clear();
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      ready.swap(w->ready);
+      added.swap(w->added);
+    }
+    for (auto &client : added) clients[client.get()] = client;
+
+    for (int i = 0; i < nev; i++) {
+      if (!events[i].data.ptr) {
+	uint64_t count;
+	if (read(w->evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	  perror("fanout: eventfd");
+      }
+      else ready.push_back((SendClient *) events[i].data.ptr);
+    }
+
+    ready.insert(ready.end(), again.begin(), again.end());
+    again.clear();
+
+    auto now = clock::now();
+    for (auto it = timers.begin(); it != timers.end(); ) {
+      if (it->second <= now) {
+	ready.push_back(it->first);
+	it = timers.erase(it);
+      }
+      else ++it;
+    }
+
+    for (auto client : ready) {
+      auto it = clients.find(client);
+      if (it == clients.end()) continue;
+
+      /* pushes from here on schedule it again */
+      client->scheduled.exchange(false);
+      timers.erase(client);
+
+      clock::time_point due;
+      switch (client->pump(&due)) {
+      case SendClient::PUMP_IDLE:
+	break;
+      case SendClient::PUMP_IDLE_UNTIL:
+	/* idle, but for held RATE values: a push or *due, whichever first */
+	timers[client] = due;
+	break;
+      case SendClient::PUMP_AGAIN:
+	client->scheduled = true;
+	again.push_back(client);
+	break;
+      case SendClient::PUMP_WRITABLE:
+      case SendClient::PUMP_TIMER:
+	/* it has work it can't do yet: pushes needn't wake us for it */
+	client->scheduled = true;
+	timers[client] = due;
+	break;
+      case SendClient::PUMP_DONE:
+	if (client->type == SendClient::SOCKET_CLIENT)
+	  epoll_ctl(w->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+	clients.erase(it);
+	this->clients--;
+	break;
+      }
+    }
+  }
+}
+
+#else
+
+FanoutServer::FanoutServer(int nthreads) {}
+
+int FanoutServer::add(std::shared_ptr<SendClient> client)
+{
+  return -1;
+}
+
+void FanoutServer::schedule(SendClient *client) {}
+
+void FanoutServer::worker(Worker *w) {}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef FANOUTSERVER_H
+#define FANOUTSERVER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class SendClient;
+
+/*
+ * FanoutServer
+ *
+ *  Event driven replacement for a thread per send client: a few worker
+ * threads, each with its own epoll set, share every subscriber.  A
+ * client is handed to a worker round robin when it registers
+ * (Dataserver::add_new_send_client) and from then on only that worker
+ * drains its dpoint_queue -- SendClient::pump() -- so a point notified
+ * to twenty subscribers is one wakeup of a worker rather than twenty
+ * thread wakeups.
+ *
+ *  Socket clients are switched to non-blocking writes: what a socket
+ * won't take stays staged until epoll says it has drained, and the
+ * points behind it wait in the client's queue, bounded by its
+ * SendPolicy exactly as they were behind a blocked write.  A slow
+ * consumer is never reaped for being slow (see SendClient::flush_stage),
+ * only for a hard error or 30 s without taking a byte.  Queue clients
+ * (TclServers) are relayed to their client_queue; sink clients
+ * (websockets) have their sink called right here, on the worker.
+ *
+ *  Linux only -- elsewhere each client keeps its own thread.
+ */
+class FanoutServer {
+  struct Worker {
+    int epfd = -1;
+    int evfd = -1;		/* ready list went non-empty */
+    std::mutex mutex;
+    std::vector<SendClient *> ready;	/* pushed to, see schedule() */
+    std::vector<std::shared_ptr<SendClient>> added;	/* not yet taken */
+  };
+  std::vector<Worker *> workers;
+  std::atomic<unsigned int> next{0};
+
+  void worker(Worker *w);
+
+ public:
+  /* totals, for dservFanoutInfo */
+  std::atomic<uint64_t> clients{0};	/* served now */
+  std::atomic<uint64_t> wakeups{0};	/* worker passes */
+
+  FanoutServer(int nthreads);
+
+  int nthreads(void) { return (int) workers.size(); }
+
+  /* serve client from a worker; -1 if it needs a thread after all */
+  int add(std::shared_ptr<SendClient> client);
+
+  /* client has points waiting (SendClient::push) */
+  void schedule(SendClient *client);
+};
+
+#endif
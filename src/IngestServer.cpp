@@ -0,0 +1,681 @@
+/*
+ * IngestServer.cpp - event driven ingest on the dataserver port
+ *
+ *  A worker reads whatever a socket has ready into that connection's
+ * buffer and IngestConn::parse() peels off every complete message in
+ * it, so a box pipelining '>' frames costs one read() per batch, and
+ * 100 idle producers cost 100 buffers instead of 100 thread stacks.
+ * Dataserver::tcp_client_process runs the same parser from a thread
+ * per connection, blocking in read() instead.
+ *
+ *  Nothing on a worker may block, since every connection it serves
+ * would wait too: a '%reg', which looks up and connects to the client
+ * being registered (a second or more for one that doesn't answer), is
+ * run on a thread of its own and its reply handed back (defer_text).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <mutex>
+
+#include "Dataserver.h"
+#include "IngestServer.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+/*
+ * one epoll worker: its epoll set, and the '%reg' replies coming back
+ * to it from the threads they ran on, with wake (in the epoll set too)
+ * to say there are some
+ */
+struct IngestWorker {
+  struct text_reply_t {
+    IngestConn *conn;
+    int rc;
+    std::string reply;
+  };
+
+  int epfd = -1;
+  int wake = -1;
+  std::mutex mutex;
+  std::vector<text_reply_t> replies;
+
+  /* closed during this epoll_wait batch: a later entry in it may still
+     name them, so they are deleted once the batch is done */
+  std::vector<IngestConn *> closed;
+};
+
+static void defer_text(Dataserver *ds, IngestConn *conn,
+		       const char *line, size_t len);
+
+/* the thread engine's limits on a '%' line and an '@' header */
+static const size_t TEXT_MAX = 4095;
+static const size_t AT_HEADER_MAX = 31;
+
+/* socket reads; a connection's buffer grows past this only to hold one
+   big '@set' or '}' message */
+static const size_t READ_CHUNK = 64*1024;
+
+/* stop reading from a client that isn't reading its replies */
+static const size_t OUT_MAX = 1024*1024;
+
+/*
+ * length of the line at p (through its newline), or of what there is
+ * of it when it can't get any longer; 0 if more may be coming
+ */
+static size_t line_length(const char *p, size_t n, size_t max, bool drained)
+{
+  size_t limit = n < max ? n : max;
+  const char *nl = (const char *) memchr(p, '\n', limit);
+  if (nl) return nl - p + 1;
+  if (n >= max) return max;
+  return drained ? n : 0;
+}
+
+IngestConn::~IngestConn()
+{
+  for (auto dpoint : batch) dpoint_free(dpoint);
+}
+
+/* hand the pending binary pushes to the dataserver, in arrival order */
+void IngestConn::publish(Dataserver *ds)
+{
+  ds->set_batch(batch);
+}
+
+int IngestConn::parse(Dataserver *ds, bool drained)
+{
+  int handled = 0;
+  int rc;
+
+  while (pos < in.size()) {
+    char *p = &in[pos];
+    size_t n = in.size() - pos;
+
+    if (state != READY) rc = parse_at_state(ds, p, n);
+    else {
+      /* everything else may read what the pushes ahead of it set */
+      if (!batch.empty() && p[0] != DPOINT_BINARY_MSG_CHAR &&
+	  p[0] != DPOINT_BINARY_VAR_MSG_CHAR)
+	publish(ds);
+
+      switch (p[0]) {
+      case '%':
+	rc = parse_text(ds, p, n, drained);
+	break;
+      case '@':
+	rc = parse_at(ds, p, n, drained);
+	break;
+      case '<':
+	rc = parse_get_binary(ds, p, n);
+	break;
+      case DPOINT_BINARY_MSG_CHAR:
+	rc = parse_fixed(ds, p, n);
+	break;
+      case DPOINT_BINARY_VAR_MSG_CHAR:
+	rc = parse_var(ds, p, n);
+	break;
+      default:
+	rc = 1;			/* not a message start: skip it */
+	break;
+      }
+    }
+    if (rc < 0) {
+      publish(ds);		/* what arrived intact still counts */
+      return -1;
+    }
+    if (rc == 0) break;		/* rest of the message isn't here yet */
+    pos += rc;
+    if (state == READY) handled++;
+  }
+  publish(ds);
+
+  /* drop what's been parsed once it's most of the buffer */
+  if (pos == in.size()) {
+    in.clear();
+    pos = 0;
+  }
+  else if (pos > in.size() / 2) {
+    in.erase(0, pos);
+    pos = 0;
+  }
+  return handled;
+}
+
+/* %command ... \n  ->  "rc reply\n" */
+int IngestConn::parse_text(Dataserver *ds, const char *p, size_t n,
+			   bool drained)
+{
+  size_t len = line_length(p, n, TEXT_MAX, drained);
+  if (!len) return 0;
+
+  /* tcp_process_request edits and strcmp's its buffer */
+  char buf[TEXT_MAX + 1];
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+
+  /* connecting to the new client can take a while: not on a worker */
+  if (worker && len > 5 && !strncmp(buf, "%reg ", 5)) {
+    state = TEXT_WAIT;
+    defer_text(ds, this, buf, len);
+    return len;
+  }
+
+  char *repbuf = NULL;
+  int repsize = 0, repalloc = 0;
+  int rc = Dataserver::tcp_process_request(ds, buf, len, fd,
+					   &repbuf, &repsize, &repalloc);
+  text_done(rc, std::string(repbuf ? repbuf : "", repsize));
+  if (repalloc) free(repbuf);
+  return len;
+}
+
+/* a '%' command's reply, "rc reply\n" */
+void IngestConn::text_done(int rc, const std::string &reply)
+{
+  out += std::to_string(rc);
+  out += ' ';
+  out += reply;
+  out += '\n';
+  state = READY;
+}
+
+/* @set varlen datatype datalen / @get varlen: start the handshake */
+int IngestConn::parse_at(Dataserver *ds, const char *p, size_t n,
+			 bool drained)
+{
+  size_t len = line_length(p, n, AT_HEADER_MAX, drained);
+  if (!len) return 0;
+
+  char buf[AT_HEADER_MAX + 1];
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+
+  /* sanity bounds on client-supplied lengths: they include a trailing
+     \r\n (so >= 2), and the caps keep a malformed/hostile length from
+     driving huge allocations or the out-of-bounds [len - 2] writes
+     below.  DSERV_MAX_VARNAME_LEN / DSERV_MAX_DATA_LEN come from
+     Datapoint.h -- shared with the websocket transport limits in
+     TclServer.cpp. */
+  if (len > 5 && !strncmp(buf, "@set ", 5)) {
+    if (sscanf(&buf[5], "%d %d %d", &varlen, &datatype, &datalen) != 3)
+      return -1;
+    if (varlen < 2 || varlen > DSERV_MAX_VARNAME_LEN ||
+	datalen > DSERV_MAX_DATA_LEN)
+      return -1;
+
+    if (datatype == DSERV_STRING || datatype == DSERV_SCRIPT ||
+	datatype == DSERV_JSON) {
+      if (datalen < 2) return -1;	/* includes trailing \r\n */
+      inlen = datalen;
+    }
+    else if (datatype != DSERV_DG)
+      inlen = (((4 * datalen / 3) + 3) & ~3) + 2;
+    else
+      inlen = datalen + 2;
+
+    state = AT_SET_NAME;
+    out += '\n';		/* ack: send the name */
+  }
+  else if (len > 5 && !strncmp(buf, "@get ", 5)) {
+    if (sscanf(&buf[5], "%d", &varlen) != 1) return -1;
+    if (varlen < 2 || varlen > DSERV_MAX_VARNAME_LEN) return -1;
+    state = AT_GET_NAME;
+    out += '\n';
+  }
+  return len;
+}
+
+/* the rest of an '@' handshake, one step per call */
+int IngestConn::parse_at_state(Dataserver *ds, const char *p, size_t n)
+{
+  switch (state) {
+  case AT_SET_NAME:
+  case AT_GET_NAME:
+    if (n < varlen) return 0;
+    varname.assign(p, varlen - 2);	/* less the \r\n */
+    if (state == AT_GET_NAME) break;
+    state = AT_SET_DATA;
+    out += '\n';		/* ack: send the data */
+    return varlen;
+
+  case AT_SET_DATA:
+    {
+      if (n < inlen) return 0;
+
+      unsigned char *databuf;
+      unsigned int outlen;
+
+      if (datatype == DSERV_STRING || datatype == DSERV_SCRIPT ||
+	  datatype == DSERV_JSON) {
+	if (!(databuf = (unsigned char *) malloc(datalen))) return -1;
+	memcpy(databuf, p, datalen - 2);
+	databuf[datalen - 2] = '\0';
+	outlen = datalen - 2;
+      }
+      else {
+	/* the thread engine sizes a DG's buffer from its base64 */
+	outlen = datatype != DSERV_DG ? datalen : (inlen * 4) / 3 + 1;
+	if (!(databuf = (unsigned char *) malloc(outlen ? outlen : 1)))
+	  return -1;
+	base64decode((char *) p, inlen - 2, databuf, &outlen);
+      }
+
+      ds_datapoint_t *dpoint =
+	(ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
+      dpoint_set(dpoint, strdup(varname.c_str()), Dataserver::now(),
+		 (ds_datatype_t) datatype, outlen, databuf);
+      ds->set(dpoint);
+
+      state = READY;
+      out += "1\n";
+      return inlen;
+    }
+
+  case TEXT_WAIT:
+    return 0;			/* nothing more until its reply is in */
+
+  case AT_GET_ACK:
+    state = READY;
+    out += reply;
+    out += '\n';
+    reply.clear();
+    return 1;
+
+  default:
+    return -1;
+  }
+
+  /* AT_GET_NAME: reply with the size and hold the point for the ack */
+  DatapointSnapshot snap = ds->get_snapshot((char *) varname.c_str());
+  if (!snap) {
+    state = READY;
+    out += "0\n";
+  }
+  else {
+    ds_datapoint_t *sp = (ds_datapoint_t *) snap.get();
+    reply.resize(dpoint_string_size(sp));
+    reply.resize(dpoint_to_string(sp, &reply[0], reply.size()));
+    out += std::to_string(reply.size());
+    out += '\n';
+    state = AT_GET_ACK;
+  }
+  return varlen;
+}
+
+/* < varlen(u16) varname  ->  size(int) binary dpoint */
+int IngestConn::parse_get_binary(Dataserver *ds, const char *p, size_t n)
+{
+  uint16_t len;
+  if (n < 1 + sizeof(len)) return 0;
+  memcpy(&len, p + 1, sizeof(len));
+  if (n < 1 + sizeof(len) + len) return 0;
+
+  std::string name(p + 1 + sizeof(len), len);
+  DatapointSnapshot snap = ds->get_snapshot((char *) name.c_str());
+
+  int point_bufsize = 0;
+  if (snap) {
+    ds_datapoint_t *sp = (ds_datapoint_t *) snap.get();
+    point_bufsize = dpoint_binary_size(sp);
+    size_t at = out.size();
+    out.resize(at + sizeof(int) + point_bufsize);
+    dpoint_to_binary(sp, (unsigned char *) &out[at + sizeof(int)],
+		     &point_bufsize);
+    memcpy(&out[at], &point_bufsize, sizeof(int));
+    out.resize(at + sizeof(int) + point_bufsize);
+  }
+  else out.append((const char *) &point_bufsize, sizeof(int));
+
+  return 1 + sizeof(len) + len;
+}
+
+/* > fixed 128 byte frame (see SendClient::send_dpoint) */
+int IngestConn::parse_fixed(Dataserver *ds, const char *p, size_t n)
+{
+  if (n < DPOINT_BINARY_FIXED_LENGTH) return 0;
+
+  const char *bufptr = p + 1;
+  uint16_t len;
+  uint64_t timestamp;
+  uint32_t type, dlen;
+
+  memcpy(&len, bufptr, sizeof(len));
+  bufptr += sizeof(len);
+
+  /* name and data have to fit the frame */
+  if (len > 100) return -1;
+  const char *name = bufptr;
+  bufptr += len;
+
+  memcpy(&timestamp, bufptr, sizeof(timestamp));
+  bufptr += sizeof(timestamp);
+  memcpy(&type, bufptr, sizeof(type));
+  bufptr += sizeof(type);
+  memcpy(&dlen, bufptr, sizeof(dlen));
+  bufptr += sizeof(dlen);
+
+  if (dlen > 109 || (uint32_t) len + dlen > 109) return -1;
+
+  char *varname = (char *) malloc(len + 1);
+  unsigned char *databuf = (unsigned char *) malloc(dlen ? dlen : 1);
+  if (!varname || !databuf) {
+    free(varname);
+    free(databuf);
+    return -1;
+  }
+  memcpy(varname, name, len);
+  varname[len] = '\0';
+  memcpy(databuf, bufptr, dlen);
+
+  ds_datapoint_t *dpoint = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
+  dpoint_set(dpoint, varname, timestamp ? timestamp : Dataserver::now(),
+	     (ds_datatype_t) type, dlen, databuf);
+  batch.push_back(dpoint);
+
+  return DPOINT_BINARY_FIXED_LENGTH;
+}
+
+/* } varlen(u16) type(u32) datalen(u32) timestamp(u64) varname data */
+int IngestConn::parse_var(Dataserver *ds, const char *p, size_t n)
+{
+  if (n < 1 + DPOINT_BINARY_VAR_HEADER_LEN) return 0;
+
+  const char *header = p + 1;
+  uint16_t len;
+  uint32_t type, dlen;
+  uint64_t timestamp;
+
+  memcpy(&len,       header + 0,  sizeof(uint16_t));
+  memcpy(&type,      header + 2,  sizeof(uint32_t));
+  memcpy(&dlen,      header + 6,  sizeof(uint32_t));
+  memcpy(&timestamp, header + 10, sizeof(uint64_t));
+
+  if (len < 1 || len > DSERV_MAX_VARNAME_LEN || dlen > DSERV_MAX_DATA_LEN)
+    return -1;
+
+  size_t total = 1 + DPOINT_BINARY_VAR_HEADER_LEN + len + dlen;
+  if (n < total) {
+    in.reserve(pos + total);	/* one allocation for a big payload */
+    return 0;
+  }
+
+  const char *name = header + DPOINT_BINARY_VAR_HEADER_LEN;
+  char *varname = (char *) malloc(len + 1);
+  unsigned char *databuf = (unsigned char *) malloc(dlen ? dlen : 1);
+  if (!varname || !databuf) {
+    free(varname);
+    free(databuf);
+    return -1;
+  }
+  memcpy(varname, name, len);
+  varname[len] = '\0';
+  memcpy(databuf, name + len, dlen);
+
+  ds_datapoint_t *dpoint = (ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
+  dpoint_set(dpoint, varname, timestamp ? timestamp : Dataserver::now(),
+	     (ds_datatype_t) type, dlen, databuf);
+  batch.push_back(dpoint);
+
+  return total;
+}
+
+
+#ifdef __linux__
+
+/* run conn's '%reg' line on a thread of its own, its reply to the worker */
+static void defer_text(Dataserver *ds, IngestConn *conn,
+		       const char *line, size_t len)
+{
+  int fd = conn->fd;
+  std::string text(line, len);
+
+  std::thread([ds, conn, fd, text]() mutable {
+    char *repbuf = NULL;
+    int repsize = 0, repalloc = 0;
+    int rc = Dataserver::tcp_process_request(ds, &text[0], text.size(), fd,
+					     &repbuf, &repsize, &repalloc);
+
+    IngestWorker *w = conn->worker;
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->replies.push_back({ conn, rc,
+	  std::string(repbuf ? repbuf : "", repsize) });
+    }
+    if (repalloc) free(repbuf);
+    uint64_t one = 1;
+    if (write(w->wake, &one, sizeof(one)) < 0) perror("ingest: wake");
+  }).detach();
+}
+
+IngestServer::IngestServer(Dataserver *ds, int nthreads): ds(ds)
+{
+  if (nthreads < 1) nthreads = 1;
+  for (int i = 0; i < nthreads; i++) {
+    IngestWorker *w = new IngestWorker;
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epfd < 0) {
+      perror("ingest: epoll_create1");
+      delete w;
+      continue;
+    }
+    w->wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = w;
+    if (w->wake < 0 || epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wake, &ev) < 0) {
+      perror("ingest: eventfd");
+      if (w->wake >= 0) close(w->wake);
+      close(w->epfd);
+      delete w;
+      continue;
+    }
+    workers.push_back(w);
+
+    /* like the per-connection threads, these run for the life of the
+       process */
+    std::thread thr(&IngestServer::worker, this, w);
+    thr.detach();
+  }
+}
+
+int IngestServer::add(int fd)
+{
+  if (workers.empty()) {
+    close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  IngestConn *conn = new IngestConn(fd);
+  IngestWorker *w = workers[next++ % workers.size()];
+  conn->worker = w;
+
+  struct epoll_event ev;
+  ev.events = conn->events = EPOLLIN | EPOLLRDHUP;
+  ev.data.ptr = conn;
+  if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("ingest: epoll_ctl");
+    close(fd);
+    delete conn;
+    return -1;
+  }
+  accepted++;
+  connections++;
+  return 0;
+}
+
+/* write what we can of conn->out; -1 if the connection is gone */
+static int flush_out(IngestConn *conn)
+{
+  size_t sent = 0;
+  while (sent < conn->out.size()) {
+    ssize_t n = write(conn->fd, conn->out.data() + sent,
+		      conn->out.size() - sent);
+    if (n > 0) sent += n;
+    else if (n < 0 && errno == EINTR) continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    else return -1;
+  }
+  conn->out.erase(0, sent);
+  return 0;
+}
+
+/* close conn; it is deleted at the end of the worker's batch */
+void IngestServer::retire(IngestWorker *w, IngestConn *conn)
+{
+  close(conn->fd);
+  conn->closed = true;
+  w->closed.push_back(conn);
+  connections--;
+}
+
+/* close a finished connection, or wait on what it's ready for next */
+void IngestServer::settle(IngestWorker *w, IngestConn *conn, bool done)
+{
+  if (done && conn->state == IngestConn::TEXT_WAIT) {
+    /* its '%reg' thread still has it: the reply coming back closes it */
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->hungup = true;
+    return;
+  }
+  if (done) {
+    /* closing removes it from the epoll set */
+    retire(w, conn);
+    return;
+  }
+
+  /* wait for the client to take its replies before reading more, and
+     read nothing past a '%reg' until it has its reply */
+  uint32_t want;
+  if (conn->state == IngestConn::TEXT_WAIT)
+    want = conn->out.empty() ? 0 : EPOLLOUT;
+  else if (conn->out.empty())
+    want = EPOLLIN | EPOLLRDHUP;
+  else if (conn->out.size() < OUT_MAX)
+    want = EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+  else
+    want = EPOLLOUT;
+  if (want != conn->events) {
+    struct epoll_event ev;
+    ev.events = conn->events = want;
+    ev.data.ptr = conn;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+void IngestServer::worker(IngestWorker *w)
+{
+  const int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+
+  while (1) {
+    int nev = epoll_wait(w->epfd, events, MAX_EVENTS, -1);
+    if (nev < 0) {
+      if (errno == EINTR) continue;
+      perror("ingest: epoll_wait");
+      return;
+    }
+
+    for (int i = 0; i < nev; i++) {
+      if (events[i].data.ptr == w) {
+	/* '%reg' replies: send them, and go on with what came after */
+	uint64_t count;
+	std::vector<IngestWorker::text_reply_t> replies;
+	if (read(w->wake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	  perror("ingest: wake");
+	{
+	  std::lock_guard<std::mutex> lock(w->mutex);
+	  replies.swap(w->replies);
+	}
+	for (auto &r : replies) {
+	  IngestConn *conn = r.conn;
+	  if (conn->hungup) {
+	    retire(w, conn);
+	    continue;
+	  }
+	  conn->text_done(r.rc, r.reply);
+	  messages++;
+	  int handled = conn->parse(ds, false);
+	  bool done = handled < 0;
+	  if (!done) messages += handled;
+	  if (!done && !conn->out.empty() && flush_out(conn) < 0)
+	    done = true;
+	  settle(w, conn, done);
+	}
+	continue;
+      }
+
+      IngestConn *conn = (IngestConn *) events[i].data.ptr;
+      bool done = false;
+      if (conn->closed) continue;	/* by a reply earlier in the batch */
+
+      if (events[i].events & EPOLLOUT) {
+	if (flush_out(conn) < 0) done = true;
+      }
+
+      /*
+       * one read per wakeup, level triggered: a producer that never
+       * lets up still only gets a chunk's worth of attention before
+       * the others get theirs.  A read that comes up short says
+       * nothing about where the client's lines end, so a '%' line
+       * or '@' header is only taken once its newline is in.
+       */
+      if (!done && (events[i].events & (EPOLLIN | EPOLLRDHUP |
+					EPOLLHUP | EPOLLERR))) {
+	size_t have = conn->in.size();
+	conn->in.resize(have + READ_CHUNK);
+	ssize_t n = read(conn->fd, &conn->in[have], READ_CHUNK);
+	conn->in.resize(have + (n > 0 ? n : 0));
+
+	if (n > 0) {
+	  bytes += n;
+	  int handled = conn->parse(ds, false);
+	  if (handled < 0) done = true;
+	  else messages += handled;
+	  if (!done && !conn->out.empty() && flush_out(conn) < 0)
+	    done = true;
+	}
+	else if (n == 0) done = true;
+	else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	  done = true;
+      }
+
+      settle(w, conn, done);
+    }
+
+    for (auto conn : w->closed) delete conn;
+    w->closed.clear();
+  }
+}
+
+#else
+
+/* no workers here, so nothing is ever deferred */
+static void defer_text(Dataserver *ds, IngestConn *conn,
+		       const char *line, size_t len) {}
+
+IngestServer::IngestServer(Dataserver *ds, int nthreads): ds(ds) {}
+
+int IngestServer::add(int fd)
+{
+  close(fd);
+  return -1;
+}
+
+void IngestServer::worker(IngestWorker *w) {}
+
+void IngestServer::settle(IngestWorker *w, IngestConn *conn, bool done) {}
+
+void IngestServer::retire(IngestWorker *w, IngestConn *conn) {}
+
+#endif
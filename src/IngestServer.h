@@ -0,0 +1,128 @@
+#ifndef INGESTSERVER_H
+#define INGESTSERVER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Datapoint.h"
+
+class Dataserver;
+struct IngestWorker;
+
+/*
+ * IngestConn
+ *
+ *  Parse state for one connection to the dataserver port.  Bytes are
+ * appended to `in` as they arrive, in whatever pieces the socket hands
+ * over, and parse() consumes every complete message they hold -- the
+ * '%' text commands, the '@set'/'@get' handshakes, '<' binary gets and
+ * '>'/'}' binary pushes -- leaving a partial one in place for the next
+ * call.  Binary pushes are collected and handed to the dataserver
+ * together, once per call, rather than one set() per frame -- but
+ * before any other message, so a '%get' still sees the points sent
+ * ahead of it.  Replies (and the '@' protocol's acks) are appended to
+ * `out`;
+ * writing them is the caller's business, so the same parser can sit
+ * behind an epoll loop or a blocking socket.
+ */
+class IngestConn {
+ public:
+  enum ingest_state {
+    READY,			/* at a message boundary */
+    AT_SET_NAME,		/* @set: waiting for varname\r\n */
+    AT_SET_DATA,		/* @set: waiting for the data */
+    AT_GET_NAME,		/* @get: waiting for varname\r\n */
+    AT_GET_ACK,			/* @get: size sent, waiting for the ack */
+    TEXT_WAIT			/* a '%reg' is running on another thread */
+  };
+
+  int fd;
+  uint32_t events = 0;		/* what it's waiting for (IngestServer) */
+  IngestWorker *worker = nullptr;	/* its epoll worker, if it has one */
+  bool hungup = false;		/* gone while a TEXT_WAIT was running */
+  bool closed = false;		/* closed, deleted after this batch */
+  std::string in;		/* received, pos.. not yet parsed */
+  size_t pos = 0;
+  std::string out;		/* replies not yet written */
+  ingest_state state = READY;
+
+  /* the '@' handshake in progress */
+  unsigned int varlen = 0, datalen = 0, inlen = 0;
+  int datatype = 0;
+  std::string varname;
+  std::string reply;		/* @get: held until the client acks */
+
+  /* '>' and '}' points parsed but not yet handed to the dataserver */
+  std::vector<ds_datapoint_t *> batch;
+
+  IngestConn(int fd): fd(fd) {}
+
+  /*
+   * consume the complete messages in `in`; drained says the socket had
+   * nothing more to give, so a '%' line or '@' header missing its
+   * newline is taken as it is (what the one read() per command of the
+   * thread engine always did -- the epoll workers never pass it, and
+   * wait for the newline).  Returns the number of messages handled, or
+   * -1 if the stream is bad and the connection should be dropped.
+   *
+   *  On a worker, a '%reg' (which resolves and connects to the client
+   * being registered) is handed to a thread of its own and the
+   * connection waits in TEXT_WAIT, reading nothing more, until
+   * text_done() brings the reply back.
+   */
+  int parse(Dataserver *ds, bool drained);
+  void text_done(int rc, const std::string &reply);
+
+  IngestConn(const IngestConn &) = delete;
+  IngestConn &operator=(const IngestConn &) = delete;
+  ~IngestConn();
+
+ private:
+  int parse_text(Dataserver *ds, const char *p, size_t n, bool drained);
+  int parse_at(Dataserver *ds, const char *p, size_t n, bool drained);
+  int parse_at_state(Dataserver *ds, const char *p, size_t n);
+  int parse_get_binary(Dataserver *ds, const char *p, size_t n);
+  int parse_fixed(Dataserver *ds, const char *p, size_t n);
+  int parse_var(Dataserver *ds, const char *p, size_t n);
+  void publish(Dataserver *ds);
+};
+
+/*
+ * IngestServer
+ *
+ *  Event driven replacement for a thread per connection on the
+ * dataserver port: a few worker threads, each with its own epoll set,
+ * share every producer connection.  The accept loop stays where it is
+ * (Dataserver::start_tcp_server) and hands each new socket to the
+ * workers round robin; from then on only that worker touches it.
+ *
+ *  Linux only -- elsewhere the dataserver keeps a thread per
+ * connection.
+ */
+class IngestServer {
+  Dataserver *ds;
+  std::vector<IngestWorker *> workers;
+  std::atomic<unsigned int> next{0};
+
+  void worker(IngestWorker *w);
+  void settle(IngestWorker *w, IngestConn *conn, bool done);
+  void retire(IngestWorker *w, IngestConn *conn);
+
+ public:
+  /* totals, for dservIngestInfo */
+  std::atomic<uint64_t> connections{0};	/* open now */
+  std::atomic<uint64_t> accepted{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> messages{0};
+
+  IngestServer(Dataserver *ds, int nthreads);
+
+  int nthreads(void) { return (int) workers.size(); }
+
+  /* take ownership of accepted socket fd; -1 (fd closed) on failure */
+  int add(int fd);
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include <chrono>
 #include <queue>
 #include <cstring>
+#include <algorithm>
 
 #ifdef __linux__
 #include <sstream>
@@ -28,14 +29,23 @@ include <io.h>
 
 #include <sys/types.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #include "Datapoint.h"
 #include "sharedqueue.h"
 #include "LogMatchDict.h"
 #include "LogTable.h"
 #include "LogClient.h"
+#include "dslog_index.h"
+#include "dslog_compact.h"
+#include "dslog_block.h"
+#include "dslog_column.h"
   
-LogClient::LogClient(std::string filename, int fd): fd(fd), filename(filename)
+LogClient::LogClient(std::string filename, int fd, int version,
+		     int compress_level):
+  filename(filename), version(version), compress_level(compress_level),
+  fd(fd)
 {
   active = 1;
   initialized = 0;		/* set to 1 after process thread set */
@@ -60,7 +70,46 @@ LogClient::LogClient(std::string filename, int fd): fd(fd), filename(filename)
   shutdown_dpoint.flags =
     DSERV_DPOINT_SHUTDOWN_FLAG | DSERV_DPOINT_DONTFREE_FLAG;
 
+  /* these live in this object, not in a shared block: log_point hands
+     begin/endobs to dpoint_ref, which must see them as copyable */
+  beginobs_dpoint.storage = DPOINT_STORAGE_MALLOC;
+  endobs_dpoint.storage = DPOINT_STORAGE_MALLOC;
+  shutdown_dpoint.storage = DPOINT_STORAGE_MALLOC;
+
+  /* a writer stalled on its disk drops (and counts, as dropped in
+     dservLoggerBuffering) rather than growing the queue without bound */
+  dpoint_queue.set_overflow_limit(dpoint_queue.OVERFLOW_LIMIT,
+    [this](ds_datapoint_t *&dpoint) {
+      if (dpoint->flags & DSERV_DPOINT_MARKER_FLAGS) return false;
+      release_dpoint(dpoint);
+      return true;
+    });
+
   state = LOGGER_CLIENT_PAUSED;
+
+  stage_size_request = DEFAULT_STAGE_SIZE;
+  flush_ms = DEFAULT_FLUSH_MS;
+  points_written = 0;
+  bytes_written = 0;
+  writes = 0;
+  raw_bytes = 0;
+  cpu_us = 0;
+  stage_size = DEFAULT_STAGE_SIZE;
+  stage = (unsigned char *) malloc(stage_size);
+  stage_len = run_start = 0;
+
+  file_pos = last_sync = DSERV_LOG_HEADER_SIZE;
+  block_start = DSERV_LOG_HEADER_SIZE;
+  block_timestamp = 0;
+  nrecords = 0;
+  last_timestamp = 0;
+
+  zs_ready = false;
+  if (compress_level) {
+    memset(&zs, 0, sizeof(zs));
+    zs_ready = deflateInit(&zs, compress_level) == Z_OK;
+    if (!zs_ready) this->compress_level = 0;	/* write it plain */
+  }
   
   if (fd >= 0) write_header(now());
 }
@@ -68,6 +117,9 @@ LogClient::LogClient(std::string filename, int fd): fd(fd), filename(filename)
 LogClient::~LogClient()
 {
   if (fd >= 0) close(fd);
+  if (zs_ready) deflateEnd(&zs);
+  for (auto dpoint : held) release_dpoint(dpoint);
+  free(stage);
   matches.clear();
 }
 
@@ -93,13 +145,20 @@ int LogClient::write_header(uint64_t timestamp)
   buf[3] = 'o';
   buf[4] = 'g';
   
-  buf[5] = DSERV_LOG_CURRENT_VERSION;
+  buf[5] = version;
+  buf[6] = buf[7] = 0;
+  if (compress_level) {
+    buf[5] |= DSLOG_FLAG_COMPRESSED;
+    buf[6] = DSLOG_CODEC_ZLIB;
+  }
     
   memcpy((unsigned char *) &buf[8], &timestamp, sizeof(uint64_t));
   
   if (write(fd, buf, DSERV_LOG_HEADER_SIZE) != DSERV_LOG_HEADER_SIZE) {
     return 0;
   }
+  bytes_written += DSERV_LOG_HEADER_SIZE;
+  raw_bytes += DSERV_LOG_HEADER_SIZE;
   return 1;
 }
 
@@ -114,7 +173,10 @@ void LogClient::flush_dpoints(void)
 void LogClient::log_flush(ds_logger_buf_t *logbuf)
 {
   ds_datapoint_t *dpoint;
-  if (logbuf && logbuf->bufcount) {
+  if (logbuf && logbuf->columnar) {
+    for (auto &col : *logbuf->columns) flush_column(col.first, col.second);
+  }
+  else if (logbuf && logbuf->bufcount) {
     dpoint = &logbuf->dpoint;
     dpoint->data.len = logbuf->bufcount;
     dpoint->data.buf = (unsigned char *) logbuf->buf;
@@ -144,10 +206,12 @@ int LogClient::log_point(ds_datapoint_t *dpoint, ds_logger_buf_t *logbuf)
   if (!logbuf) {
     ds_datapoint_t *forwarded_dpoint = dpoint;
     if (!(dpoint->flags & ~DSERV_DPOINT_ATTR_MASK))
-      forwarded_dpoint = dpoint_copy(dpoint);
+      forwarded_dpoint = dpoint_ref(dpoint);
     dpoint_queue.push_back(forwarded_dpoint);
     return 1;
   }
+
+  if (logbuf->columnar) return log_column(dpoint, logbuf);
   
   // first dpoint to be added to empty buffer so initialize
   if (logbuf->dpoint.flags & DSERV_DPOINT_NOT_INITIALIZED_FLAG) {
@@ -170,7 +234,7 @@ int LogClient::log_point(ds_datapoint_t *dpoint, ds_logger_buf_t *logbuf)
   if (logbuf->bufsize <= dpoint->data.len) {
     ds_datapoint_t *forwarded_dpoint = dpoint;
     if (!(dpoint->flags & ~DSERV_DPOINT_ATTR_MASK))
-      forwarded_dpoint = dpoint_copy(dpoint);
+      forwarded_dpoint = dpoint_ref(dpoint);
     dpoint_queue.push_back(forwarded_dpoint);
     return 1;
   }
@@ -217,55 +281,560 @@ int LogClient::log_point(ds_datapoint_t *dpoint, ds_logger_buf_t *logbuf)
   return 1;
 }
 
+/*
+ * log_column
+ *
+ *  Add a point to its varname's column block (see dslog_column.h),
+ * keeping its own timestamp.  Only fixed-shape numeric points are
+ * blocked; anything else is logged as an ordinary record.  A point
+ * whose type or length differs from the block's ends that block and
+ * starts the next.  Runs on the logger thread, like log_point.
+ */
+int LogClient::log_column(ds_datapoint_t *dpoint, ds_logger_buf_t *logbuf)
+{
+  uint32_t elsize;
+  switch (dpoint->data.type) {
+  case DSERV_SHORT: elsize = sizeof(int16_t); break;
+  case DSERV_INT:
+  case DSERV_FLOAT: elsize = sizeof(int32_t); break;
+  case DSERV_DOUBLE: elsize = sizeof(double); break;
+  default: elsize = 0; break;
+  }
+  if (!elsize || !dpoint->data.len || dpoint->data.len % elsize)
+    return log_point(dpoint, NULL);
+
+  auto iter = logbuf->columns->find(dpoint->varname);
+  if (iter == logbuf->columns->end())
+    iter = logbuf->columns->emplace(dpoint->varname, ds_column_buf_t()).first;
+  ds_column_buf_t &col = iter->second;
+
+  if (col.timestamps.size() &&
+      (col.type != (uint32_t) dpoint->data.type ||
+       col.sample_len != dpoint->data.len))
+    flush_column(iter->first, col);
+
+  if (col.timestamps.empty()) {
+    col.type = dpoint->data.type;
+    col.sample_len = dpoint->data.len;
+    col.max_samples = std::max(1u, (uint32_t) logbuf->bufsize / col.sample_len);
+    col.timestamps.reserve(col.max_samples);
+    col.samples.reserve((size_t) col.max_samples * col.sample_len);
+  }
+
+  col.timestamps.push_back(dpoint->timestamp);
+  col.samples.insert(col.samples.end(), dpoint->data.buf,
+		     dpoint->data.buf + dpoint->data.len);
+  if (col.timestamps.size() >= col.max_samples)
+    flush_column(iter->first, col);
+  return 1;
+}
+
+/* queue a column's pending samples as one block record */
+void LogClient::flush_column(const std::string &varname, ds_column_buf_t &col)
+{
+  uint32_t n = col.timestamps.size();
+  if (!n) return;
+
+  dslog_column_header_t header;
+  memcpy(header.magic, DSLOG_COLUMN_MAGIC, sizeof(header.magic));
+  header.type = col.type;
+  header.nsamples = n;
+  header.sample_len = col.sample_len;
+  header.elsize = col.type == DSERV_SHORT ? sizeof(int16_t) :
+    col.type == DSERV_DOUBLE ? sizeof(double) : sizeof(int32_t);
+  header.reserved = 0;
+
+  uint32_t len = DSLOG_COLUMN_PAYLOAD(n, col.sample_len);
+  ds_datapoint_t *block = dpoint_new((char *) varname.c_str(),
+				     col.timestamps[0], DSERV_BYTE, 0, NULL);
+  block->data.buf = (unsigned char *) malloc(len);
+  block->data.len = len;
+  block->flags = DSERV_DPOINT_COLUMNAR_FLAG;
+
+  unsigned char *p = block->data.buf;
+  memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+  memcpy(p, col.timestamps.data(), n * sizeof(uint64_t));
+  p += n * sizeof(uint64_t);
+  memcpy(p, col.samples.data(), col.samples.size());
+
+  dpoint_queue.push_back(block);
+  col.timestamps.clear();
+  col.samples.clear();
+}
+
+void LogClient::release_dpoint(ds_datapoint_t *dpoint)
+{
+  // free dpoints that were copied (or referenced) before queuing up
+  if (!(dpoint->flags & DSERV_DPOINT_DONTFREE_FLAG)) {
+    dpoint_free(dpoint);
+  }
+}
+
+/* close off the staged bytes since the last iovec as an iovec */
+void LogClient::stage_run(void)
+{
+  if (stage_len > run_start) {
+    iov.push_back({ stage + run_start, stage_len - run_start });
+    run_start = stage_len;
+  }
+}
+
 /*
  * write_dpoint
  *
- *  Actually write the dpoint to the open file descriptor.  This
- * should be the only direct write to the fd - all clients should
- * request this via the logclient's process thread
+ *  Serialize the dpoint into the staging buffer, in exactly the byte
+ * layout the v3 format has always had (varlen, varname, timestamp,
+ * flags, type, len, data), writing out what is staged first if it
+ * won't fit.  The point is consumed: it is released here, or once its
+ * payload has been written if that goes out by reference.  This and
+ * flush_stage() are the only writes to the fd after the header, and
+ * only the logclient's process thread calls them.
+ *
+ *  A version 4 log also gets a sync record every DSLOG_SYNC_INTERVAL
+ * bytes and has the point's offset noted for the index.  A version 5
+ * log uses the compact record encoding instead (see write_record).
  */
 
 int LogClient::write_dpoint(ds_datapoint_t *dpoint)
+{
+  /* a compressed log's record has to fit in one block; skip, not fail */
+  if (compress_level && dpoint->data.len > DSLOG_BLOCK_MAX - 1024) {
+    fprintf(stderr, "dserv: %s: %s (%u bytes) is too large for a "
+	    "compressed log, not logged\n", filename.c_str(),
+	    dpoint->varname, dpoint->data.len);
+    release_dpoint(dpoint);
+    return 0;
+  }
+  if (version == DSLOG_VERSION_INDEXED) {
+    if (file_pos - last_sync >= DSLOG_SYNC_INTERVAL && write_sync() < 0) {
+      release_dpoint(dpoint);
+      return -1;
+    }
+    index_record(dpoint);
+  }
+  return write_record(dpoint, true);
+}
+
+/*
+ * write_record
+ *
+ *  Stage one record.  Points we own are released as described above;
+ * the logger's own records (own false) point into this object and are
+ * left alone, their payload kept alive by the caller until the flush.
+ */
+int LogClient::write_record(ds_datapoint_t *dpoint, bool own)
 {
 #if 0
   printf("%s(%d) %d %d %d\n", dpoint->varname, dpoint->varlen,
 	 dpoint->data.e.dtype, dpoint->flags, dpoint->data.len);
 #endif
-  
-  if (write(fd, &dpoint->varlen, sizeof(uint16_t)) != sizeof(uint16_t))
-    goto write_error;
-  
-  if (write(fd, dpoint->varname, (int) dpoint->varlen) !=
-      (int) dpoint->varlen)
-    goto write_error;
-  
-  if (write(fd, &dpoint->timestamp, sizeof(uint64_t)) != sizeof(uint64_t))
-    goto write_error;
-  
-  if (write(fd, &dpoint->flags, sizeof(uint32_t)) != sizeof(uint32_t))
-    goto write_error;
-  
-  if (write(fd, &dpoint->data.type, sizeof (ds_datatype_t)) !=
-      sizeof (ds_datatype_t))
-    goto write_error;
-  
-  if (write(fd, &dpoint->data.len, sizeof(uint32_t)) != sizeof(uint32_t))
-    goto write_error;
-  
-  if (dpoint->data.len) {
-    if (write(fd, dpoint->data.buf, dpoint->data.len) != dpoint->data.len)
-      goto write_error;
+  bool compact = version == DSLOG_VERSION_COMPACT;
+  size_t header = compact ? compact_header_bound(dpoint) :
+    sizeof(uint16_t) + dpoint->varlen + sizeof(uint64_t) +
+    sizeof(uint32_t) + sizeof(ds_datatype_t) + sizeof(uint32_t);
+  bool direct = dpoint->data.len >= DIRECT_PAYLOAD;
+  size_t need = header + (direct ? 0 : dpoint->data.len);
+
+  /* a compressed block is one flush, and must stay under the cap */
+  bool block_full = compress_level &&
+    file_pos - block_start + header + dpoint->data.len > DSLOG_BLOCK_MAX;
+
+  if (stage_len + need > stage_size || iov.size() + 2 >= MAX_IOV ||
+      block_full) {
+    if (flush_stage() < 0) {
+      if (own) release_dpoint(dpoint);
+      return -1;
+    }
+  }
+
+  unsigned char *p = stage + stage_len;
+  if (compact) {
+    p = compact_header(dpoint, p);
+  }
+  else {
+    memcpy(p, &dpoint->varlen, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    memcpy(p, dpoint->varname, dpoint->varlen);
+    p += dpoint->varlen;
+    memcpy(p, &dpoint->timestamp, sizeof(uint64_t));
+    p += sizeof(uint64_t);
+    memcpy(p, &dpoint->flags, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    memcpy(p, &dpoint->data.type, sizeof(ds_datatype_t));
+    p += sizeof(ds_datatype_t);
+    memcpy(p, &dpoint->data.len, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+  }
+  header = p - (stage + stage_len);
+  stage_len += header;
+  if (file_pos == block_start) block_timestamp = dpoint->timestamp;
+  file_pos += header + dpoint->data.len;
+  nrecords++;
+  if (own) points_written++;
+
+  if (!dpoint->data.len) {
+    if (own) release_dpoint(dpoint);
+  }
+  else if (direct) {
+    stage_run();
+    iov.push_back({ dpoint->data.buf, dpoint->data.len });
+    if (own) held.push_back(dpoint);
+  }
+  else {
+    memcpy(p, dpoint->data.buf, dpoint->data.len);
+    stage_len += dpoint->data.len;
+    if (own) release_dpoint(dpoint);
   }
   return 0;
-  
- write_error:
-  return -1;
+}
+
+/* most bytes compact_header() can write for this point */
+size_t LogClient::compact_header_bound(ds_datapoint_t *dpoint)
+{
+  size_t def = 1 + 2 * sizeof(uint16_t) + dpoint->varlen;
+  return DSLOG_COMPACT_MAX_HEAD + def;
+}
+
+/*
+ * compact_header
+ *
+ *  Write the version 5 header for this point at p (see
+ * dslog_compact.h), defining an id for its varname first if this is
+ * the first time it has been seen.  Returns the end of the header.
+ */
+unsigned char *LogClient::compact_header(ds_datapoint_t *dpoint,
+					 unsigned char *p)
+{
+  std::string name(dpoint->varname, dpoint->varlen);
+  auto it = compact_ids.find(name);
+
+  if (it == compact_ids.end() &&
+      compact_ids.size() < DSLOG_COMPACT_MAX_IDS) {
+    uint16_t id = compact_ids.size();
+    it = compact_ids.emplace(name, id).first;
+    *p++ = DSLOG_COMPACT_DEF;
+    memcpy(p, &id, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    memcpy(p, &dpoint->varlen, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    memcpy(p, dpoint->varname, dpoint->varlen);
+    p += dpoint->varlen;
+  }
+
+  if (it != compact_ids.end()) {
+    *p++ = DSLOG_COMPACT_POINT;
+    memcpy(p, &it->second, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+  }
+  else {
+    *p++ = DSLOG_COMPACT_LITERAL;
+    memcpy(p, &dpoint->varlen, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    memcpy(p, dpoint->varname, dpoint->varlen);
+    p += dpoint->varlen;
+  }
+
+  p = dslog_put_varint(p, dslog_zigzag((int64_t) (dpoint->timestamp -
+						  last_timestamp)));
+  last_timestamp = dpoint->timestamp;
+  p = dslog_put_varint(p, dpoint->flags);
+  p = dslog_put_varint(p, (uint32_t) dpoint->data.type);
+  p = dslog_put_varint(p, dpoint->data.len);
+  return p;
+}
+
+/* note where this point's record goes, by varname and obs period */
+void LogClient::index_record(ds_datapoint_t *dpoint)
+{
+  std::string name(dpoint->varname, dpoint->varlen);
+  auto it = var_ids.find(name);
+  if (it == var_ids.end()) {
+    it = var_ids.emplace(name, (int) var_names.size()).first;
+    var_names.push_back(name);
+    var_offsets.emplace_back();
+  }
+  var_offsets[it->second].push_back(file_pos);
+
+  if (name == beginobs_varname)
+    obs_offsets.push_back({ file_pos, 0 });
+  else if (name == endobs_varname &&
+	   obs_offsets.size() && !obs_offsets.back().second)
+    obs_offsets.back().second = file_pos;
+}
+
+int LogClient::write_sync(void)
+{
+  unsigned char payload[DSLOG_MAGIC_LEN + sizeof(uint64_t)];
+  ds_datapoint_t sync;
+
+  memcpy(payload, DSLOG_SYNC_MAGIC, DSLOG_MAGIC_LEN);
+  memcpy(&payload[DSLOG_MAGIC_LEN], &nrecords, sizeof(uint64_t));
+
+  memset(&sync, 0, sizeof(sync));
+  sync.varname = (char *) DSLOG_SYNC_VARNAME;
+  sync.varlen = strlen(DSLOG_SYNC_VARNAME);
+  sync.timestamp = now();
+  sync.data.type = DSERV_BYTE;
+  sync.data.len = sizeof(payload);
+  sync.data.buf = payload;	/* small enough to be copied when staged */
+
+  sync_offsets.push_back(file_pos);
+  last_sync = file_pos;
+  return write_record(&sync, false);
+}
+
+/*
+ * write_index
+ *
+ *  Append the logger:index records (layout in dslog_index.h) and
+ * flush.  Only called as the log is closed, after the last point.
+ */
+int LogClient::write_index(void)
+{
+  auto put = [this](const void *src, size_t n) {
+    const unsigned char *s = (const unsigned char *) src;
+    index_blob.insert(index_blob.end(), s, s + n);
+  };
+  uint32_t count;
+  uint64_t self = file_pos;
+
+  index_blob.clear();
+  count = var_names.size();
+  put(&count, sizeof(count));
+  for (size_t i = 0; i < var_names.size(); i++) {
+    uint16_t namelen = var_names[i].size();
+    put(&namelen, sizeof(namelen));
+    put(var_names[i].data(), namelen);
+    count = var_offsets[i].size();
+    put(&count, sizeof(count));
+    put(var_offsets[i].data(), count * sizeof(uint64_t));
+  }
+  count = obs_offsets.size();
+  put(&count, sizeof(count));
+  for (auto &obs : obs_offsets) {
+    put(&obs.first, sizeof(uint64_t));
+    put(&obs.second, sizeof(uint64_t));
+  }
+  count = sync_offsets.size();
+  put(&count, sizeof(count));
+  put(sync_offsets.data(), count * sizeof(uint64_t));
+  put(&self, sizeof(self));
+  put(DSLOG_INDEX_MAGIC, DSLOG_MAGIC_LEN);
+
+  /* index_blob outlives the flush, so the chunks can go by reference */
+  ds_datapoint_t index;
+  memset(&index, 0, sizeof(index));
+  index.varname = (char *) DSLOG_INDEX_VARNAME;
+  index.varlen = strlen(DSLOG_INDEX_VARNAME);
+  index.timestamp = now();
+  index.data.type = DSERV_BYTE;
+
+  /* the closing offset and magic must end the file in one piece, so
+     the last chunk is never left shorter than they are */
+  const size_t tail = sizeof(self) + DSLOG_MAGIC_LEN;
+  for (size_t off = 0; off < index_blob.size(); off += index.data.len) {
+    size_t len = std::min(index_blob.size() - off,
+			  (size_t) DSLOG_INDEX_CHUNK);
+    size_t rest = index_blob.size() - off - len;
+    if (rest && rest < tail) len -= tail - rest;
+    index.data.len = len;
+    index.data.buf = index_blob.data() + off;
+    if (write_record(&index, false) < 0) return -1;
+  }
+  return flush_stage();
+}
+
+/*
+ * pack_block
+ *
+ *  Replace what is staged with one compressed block (header and
+ * deflated data, see dslog_block.h).  Direct payloads are copied into
+ * the block, so the points holding them can be released as usual.
+ */
+int LogClient::pack_block(void)
+{
+  size_t raw_len = 0;
+  for (auto &v : iov) raw_len += v.iov_len;
+  if (raw_len > DSLOG_BLOCK_MAX) return -1;	/* write_record prevents it */
+  raw_bytes += raw_len;
+  blocks.push_back({ bytes_written, block_start, block_timestamp });
+
+  unsigned char *src;
+  if (iov.size() == 1) {
+    src = (unsigned char *) iov[0].iov_base;
+  }
+  else {
+    block_raw.resize(raw_len);
+    src = block_raw.data();
+    for (auto &v : iov) {
+      memcpy(src, v.iov_base, v.iov_len);
+      src += v.iov_len;
+    }
+    src = block_raw.data();
+  }
+
+  deflateReset(&zs);
+  block_out.resize(deflateBound(&zs, raw_len));
+  zs.next_in = src;
+  zs.avail_in = raw_len;
+  zs.next_out = block_out.data();
+  zs.avail_out = block_out.size();
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END) return -1;
+
+  uint32_t lens[3];
+  lens[0] = raw_len;
+  lens[1] = block_out.size() - zs.avail_out;
+  lens[2] = crc32(0L, block_out.data(), lens[1]);
+  memcpy(block_header, DSLOG_BLOCK_MAGIC, DSLOG_BLOCK_MAGIC_LEN);
+  memcpy(&block_header[DSLOG_BLOCK_MAGIC_LEN], lens, sizeof(lens));
+
+  iov.clear();
+  iov.push_back({ block_header, DSLOG_BLOCK_HEADER });
+  iov.push_back({ block_out.data(), lens[1] });
+  return 0;
+}
+
+/*
+ * flush_stage
+ *
+ *  Write everything staged with as few writev() calls as the iovec
+ * limit allows (as one compressed block if the log is compressed),
+ * then release the points held for their payloads.
+ */
+int LogClient::flush_stage(void)
+{
+  int rc = 0;
+  size_t i = 0;
+
+  stage_run();
+  if (compress_level && iov.size()) {
+    if (pack_block() < 0) {
+      iov.clear();
+      rc = -1;
+    }
+  }
+  else {
+    for (auto &v : iov) raw_bytes += v.iov_len;
+  }
+  while (i < iov.size()) {
+    int n = std::min((int) (iov.size() - i), MAX_IOV);
+    ssize_t w = writev(fd, &iov[i], n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+    writes++;
+    bytes_written += w;
+
+    /* step over what went out, allowing for a short write */
+    while (w > 0) {
+      if ((size_t) w >= iov[i].iov_len) {
+	w -= iov[i].iov_len;
+	i++;
+      }
+      else {
+	iov[i].iov_base = (unsigned char *) iov[i].iov_base + w;
+	iov[i].iov_len -= w;
+	w = 0;
+      }
+    }
+  }
+
+  iov.clear();
+  stage_len = run_start = 0;
+  block_start = file_pos;
+  for (auto dpoint : held) release_dpoint(dpoint);
+  held.clear();
+  return rc;
+}
+
+/*
+ * write_block_index
+ *
+ *  Append a compressed log's block index (layout in dslog_block.h),
+ * after the last block.  Only called as the log is closed.
+ */
+int LogClient::write_block_index(void)
+{
+  auto put = [this](const void *src, size_t n) {
+    const unsigned char *s = (const unsigned char *) src;
+    index_blob.insert(index_blob.end(), s, s + n);
+  };
+  uint64_t self = bytes_written;
+  uint32_t count = blocks.size();
+
+  index_blob.clear();
+  put(DSLOG_BLOCKIDX_MAGIC, DSLOG_BLOCK_MAGIC_LEN);
+  put(&count, sizeof(count));
+  for (auto &b : blocks) put(b.data(), DSLOG_BLOCKIDX_ENTRY);
+  put(&file_pos, sizeof(file_pos));
+  put(&self, sizeof(self));
+  put(DSLOG_BLOCKIDX_TAIL, DSLOG_MAGIC_LEN);
+
+  size_t off = 0;
+  while (off < index_blob.size()) {
+    ssize_t w = write(fd, index_blob.data() + off, index_blob.size() - off);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return -1;
+    off += w;
+  }
+  writes++;
+  bytes_written += off;
+  return 0;
+}
+
+/*
+ * write_trailer
+ *
+ *  What a clean close appends: a v4 log's index, then (once the last
+ * block is out) a compressed log's block index.
+ */
+int LogClient::write_trailer(void)
+{
+  if (version == DSLOG_VERSION_INDEXED && write_index() < 0) return -1;
+  if (compress_level && (flush_stage() < 0 || write_block_index() < 0))
+    return -1;
+  return 0;
+}
+
+/* apply a buffer size change, only between flushes */
+void LogClient::resize_stage(void)
+{
+  size_t want = stage_size_request;
+  if (want == stage_size || stage_len) return;
+  unsigned char *newstage = (unsigned char *) realloc(stage, want);
+  if (!newstage) return;
+  stage = newstage;
+  stage_size = want;
+}
+
+void LogClient::io_info(log_client_io_t *info)
+{
+  info->stage_size = stage_size_request;
+  info->flush_ms = flush_ms;
+  info->points = points_written;
+  info->bytes = bytes_written;
+  info->writes = writes;
+  info->compress = compress_level;
+  info->raw_bytes = raw_bytes;
+  info->cpu_us = cpu_us;
+  info->dropped = dpoint_queue.dropped();
+}
+
+static uint64_t thread_cpu_us(void)
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return 0;
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 void LogClient::log_client_process(LogClient *logclient)
 {
   ds_datapoint_t *dpoint;
   bool done = false;
+  bool error = false;
 
   //  std::cout << "waiting to receive dpoints to log" << std::endl;
 
@@ -280,33 +849,73 @@ void LogClient::log_client_process(LogClient *logclient)
    * every logbuf.  Any buffer flushing for a close has already been
    * queued ahead of the shutdown dpoint, so this thread just writes
    * what it is handed, in order, until told to stop.
+   *
+   * Whatever has queued up is staged and written together: the queue
+   * is drained until it is empty or the stage is half full.  With a
+   * flush interval, once the queue is empty a batch that came sooner
+   * than that after the last write waits out the rest of the interval
+   * (picking up what arrives meanwhile) rather than costing another
+   * syscall; staged data never waits longer than that, and a full
+   * stage is written immediately.
    */
+  std::vector<ds_datapoint_t *> batch;
+  auto last_flush = std::chrono::steady_clock::now();
+
   while (!done) {
-    dpoint = logclient->dpoint_queue.front();
-    logclient->dpoint_queue.pop_front();
+    batch.clear();
+    logclient->dpoint_queue.pop_all(batch);
 
-    /* check for shutdown */
-    if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
-      logclient->state = LOGGER_CLIENT_SHUTDOWN;
-      logclient->active = 0;
-      done = true;
-    }
-    else {
-      // actually write this point
-      auto result = logclient->write_dpoint(dpoint);
+    size_t i;
+    for (i = 0; i < batch.size() && !done; i++) {
+      dpoint = batch[i];
 
-      // free dpoints that were copied before queuing up
-      if (!(dpoint->flags & DSERV_DPOINT_DONTFREE_FLAG)) {
-	dpoint_free(dpoint);
+      /* check for shutdown */
+      if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
+	logclient->state = LOGGER_CLIENT_SHUTDOWN;
+	logclient->active = 0;
+	done = true;
+	/* a clean close: finish the log with its index(es) */
+	if (!error && logclient->write_trailer() < 0) {
+	  fprintf(stderr, "dserv: writing the index of %s failed, "
+		  "readers will have to scan it\n", logclient->filename.c_str());
+	  error = true;
+	}
       }
-
-      // if there was a write error (result == 0) then shutdown this client
-      if (result < 0) {
+      // actually stage this point, shutting down on a write error
+      else if (logclient->write_dpoint(dpoint) < 0) {
 	logclient->state = LOGGER_CLIENT_SHUTDOWN;
 	logclient->active = 0;
 	done = true;
+	error = true;
+      }
+    }
+    /* nothing should follow the shutdown, but don't leak it if it does */
+    for (; i < batch.size(); i++) {
+      if (!(batch[i]->flags & DSERV_DPOINT_SHUTDOWN_FLAG))
+	logclient->release_dpoint(batch[i]);
+    }
+
+    if (!done && logclient->stage_len < logclient->stage_size / 2) {
+      /* a backlog is drained before anything is written: pop_all takes
+	 at most DRAIN_MAX points, and sleeping between those would
+	 hold a behind logger to one of them per interval */
+      if (logclient->dpoint_queue.size()) continue;
+      auto interval = std::chrono::milliseconds(logclient->flush_ms.load());
+      auto due = last_flush + interval;
+      if (std::chrono::steady_clock::now() < due) {
+	std::this_thread::sleep_until(due);
+	if (logclient->dpoint_queue.size()) continue;
       }
     }
+
+    if (logclient->flush_stage() < 0 && !error) {
+      logclient->state = LOGGER_CLIENT_SHUTDOWN;
+      logclient->active = 0;
+      done = true;
+    }
+    last_flush = std::chrono::steady_clock::now();
+    logclient->cpu_us = thread_cpu_us();
+    logclient->resize_stage();
   }
 
   // remove this client from the LogTable and free
@@ -3,6 +3,27 @@
 
 #include <mutex>
 #include <condition_variable>
+#include <vector>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <atomic>
+#include <sys/uio.h>
+#include <zlib.h>
+#include "mpscring.h"
+
+/* writer I/O settings and counters, see LogTable::buffering */
+typedef struct log_client_io_s {
+  int stage_size;		/* bytes staged before a write is forced */
+  int flush_ms;			/* min interval between writes, 0: per batch */
+  uint64_t points;		/* points written */
+  uint64_t bytes;		/* bytes written (header included) */
+  uint64_t writes;		/* write syscalls */
+  int compress;			/* zlib level, 0: uncompressed */
+  uint64_t raw_bytes;		/* bytes before compression */
+  uint64_t cpu_us;		/* writer thread CPU time */
+  uint64_t dropped;		/* points its queue had no room for */
+} log_client_io_t;
 
 class LogClient {
  public:
@@ -17,6 +38,9 @@ class LogClient {
   const int DSERV_LOG_HEADER_SIZE = 16;
   
   std::string filename;
+  int version;			/* 3, 4: sync records + index,
+				   5: compact records */
+  int compress_level;		/* zlib level for blocks, 0: off */
   std::atomic<int> active;	/* set to 0 if closing      */
   int fd;			/* file to write to         */
 
@@ -30,7 +54,7 @@ class LogClient {
      handled on the dataserver's logger thread (see
      LogTable::control_client), which is the sole owner of logbuf
      state, so no other control dpoints travel through here. */
-  SharedQueue<ds_datapoint_t *> dpoint_queue;
+  MPSCRing<ds_datapoint_t *> dpoint_queue;
 
   ds_datapoint_t shutdown_dpoint; /* dpoint signal shutdown */
 
@@ -48,9 +72,76 @@ class LogClient {
   const char *beginobs_varname = "logger:beginobs";
   const char *endobs_varname = "logger:endobs";
 
+  /*
+   * Writer-side staging.  Points are serialized (v3 record layout)
+   * into stage and go to the file in one writev per flush rather than
+   * seven write()s per point.  Payloads of DIRECT_PAYLOAD bytes or more
+   * aren't copied: they are written straight from the point, which is
+   * held until the flush.  All of this belongs to the writer thread;
+   * other threads only touch the atomics.
+   */
+  static constexpr int DEFAULT_STAGE_SIZE = 256*1024;
+  static constexpr int MIN_STAGE_SIZE = 64*1024;
+  static constexpr int MAX_STAGE_SIZE = 64*1024*1024;
+  static constexpr int DEFAULT_FLUSH_MS = 20;
+  static constexpr uint32_t DIRECT_PAYLOAD = 32*1024;
+  static constexpr int MAX_IOV = 1024;
+
+  std::atomic<int> stage_size_request;
+  std::atomic<int> flush_ms;
+  std::atomic<uint64_t> points_written;
+  std::atomic<uint64_t> bytes_written;
+  std::atomic<uint64_t> writes;
+  std::atomic<uint64_t> raw_bytes;
+  std::atomic<uint64_t> cpu_us;
+
+  unsigned char *stage;
+  size_t stage_size;
+  size_t stage_len;
+  size_t run_start;		/* start of stage not yet in iov */
+  std::vector<struct iovec> iov;
+  std::vector<ds_datapoint_t *> held;
+
+  /*
+   * Version 4 bookkeeping (see dslog_index.h), also writer-thread only:
+   * where each record lands in the file, grouped by varname, plus the
+   * obs periods and sync records, written out as the index on close.
+   */
+  uint64_t file_pos;		/* offset the next record will have */
+  uint64_t last_sync;
+  uint64_t nrecords;
+  std::unordered_map<std::string, int> var_ids;
+  std::vector<std::string> var_names;
+  std::vector<std::vector<uint64_t>> var_offsets;
+  std::vector<std::pair<uint64_t, uint64_t>> obs_offsets;
+  std::vector<uint64_t> sync_offsets;
+  std::vector<unsigned char> index_blob;
+
+  /* version 5 (see dslog_compact.h): varname ids and the timestamp
+     the next delta is taken from */
+  std::unordered_map<std::string, uint16_t> compact_ids;
+  uint64_t last_timestamp;
+
+  /*
+   * Compressed logs (see dslog_block.h): each flush deflates what is
+   * staged, direct payloads included, into one independent block
+   */
+  z_stream zs;
+  bool zs_ready;
+  std::vector<unsigned char> block_raw;
+  std::vector<unsigned char> block_out;
+  unsigned char block_header[16];
+
+  /* the block index: per block its file offset and the stream offset
+     and timestamp of its first record; where the next block starts */
+  std::vector<std::array<uint64_t, 3>> blocks;
+  uint64_t block_start;
+  uint64_t block_timestamp;
+
   static void log_client_process(LogClient *);
   
-  LogClient(std::string filename, int fd);
+  LogClient(std::string filename, int fd, int version = 3,
+	    int compress_level = 0);
   ~LogClient();
   uint64_t now(void);
   int write_header(uint64_t timestamp);
@@ -59,7 +150,24 @@ class LogClient {
   void log_resume(void);
   void log_flush(ds_logger_buf_t *logbuf);
   int log_point(ds_datapoint_t *dpoint, ds_logger_buf_t *logbuf);
+  int log_column(ds_datapoint_t *dpoint, ds_logger_buf_t *logbuf);
+  void flush_column(const std::string &varname, ds_column_buf_t &col);
   int write_dpoint(ds_datapoint_t *dpoint);
+  int write_index(void);
+  int write_block_index(void);
+  int write_trailer(void);
+  int flush_stage(void);
+  void resize_stage(void);
+  void io_info(log_client_io_t *info);
+ private:
+  int write_record(ds_datapoint_t *dpoint, bool own);
+  size_t compact_header_bound(ds_datapoint_t *dpoint);
+  unsigned char *compact_header(ds_datapoint_t *dpoint, unsigned char *p);
+  int write_sync(void);
+  void index_record(ds_datapoint_t *dpoint);
+  void stage_run(void);
+  int pack_block(void);
+  void release_dpoint(ds_datapoint_t *dpoint);
 };
 
 #endif
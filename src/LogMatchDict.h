@@ -3,15 +3,30 @@
 
 #include <unordered_map>
 #include <vector>
+#include <string>
 #include <mutex>
 #include "MatchDict.h"
 
+/* one varname's pending samples for a columnar match */
+typedef struct ds_column_buf_s {
+  uint32_t type;
+  uint32_t sample_len;
+  uint32_t max_samples;
+  std::vector<uint64_t> timestamps;
+  std::vector<unsigned char> samples;
+} ds_column_buf_t;
+
 /* storage for buffered datapoints for a given match */
 typedef struct ds_logger_buf_s {
   ds_datapoint_t dpoint;
   int bufsize;
   int bufcount;
   void *buf;
+
+  /* columnar matches (see dslog_column.h) buffer per varname here
+     instead, bufsize bytes of samples per block */
+  int columnar;
+  std::unordered_map<std::string, ds_column_buf_t> *columns;
 } ds_logger_buf_t;
 
 
@@ -22,10 +37,19 @@ public:
 
 public:
 
-  LogMatchSpec(const char *str, int every, int obs_limited, int bufsize):
+  static constexpr int DEFAULT_COLUMN_BYTES = 16*1024;
+
+  LogMatchSpec(const char *str, int every, int obs_limited, int bufsize,
+	       int columnar = 0):
     MatchSpec(str, every), obs_limited(obs_limited) {
 
-    if (bufsize > 0) {
+    if (columnar) {
+      logbuf = (ds_logger_buf_t *) calloc(1, sizeof (ds_logger_buf_t));
+      logbuf->bufsize = bufsize > 0 ? bufsize : DEFAULT_COLUMN_BYTES;
+      logbuf->columnar = 1;
+      logbuf->columns = new std::unordered_map<std::string, ds_column_buf_t>;
+    }
+    else if (bufsize > 0) {
       logbuf = (ds_logger_buf_t *) calloc(1, sizeof (ds_logger_buf_t));
       logbuf->bufsize = bufsize;
       logbuf->buf = malloc(bufsize);
@@ -41,6 +65,7 @@ public:
   ~LogMatchSpec() {
     if (logbuf) {
       if (logbuf->buf) free(logbuf->buf);
+      delete logbuf->columns;
       free(logbuf);
     }
   }
@@ -4,6 +4,7 @@
 #include <thread>
 #include <chrono>
 #include <iostream>
+#include <algorithm>
 
 #include "Datapoint.h"
 #include "sharedqueue.h"
@@ -110,7 +111,7 @@ void LogTable::control_client(std::string key, uint32_t flags)
  * stays alive for the duration of the call.
  */
 int LogTable::add_match(std::string key, const char *match,
-			int every, int obs, int bufsize)
+			int every, int obs, int bufsize, int columnar)
 {
   std::lock_guard<std::mutex> mlock(mutex_);
   auto iter = map_.find(key);
@@ -119,12 +120,41 @@ int LogTable::add_match(std::string key, const char *match,
   LogClient *log_client = iter->second;
   if (!log_client || !log_client->active) return 0;
 
-  LogMatchSpec *m = new LogMatchSpec(match, every, obs, bufsize);
+  LogMatchSpec *m = new LogMatchSpec(match, every, obs, bufsize, columnar);
   log_client->matches.insert(m->matchstr, m);
   log_client->obs_limited_matches += m->obs_limited;
   return 1;
 }
 
+/*
+ * buffering
+ *
+ *  Change a client's writer staging size and/or flush interval (a
+ * negative value leaves it alone) and report the current settings and
+ * write counters.  Only atomics are touched here; the writer thread
+ * picks a new size up after its next flush.  Same lifetime argument
+ * as add_match.
+ */
+int LogTable::buffering(std::string key, int stage_size, int flush_ms,
+			log_client_io_t *info)
+{
+  std::lock_guard<std::mutex> mlock(mutex_);
+  auto iter = map_.find(key);
+  if (iter == map_.end()) return 0;
+
+  LogClient *log_client = iter->second;
+  if (!log_client || !log_client->active) return 0;
+
+  if (stage_size >= 0) {
+    stage_size = std::max(stage_size, (int) LogClient::MIN_STAGE_SIZE);
+    stage_size = std::min(stage_size, (int) LogClient::MAX_STAGE_SIZE);
+    log_client->stage_size_request = stage_size;
+  }
+  if (flush_ms >= 0) log_client->flush_ms = flush_ms;
+  if (info) log_client->io_info(info);
+  return 1;
+}
+
 /*
  * shutdown_clients
  *
@@ -6,6 +6,7 @@
 #include <cstdint>
 
 class LogClient;
+typedef struct log_client_io_s log_client_io_t;
 
 class LogTable
 {
@@ -25,7 +26,9 @@ public:
   void forward_dpoint(ds_datapoint_t *dpoint);
   void control_client(std::string key, uint32_t flags);
   int add_match(std::string key, const char *match,
-		int every, int obs, int bufsize);
+		int every, int obs, int bufsize, int columnar = 0);
+  int buffering(std::string key, int stage_size, int flush_ms,
+		log_client_io_t *info);
   void shutdown_clients(void);
 
 };
@@ -0,0 +1,471 @@
+#ifndef MATCHINDEX_H
+#define MATCHINDEX_H
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+
+// Copyright 2018 IBM Corporation
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Compares two text strings.  Accepts '?' as a single-character wildcard.  
+// For each '*' wildcard, seeks out a matching sequence of any characters 
+// beyond it.  Otherwise compares the strings a character at a time. 
+//
+inline bool FastWildCompare(char *pWild, char *pTame)
+{
+  char *pWildSequence;  // Points to prospective wild string match after '*'
+  char *pTameSequence;  // Points to prospective tame string match
+
+  // Find a first wildcard, if one exists, and the beginning of any  
+  // prospectively matching sequence after it.
+  do
+    {
+      // Check for the end from the start.  Get out fast, if possible.
+      if (!*pTame)
+	{
+	  if (*pWild)
+	    {
+	      while (*(pWild++) == '*')
+		{
+		  if (!(*pWild))
+		    {
+		      return true;   // "ab" matches "ab*".
+		    }
+		}
+	    
+	      return false;          // "abcd" doesn't match "abc".
+	    }
+	  else
+	    {
+	      return true;           // "abc" matches "abc".
+	    }
+	}
+      else if (*pWild == '*')
+	{
+	  // Got wild: set up for the second loop and skip on down there.
+	  while (*(++pWild) == '*')
+	    {
+	      continue;
+	    }
+	
+	  if (!*pWild)
+	    {
+	      return true;           // "abc*" matches "abcd".
+	    }
+	
+	  // Search for the next prospective match.
+	  if (*pWild != '?')
+	    {
+	      while (*pWild != *pTame)
+		{
+		  if (!*(++pTame))
+		    {
+		      return false;  // "a*bc" doesn't match "ab".
+		    }
+		}
+	    }
+	
+	  // Keep fallback positions for retry in case of incomplete match.
+	  pWildSequence = pWild;
+	  pTameSequence = pTame;
+	  break;
+	}
+      else if (*pWild != *pTame && *pWild != '?')
+	{
+	  return false;              // "abc" doesn't match "abd".
+	}
+    
+      ++pWild;                       // Everything's a match, so far.
+      ++pTame;
+    } while (true);
+
+  // Find any further wildcards and any further matching sequences.
+  do
+    {
+      if (*pWild == '*')
+	{
+	  // Got wild again.
+	  while (*(++pWild) == '*')
+	    {
+	      continue;
+	    }
+	
+	  if (!*pWild)
+	    {
+	      return true;           // "ab*c*" matches "abcd".
+	    }
+	
+	  if (!*pTame)
+	    {
+	      return false;          // "*bcd*" doesn't match "abc".
+	    }
+	
+	  // Search for the next prospective match.
+	  if (*pWild != '?')
+	    {
+	      while (*pWild != *pTame)
+		{
+		  if (!*(++pTame))
+		    {
+		      return false;  // "a*b*c" doesn't match "ab".
+		    }
+		}
+	    }
+	
+	  // Keep the new fallback positions.
+	  pWildSequence = pWild;
+	  pTameSequence = pTame;
+	}
+      else if (*pWild != *pTame && *pWild != '?')
+	{
+	  // The equivalent portion of the upper loop is really simple.
+	  if (!*pTame)
+	    {
+	      return false;          // "*bcd" doesn't match "abc".
+	    }
+	
+	  // A fine time for questions.
+	  while (*pWildSequence == '?')
+	    {
+	      ++pWildSequence;
+	      ++pTameSequence;
+	    }
+	
+	  pWild = pWildSequence;
+	
+	  // Fall back, but never so far again.
+	  while (*pWild != *(++pTameSequence))
+	    {
+	      if (!*pTameSequence)
+		{
+		  return false;      // "*a*b" doesn't match "ac".
+		}
+	    }
+	
+	  pTame = pTameSequence;
+	}
+    
+      // Another check for the end, at the end.
+      if (!*pTame)
+	{
+	  if (!*pWild)
+	    {
+	      return true;           // "*bc" matches "abc".
+	    }
+	  else
+	    {
+	      return false;          // "*bc" doesn't match "abcd".
+	    }
+	}
+    
+      ++pWild;                       // Everything's still a match.
+      ++pTame;
+    } while (true);
+}
+
+/*
+ * MatchIndex
+ *
+ *  Subscription patterns compiled into a hash and a trie, so a
+ * datapoint name is matched against every subscriber in one pass
+ * instead of running FastWildCompare over every pattern of every
+ * client:
+ *
+ *   exact   no wildcards ("ain/vals"), or an EXACT match spec:
+ *           one hash lookup
+ *   prefix  a literal followed only by '*' ("ess/" then '*', or '*'
+ *           alone): hung on the trie node for the literal, so one walk
+ *           down the trie along the name finds them all, however many
+ *           prefixes are registered
+ *   glob    anything else ("ess/?_" then '*', '*' then "/init_error"):
+ *           hung on the trie node for its literal lead-in (the root if
+ *           it starts with a wildcard), so it is only tried for names
+ *           that share that lead-in; its literal tail is compared
+ *           before FastWildCompare is run at all
+ *
+ * Each registration is an (owner, pattern) pair with its own
+ * alert_every counter, exactly as a MatchSpec had.  As before, every
+ * registration that matches advances its counter, and an owner is
+ * reported once if any of its registrations fires.  Owners come back
+ * most specific first: exact, then by literal lead-in, longest first,
+ * a glob ahead of a prefix with the same lead-in ("ess/stat?s" before
+ * "ess/" then '*', and both before a bare '*'), and registration order
+ * among equals.
+ *
+ * Counters are atomic, so match() runs under a shared lock and
+ * concurrent matchers don't serialize; insert/remove take it
+ * exclusively.
+ */
+template <typename Owner>
+class MatchIndex
+{
+ private:
+  struct Sub {
+    Owner owner;
+    std::string matchstr;	/* as registered: the removal key */
+    std::string tail;		/* globs: literal text after the last '*' */
+    int alert_every;
+    std::atomic<int> count;
+    Sub(Owner o, const std::string &m, int every):
+      owner(o), matchstr(m), alert_every(every < 1 ? 1 : every), count(0) {}
+  };
+  typedef std::vector<std::unique_ptr<Sub>> subs_t;
+
+  struct Node {
+    std::unordered_map<char, std::unique_ptr<Node>> next;
+    subs_t subs;		/* prefix patterns ending here */
+    subs_t globs;		/* glob patterns whose lead-in ends here */
+  };
+
+  struct Hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const noexcept
+    { return std::hash<std::string_view>{}(s); }
+  };
+
+  enum kind_t { KIND_EXACT, KIND_PREFIX, KIND_GLOB };
+
+  std::unordered_map<std::string, subs_t, Hash, std::equal_to<>> exact_;
+  Node root_;
+  std::shared_mutex mutex_;
+
+  /* key: the whole name (exact) or the trie path (prefix, glob) */
+  static kind_t classify(const std::string &m, bool exact, std::string &key)
+  {
+    if (exact) { key = m; return KIND_EXACT; }
+
+    size_t wild = m.find_first_of("*?");
+    if (wild == std::string::npos) { key = m; return KIND_EXACT; }
+
+    key = m.substr(0, wild);
+    if (m.find_first_not_of('*', wild) == std::string::npos)
+      return KIND_PREFIX;
+    return KIND_GLOB;
+  }
+
+  static bool erase_sub(subs_t &subs, Owner owner, const std::string &m)
+  {
+    auto it = std::find_if(subs.begin(), subs.end(),
+			   [&](const std::unique_ptr<Sub> &s) {
+			     return s->owner == owner && s->matchstr == m;
+			   });
+    if (it == subs.end()) return false;
+    subs.erase(it);
+    return true;
+  }
+
+  static void erase_owner(subs_t &subs, Owner owner)
+  {
+    subs.erase(std::remove_if(subs.begin(), subs.end(),
+			      [&](const std::unique_ptr<Sub> &s) {
+				return s->owner == owner;
+			      }), subs.end());
+  }
+
+  static void erase_owner(Node &n, Owner owner)
+  {
+    erase_owner(n.subs, owner);
+    erase_owner(n.globs, owner);
+    for (auto &kv : n.next) erase_owner(*kv.second, owner);
+  }
+
+  /* drop trie nodes left with nothing on them or below them */
+  static bool prune(Node &n)
+  {
+    for (auto it = n.next.begin(); it != n.next.end(); ) {
+      if (prune(*it->second)) it = n.next.erase(it);
+      else ++it;
+    }
+    return n.subs.empty() && n.globs.empty() && n.next.empty();
+  }
+
+  Node *walk(const std::string &key, bool create)
+  {
+    Node *n = &root_;
+    for (char c : key) {
+      auto child = n->next.find(c);
+      if (child == n->next.end()) {
+	if (!create) return nullptr;
+	child = n->next.emplace(c, std::make_unique<Node>()).first;
+      }
+      n = child->second.get();
+    }
+    return n;
+  }
+
+  static void fire(Sub &s, std::vector<Owner> &owners)
+  {
+    if (s.count.fetch_add(1, std::memory_order_relaxed) % s.alert_every)
+      return;
+    if (std::find(owners.begin(), owners.end(), s.owner) == owners.end())
+      owners.push_back(s.owner);
+  }
+
+  static bool glob_match(Sub &s, const char *name, size_t len)
+  {
+    size_t tl = s.tail.size();
+    if (tl && (tl > len || memcmp(name + len - tl, s.tail.data(), tl)))
+      return false;
+    return FastWildCompare((char *) s.matchstr.c_str(), (char *) name);
+  }
+
+  bool remove_locked(Owner owner, const std::string &m)
+  {
+    bool removed = false;
+    std::string key;
+
+    /* the same pattern may have been registered as EXACT or not, so
+       look in the hash as well as where classify() would put it */
+    auto it = exact_.find(std::string_view(m));
+    if (it != exact_.end()) {
+      removed |= erase_sub(it->second, owner, m);
+      if (it->second.empty()) exact_.erase(it);
+    }
+
+    kind_t kind = classify(m, false, key);
+    if (kind == KIND_EXACT) return removed;
+
+    Node *n = walk(key, false);
+    if (n && erase_sub(kind == KIND_PREFIX ? n->subs : n->globs, owner, m)) {
+      removed = true;
+      prune(root_);
+    }
+    return removed;
+  }
+
+ public:
+  /* register pattern m for owner, replacing the same (owner, m) */
+  void insert(Owner owner, const std::string &m, bool exact, int every = 1)
+  {
+    std::string key;
+    kind_t kind = classify(m, exact, key);
+    auto sub = std::make_unique<Sub>(owner, m, every);
+
+    if (kind == KIND_GLOB) {
+      /* a '?' in the tail is fine, FastWildCompare still decides; only
+	 a purely literal tail can be used to reject early */
+      size_t star = m.find_last_of('*');
+      if (star != std::string::npos &&
+	  m.find('?', star) == std::string::npos)
+	sub->tail = m.substr(star + 1);
+    }
+
+    std::unique_lock<std::shared_mutex> mlock(mutex_);
+    remove_locked(owner, m);
+
+    switch (kind) {
+    case KIND_EXACT:
+      exact_[key].push_back(std::move(sub));
+      break;
+    case KIND_PREFIX:
+      walk(key, true)->subs.push_back(std::move(sub));
+      break;
+    case KIND_GLOB:
+      walk(key, true)->globs.push_back(std::move(sub));
+      break;
+    }
+  }
+
+  bool remove(Owner owner, const std::string &m)
+  {
+    std::unique_lock<std::shared_mutex> mlock(mutex_);
+    return remove_locked(owner, m);
+  }
+
+  /* everything registered by owner (client going away, or clear) */
+  void remove_owner(Owner owner)
+  {
+    std::unique_lock<std::shared_mutex> mlock(mutex_);
+    for (auto it = exact_.begin(); it != exact_.end(); ) {
+      erase_owner(it->second, owner);
+      if (it->second.empty()) it = exact_.erase(it);
+      else ++it;
+    }
+    erase_owner(root_, owner);
+    prune(root_);
+  }
+
+  void clear()
+  {
+    std::unique_lock<std::shared_mutex> mlock(mutex_);
+    exact_.clear();
+    root_.next.clear();
+    root_.subs.clear();
+    root_.globs.clear();
+  }
+
+  /*
+   * match
+   *
+   *  Append to owners (without duplicates) every owner with at least
+   * one registration that matches name and is due under its
+   * alert_every.  Returns the number appended.
+   */
+  int match(const char *name, std::vector<Owner> &owners)
+  {
+    size_t before = owners.size();
+    size_t len = strlen(name);
+    std::shared_lock<std::shared_mutex> mlock(mutex_);
+
+    auto it = exact_.find(std::string_view(name, len));
+    if (it != exact_.end())
+      for (auto &s : it->second) fire(*s, owners);
+
+    /* the trie nodes along the name, deepest (most specific) last */
+    static thread_local std::vector<Node *> path;
+    path.clear();
+    Node *n = &root_;
+    for (const char *p = name; n; p++) {
+      if (!n->subs.empty() || !n->globs.empty()) path.push_back(n);
+      if (!*p) break;
+      auto child = n->next.find(*p);
+      n = (child == n->next.end()) ? nullptr : child->second.get();
+    }
+
+    /* deepest first, and at each node the globs ahead of the plain
+       prefix: both share the lead-in, but the glob says more after it */
+    for (auto r = path.rbegin(); r != path.rend(); ++r) {
+      for (auto &s : (*r)->globs)
+	if (glob_match(*s, name, len)) fire(*s, owners);
+      for (auto &s : (*r)->subs) fire(*s, owners);
+    }
+
+    return (int) (owners.size() - before);
+  }
+
+  /* does any registration fire for name (all counters still advance) */
+  bool is_match(const char *name)
+  {
+    std::vector<Owner> owners;
+    return match(name, owners) > 0;
+  }
+
+  bool empty()
+  {
+    std::shared_lock<std::shared_mutex> mlock(mutex_);
+    return exact_.empty() && root_.next.empty() &&
+      root_.subs.empty() && root_.globs.empty();
+  }
+};
+
+#endif
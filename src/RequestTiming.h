@@ -23,6 +23,9 @@
  *     execution       = t_done    - t_dequeue   how long the work took
  *     utilization rho = sum(execution) / wall   how close to saturation
  *
+ *   Residency is also kept per queue lane (SharedQueue::set_lanes), the
+ *   number that shows whether one lane's traffic is waiting on another's.
+ *
  *   rho is the one that predicts trouble.  The queue has a single
  *   consumer, so wait time scales as rho/(1-rho): once the process
  *   thread approaches saturation a modest increase in per-request work
@@ -72,6 +75,7 @@ class RequestTiming
 {
 public:
   static const size_t NTYPES = 16;
+  static const size_t NLANES = 4;
 
   /*
    * Retained samples for percentile estimation.  8192 puts ~80 samples
@@ -89,7 +93,7 @@ public:
   {
     m_enabled = e;
     if (e) {
-      m_ring.assign(RING, sample_t{0, 0, 0});
+      m_ring.assign(RING, sample_t{0, 0, 0, 0});
       reset();
     }
     else {
@@ -111,10 +115,22 @@ public:
       m_type_count[i] = 0;
       m_type_exec_ns[i] = 0;
     }
+    for (size_t i = 0; i < NLANES; i++) {
+      m_lane_count[i] = 0;
+      m_lane_queue_ns[i] = 0;
+      m_lane_exec_ns[i] = 0;
+    }
+  }
+
+  /* names for the lanes in reports; unnamed lanes go by number */
+  void set_lane_names(const std::vector<std::string> &names)
+  {
+    m_lane_names = names;
   }
 
   void record(int type, const std::string &label,
-	      uint64_t t_enqueue, uint64_t t_dequeue, uint64_t t_done)
+	      uint64_t t_enqueue, uint64_t t_dequeue, uint64_t t_done,
+	      int lane = 0)
   {
     if (!m_enabled) return;
 
@@ -158,12 +174,18 @@ public:
       m_type_exec_ns[type] += x;
     }
 
+    if (lane < 0 || (size_t) lane >= NLANES) lane = 0;
+    m_lane_count[lane]++;
+    m_lane_queue_ns[lane] += q;
+    m_lane_exec_ns[lane] += x;
+
     if (m_ring.empty()) return;          // enabled but not yet allocated
 
     sample_t *s = &m_ring[m_head];
     s->queue_ns = clamp32(q);
     s->exec_ns = clamp32(x);
     s->type = (uint8_t) (type & 0xff);
+    s->lane = (uint8_t) lane;
 
     m_head = (m_head + 1) % m_ring.size();
     if (m_filled < m_ring.size()) m_filled++;
@@ -215,6 +237,38 @@ public:
     }
     out += "}";
 
+    out += " by_lane {" + lanes() + "}";
+
+    return out;
+  }
+
+  /*
+   * Residency per lane: percentiles from the retained ring, mean and
+   * totals over the window -- the state system's lane should stay flat
+   * however busy the GUI's is.
+   */
+  std::string lanes(void)
+  {
+    std::string out;
+    char buf[512];
+    for (size_t l = 0; l < NLANES; l++) {
+      if (!m_lane_count[l]) continue;
+      std::vector<uint32_t> q;
+      for (size_t i = 0; i < m_filled; i++)
+	if (m_ring[i].lane == l) q.push_back(m_ring[i].queue_ns);
+      std::sort(q.begin(), q.end());
+
+      std::string name = (l < m_lane_names.size()) ? m_lane_names[l] :
+	std::to_string(l);
+      snprintf(buf, sizeof(buf),
+	       "%s {n %llu queue_us {mean %.1f p50 %.1f p95 %.1f p99 %.1f "
+	       "max %.1f} exec_ms %.3f} ",
+	       name.c_str(), (unsigned long long) m_lane_count[l],
+	       (double) m_lane_queue_ns[l] / (double) m_lane_count[l] / 1000.0,
+	       pct(q, 0.50), pct(q, 0.95), pct(q, 0.99), pct(q, 1.0),
+	       (double) m_lane_exec_ns[l] / 1e6);
+      out += buf;
+    }
     return out;
   }
 
@@ -264,6 +318,7 @@ private:
     uint32_t queue_ns;
     uint32_t exec_ns;
     uint8_t type;
+    uint8_t lane;
   } sample_t;
 
   typedef struct agg_s {
@@ -305,6 +360,10 @@ private:
   uint64_t m_window_start = 0;
   uint64_t m_type_count[NTYPES];
   uint64_t m_type_exec_ns[NTYPES];
+  uint64_t m_lane_count[NLANES];
+  uint64_t m_lane_queue_ns[NLANES];
+  uint64_t m_lane_exec_ns[NLANES];
+  std::vector<std::string> m_lane_names;
 };
 
 #endif
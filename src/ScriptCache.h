@@ -0,0 +1,154 @@
+#ifndef SCRIPTCACHE_H
+#define SCRIPTCACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <tcl.h>
+
+/*
+ * ScriptCache
+ *
+ *   script text -> a Tcl_Obj holding it, for the request paths that
+ *   evaluate whatever text a client sent (REQ_SCRIPT and friends).
+ *
+ *   Those used Tcl_Eval, which parses the text and runs it word by word
+ *   every time.  The clients that talk to us most -- dashboards, essqt,
+ *   dservctl -- send the same few polling scripts over and over, so here
+ *   a script seen before is evaluated with Tcl_EvalObjEx on an object
+ *   that is kept: Tcl compiles it once and leaves the bytecode in the
+ *   object for next time.
+ *
+ *   Staleness is Tcl's to judge, not ours.  Before running saved
+ *   bytecode Tcl checks it against the interp's compile epoch (bumped
+ *   when a command it compiled inline, or a namespace it resolved in,
+ *   changes) and recompiles if need be; calls to procs are looked up by
+ *   name at run time, so a redefined proc takes effect at once.  flush()
+ *   is for letting the memory go.
+ *
+ *   A script is only compiled the second time it is seen: the first
+ *   time it is just remembered and run with Tcl_EvalEx as before, so
+ *   one-off scripts (a dservSet carrying its data, say) never pay for a
+ *   compile they won't reuse.  Texts longer than max_script are never
+ *   kept.  At most capacity texts are remembered, least recently used
+ *   going first; capacity 0 turns the cache off.
+ *
+ *   Tcl_Objs belong to the thread that made them: one of these lives on
+ *   each TclServer and only its process thread touches it (dservTiming
+ *   and dservScriptCache run there too).
+ */
+
+class ScriptCache
+{
+  struct entry_t {
+    std::string script;
+    Tcl_Obj *obj = nullptr;		/* null until seen a second time */
+  };
+  std::list<entry_t> lru_;		/* most recently used first */
+  std::unordered_map<std::string_view,
+		     std::list<entry_t>::iterator> index_;
+  size_t capacity_;
+
+  void drop(std::list<entry_t>::iterator iter)
+  {
+    if (iter->obj) Tcl_DecrRefCount(iter->obj);
+    index_.erase(std::string_view(iter->script));
+    lru_.erase(iter);
+  }
+
+ public:
+  static const size_t DEFAULT_CAPACITY = 256;
+  static const size_t max_script = 16 * 1024;
+
+  uint64_t hits = 0;			/* run from a kept object */
+  uint64_t misses = 0;			/* run from text */
+  uint64_t compiles = 0;		/* objects made (second sightings) */
+  uint64_t evictions = 0;
+
+  ScriptCache(size_t capacity = DEFAULT_CAPACITY) : capacity_(capacity) {}
+  ScriptCache(const ScriptCache &) = delete;
+  ScriptCache &operator=(const ScriptCache &) = delete;
+  ~ScriptCache(void) { flush(); }
+
+  void flush(void)
+  {
+    for (auto &entry : lru_)
+      if (entry.obj) Tcl_DecrRefCount(entry.obj);
+    index_.clear();
+    lru_.clear();
+  }
+
+  void reset_counters(void) { hits = misses = compiles = evictions = 0; }
+
+  size_t size(void) const { return lru_.size(); }
+  size_t capacity(void) const { return capacity_; }
+
+  void set_capacity(size_t capacity)
+  {
+    capacity_ = capacity;
+    while (lru_.size() > capacity_) {
+      drop(std::prev(lru_.end()));
+      evictions++;
+    }
+  }
+
+  /* evaluate script at the global level, as Tcl_Eval(interp, script) */
+  int eval(Tcl_Interp *interp, const std::string &script)
+  {
+    if (!capacity_ || script.size() > max_script) {
+      misses++;
+      return Tcl_EvalEx(interp, script.data(), script.size(), 0);
+    }
+
+    auto found = index_.find(std::string_view(script));
+    if (found == index_.end()) {
+      if (lru_.size() >= capacity_) {
+	drop(std::prev(lru_.end()));
+	evictions++;
+      }
+      lru_.push_front(entry_t{ script, nullptr });
+      index_.emplace(std::string_view(lru_.front().script), lru_.begin());
+      misses++;
+      return Tcl_EvalEx(interp, script.data(), script.size(), 0);
+    }
+
+    auto iter = found->second;
+    if (iter != lru_.begin()) lru_.splice(lru_.begin(), lru_, iter);
+    if (!iter->obj) {
+      iter->obj = Tcl_NewStringObj(script.data(), script.size());
+      Tcl_IncrRefCount(iter->obj);
+      compiles++;
+    }
+    else hits++;
+
+    /* our own reference for the eval: the script could flush us */
+    Tcl_Obj *obj = iter->obj;
+    Tcl_IncrRefCount(obj);
+    int rc = Tcl_EvalObjEx(interp, obj, 0);
+    Tcl_DecrRefCount(obj);
+    return rc;
+  }
+
+  /* for dservTiming scripts; hit_rate is hits / (hits + misses), the
+     compiles (second sightings) being neither */
+  std::string report(void) const
+  {
+    char buf[256];
+    uint64_t runs = hits + misses;
+    snprintf(buf, sizeof(buf),
+	     "size %zu capacity %zu hits %llu misses %llu compiles %llu "
+	     "evictions %llu hit_rate %.3f",
+	     lru_.size(), capacity_, (unsigned long long) hits,
+	     (unsigned long long) misses, (unsigned long long) compiles,
+	     (unsigned long long) evictions,
+	     runs ? (double) hits / (double) runs : 0.0);
+    return buf;
+  }
+};
+
+#endif
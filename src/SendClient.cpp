@@ -41,8 +41,21 @@
 #include <fcntl.h>
 
 #include "SendClient.h"
+#include "FanoutServer.h"
 #include <errno.h>
 
+/* LATEST queue clients: how far ahead of their consumer to run */
+static const int QUEUE_LATEST_AHEAD = 64;
+
+/* pooled socket clients: how long a write may go without moving a
+   byte before the client is taken for gone (the thread's six 5 s
+   send timeouts) */
+static const auto STALL_LIMIT = std::chrono::seconds(30);
+
+/* points one pump() takes, so a busy client can't starve the other
+   clients on its worker */
+static const size_t PUMP_POINTS = 1024;
+
 SendClient::SendClient(int socket, char *hoststr, int port, uint8_t flags):
     port(port), fd(socket)
   {
@@ -53,6 +66,9 @@ SendClient::SendClient(int socket, char *hoststr, int port, uint8_t flags):
     send_binary = binary;
     send_json = json;
     shutdown_dpoint.flags = DSERV_DPOINT_SHUTDOWN_FLAG;
+    /* a stalled subscriber must not pin memory without bound */
+    policy.limit = DEFAULT_SOCKET_LIMIT;
+    bound_queue();
   }
 
 SendClient::SendClient(SharedQueue<client_request_t> *client_queue):
@@ -60,6 +76,45 @@ SendClient::SendClient(SharedQueue<client_request_t> *client_queue):
 {
   type = QUEUE_CLIENT;
   shutdown_dpoint.flags = DSERV_DPOINT_SHUTDOWN_FLAG;
+  bound_queue();
+}
+
+SendClient::SendClient(std::function<void(ds_datapoint_t *)> sink):
+  sink(std::move(sink))
+{
+  type = SINK_CLIENT;
+  shutdown_dpoint.flags = DSERV_DPOINT_SHUTDOWN_FLAG;
+  bound_queue();
+}
+
+/*
+ * The policy is what normally keeps dpoint_queue short; this is the
+ * backstop for a policy that doesn't (all with no limit): past it
+ * points are dropped and counted as the policy's own drops are.  The
+ * shutdown, LATEST and RATE markers are always queued.
+ */
+void SendClient::bound_queue(void)
+{
+  dpoint_queue.set_overflow_limit(dpoint_queue.OVERFLOW_LIMIT,
+    [this](ds_datapoint_t *&dpoint) {
+      if (dpoint == &latest_dpoint || dpoint == &rate_dpoint ||
+	  (dpoint->flags & DSERV_DPOINT_MARKER_FLAGS)) return false;
+      dpoint_free(dpoint);
+      backlog--;
+      dropped++;
+      return true;
+    });
+}
+
+/*
+ * deactivate
+ *
+ *  Mark the client bad, once, and tell its SendTable, whose next
+ * forward_dpoint then reaps it.
+ */
+void SendClient::deactivate(void)
+{
+  if (active.exchange(0) && inactive_count) (*inactive_count)++;
 }
 
 SendClient::~SendClient()
@@ -72,144 +127,544 @@ SendClient::~SendClient()
 #endif
     free(host);
   }
+  for (auto dp : latest) dpoint_free(dp);
+  for (auto &[name, slot] : rate_slots)
+    if (slot.held) dpoint_free(slot.held);
   //    std::cout << "SendClient shutdown" << std::endl;
 }
 
-int SendClient::send_dpoint(ds_datapoint_t *dpoint)
+bool SendPolicy::parse(const char *str, SendPolicy *policy)
 {
-  int nwritten;
-  
-  if (send_binary) {
-    int bufsize = DPOINT_BINARY_FIXED_LENGTH - 1;
+  SendPolicy p;
+  const char *arg = strchr(str, ':');
+  size_t len = arg ? (size_t) (arg - str) : strlen(str);
+  char *end;
 
-    unsigned char buf[DPOINT_BINARY_FIXED_LENGTH];
-    buf[0] = DPOINT_BINARY_MSG_CHAR;
-    if (dpoint_to_binary(dpoint, &buf[1], &bufsize)) {
-#ifndef _MSC_VER
-      /* A SEND TIMEOUT IS NOT A DEAD PEER, and conflating them broke OTA.
-       *
-       * This used to be an unconditional `active = 0` on any short write, with an
-       * EMPTY `if (nwritten == -1) {}` block where the errno test belonged. That
-       * was harmless while the socket had no SO_SNDTIMEO: write() blocked as long
-       * as the consumer needed and eventually succeeded. Adding a 5 s send timeout
-       * (Dataserver.cpp, to reap vanished boxes) turned every SLOW consumer into a
-       * reaped one -- and an OTA target is slow BY DEFINITION, because it writes
-       * flash between chunks. Symptom: the box's session dies seconds into
-       * staging, the next host write fails, and the OTA reports host_io with
-       * progress=0 while the box itself is perfectly healthy. It then cannot
-       * re-register (dserv's connect-back is one-shot) so it looks dead until
-       * power-cycled. Diagnosed 2026-07-30 after it killed two boxes in a row.
-       *
-       * EAGAIN/EWOULDBLOCK after SO_SNDTIMEO means "the buffer is full and the
-       * peer has not drained it yet" -- transient. Retry, bounded, so a genuinely
-       * wedged peer cannot park this thread forever. Detecting a truly dead peer
-       * is TCP_USER_TIMEOUT's job (socket_keepalive.h): it fires on data that goes
-       * unacknowledged, which is the actual signal for "gone", and it is what the
-       * leak fix should have relied on for this case all along.
-       *
-       * Only a HARD error (EPIPE, ECONNRESET, ...) or a persistent stall reaps the
-       * client now. Each SendClient has its own thread, so the retry delays only
-       * this consumer and never dserv as a whole.
-       */
-      int tries = 0;
-      for (;;) {
-	nwritten = write(fd, buf, DPOINT_BINARY_FIXED_LENGTH);
-	if (nwritten == DPOINT_BINARY_FIXED_LENGTH) {
-	  break;
-	}
-	if (nwritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
-	  if (++tries < 6) {         /* ~30 s at the 5 s SO_SNDTIMEO */
-	    continue;
-	  }
+  if (len == 3 && !strncmp(str, "all", 3)) p.mode = ALL;
+  else if (len == 6 && !strncmp(str, "latest", 6) && !arg) p.mode = LATEST;
+  else if (len == 4 && !strncmp(str, "rate", 4) && arg) p.mode = RATE;
+  else return false;
+
+  if (arg) {
+    long n = strtol(arg + 1, &end, 10);
+    if (end == arg + 1 || *end || n < 0 || n > INT32_MAX ||
+	(p.mode == RATE && n == 0))
+      return false;
+    p.limit = (int) n;
+  }
+  *policy = p;
+  return true;
+}
+
+std::string SendPolicy::to_string(void) const
+{
+  switch (mode) {
+  case LATEST: return "latest";
+  case RATE: return "rate:" + std::to_string(limit);
+  default: return limit ? "all:" + std::to_string(limit) : "all";
+  }
+}
+
+/*
+ * offer
+ *
+ *  Hand a matched point to this client according to its policy.  Runs
+ * under the SendTable lock; takes its own reference to anything it
+ * keeps.
+ */
+void SendClient::offer(ds_datapoint_t *dpoint)
+{
+  switch (policy.mode) {
+  case SendPolicy::LATEST:
+    {
+      std::unique_lock<std::mutex> lock(latest_mutex);
+      auto slot = latest_slot.find(dpoint->varname);
+      if (slot != latest_slot.end()) {
+	dpoint_free(latest[slot->second]);
+	latest[slot->second] = dpoint_ref(dpoint);
+	conflated++;
+	return;
+      }
+      latest_slot.emplace(dpoint->varname, latest.size());
+      latest.push_back(dpoint_ref(dpoint));
+      bool wake = latest.size() == 1;
+      lock.unlock();
+      /* one marker per empty -> non-empty; the thread takes them all */
+      if (wake) push(&latest_dpoint);
+      return;
+    }
+  case SendPolicy::RATE:
+    {
+      int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>
+	(std::chrono::steady_clock::now().time_since_epoch()).count();
+      std::unique_lock<std::mutex> lock(rate_mutex);
+      auto &slot = rate_slots[dpoint->varname];
+      if (now >= slot.next) {
+	/* due: this goes now, and anything still held is older */
+	if (slot.held) {
+	  dpoint_free(slot.held);
+	  slot.held = nullptr;
+	  rate_held--;
+	  conflated++;
 	}
-	active = 0;                  /* hard error, short write, or a real stall */
+	slot.last = now;
+	slot.next = now + 1000000000LL / policy.limit;
 	break;
       }
-#else
-      nwritten = send(fd, (const char *) buf, DPOINT_BINARY_FIXED_LENGTH, 0);
-      if (nwritten != DPOINT_BINARY_FIXED_LENGTH) {
-	active = 0;
+      bool wake = false;
+      if (slot.held) {
+	dpoint_free(slot.held);
+	conflated++;
       }
-#endif
+      else wake = rate_held++ == 0;
+      slot.held = dpoint_ref(dpoint);
+      lock.unlock();
+      /* as for LATEST: one marker per none held -> some held */
+      if (wake) push(&rate_dpoint);
+      return;
+    }
+  case SendPolicy::ALL:
+    if (policy.limit) {
+      /* a queue client's backlog is mostly in its client_queue */
+      int waiting = backlog + (client_queue ? client_queue->size() : 0);
+      if (waiting >= policy.limit) {
+	dropped++;
+	return;
+      }
+    }
+    break;
+  }
+
+  /* a reference, not a copy: the point is shared and immutable */
+  backlog++;
+  push(dpoint_ref(dpoint));
+}
+
+/*
+ * push
+ *
+ *  Queue a point (or the shutdown/LATEST markers) for this client.  A
+ * client with a thread is woken by the queue itself; a pooled one is
+ * put on its worker's ready list, once per drain however many points
+ * follow.
+ */
+void SendClient::push(ds_datapoint_t *dpoint)
+{
+  dpoint_queue.push_back(dpoint);
+  if (fanout && !scheduled.exchange(true))
+    fanout->schedule(this);
+}
+
+/*
+ * take_rate
+ *
+ *  The sending side of RATE: the held values whose interval is up, each
+ * counting as that varname's send.  What is still held sets rate_due,
+ * the soonest of them, and rate_waiting, for the caller to come back
+ * then: nothing else will prompt it, as offer() queues rate_dpoint
+ * only when it holds the first value.
+ */
+void SendClient::take_rate(std::vector<ds_datapoint_t *> &points)
+{
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>
+    (std::chrono::steady_clock::now().time_since_epoch()).count();
+  int64_t first = INT64_MAX;
+
+  std::lock_guard<std::mutex> lock(rate_mutex);
+  for (auto &[name, slot] : rate_slots) {
+    if (!slot.held) continue;
+    if (now >= slot.next) {
+      points.push_back(slot.held);
+      slot.held = nullptr;
+      rate_held--;
+      slot.next = now + (slot.next - slot.last);
+      slot.last = now;
+    }
+    else if (slot.next < first) first = slot.next;
+  }
+  rate_waiting = first != INT64_MAX;
+  if (rate_waiting)
+    rate_due = std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::nanoseconds(first)));
+}
+
+/* a new policy: held values are due at once, the rest are forgotten */
+void SendClient::reset_rate(void)
+{
+  std::lock_guard<std::mutex> lock(rate_mutex);
+  for (auto it = rate_slots.begin(); it != rate_slots.end(); ) {
+    if (!it->second.held) it = rate_slots.erase(it);
+    else {
+      it->second.last = it->second.next = 0;
+      ++it;
     }
   }
+}
+
+/* the send thread's side of LATEST: everything waiting, oldest name first */
+void SendClient::take_latest(std::vector<ds_datapoint_t *> &points)
+{
+  std::lock_guard<std::mutex> lock(latest_mutex);
+  points.swap(latest);
+  latest.clear();
+  latest_slot.clear();
+}
+
+/*
+ * deliver
+ *
+ *  Pass one point on: staged for a socket client (or dropped, once it
+ * has gone bad), forwarded to a queue client's consumer, handed to a
+ * sink client's sink.  Either way the reference is passed on or
+ * released.
+ */
+void SendClient::deliver(ds_datapoint_t *dpoint)
+{
+  if (type == SOCKET_CLIENT) {
+    if (active) stage_dpoint(dpoint);
+    dpoint_free(dpoint);
+  }
+  else if (type == QUEUE_CLIENT) {
+    if (client_queue) {
+      /* the client is reponsible for freeing the dpoint */
+      client_request_t client_request;
+      client_request.type = REQ_DPOINT_SCRIPT;
+      client_request.dpoint = dpoint;
+      client_request.source = SRC_DPOINT;
+      client_queue->push_back(client_request);
+    }
+    else dpoint_free(dpoint);
+  }
+  else if (sink) sink(dpoint);
+  else dpoint_free(dpoint);
+}
+
+/*
+ * stage_dpoint
+ *
+ *  Serialize a point onto the end of stage in this client's format:
+ * a padded '>' frame (binary), dpoint_to_string's text or JSON, each
+ * of the last two followed by a newline.  Nothing is written here.
+ */
+void SendClient::stage_dpoint(ds_datapoint_t *dpoint)
+{
+  size_t len = stage.size();
+
+  if (send_binary) {
+    int bufsize = DPOINT_BINARY_FIXED_LENGTH - 1;
+
+    stage.resize(len + DPOINT_BINARY_FIXED_LENGTH);
+    stage[len] = DPOINT_BINARY_MSG_CHAR;
+    if (!dpoint_to_binary(dpoint, (unsigned char *) &stage[len + 1],
+			  &bufsize)) {
+      stage.resize(len);	/* too big for a frame: never was sent */
+      return;
+    }
+  }
+
+  /* original send format */
+  else if (!send_json) {
+    int dstring_bufsize = dpoint_string_size(dpoint);
+    stage.resize(len + dstring_bufsize);
+    int dstring_size = dpoint_to_string(dpoint, &stage[len], dstring_bufsize);
+    stage.resize(len + dstring_size);
+    stage.push_back('\n');
+  }
+
+  /* send dpoint as JSON */
   else {
-    iovec iov[2];
-    char newline_buf[2] = "\n";
-    char buf[128], *dstring_buf;
-    int dstring_bufsize, dstring_size, dstring_alloc;
-    
-    /* original send format */
-    if (!send_json) {
-      dstring_bufsize = dpoint_string_size(dpoint);
-      if (dstring_bufsize < sizeof(buf)) {
-	dstring_size = dpoint_to_string(dpoint, buf, sizeof(buf));
-	iov[0].iov_base = buf;
-	iov[0].iov_len = dstring_size;
-	iov[1].iov_base = newline_buf;
-	iov[1].iov_len = 1;
-	dstring_alloc = 0;
-      }
-      /* Still some concern about below... */
-      else {
-	dstring_buf = (char *) malloc(dstring_bufsize);
-	dstring_size = dpoint_to_string(dpoint, dstring_buf, dstring_bufsize);
-	iov[0].iov_base = dstring_buf;
-	iov[0].iov_len = dstring_size;
-	iov[1].iov_base = newline_buf;
-	iov[1].iov_len = 1;
-	dstring_alloc = 1;
-      }
+    char *dstring_buf;
+    if ((dstring_buf = dpoint_to_json(dpoint))) {
+      stage.append(dstring_buf);
+      free(dstring_buf);
     }
-    /* send dpoint as JSON */
     else {
-      if ((dstring_buf = dpoint_to_json(dpoint))) {
-	dstring_size = strlen(dstring_buf);
-	iov[0].iov_base = dstring_buf;
-	iov[0].iov_len = dstring_size;
-	iov[1].iov_base = newline_buf;
-	iov[1].iov_len = 1;
-	dstring_alloc = 1;
-      }
-      else {
-	/* should never happen? */
-	const char s[] = "json";
-	iov[0].iov_base = (void *) s;
-	iov[0].iov_len = strlen(s);
-	iov[1].iov_base = newline_buf;
-	iov[1].iov_len = 1;
-	dstring_alloc = 0;
+      /* should never happen? */
+      stage.append("json");
+    }
+    stage.push_back('\n');
+  }
+  staged++;
+}
+
+/*
+ * flush_stage
+ *
+ *  Write everything staged in one go.  Returns active.
+ */
+int SendClient::flush_stage(void)
+{
+  size_t off = 0, n = stage.size();
+  int nwritten;
+
+  if (!n) return active;
+
+#ifndef _MSC_VER
+  /* A SEND TIMEOUT IS NOT A DEAD PEER, and conflating them broke OTA.
+   *
+   * This used to be an unconditional `active = 0` on any short write, with an
+   * EMPTY `if (nwritten == -1) {}` block where the errno test belonged. That
+   * was harmless while the socket had no SO_SNDTIMEO: write() blocked as long
+   * as the consumer needed and eventually succeeded. Adding a 5 s send timeout
+   * (Dataserver.cpp, to reap vanished boxes) turned every SLOW consumer into a
+   * reaped one -- and an OTA target is slow BY DEFINITION, because it writes
+   * flash between chunks. Symptom: the box's session dies seconds into
+   * staging, the next host write fails, and the OTA reports host_io with
+   * progress=0 while the box itself is perfectly healthy. It then cannot
+   * re-register (dserv's connect-back is one-shot) so it looks dead until
+   * power-cycled. Diagnosed 2026-07-30 after it killed two boxes in a row.
+   *
+   * EAGAIN/EWOULDBLOCK after SO_SNDTIMEO means "the buffer is full and the
+   * peer has not drained it yet" -- transient. Retry, bounded, so a genuinely
+   * wedged peer cannot park this thread forever. Detecting a truly dead peer
+   * is TCP_USER_TIMEOUT's job (socket_keepalive.h): it fires on data that goes
+   * unacknowledged, which is the actual signal for "gone", and it is what the
+   * leak fix should have relied on for this case all along.
+   *
+   * Only a HARD error (EPIPE, ECONNRESET, ...) or a persistent stall reaps the
+   * client now. Each SendClient has its own thread, so the retry delays only
+   * this consumer and never dserv as a whole.
+   *
+   * The same goes for every format -- the string and JSON clients (essgui,
+   * plain socket subscribers) have exactly the same right not to be reaped
+   * for being briefly slow.  A stage holds many points, so a write that
+   * the timeout cuts short is simply continued where it stopped; the
+   * retry budget is for writes that move nothing at all.
+   */
+  int tries = 0;
+  while (off < n) {
+    nwritten = write(fd, stage.data() + off, n - off);
+    if (nwritten > 0) {
+      off += nwritten;
+      tries = 0;
+      continue;
+    }
+    if (nwritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      if (++tries < 6) {         /* ~30 s at the 5 s SO_SNDTIMEO */
+	continue;
       }
     }
-    
-    /* Same slow-consumer-is-not-a-dead-consumer fix as the binary path above --
-     * see that comment for why. This path had the identical unconditional
-     * `active = 0` with the identical empty errno block, and it feeds the string
-     * and JSON clients (essgui, plain socket subscribers), which have exactly the
-     * same right not to be reaped for being briefly slow. Fixed together on
-     * purpose: an hour earlier the same day, fixing one of two identical build
-     * matchers and leaving its twin alone cost a debugging round. */
-    {
-      int tries = 0;
-      for (;;) {
-	nwritten = writev(fd, (const struct iovec *) iov, 2);
-	if (nwritten == dstring_size + 1) {
-	  break;
+    deactivate();                /* hard error or a real stall */
+    break;
+  }
+#else
+  while (off < n) {
+    nwritten = send(fd, stage.data() + off, (int) (n - off), 0);
+    if (nwritten <= 0) {
+      deactivate();
+      break;
+    }
+    off += nwritten;
+  }
+#endif
+
+  points_sent += staged;
+  bytes_sent += off;
+  batches++;
+  staged = 0;
+  stage.clear();
+  return active;
+}
+
+/*
+ * write_stage
+ *
+ *  flush_stage() for a pooled client's non-blocking socket: write as
+ * much of the stage as the socket will take now.  Returns 1 once the
+ * stage is written, 0 if the rest has to wait for the socket to drain,
+ * and -1 if the client has gone bad (the stage is dropped).  As in
+ * flush_stage, a full socket buffer is not an error -- only a hard
+ * error, or STALL_LIMIT without a byte moving, is.
+ */
+int SendClient::write_stage(void)
+{
+  auto now = std::chrono::steady_clock::now();
+  int nwritten;
+
+  if (stage_off == 0) stalled_since = now;
+
+  while (stage_off < stage.size()) {
+#ifndef _MSC_VER
+    nwritten = write(fd, stage.data() + stage_off, stage.size() - stage_off);
+#else
+    nwritten = send(fd, stage.data() + stage_off,
+		    (int) (stage.size() - stage_off), 0);
+#endif
+    if (nwritten > 0) {
+      stage_off += nwritten;
+      bytes_sent += nwritten;
+      stalled_since = now;
+      continue;
+    }
+    if (nwritten == -1 && errno == EINTR) continue;
+    if (nwritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+	now - stalled_since < STALL_LIMIT)
+      return 0;
+    deactivate();		/* hard error or a real stall */
+    break;
+  }
+
+  points_sent += staged;
+  batches++;
+  staged = 0;
+  stage.clear();
+  stage_off = 0;
+  last_flush = now;
+  return active ? 1 : -1;
+}
+
+/*
+ * pump
+ *
+ *  A pooled client's turn on its FanoutServer worker: the body of
+ * send_client_process's loop, minus everything that would block.
+ * Takes what is queued -- up to a stage's worth, the rest waits in
+ * dpoint_queue where the policy bounds it -- and writes what the
+ * socket will take.  Where the thread would sleep this returns
+ * instead, saying what to wait for: PUMP_WRITABLE (the socket to
+ * drain, or *due to give up on it), PUMP_TIMER (*due: flush_us, or a
+ * LATEST queue client's consumer to catch up), PUMP_AGAIN (more is
+ * queued than one turn takes), PUMP_IDLE (the next push) or
+ * PUMP_IDLE_UNTIL (the next push, or *due for held RATE values).
+ * PUMP_DONE: shutdown seen and handled, the worker can let go.
+ */
+SendClient::pump_result
+SendClient::pump(std::chrono::steady_clock::time_point *due)
+{
+  static thread_local std::vector<ds_datapoint_t *> batch, pending;
+  size_t taken = 0;
+  bool empty = false, held = false;
+
+  if (rate_waiting && std::chrono::steady_clock::now() >= rate_due) {
+    pending.clear();
+    take_rate(pending);
+    for (auto dp : pending) deliver(dp);
+  }
+
+  for (;;) {
+    while (!done && !held && stage_off == 0 && stage.size() < MAX_STAGE &&
+	   taken < PUMP_POINTS) {
+      batch.clear();
+      if (!dpoint_queue.try_pop_all(batch, 64)) {
+	empty = true;
+	break;
+      }
+      taken += batch.size();
+
+      size_t i;
+      for (i = 0; i < batch.size() && !done; i++) {
+	ds_datapoint_t *dpoint = batch[i];
+
+	if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
+	  done = true;
 	}
-	if (nwritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
-	  if (++tries < 6) {
-	    continue;
+
+	/* LATEST: as in send_client_process, but the wait is a timer */
+	else if (dpoint == &latest_dpoint) {
+	  if (type == QUEUE_CLIENT && client_queue &&
+	      client_queue->size() > QUEUE_LATEST_AHEAD &&
+	      latest_waits < 1000) {
+	    latest_waits++;
+	    held = true;
+	    dpoint_queue.push_back(&latest_dpoint);
+	  }
+	  else {
+	    latest_waits = 0;
+	    pending.clear();
+	    take_latest(pending);
+	    for (auto dp : pending) deliver(dp);
 	  }
 	}
-	active = 0;
-	break;
+
+	else if (dpoint == &rate_dpoint) {
+	  pending.clear();
+	  take_rate(pending);
+	  for (auto dp : pending) deliver(dp);
+	}
+
+	else {
+	  backlog--;
+	  deliver(dpoint);
+	}
+      }
+      for (; i < batch.size(); i++) {
+	if (!(batch[i]->flags & DSERV_DPOINT_SHUTDOWN_FLAG) &&
+	    batch[i] != &latest_dpoint && batch[i] != &rate_dpoint)
+	  dpoint_free(batch[i]);
+      }
+    }
+
+    if (type != SOCKET_CLIENT || stage.empty()) break;
+
+    auto now = std::chrono::steady_clock::now();
+    auto flush_due = last_flush + std::chrono::microseconds(flush_us.load());
+    if (stage_off == 0 && !done && stage.size() < MAX_STAGE &&
+	now < flush_due) {
+      *due = (rate_waiting && rate_due < flush_due) ? rate_due : flush_due;
+      return PUMP_TIMER;
+    }
+
+    if (write_stage() == 0) {
+      if (!done) {
+	*due = stalled_since + STALL_LIMIT;
+	return PUMP_WRITABLE;
       }
+      /* going away: what the socket didn't take now is dropped */
+      staged = 0;
+      stage.clear();
+      stage_off = 0;
     }
+    if (done || empty || taken >= PUMP_POINTS) break;
+  }
 
-    /* if we allocated the buffer, free here */
-    if (dstring_alloc) free(dstring_buf);
+  if (done) {
+    end_of_stream();
+    return PUMP_DONE;
+  }
+  if (held) {
+    *due = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+    return PUMP_TIMER;
+  }
+  if (empty && rate_waiting) {
+    *due = rate_due;
+    return PUMP_IDLE_UNTIL;
+  }
+  return empty ? PUMP_IDLE : PUMP_AGAIN;
+}
+
+/*
+ * end_of_stream
+ *
+ *  A queue client's final touch of its client_queue: the queue's owner
+ * may free it only after receiving REQ_QUEUE_EOS (consumers that never
+ * tear their queue down just ignore it).
+ */
+void SendClient::end_of_stream(void)
+{
+  if (type == QUEUE_CLIENT && client_queue) {
+    client_request_t eos_request;
+    eos_request.type = REQ_QUEUE_EOS;
+    eos_request.source = SRC_DPOINT;	/* behind our deliveries, same lane */
+    client_queue->push_back(eos_request);
   }
-  return active;
+}
+
+int SendClient::send_dpoint(ds_datapoint_t *dpoint)
+{
+  stage_dpoint(dpoint);
+  return flush_stage();
+}
+
+/* settings and counters, see SendTable::buffering */
+void SendClient::io_info(send_client_io_t *info)
+{
+  info->flush_us = flush_us;
+  info->points = points_sent;
+  info->batches = batches;
+  info->bytes = bytes_sent;
+  info->dropped = dropped;
+  info->conflated = conflated;
 }
 
 void SendClient::send_client_process(std::shared_ptr<SendClient> sendclient)
@@ -217,43 +672,118 @@ void SendClient::send_client_process(std::shared_ptr<SendClient> sendclient)
   ds_datapoint_t *dpoint;
   bool done = false;
 
+  /*
+   * Socket clients: whatever has queued up is staged in one buffer and
+   * written with one write(), so a subscriber to a few kHz of points
+   * gets a few large segments rather than a segment per point.  This
+   * adds no latency by itself -- a lone point is written as soon as it
+   * is popped.  With flush_us set, a batch that comes sooner than that
+   * after the last write, and finds the queue empty, waits out the
+   * rest of the interval (picking up what arrives meanwhile); staged
+   * points never wait longer than that, and a stage past MAX_STAGE is
+   * written at once.
+   */
+  std::vector<ds_datapoint_t *> batch, pending;
+  auto last_flush = std::chrono::steady_clock::now();
+
+  auto deliver = [&sendclient](ds_datapoint_t *dpoint) {
+    sendclient->deliver(dpoint);
+    if (sendclient->type == SOCKET_CLIENT &&
+	sendclient->stage.size() >= MAX_STAGE)
+      sendclient->flush_stage();
+  };
+
   /* process until receive a message saying we are done */
   while (!done) {
-    dpoint = sendclient->dpoint_queue.front();
-    sendclient->dpoint_queue.pop_front();
-
-    /* check for shutdown */
-    if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
-      done = true;
+    batch.clear();
+    if (sendclient->rate_waiting) {
+      /* RATE values are held until rate_due: wait for that, or a point */
+      auto now = std::chrono::steady_clock::now();
+      while (!sendclient->dpoint_queue.size() && now < sendclient->rate_due) {
+	std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>
+				    (std::chrono::milliseconds(1),
+				     sendclient->rate_due - now));
+	now = std::chrono::steady_clock::now();
+      }
+      if (now >= sendclient->rate_due) {
+	pending.clear();
+	sendclient->take_rate(pending);
+	for (auto dp : pending) deliver(dp);
+      }
+      sendclient->dpoint_queue.try_pop_all(batch, sendclient->dpoint_queue.DRAIN_MAX);
     }
-    else {
-      if (sendclient->type == SOCKET_CLIENT) {
-	auto result = sendclient->send_dpoint(dpoint);
-	dpoint_free(dpoint);
+    else sendclient->dpoint_queue.pop_all(batch);
+
+    size_t i;
+    for (i = 0; i < batch.size() && !done; i++) {
+      dpoint = batch[i];
+
+      /* check for shutdown */
+      if (dpoint->flags & DSERV_DPOINT_SHUTDOWN_FLAG) {
+	done = true;
       }
-      else if (sendclient->type == QUEUE_CLIENT) {
-	if (sendclient->client_queue) {
-	  /* the client is reponsible for freeing the dpoint */
-	  client_request_t client_request;
-	  client_request.type = REQ_DPOINT_SCRIPT;
-	  client_request.dpoint = dpoint;
-	  sendclient->client_queue->push_back(client_request);
-	}
+
+      /*
+       * LATEST: take whatever is waiting.  A queue client's real backlog
+       * is its client_queue, so hold off while that is deep and let the
+       * points go on conflating here: the consumer's pops wake us once
+       * it is down to QUEUE_LATEST_AHEAD (and a second's wait at most,
+       * so a consumer that has gone away can't park this thread).
+       */
+      else if (dpoint == &sendclient->latest_dpoint) {
+	if (sendclient->type == QUEUE_CLIENT && sendclient->client_queue)
+	  sendclient->client_queue->wait_size(QUEUE_LATEST_AHEAD,
+					      std::chrono::seconds(1));
+	pending.clear();
+	sendclient->take_latest(pending);
+	for (auto dp : pending) deliver(dp);
+      }
+
+      /* RATE: the held values that are due; take_rate says when the
+	 rest are, and the top of the loop waits for them */
+      else if (dpoint == &sendclient->rate_dpoint) {
+	pending.clear();
+	sendclient->take_rate(pending);
+	for (auto dp : pending) deliver(dp);
+      }
+
+      else {
+	sendclient->backlog--;
+	deliver(dpoint);
       }
     }
+    /* nothing should follow the shutdown, but don't leak it if it does */
+    for (; i < batch.size(); i++) {
+      if (!(batch[i]->flags & DSERV_DPOINT_SHUTDOWN_FLAG) &&
+	  batch[i] != &sendclient->latest_dpoint &&
+	  batch[i] != &sendclient->rate_dpoint)
+	dpoint_free(batch[i]);
+    }
+
+    if (sendclient->type != SOCKET_CLIENT || sendclient->stage.empty())
+      continue;
+
+    if (!done) {
+      /* a backlog is staged before anything is written (deliver writes
+	 a stage past MAX_STAGE): no sleeping between its batches */
+      if (sendclient->dpoint_queue.size()) continue;
+      auto interval = std::chrono::microseconds(sendclient->flush_us.load());
+      auto due = last_flush + interval;
+      if (std::chrono::steady_clock::now() < due) {
+	std::this_thread::sleep_until(due);
+	if (sendclient->dpoint_queue.size()) continue;
+      }
+    }
+
+    sendclient->flush_stage();
+    last_flush = std::chrono::steady_clock::now();
   }
 
   /*
    * end-of-stream contract: this thread is the only producer into
    * client_queue, and this push is its final touch of that queue.
-   * The queue's owner may free it only after receiving REQ_QUEUE_EOS
-   * (consumers that never tear their queue down just ignore it).
    */
-  if (sendclient->type == QUEUE_CLIENT && sendclient->client_queue) {
-    client_request_t eos_request;
-    eos_request.type = REQ_QUEUE_EOS;
-    sendclient->client_queue->push_back(eos_request);
-  }
+  sendclient->end_of_stream();
 
   /* the object is freed when the last shared_ptr (table's or ours)
      goes away — no delete here */
@@ -13,29 +13,84 @@
 #include <chrono>
 #include <queue>
 #include <cstring>
+#include <unordered_map>
 
 #include "sharedqueue.h"
+#include "mpscring.h"
 #include "Datapoint.h"
 #include "MatchDict.h"
 #include "ClientRequest.h"
 
+class FanoutServer;
+
+/* writer settings and counters, see SendTable::buffering */
+typedef struct send_client_io_s {
+  int flush_us;			/* min interval between writes, 0: per batch */
+  uint64_t points;		/* points written */
+  uint64_t batches;		/* writes (one staged batch each) */
+  uint64_t bytes;		/* bytes written */
+  uint64_t dropped;		/* refused by the policy (queue full, rate) */
+  uint64_t conflated;		/* replaced by a newer value before sending */
+} send_client_io_t;
+
+/*
+ * SendPolicy
+ *
+ *  What a client is sent when it can't keep up:
+ *
+ *   all[:N]   every point, in order, with at most N waiting (0: no
+ *             limit); points arriving past that are dropped and counted
+ *   latest    while the client is behind, only the newest value of each
+ *             varname waits, so a stalled dashboard catches up to
+ *             current values instead of working through a backlog
+ *   rate:N    at most N points per second for each varname; one that
+ *             comes sooner is held back, replacing (conflating) any
+ *             held before it, and the newest is sent once the interval
+ *             is up, so the last value of a burst always arrives
+ *
+ *  Set with %reg/%match (or client_add_match, or a websocket
+ *  subscribe); the policy belongs to the client, so the most recent
+ *  setting covers all of its matches.
+ */
+struct SendPolicy {
+  enum policy_mode { ALL, LATEST, RATE };
+  policy_mode mode = ALL;
+  int limit = 0;		/* ALL: max waiting, RATE: per second */
+
+  static bool parse(const char *str, SendPolicy *policy);
+  std::string to_string(void) const;
+};
+
 /*
  * SendClient
  *
  *  Owned by shared_ptr: the SendTable holds one reference and the
- * client's own thread holds another, so a pointer obtained from the
- * table can never dangle — operations on a client that has already
- * been shut down are harmless no-ops.
+ * client's own thread (or its FanoutServer worker) holds another, so a
+ * pointer obtained from the table can never dangle — operations on a
+ * client that has already been shut down are harmless no-ops.
+ *
+ *  Points reach the client through push(), never dpoint_queue directly:
+ * a pooled client has no thread waiting on its queue, so push() is what
+ * tells its worker there is something to do.
+ *
+ *  A socket client writes to its socket, a queue client relays to a
+ * client_queue for another thread to take, and a sink client hands
+ * each point to its sink function, run right there on the client's
+ * worker (or thread) -- for a consumer like a websocket that would
+ * otherwise keep a thread of its own just to empty a client_queue.
  */
 class SendClient {
  public:
-  enum sendclient_type { SOCKET_CLIENT, QUEUE_CLIENT };
+  enum sendclient_type { SOCKET_CLIENT, QUEUE_CLIENT, SINK_CLIENT };
 
   sendclient_type type;
-  std::atomic<int> active{1};	/* set to 0 if connection bad;
-				   written by the client thread,
-				   read by the send thread */
+  std::atomic<int> active{1};	/* cleared by deactivate() if the
+				   connection goes bad; written by
+				   the client thread, read by the
+				   send thread */
   std::string key;		/* send_table key, set at registration */
+  std::shared_ptr<std::atomic<int>> inactive_count; /* the table's, bumped
+						      by deactivate() */
   char *host = nullptr;
   int port = 0;
   int fd = -1;			/* socket to write to         */
@@ -43,22 +98,100 @@ class SendClient {
   int send_json = 0;
   //  json_encoder_t *json_encoder;
   // point queue for incoming notifications
-  SharedQueue<ds_datapoint_t *> dpoint_queue;
+  MPSCRing<ds_datapoint_t *> dpoint_queue;
 
   // client_request queue to push points to
   SharedQueue<client_request_t> *client_queue = nullptr;
 
+  /* sink clients: takes each point, and is responsible for freeing it */
+  std::function<void(ds_datapoint_t *)> sink;
+
   ds_datapoint_t shutdown_dpoint = {}; /* dpoint signal shutdown   */
 
   MatchDict matches;
 
+  /* socket clients: points serialized but not yet written */
+  static constexpr size_t MAX_STAGE = 64 * 1024;
+  std::string stage;
+  uint64_t staged = 0;
+  std::atomic<int> flush_us{0};	/* max wait to gather a batch */
+
+  std::atomic<uint64_t> points_sent{0};
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> bytes_sent{0};
+
+  /*
+   * delivery policy; policy is only touched under the SendTable lock
+   * (offer() runs from forward_dpoint)
+   */
+  static constexpr int DEFAULT_SOCKET_LIMIT = 65536;
+  SendPolicy policy;
+  std::atomic<int> backlog{0};	/* points in dpoint_queue */
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> conflated{0};
+
+  /* LATEST: newest value per varname, in first-arrival order */
+  std::mutex latest_mutex;
+  std::vector<ds_datapoint_t *> latest;
+  std::unordered_map<std::string, size_t> latest_slot;
+  ds_datapoint_t latest_dpoint = {};	/* queued: latest has points */
+
+  /* RATE: when each varname was last sent and may be next (steady
+     clock ns), and the value held back until then */
+  struct rate_slot_t {
+    int64_t last = 0;
+    int64_t next = 0;
+    ds_datapoint_t *held = nullptr;
+  };
+  std::mutex rate_mutex;
+  std::unordered_map<std::string, rate_slot_t> rate_slots;
+  int rate_held = 0;		/* slots with a held value */
+  ds_datapoint_t rate_dpoint = {};	/* queued: a value was held */
+  /* the sending side's: held values not yet due, and when they are */
+  bool rate_waiting = false;
+  std::chrono::steady_clock::time_point rate_due;
+
+  /*
+   * pooled clients (FanoutServer): the worker that serves this one and
+   * its state there, all but scheduled only touched by that worker
+   */
+  FanoutServer *fanout = nullptr;
+  int worker = -1;
+  std::atomic<bool> scheduled{false};	/* on its worker's ready list */
+  size_t stage_off = 0;		/* stage written up to here */
+  bool done = false;		/* shutdown seen */
+  int latest_waits = 0;		/* LATEST queue client held back */
+  std::chrono::steady_clock::time_point last_flush;
+  std::chrono::steady_clock::time_point stalled_since;
+
+  /* what pump() wants next */
+  enum pump_result { PUMP_IDLE, PUMP_IDLE_UNTIL, PUMP_AGAIN,
+		     PUMP_WRITABLE, PUMP_TIMER, PUMP_DONE };
+
   static void
     send_client_process(std::shared_ptr<SendClient> sendclient);
 
   SendClient(int socket, char *hoststr, int port, uint8_t flags);
   SendClient(SharedQueue<client_request_t> *client_queue);
+  SendClient(std::function<void(ds_datapoint_t *)> sink);
   ~SendClient();
+  void stage_dpoint(ds_datapoint_t *dpoint);
+  int flush_stage(void);
   int send_dpoint(ds_datapoint_t *dpoint);
+  void io_info(send_client_io_t *info);
+  void offer(ds_datapoint_t *dpoint);
+  void push(ds_datapoint_t *dpoint);
+  void take_latest(std::vector<ds_datapoint_t *> &points);
+  void take_rate(std::vector<ds_datapoint_t *> &points);
+  void reset_rate(void);
+  void deliver(ds_datapoint_t *dpoint);
+  int write_stage(void);
+  pump_result pump(std::chrono::steady_clock::time_point *due);
+  void end_of_stream(void);
+  void deactivate(void);
+
+ private:
+  void bound_queue(void);
 };
 
 #endif
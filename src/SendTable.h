@@ -4,10 +4,12 @@
 #include <unordered_map>
 #include <memory>
 #include <mutex>
+#include <atomic>
 
 #include "Datapoint.h"
 #include "DatapointTable.h"
 #include "MatchDict.h"
+#include "MatchIndex.h"
 #include "LogMatchDict.h"
 #include "TriggerDict.h"
 #include "SendClient.h"
@@ -17,10 +19,18 @@
  *
  *  Registry of active send clients, keyed by "host:port" (socket
  * clients) or a generated id (queue clients).  Clients are held by
- * shared_ptr — the client's own thread holds another reference — so
+ * shared_ptr — the client's own thread or FanoutServer worker holds
+ * another reference — so
  * a pointer handed out by get() can never dangle; at worst it names
  * a client that has already been shut down, on which operations are
  * harmless no-ops.
+ *
+ * Every client's subscriptions are also compiled into one shared
+ * MatchIndex, so forward_dpoint() matches a point against all clients
+ * in a single lookup instead of scanning each client's MatchDict.
+ * Subscriptions must therefore be changed through add_match() and
+ * friends, which keep the client's own MatchDict (what %getmatch and
+ * client_covers see) and the index in step.
  */
 class SendTable
 {
@@ -28,6 +38,28 @@ class SendTable
   std::unordered_map<std::string, std::shared_ptr<SendClient>> map_;
   std::mutex mutex_;
 
+  MatchIndex<SendClient *> index_;
+  std::vector<SendClient *> hits_;	/* forward_dpoint scratch, under mutex_ */
+
+  /* bumped by a client as it goes inactive (SendClient::deactivate);
+     shared, as a client can outlive the table */
+  std::shared_ptr<std::atomic<int>> inactive_ =
+    std::make_shared<std::atomic<int>>(0);
+
+  /* call under mutex_ */
+  void reap_inactive(void)
+  {
+    std::vector<std::shared_ptr<SendClient>> close_vec;
+    for (auto const& it : map_) {
+      if (!it.second->active) close_vec.push_back(it.second);
+    }
+    for (auto const& send_client : close_vec) {
+      map_.erase(send_client->key);
+      index_.remove_owner(send_client.get());
+      send_client->push(&send_client->shutdown_dpoint);
+    }
+  }
+
  public:
   SendTable() {};
   ~SendTable() { shutdown_clients(); }
@@ -38,6 +70,12 @@ class SendTable
       map_[key] = s;
     }
 
+  /* for a new client's inactive_count, set before it starts running */
+  std::shared_ptr<std::atomic<int>> inactive_counter(void)
+  {
+    return inactive_;
+  }
+
   std::shared_ptr<SendClient> get(std::string key)
   {
     std::lock_guard<std::mutex> mlock(mutex_);
@@ -60,8 +98,70 @@ class SendTable
 
     std::shared_ptr<SendClient> send_client = iter->second;
     map_.erase(iter);
-    if (send_client)
-      send_client->dpoint_queue.push_back(&send_client->shutdown_dpoint);
+    if (send_client) {
+      index_.remove_owner(send_client.get());
+      send_client->push(&send_client->shutdown_dpoint);
+    }
+    return 1;
+  }
+
+  /*
+   * subscription changes: return 0 if there is no client for key
+   */
+  int add_match(std::string key, MatchSpec m)
+  {
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter == map_.end() || !iter->second) return 0;
+
+    SendClient *send_client = iter->second.get();
+    send_client->matches.insert(m.matchstr, m);
+    index_.insert(send_client, m.matchstr,
+		  m.type == MatchSpec::MATCH_EXACT, m.alert_every);
+    return 1;
+  }
+
+  /* a client's delivery policy (see SendPolicy) */
+  int set_policy(std::string key, const SendPolicy &policy)
+  {
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter == map_.end() || !iter->second) return 0;
+
+    iter->second->policy = policy;
+    iter->second->reset_rate();
+    return 1;
+  }
+
+  int get_policy(std::string key, SendPolicy *policy)
+  {
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter == map_.end() || !iter->second) return 0;
+
+    *policy = iter->second->policy;
+    return 1;
+  }
+
+  int remove_match(std::string key, std::string match)
+  {
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter == map_.end() || !iter->second) return 0;
+
+    iter->second->matches.remove(match);
+    index_.remove(iter->second.get(), match);
+    return 1;
+  }
+
+  int clear_matches(std::string key)
+  {
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter == map_.end() || !iter->second) return 0;
+
+    iter->second->matches.clear();
+    index_.remove_owner(iter->second.get());
     return 1;
   }
 
@@ -70,57 +170,76 @@ class SendTable
     std::lock_guard<std::mutex> mlock(mutex_);
     for (auto const& [key, send_client] : map_) {
       if (send_client)
-	send_client->dpoint_queue.push_back(&send_client->shutdown_dpoint);
+	send_client->push(&send_client->shutdown_dpoint);
     }
     map_.clear();
-    /* each client thread still holds its own shared_ptr, so the
-       objects stay alive until those threads exit */
+    index_.clear();
+    /* each client thread (or worker) still holds its own shared_ptr,
+       so the objects stay alive until the shutdown is handled */
   }
 
-  // Return diagnostic info: list of {key active queue_size matches}
-  std::vector<std::tuple<std::string, int, size_t, std::string>> get_client_info()
+  // Return diagnostic info: list of {key active queue_size matches io policy}
+  std::vector<std::tuple<std::string, int, size_t, std::string,
+			 send_client_io_t, std::string>> get_client_info()
   {
-    std::vector<std::tuple<std::string, int, size_t, std::string>> result;
+    std::vector<std::tuple<std::string, int, size_t, std::string,
+			   send_client_io_t, std::string>> result;
     std::lock_guard<std::mutex> mlock(mutex_);
     for (auto const& [key, send_client] : map_) {
       if (send_client) {
+	send_client_io_t io;
+	send_client->io_info(&io);
 	result.emplace_back(
 	  key,
 	  send_client->active,
 	  send_client->dpoint_queue.size(),
-	  send_client->matches.to_string()
+	  send_client->matches.to_string(),
+	  io,
+	  send_client->policy.to_string()
 	);
       }
     }
     return result;
   }
 
-  void forward_dpoint(ds_datapoint_t *dpoint)
+  /*
+   * change a client's flush interval (negative leaves it alone) and
+   * report its settings and write counters; 0 if there's no such
+   * client.  Only atomics are touched, the writer thread picks a new
+   * interval up at its next batch.
+   */
+  int buffering(std::string key, int flush_us, send_client_io_t *info)
   {
-    std::vector<std::shared_ptr<SendClient>> close_vec;
+    std::lock_guard<std::mutex> mlock(mutex_);
+    auto iter = map_.find(key);
+    if (iter == map_.end() || !iter->second) return 0;
 
+    if (flush_us >= 0) iter->second->flush_us = flush_us;
+    if (info) iter->second->io_info(info);
+    return 1;
+  }
+
+  void forward_dpoint(ds_datapoint_t *dpoint)
+  {
     /* PRIVATE points are never delivered to any send client: network
        subscribers and the TclServers' own queues (dpoint scripts) alike.
        They still reach the logger, which has its own queue and table. */
     if (DPOINT_IS_PRIVATE(dpoint)) return;
 
     std::lock_guard<std::mutex> mlock(mutex_);
-    for (auto const& it : map_) {
-      std::shared_ptr<SendClient> send_client = it.second;
-      if (!send_client->active) {
-	close_vec.push_back(send_client);
-      }
-      else if (send_client->matches.is_match(dpoint->varname)) {
-	ds_datapoint_t *dp = dpoint_copy(dpoint);
-	send_client->dpoint_queue.push_back(dp);
-      }
-    }
 
-    /* reap inactive clients by their registration key (still under
-       the same lock, so this cannot race another removal) */
-    for (auto const& send_client : close_vec) {
-      map_.erase(send_client->key);
-      send_client->dpoint_queue.push_back(&send_client->shutdown_dpoint);
+    /* reap clients that have gone inactive since the last point, by
+       their registration key (under the same lock, so this cannot race
+       another removal), so the index never hands back a client that is
+       going away.  Only a client going bad makes this walk the table;
+       a point normally costs one relaxed load here. */
+    if (inactive_->load(std::memory_order_relaxed) && inactive_->exchange(0))
+      reap_inactive();
+
+    hits_.clear();
+    index_.match(dpoint->varname, hits_);
+    for (auto send_client : hits_) {
+      send_client->offer(dpoint);
     }
   }
 };
@@ -0,0 +1,495 @@
+/*
+ * ShmIngestServer.cpp - shared memory rings for same-host producers
+ *
+ *  The worker sleeps in epoll_wait on the unix socket producers connect
+ * to, on each ring's doorbell and on each producer's connection.  A
+ * doorbell means records: drain() copies them out into datapoints --
+ * validating every length, since the other side of the mapping is
+ * another process -- and publishes them with one set_batch().  A
+ * producer's connection closing means the ring is done with.
+ *
+ *  A new connection's request is read as it arrives, from the same
+ * epoll set, so a slow or silent producer never holds up the rings.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "Dataserver.h"
+#include "ShmIngestServer.h"
+
+#ifdef __linux__
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* a ring request: "ring <name> <bytes>\n" */
+static const size_t REQUEST_MAX = 128;
+static const size_t NAME_MAX_LEN = 63;
+
+/* the producer sends its request straight away: don't wait long */
+static const int HANDSHAKE_MS = 500;
+
+ShmIngestServer::ShmIngestServer(Dataserver *ds, int tcpport): ds(ds)
+{
+  address = "dserv-shm." + std::to_string(tcpport);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path + 1, address.c_str(), address.size());
+  socklen_t len = offsetof(struct sockaddr_un, sun_path) + 1 + address.size();
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0 ||
+      bind(listen_fd, (struct sockaddr *) &addr, len) < 0 ||
+      listen(listen_fd, 8) < 0) {
+    perror("shm ingest: socket");
+    if (listen_fd >= 0) close(listen_fd);
+    listen_fd = -1;
+    return;
+  }
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    perror("shm ingest: epoll_create1");
+    close(listen_fd);
+    listen_fd = -1;
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+  /* like the ingest workers, this runs for the life of the process */
+  std::thread thr(&ShmIngestServer::worker, this);
+  thr.detach();
+}
+
+std::vector<std::string> ShmIngestServer::rings(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return ring_names;
+}
+
+static void refuse(int sock, const char *why)
+{
+  std::string reply = std::string("0 ") + why + "\n";
+  if (send(sock, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) {}
+  close(sock);
+}
+
+static bool valid_name(const std::string &name)
+{
+  if (name.empty() || name.size() > NAME_MAX_LEN) return false;
+  for (char c : name)
+    if (!isalnum((unsigned char) c) && !strchr("_-./", c)) return false;
+  return true;
+}
+
+/* read what has come of a new connection's request; a whole one opens */
+void ShmIngestServer::handshake(int sock)
+{
+  Handshake &h = handshakes[sock];
+  char buf[REQUEST_MAX];
+  ssize_t r = recv(sock, buf, REQUEST_MAX - h.request.size(), 0);
+  if (r < 0 && (errno == EAGAIN || errno == EINTR)) return;
+  if (r <= 0) {
+    handshakes.erase(sock);
+    close(sock);
+    return;
+  }
+  h.request.append(buf, r);
+  if (h.request.back() != '\n' && h.request.size() < REQUEST_MAX) return;
+
+  std::string request = std::move(h.request);
+  handshakes.erase(sock);
+  open_ring(sock, request);
+}
+
+/* drop connections that haven't sent a request in HANDSHAKE_MS */
+void ShmIngestServer::expire_handshakes(void)
+{
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = handshakes.begin(); it != handshakes.end();) {
+    if (now < it->second.deadline) {
+      ++it;
+      continue;
+    }
+    close(it->first);
+    it = handshakes.erase(it);
+  }
+}
+
+void ShmIngestServer::open_ring(int sock, const std::string &request)
+{
+  char name_buf[REQUEST_MAX + 1];
+  unsigned long bytes;
+  if (sscanf(request.c_str(), "ring %128s %lu", name_buf, &bytes) != 2)
+    return refuse(sock, "expected: ring <name> <bytes>");
+  std::string name(name_buf);
+  if (!valid_name(name)) return refuse(sock, "bad ring name");
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &other : ring_names)
+      if (other == name) return refuse(sock, "ring name in use");
+  }
+
+  uint64_t size = DSERV_SHMRING_MIN_SIZE;
+  while (size < bytes && size < DSERV_SHMRING_MAX_SIZE) size <<= 1;
+  size_t maplen = sizeof(dserv_shmring_t) + size;
+
+  /*
+   * Sealed against resizing: a producer that shrank the file under us
+   * would turn our next read of the ring into a SIGBUS.
+   */
+  int memfd = memfd_create(("dserv:" + name).c_str(),
+			   MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0) return refuse(sock, "memfd_create failed");
+  void *map = MAP_FAILED;
+  if (ftruncate(memfd, maplen) == 0 &&
+      fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0)
+    map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (map == MAP_FAILED) {
+    close(memfd);
+    return refuse(sock, "can't create ring");
+  }
+  int evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (evfd < 0) {
+    munmap(map, maplen);
+    close(memfd);
+    return refuse(sock, "eventfd failed");
+  }
+
+  dserv_shmring_t *ring = (dserv_shmring_t *) map;
+  ring->magic = DSERV_SHMRING_MAGIC;
+  ring->version = DSERV_SHMRING_VERSION;
+  ring->size = size;
+  ring->sleeping = 1;		/* nothing in it yet: ring for the first */
+
+  /* the reply carries the ring and its doorbell */
+  std::string reply = "1 " + std::to_string(size) + "\n";
+  struct iovec iov = { (void *) reply.data(), reply.size() };
+  int fds[2] = { memfd, evfd };
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  memset(cbuf, 0, sizeof(cbuf));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  close(memfd);			/* the mapping keeps it */
+  if (sent != (ssize_t) reply.size()) {
+    munmap(map, maplen);
+    close(evfd);
+    close(sock);
+    return;
+  }
+
+  Ring *r = new Ring;
+  r->name = name;
+  r->sock = sock;
+  r->evfd = evfd;
+  r->ring = ring;
+  r->maplen = maplen;
+  r->size = size;
+
+  /* sock is in the epoll set already, from the handshake */
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = evfd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+  by_fd[sock] = r;
+  by_fd[evfd] = r;
+  open_rings.push_back(r);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ring_names.push_back(name);
+}
+
+void ShmIngestServer::close_ring(Ring *r)
+{
+  by_fd.erase(r->sock);
+  by_fd.erase(r->evfd);
+  open_rings.erase(std::find(open_rings.begin(), open_rings.end(), r));
+  close(r->sock);		/* closing removes them from the epoll set */
+  close(r->evfd);
+  munmap(r->ring, r->maplen);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = ring_names.begin(); it != ring_names.end(); ++it) {
+      if (*it == r->name) {
+	ring_names.erase(it);
+	break;
+      }
+    }
+  }
+  delete r;
+}
+
+/*
+ * take every record in the ring, then (then_sleep) go back to sleep on
+ * it; -1 if the ring holds something that isn't a record
+ */
+int ShmIngestServer::drain(Ring *r, bool then_sleep)
+{
+  dserv_shmring_t *ring = r->ring;
+  const unsigned char *data = dserv_shmring_data(ring);
+  const uint64_t size = r->size, mask = size - 1;	/* not ring->size */
+  std::vector<ds_datapoint_t *> batch;
+  std::vector<uint64_t> posted;
+  int rc = 0;
+
+  while (1) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->tail;
+    if (head - tail > size) rc = -1;
+
+    while (rc == 0 && tail != head) {
+      uint64_t off = tail & mask;
+      uint32_t reclen;
+      memcpy(&reclen, data + off, sizeof(reclen));
+
+      if (reclen & DSERV_SHMRING_PAD) {
+	if ((reclen & ~DSERV_SHMRING_PAD) != size - off) {
+	  rc = -1;
+	  break;
+	}
+	tail += size - off;
+	continue;
+      }
+
+      dserv_shmrec_t rec;
+      if (reclen < sizeof(rec) || reclen & 7 || reclen > size - off ||
+	  reclen > head - tail) {
+	rc = -1;
+	break;
+      }
+      memcpy(&rec, data + off, sizeof(rec));
+      if (rec.varlen < 1 || rec.varlen > DSERV_MAX_VARNAME_LEN ||
+	  sizeof(rec) + rec.varlen + (uint64_t) rec.datalen > reclen) {
+	rc = -1;
+	break;
+      }
+
+      const unsigned char *p = data + off + sizeof(rec);
+      char *varname = (char *) malloc(rec.varlen + 1);
+      unsigned char *databuf =
+	(unsigned char *) malloc(rec.datalen ? rec.datalen : 1);
+      ds_datapoint_t *dpoint =
+	(ds_datapoint_t *) malloc(sizeof(ds_datapoint_t));
+      if (!varname || !databuf || !dpoint) {
+	free(varname);
+	free(databuf);
+	free(dpoint);
+	rc = -1;
+	break;
+      }
+      memcpy(varname, p, rec.varlen);
+      varname[rec.varlen] = '\0';
+      memcpy(databuf, p + rec.varlen, rec.datalen);
+
+      dpoint_set(dpoint, varname,
+		 rec.timestamp ? rec.timestamp : Dataserver::now(),
+		 (ds_datatype_t) rec.type, rec.datalen, databuf);
+      batch.push_back(dpoint);
+      posted.push_back(rec.posted);
+      tail += reclen;
+    }
+
+    /* give the producer its room back before the table work */
+    r->tail = tail;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    if (!batch.empty()) {
+      size_t n = batch.size();
+      ds->set_batch(batch);
+
+      uint64_t now = dserv_shmring_clock(), sum = 0, max = 0;
+      for (auto t : posted) {
+	uint64_t lat = now > t ? now - t : 0;
+	sum += lat;
+	if (lat > max) max = lat;
+      }
+      posted.clear();
+      records += n;
+      latency_ns += sum;
+      uint64_t prev = latency_max_ns;
+      while (max > prev && !latency_max_ns.compare_exchange_weak(prev, max));
+    }
+    if (rc < 0 || !then_sleep) break;
+
+    /* asleep, then look again: see shmring.h */
+    __atomic_store_n(&ring->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) break;
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+  }
+
+  uint64_t d = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  if (d > r->dropped) {
+    dropped += d - r->dropped;
+    r->dropped = d;
+  }
+  return rc;
+}
+
+/*
+ * awake on every ring (no doorbells), taking records as they come,
+ * until none has come for poll_us; then back to sleep on all of them
+ */
+void ShmIngestServer::poll(void)
+{
+  using clock = std::chrono::steady_clock;
+  auto quiet = std::chrono::microseconds(poll_us.load());
+  auto until = clock::now() + quiet;
+
+  for (auto r : open_rings)
+    __atomic_store_n(&r->ring->sleeping, 0, __ATOMIC_RELAXED);
+
+  /* a look at the epoll set now and then, for producers coming and
+     going: level triggered, so what it shows is still there after */
+  auto look = clock::now() + std::chrono::milliseconds(1);
+  struct epoll_event ev;
+
+  std::vector<Ring *> bad;
+  while (bad.empty() && clock::now() < until) {
+    if (clock::now() >= look) {
+      if (epoll_wait(epfd, &ev, 1, 0) > 0) break;
+      look = clock::now() + std::chrono::milliseconds(1);
+    }
+    for (auto r : open_rings) {
+      if (__atomic_load_n(&r->ring->head, __ATOMIC_ACQUIRE) == r->tail)
+	continue;
+      if (drain(r, false) < 0) bad.push_back(r);
+      until = clock::now() + quiet;
+    }
+  }
+
+  for (auto r : open_rings)
+    if (std::find(bad.begin(), bad.end(), r) == bad.end() &&
+	drain(r, true) < 0)
+      bad.push_back(r);
+  for (auto r : bad) {
+    fprintf(stderr, "shm ingest: ring %s is corrupt, closing it\n",
+	    r->name.c_str());
+    close_ring(r);
+  }
+}
+
+void ShmIngestServer::worker(void)
+{
+  const int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+
+  while (1) {
+    /* with handshakes under way, wake to expire the ones gone quiet */
+    int timeout = handshakes.empty() ? -1 : HANDSHAKE_MS;
+    int nev = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+    if (nev < 0) {
+      if (errno == EINTR) continue;
+      perror("shm ingest: epoll_wait");
+      return;
+    }
+    if (nev > 0) wakeups++;
+
+    for (int i = 0; i < nev; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == listen_fd) {
+	int sock = accept4(listen_fd, NULL, NULL,
+			   SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (sock < 0) continue;
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = sock;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+	handshakes[sock].deadline = std::chrono::steady_clock::now() +
+	  std::chrono::milliseconds(HANDSHAKE_MS);
+	continue;
+      }
+
+      if (handshakes.count(fd)) {
+	handshake(fd);
+	continue;
+      }
+
+      auto it = by_fd.find(fd);
+      if (it == by_fd.end()) continue;	/* closed earlier this pass */
+      Ring *r = it->second;
+
+      if (fd == r->evfd) {
+	uint64_t count;
+	if (read(r->evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	  perror("shm ingest: eventfd");
+	if (drain(r, true) < 0) {
+	  fprintf(stderr, "shm ingest: ring %s is corrupt, closing it\n",
+		  r->name.c_str());
+	  close_ring(r);
+	}
+	continue;
+      }
+
+      /* the producer's connection: it has nothing to say but goodbye */
+      char c;
+      ssize_t n = recv(fd, &c, 1, MSG_DONTWAIT);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+	drain(r, true);		/* what it wrote before it went */
+	close_ring(r);
+      }
+    }
+
+    if (!handshakes.empty()) expire_handshakes();
+    if (poll_us > 0 && !open_rings.empty()) poll();
+  }
+}
+
+#else
+
+ShmIngestServer::ShmIngestServer(Dataserver *ds, int tcpport): ds(ds) {}
+
+std::vector<std::string> ShmIngestServer::rings(void)
+{
+  return std::vector<std::string>();
+}
+
+void ShmIngestServer::handshake(int sock) {}
+
+void ShmIngestServer::expire_handshakes(void) {}
+
+void ShmIngestServer::open_ring(int sock, const std::string &request) {}
+
+void ShmIngestServer::close_ring(Ring *r) {}
+
+int ShmIngestServer::drain(Ring *r, bool then_sleep)
+{
+  return 0;
+}
+
+void ShmIngestServer::poll(void) {}
+
+void ShmIngestServer::worker(void) {}
+
+#endif
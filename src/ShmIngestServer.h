@@ -0,0 +1,102 @@
+#ifndef SHMINGESTSERVER_H
+#define SHMINGESTSERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shmring.h"
+
+class Dataserver;
+
+/*
+ * ShmIngestServer
+ *
+ *  Shared memory rings for producers on the same host (shmring.h), in
+ * place of a loopback connection to the dataserver port: no copy
+ * through the kernel each way and no per-point syscall.
+ *
+ *  A producer connects to the unix socket "dserv-shm.<tcpport>" (in the
+ * abstract namespace, so there is no file to clean up) and sends
+ *
+ *    ring <name> <bytes>\n
+ *
+ * The reply is "1 <bytes>\n" carrying two descriptors -- a sealed memfd
+ * holding the ring and the eventfd that is its doorbell -- or
+ * "0 <reason>\n".  The connection stays open for the life of the ring:
+ * when the producer goes away dserv takes what is left in it and
+ * unmaps it.  api/dservapi.c does all of this in dservapi_shm_open().
+ *
+ *  One thread serves every ring, sleeping in epoll_wait on their
+ * doorbells; woken, it drains a ring into a batch and hands that to
+ * Dataserver::set_batch, just as an IngestConn does with a read's worth
+ * of '>' frames.  With poll_us set it keeps looking at the rings for a
+ * while before it sleeps again.
+ *
+ *  Linux only.
+ */
+class ShmIngestServer {
+  struct Ring {
+    std::string name;
+    int sock = -1;		/* the producer's connection */
+    int evfd = -1;
+    dserv_shmring_t *ring = nullptr;
+    size_t maplen = 0;
+    uint64_t size = 0;		/* ours: the producer can write ring->size */
+    uint64_t tail = 0;		/* and ring->tail */
+    uint64_t dropped = 0;	/* ring->dropped already counted */
+  };
+
+  /* a producer connected, its request not all in yet */
+  struct Handshake {
+    std::string request;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  Dataserver *ds;
+  int listen_fd = -1;
+  int epfd = -1;
+  std::unordered_map<int, Handshake> handshakes;	/* worker only */
+  std::unordered_map<int, Ring *> by_fd;	/* sock and evfd: worker only */
+  std::vector<Ring *> open_rings;		/* worker only */
+
+  std::mutex mutex;
+  std::vector<std::string> ring_names;
+
+  void worker(void);
+  void handshake(int sock);
+  void expire_handshakes(void);
+  void open_ring(int sock, const std::string &request);
+  void close_ring(Ring *r);
+  int drain(Ring *r, bool then_sleep);
+  void poll(void);
+
+ public:
+  std::string address;		/* the socket's name, less its leading nul */
+
+  /* totals, for dservShmInfo */
+  std::atomic<uint64_t> records{0};
+  std::atomic<uint64_t> dropped{0};	/* producers found the ring full */
+  std::atomic<uint64_t> wakeups{0};
+  std::atomic<uint64_t> latency_ns{0};	/* posted -> in the table, summed */
+  std::atomic<uint64_t> latency_max_ns{0};
+
+  /*
+   * After a ring goes quiet, keep checking the rings for this long
+   * before sleeping on their doorbells (dservShmPoll).  0, the default,
+   * sleeps at once: a producer writing slower than this pays an eventfd
+   * write per point and dserv a wakeup.  Polling trades a core for
+   * neither -- worth it only where there's a core to spare.
+   */
+  std::atomic<int> poll_us{0};
+
+  ShmIngestServer(Dataserver *ds, int tcpport);
+
+  bool running(void) { return listen_fd >= 0; }
+  std::vector<std::string> rings(void);
+};
+
+#endif
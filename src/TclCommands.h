@@ -1,4 +1,6 @@
 Tcl_Obj *dpoint_to_tclobj(Tcl_Interp *interp,  ds_datapoint_t *dpoint);
+void dpoint_to_tclargs(Tcl_Interp *interp, ds_datapoint_t *dpoint,
+		       Tcl_Obj *args[2]);
 int dserv_exists_command(ClientData data, Tcl_Interp * interp, int objc,
 		      Tcl_Obj * const objv[]);
 int dserv_get_command(ClientData data, Tcl_Interp * interp, int objc,
@@ -15,10 +17,26 @@ int dserv_dgdir_command(ClientData data, Tcl_Interp * interp, int objc,
 		       Tcl_Obj * const objv[]);
 int dserv_send_clients_command(ClientData data, Tcl_Interp * interp, int objc,
 			       Tcl_Obj * const objv[]);
+int dserv_send_client_buffering_command(ClientData data, Tcl_Interp *interp,
+					int objc, Tcl_Obj * const objv[]);
+int dserv_send_client_policy_command(ClientData data, Tcl_Interp *interp,
+				     int objc, Tcl_Obj * const objv[]);
+int dserv_ingest_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			      Tcl_Obj * const objv[]);
+int dserv_fanout_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			      Tcl_Obj * const objv[]);
+int dserv_queue_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			     Tcl_Obj * const objv[]);
+int dserv_shm_info_command(ClientData data, Tcl_Interp * interp, int objc,
+			   Tcl_Obj * const objv[]);
+int dserv_shm_poll_command(ClientData data, Tcl_Interp * interp, int objc,
+			   Tcl_Obj * const objv[]);
 int dserv_setdata_command (ClientData data, Tcl_Interp *interp,
 			   int objc, Tcl_Obj * const objv[]);
 int dserv_setdata64_command (ClientData data, Tcl_Interp *interp,
 			     int objc, Tcl_Obj * const objv[]);
+int dserv_setbatch_command (ClientData data, Tcl_Interp *interp,
+			    int objc, Tcl_Obj * const objv[]);
 int dserv_timestamp_command(ClientData data, Tcl_Interp *interp,
 			    int objc, Tcl_Obj * const objv[]);
 int dserv_touch_command(ClientData data, Tcl_Interp * interp, int objc,
@@ -36,4 +54,6 @@ int process_get_param_command(ClientData data, Tcl_Interp * interp, int objc,
 int process_set_param_command(ClientData data,
 			      Tcl_Interp * interp, int objc,
 			      Tcl_Obj * const objv[]);
+int process_stats_command(ClientData data, Tcl_Interp * interp, int objc,
+			  Tcl_Obj * const objv[]);
 
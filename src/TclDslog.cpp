@@ -0,0 +1,491 @@
+/*
+ * TclDslog.cpp - seekable reads of .ds log files from Tcl
+ *
+ * Provides:
+ *   dslogOpen $path          - open a log, returns a handle
+ *   dslogInfo $h             - dict: version compressed indexed
+ *                              bad_trailer damaged nobs vars
+ *                              (vars is a list of {name count})
+ *   dslogVar $h $varname     - every record of one variable
+ *   dslogObs $h $obs         - every record of one obs period
+ *   dslogColumns $h $varname - a numeric variable as columns, from
+ *                              columnar blocks and plain records alike:
+ *                              dict: type sample_len timestamps samples
+ *   dslogClose $h
+ *   dslogExpand $in $out     - rewrite a compact (version 5) log as
+ *                              version 3, returns the record count
+ *   dslogInflate $in $out    - decompress a compressed log, returns a
+ *                              dict: blocks damaged bytes_in bytes_out
+ *
+ * Records come back as {varname timestamp type value}.  type is the
+ * record's raw 32 bit type word (for events the packed event info);
+ * strings and numeric arrays are converted, anything else is returned
+ * as a bytearray.
+ *
+ * Version 4 logs (dservLoggerOpen path overwrite 4) carry an index, so
+ * these only read the records asked for; older logs are scanned once
+ * when opened (see dslog_index.h).  Compressed logs are read in place,
+ * through their blocks.
+ *
+ * Add to TclServer.cpp's add_tcl_commands():
+ *   TclDslog_RegisterCommands(interp);
+ */
+
+#include <tcl.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Datapoint.h"
+#include "dslog_index.h"
+#include "dslog_compact.h"
+#include "dslog_block.h"
+#include "dslog_column.h"
+
+/* open logs, per interp, closed with it */
+struct DslogHandles {
+  std::map<std::string, dslog_file_t *> files;
+  int next = 0;
+};
+
+static const char *DSLOG_ASSOC_KEY = "dslog_handles";
+
+static void dslogDeleteHandles(ClientData clientData, Tcl_Interp *)
+{
+  DslogHandles *handles = (DslogHandles *) clientData;
+  for (auto &kv : handles->files) dslog_close(kv.second);
+  delete handles;
+}
+
+static dslog_file_t *dslogGetHandle(Tcl_Interp *interp,
+                                    DslogHandles *handles, Tcl_Obj *obj)
+{
+  auto it = handles->files.find(Tcl_GetString(obj));
+  if (it == handles->files.end()) {
+    Tcl_AppendResult(interp, "dslog handle \"", Tcl_GetString(obj),
+                     "\" not found", NULL);
+    return NULL;
+  }
+  return it->second;
+}
+
+static Tcl_Obj *dslogValueObj(int dtype, const unsigned char *data,
+                              uint32_t len)
+{
+  Tcl_Obj *list;
+
+  switch (dtype) {
+  case DSERV_STRING:
+  case DSERV_JSON:
+  case DSERV_SCRIPT:
+  case DSERV_TRIGGER_SCRIPT:
+    return Tcl_NewStringObj((const char *) data, len);
+  case DSERV_SHORT:
+    list = Tcl_NewListObj(0, NULL);
+    for (uint32_t i = 0; i + sizeof(int16_t) <= len; i += sizeof(int16_t)) {
+      int16_t v;
+      memcpy(&v, &data[i], sizeof(v));
+      Tcl_ListObjAppendElement(NULL, list, Tcl_NewIntObj(v));
+    }
+    return list;
+  case DSERV_INT:
+    list = Tcl_NewListObj(0, NULL);
+    for (uint32_t i = 0; i + sizeof(int32_t) <= len; i += sizeof(int32_t)) {
+      int32_t v;
+      memcpy(&v, &data[i], sizeof(v));
+      Tcl_ListObjAppendElement(NULL, list, Tcl_NewIntObj(v));
+    }
+    return list;
+  case DSERV_INT64:
+    list = Tcl_NewListObj(0, NULL);
+    for (uint32_t i = 0; i + sizeof(int64_t) <= len; i += sizeof(int64_t)) {
+      int64_t v;
+      memcpy(&v, &data[i], sizeof(v));
+      Tcl_ListObjAppendElement(NULL, list, Tcl_NewWideIntObj(v));
+    }
+    return list;
+  case DSERV_FLOAT:
+    list = Tcl_NewListObj(0, NULL);
+    for (uint32_t i = 0; i + sizeof(float) <= len; i += sizeof(float)) {
+      float v;
+      memcpy(&v, &data[i], sizeof(v));
+      Tcl_ListObjAppendElement(NULL, list, Tcl_NewDoubleObj(v));
+    }
+    return list;
+  case DSERV_DOUBLE:
+    list = Tcl_NewListObj(0, NULL);
+    for (uint32_t i = 0; i + sizeof(double) <= len; i += sizeof(double)) {
+      double v;
+      memcpy(&v, &data[i], sizeof(v));
+      Tcl_ListObjAppendElement(NULL, list, Tcl_NewDoubleObj(v));
+    }
+    return list;
+  default:
+    return Tcl_NewByteArrayObj(data, len);
+  }
+}
+
+/* DSLOG_RECORD_FUNC appending {varname timestamp type value} */
+static int dslogAppendRecord(const dslog_record_t *rec, void *clientdata)
+{
+  Tcl_Obj *result = (Tcl_Obj *) clientdata;
+  ds_event_info_t e;
+  int dtype;
+
+  memcpy(&e, &rec->type, sizeof(e));
+  dtype = (e.dtype == DSERV_EVT) ? e.puttype : e.dtype;
+
+  Tcl_Obj *elts[4];
+  elts[0] = Tcl_NewStringObj(rec->varname, rec->varlen);
+  elts[1] = Tcl_NewWideIntObj((Tcl_WideInt) rec->timestamp);
+  elts[2] = Tcl_NewWideIntObj(rec->type);
+  elts[3] = dslogValueObj(dtype, rec->data, rec->len);
+  Tcl_ListObjAppendElement(NULL, result, Tcl_NewListObj(4, elts));
+  return 0;
+}
+
+/*
+ * DSLOG_RECORD_FUNC accumulating one variable's samples as columns
+ *
+ *  Columnar blocks and plain records alike are copied as they are into
+ * one timestamp buffer and one sample buffer, and each column becomes a
+ * list in one go at the end (dslogColumnObj): no list per record, and
+ * nothing grown element by element.
+ */
+struct dslog_columns_t {
+  std::vector<uint64_t> timestamps;
+  std::vector<unsigned char> samples;
+  int type = -1;
+  int sample_len = 0;
+};
+
+static int dslogAppendColumns(const dslog_record_t *rec, void *clientdata)
+{
+  dslog_columns_t *cols = (dslog_columns_t *) clientdata;
+  dslog_column_header_t header;
+  const unsigned char *ts, *data;
+  uint32_t n, sample_len;
+  int type;
+
+  if (rec->flags & DSERV_DPOINT_COLUMNAR_FLAG) {
+    if (rec->len < sizeof(header)) return 0;
+    memcpy(&header, rec->data, sizeof(header));
+    if (memcmp(header.magic, DSLOG_COLUMN_MAGIC, sizeof(header.magic)) ||
+        DSLOG_COLUMN_PAYLOAD(header.nsamples, header.sample_len) != rec->len)
+      return 0;
+    type = header.type;
+    n = header.nsamples;
+    sample_len = header.sample_len;
+    ts = rec->data + sizeof(header);
+    data = ts + (size_t) n * sizeof(uint64_t);
+  }
+  else {
+    type = rec->type;
+    n = 1;
+    sample_len = rec->len;
+    ts = (const unsigned char *) &rec->timestamp;
+    data = rec->data;
+  }
+
+  /* numeric only, and the shape of the first sample seen */
+  if (type != DSERV_SHORT && type != DSERV_INT &&
+      type != DSERV_FLOAT && type != DSERV_DOUBLE)
+    return 0;
+  if (cols->type < 0) {
+    cols->type = type;
+    cols->sample_len = sample_len;
+  }
+  else if (cols->type != type || cols->sample_len != (int) sample_len)
+    return 0;
+
+  size_t first = cols->timestamps.size();
+  cols->timestamps.resize(first + n);
+  memcpy(&cols->timestamps[first], ts, (size_t) n * sizeof(uint64_t));
+  cols->samples.insert(cols->samples.end(), data,
+                       data + (size_t) n * sample_len);
+  return 0;
+}
+
+/* a whole column of one numeric type as a list, built in one go */
+template <typename T>
+static Tcl_Obj *dslogColumnObj(const unsigned char *data, size_t len)
+{
+  size_t n = len / sizeof(T);
+  std::vector<Tcl_Obj *> objs(n);
+  for (size_t i = 0; i < n; i++) {
+    T v;
+    memcpy(&v, data + i * sizeof(T), sizeof(v));
+    if constexpr (std::is_floating_point_v<T>)
+      objs[i] = Tcl_NewDoubleObj(v);
+    else
+      objs[i] = Tcl_NewWideIntObj((Tcl_WideInt) v);
+  }
+  return Tcl_NewListObj(n, objs.data());
+}
+
+static int dslogReadError(Tcl_Interp *interp, int rc)
+{
+  Tcl_AppendResult(interp, "dslog: ",
+                   rc == DSLOG_ERR_RANGE ? "out of range" :
+                   "error reading log", NULL);
+  return TCL_ERROR;
+}
+
+static int DslogOpenCmd(ClientData clientData, Tcl_Interp *interp,
+                        int objc, Tcl_Obj *const objv[])
+{
+  DslogHandles *handles = (DslogHandles *) clientData;
+  int err;
+
+  if (objc != 2) {
+    Tcl_WrongNumArgs(interp, 1, objv, "path");
+    return TCL_ERROR;
+  }
+
+  dslog_file_t *f = dslog_open(Tcl_GetString(objv[1]), &err);
+  if (!f) {
+    Tcl_AppendResult(interp, Tcl_GetString(objv[0]), ": ",
+                     err == DSLOG_ERR_FORMAT ?
+                     "not a readable dslog file (compact logs "
+                     "need dslogExpand) \"" :
+                     "unable to open \"", Tcl_GetString(objv[1]), "\"",
+                     NULL);
+    return TCL_ERROR;
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "dslog%d", handles->next++);
+  handles->files[name] = f;
+  Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+  return TCL_OK;
+}
+
+static int DslogInfoCmd(ClientData clientData, Tcl_Interp *interp,
+                        int objc, Tcl_Obj *const objv[])
+{
+  DslogHandles *handles = (DslogHandles *) clientData;
+
+  if (objc != 2) {
+    Tcl_WrongNumArgs(interp, 1, objv, "handle");
+    return TCL_ERROR;
+  }
+  dslog_file_t *f = dslogGetHandle(interp, handles, objv[1]);
+  if (!f) return TCL_ERROR;
+
+  Tcl_Obj *vars = Tcl_NewListObj(0, NULL);
+  for (int i = 0; i < dslog_nvars(f); i++) {
+    Tcl_Obj *elts[2];
+    elts[0] = Tcl_NewStringObj(dslog_varname(f, i), -1);
+    elts[1] = Tcl_NewIntObj(dslog_var_count(f, i));
+    Tcl_ListObjAppendElement(interp, vars, Tcl_NewListObj(2, elts));
+  }
+
+  Tcl_Obj *dict = Tcl_NewDictObj();
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("version", -1),
+                 Tcl_NewIntObj(dslog_version(f)));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("start", -1),
+                 Tcl_NewWideIntObj((Tcl_WideInt) dslog_start_time(f)));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("compressed", -1),
+                 Tcl_NewIntObj(dslog_compressed(f)));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("indexed", -1),
+                 Tcl_NewIntObj(dslog_indexed(f)));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("bad_trailer", -1),
+                 Tcl_NewIntObj(dslog_bad_trailer(f)));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("damaged", -1),
+                 Tcl_NewIntObj(dslog_damaged(f)));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("nobs", -1),
+                 Tcl_NewIntObj(dslog_nobs(f)));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("vars", -1), vars);
+  Tcl_SetObjResult(interp, dict);
+  return TCL_OK;
+}
+
+static int DslogVarCmd(ClientData clientData, Tcl_Interp *interp,
+                       int objc, Tcl_Obj *const objv[])
+{
+  DslogHandles *handles = (DslogHandles *) clientData;
+
+  if (objc != 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "handle varname");
+    return TCL_ERROR;
+  }
+  dslog_file_t *f = dslogGetHandle(interp, handles, objv[1]);
+  if (!f) return TCL_ERROR;
+
+  /* a variable that was never logged just has no records */
+  Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+  int var = dslog_var_find(f, Tcl_GetString(objv[2]));
+  if (var >= 0) {
+    int rc = dslog_read_var(f, var, dslogAppendRecord, result);
+    if (rc != DSLOG_OK) {
+      Tcl_DecrRefCount(result);
+      return dslogReadError(interp, rc);
+    }
+  }
+  Tcl_SetObjResult(interp, result);
+  return TCL_OK;
+}
+
+static int DslogColumnsCmd(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *const objv[])
+{
+  DslogHandles *handles = (DslogHandles *) clientData;
+  dslog_columns_t cols;
+
+  if (objc != 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "handle varname");
+    return TCL_ERROR;
+  }
+  dslog_file_t *f = dslogGetHandle(interp, handles, objv[1]);
+  if (!f) return TCL_ERROR;
+
+  int var = dslog_var_find(f, Tcl_GetString(objv[2]));
+  int rc = var >= 0 ? dslog_read_var(f, var, dslogAppendColumns, &cols) :
+    DSLOG_OK;
+  if (rc == DSLOG_OK) {
+    const unsigned char *data = cols.samples.data();
+    size_t len = cols.samples.size();
+    Tcl_Obj *samples;
+    switch (cols.type) {
+    case DSERV_SHORT:  samples = dslogColumnObj<int16_t>(data, len); break;
+    case DSERV_INT:    samples = dslogColumnObj<int32_t>(data, len); break;
+    case DSERV_FLOAT:  samples = dslogColumnObj<float>(data, len);   break;
+    case DSERV_DOUBLE: samples = dslogColumnObj<double>(data, len);  break;
+    default:           samples = Tcl_NewListObj(0, NULL);            break;
+    }
+
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("type", -1),
+                   Tcl_NewIntObj(cols.type));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("sample_len", -1),
+                   Tcl_NewIntObj(cols.sample_len));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("timestamps", -1),
+                   dslogColumnObj<uint64_t>(
+                     (const unsigned char *) cols.timestamps.data(),
+                     cols.timestamps.size() * sizeof(uint64_t)));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("samples", -1), samples);
+    Tcl_SetObjResult(interp, dict);
+  }
+  return rc == DSLOG_OK ? TCL_OK : dslogReadError(interp, rc);
+}
+
+static int DslogObsCmd(ClientData clientData, Tcl_Interp *interp,
+                       int objc, Tcl_Obj *const objv[])
+{
+  DslogHandles *handles = (DslogHandles *) clientData;
+  int obs;
+
+  if (objc != 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "handle obs");
+    return TCL_ERROR;
+  }
+  dslog_file_t *f = dslogGetHandle(interp, handles, objv[1]);
+  if (!f) return TCL_ERROR;
+  if (Tcl_GetIntFromObj(interp, objv[2], &obs) != TCL_OK) return TCL_ERROR;
+
+  Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+  int rc = dslog_read_obs(f, obs, dslogAppendRecord, result);
+  if (rc != DSLOG_OK) {
+    Tcl_DecrRefCount(result);
+    return dslogReadError(interp, rc);
+  }
+  Tcl_SetObjResult(interp, result);
+  return TCL_OK;
+}
+
+static int DslogCloseCmd(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *const objv[])
+{
+  DslogHandles *handles = (DslogHandles *) clientData;
+
+  if (objc != 2) {
+    Tcl_WrongNumArgs(interp, 1, objv, "handle");
+    return TCL_ERROR;
+  }
+  dslog_file_t *f = dslogGetHandle(interp, handles, objv[1]);
+  if (!f) return TCL_ERROR;
+  dslog_close(f);
+  handles->files.erase(Tcl_GetString(objv[1]));
+  return TCL_OK;
+}
+
+static int DslogExpandCmd(ClientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *const objv[])
+{
+  if (objc != 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "compact_path v3_path");
+    return TCL_ERROR;
+  }
+
+  int64_t n = dslog_expand(Tcl_GetString(objv[1]), Tcl_GetString(objv[2]));
+  if (n < 0) {
+    Tcl_AppendResult(interp, Tcl_GetString(objv[0]), ": ",
+                     n == DSLOG_ERR_FORMAT ? "not a compact dslog file" :
+                     n == DSLOG_ERR_OPEN ? "unable to open/write file" :
+                     "malformed log", NULL);
+    return TCL_ERROR;
+  }
+  Tcl_SetObjResult(interp, Tcl_NewWideIntObj(n));
+  return TCL_OK;
+}
+
+static int DslogInflateCmd(ClientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *const objv[])
+{
+  dslog_inflate_stats_t stats;
+
+  if (objc != 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "compressed_path out_path");
+    return TCL_ERROR;
+  }
+
+  int rc = dslog_inflate(Tcl_GetString(objv[1]), Tcl_GetString(objv[2]),
+                         &stats);
+  if (rc != DSLOG_OK) {
+    Tcl_AppendResult(interp, Tcl_GetString(objv[0]), ": ",
+                     rc == DSLOG_ERR_FORMAT ? "not a compressed dslog file" :
+                     rc == DSLOG_ERR_NOMEM ? "out of memory" :
+                     "unable to open/write file", NULL);
+    return TCL_ERROR;
+  }
+
+  Tcl_Obj *dict = Tcl_NewDictObj();
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("blocks", -1),
+                 Tcl_NewWideIntObj(stats.blocks));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("damaged", -1),
+                 Tcl_NewWideIntObj(stats.damaged));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("bytes_in", -1),
+                 Tcl_NewWideIntObj(stats.bytes_in));
+  Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("bytes_out", -1),
+                 Tcl_NewWideIntObj(stats.bytes_out));
+  Tcl_SetObjResult(interp, dict);
+  return TCL_OK;
+}
+
+/*
+ * Register commands with interpreter
+ * Call from add_tcl_commands() in TclServer.cpp:
+ *   TclDslog_RegisterCommands(interp);
+ */
+extern "C" {
+  int TclDslog_RegisterCommands(Tcl_Interp *interp) {
+    DslogHandles *handles = new DslogHandles;
+    Tcl_SetAssocData(interp, DSLOG_ASSOC_KEY, dslogDeleteHandles, handles);
+
+    Tcl_CreateObjCommand(interp, "dslogOpen", DslogOpenCmd, handles, NULL);
+    Tcl_CreateObjCommand(interp, "dslogInfo", DslogInfoCmd, handles, NULL);
+    Tcl_CreateObjCommand(interp, "dslogVar", DslogVarCmd, handles, NULL);
+    Tcl_CreateObjCommand(interp, "dslogObs", DslogObsCmd, handles, NULL);
+    Tcl_CreateObjCommand(interp, "dslogColumns", DslogColumnsCmd, handles,
+                         NULL);
+    Tcl_CreateObjCommand(interp, "dslogClose", DslogCloseCmd, handles, NULL);
+    Tcl_CreateObjCommand(interp, "dslogExpand", DslogExpandCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "dslogInflate", DslogInflateCmd, NULL, NULL);
+    return TCL_OK;
+  }
+}
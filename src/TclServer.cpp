@@ -6,13 +6,18 @@
 #include "dservConfig.h"
 #include "socket_keepalive.h"
 #include "ListenerSocket.h"
+#include "CommandObjCache.h"
 #include <vector>
 #include <algorithm>
+#include <cinttypes>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <poll.h>
 
 // JSON support
@@ -37,6 +42,7 @@
 
 extern "C" int TclHttps_RegisterCommands(Tcl_Interp *interp);
 extern "C" int TclSha256_RegisterCommands(Tcl_Interp *interp);
+extern "C" int TclDslog_RegisterCommands(Tcl_Interp *interp);
 
 static int process_requests(TclServer *tserv);
 static Tcl_Interp *setup_tcl(TclServer *tserv);
@@ -49,6 +55,14 @@ static int dserv_when_command(ClientData data, Tcl_Interp *interp,
 static int dserv_when_cancel_command(ClientData data, Tcl_Interp *interp,
                                      int objc, Tcl_Obj *const objv[]);
 
+/* names for dservLanes and dservTiming, in enum order (ClientRequest.h) */
+static const char *lane_names[LANE_NLANES + 1] = {
+  "realtime", "normal", "bulk", NULL
+};
+static const char *source_names[SRC_NSOURCES + 1] = {
+  "local", "dpoint", "timer", "module", "newline", "message", "web", NULL
+};
+
 // For one off subprocesses don't need name
 TclServer::TclServer(int argc, char **argv, Dataserver *dserv)
   : TclServer(argc, argv, dserv, TclServerConfig("", -1, -1, -1))
@@ -133,6 +147,32 @@ TclServer::TclServer(int argc, char **argv,
     }
   }
   std::filesystem::create_directories(exports_path); 
+
+  // lanes before anything can queue a request
+  for (int i = 0; i < SRC_NSOURCES; i++) source_lane[i] = LANE_NORMAL;
+  source_lane[SRC_DPOINT] = LANE_REALTIME;
+  source_lane[SRC_TIMER] = LANE_REALTIME;
+  source_lane[SRC_NEWLINE] = LANE_BULK;
+  source_lane[SRC_MESSAGE] = LANE_BULK;
+  source_lane[SRC_WEB] = LANE_BULK;
+  timing.set_lane_names(std::vector<std::string>(lane_names,
+                                                 lane_names + LANE_NLANES));
+  queue.set_lanes(LANE_NLANES,
+                  [this](const client_request_t &req) { return lane_of(req); },
+                  DEFAULT_LANE_BURST);
+
+  // deliveries for -latest dpoint scripts collapse to the newest waiting
+  queue.set_conflate(
+    [this](const client_request_t &req) {
+      if (req.type != REQ_DPOINT_SCRIPT || !req.dpoint ||
+          !req.dpoint->varname) return std::string();
+      const char *varname = req.dpoint->varname;
+      /* the event dispatcher wants every event, whatever is registered */
+      if (!dpoint_scripts.latest(varname) ||
+          !strcmp(varname, "eventlog/events")) return std::string();
+      return std::string(varname);
+    },
+    [](client_request_t &req) { dpoint_free(req.dpoint); });
   
   // create a connection to dataserver so we can subscribe to datapoints
   client_name = ds->add_new_send_client(&queue);
@@ -760,6 +800,7 @@ void TclServer::start_websocket_server(void)
                 client_request.script = tcl_cmd;
                 client_request.socket_fd = -1;
                 client_request.websocket_id = "";
+                client_request.source = SRC_WEB;
                 
                 this->queue.push_back(client_request);
                 
@@ -1104,54 +1145,48 @@ set www_path /usr/local/dserv/www</code>
           }
 
           try {
-            // Channel outlives this socket: the notification thread holds a
+            // Channel outlives this socket: the SendClient's sink holds a
             // shared_ptr to it, so uWS freeing userData cannot pull it away
             userData->channel = std::make_shared<WSClientChannel>();
-            userData->channel->notification_queue =
-	      new SharedQueue<client_request_t>();
 
             // Create async response queue for this client
             userData->async_responses = new SharedQueue<std::string>();
 
-            // Register with Dataserver as a queue-based client
-            userData->dataserver_client_id =
-	      this->ds->add_new_send_client(userData->channel->notification_queue);
+            // Create a unique client name for this WebSocket
+            char client_id[32];
+            snprintf(client_id, sizeof(client_id), "ws_%p", (void*)ws);
+            userData->client_name = std::string(client_id);
+
+            // Register with Dataserver as a sink client, served on a
+            // fanout worker.  The sink captures the channel (shared_ptr,
+            // by value) and the name -- deliberately NOT userData, which
+            // uWS frees at socket destruction while deliveries may still
+            // be on their way.
+            {
+              auto channel = userData->channel;
+              std::string client_name = userData->client_name;
+              userData->dataserver_client_id =
+                this->ds->add_new_send_client(
+                  [this, ws, channel, client_name](ds_datapoint_t *dpoint) {
+                    this->ws_notify(ws, channel.get(), client_name, dpoint);
+                  });
+            }
 
             if (userData->dataserver_client_id.empty()) {
               std::cerr <<
 		"Failed to register WebSocket client with Dataserver" <<
 		std::endl;
-              delete userData->channel->notification_queue;
-              userData->channel->notification_queue = nullptr;
               userData->channel.reset();
               ws->close();
               return;
             }
 
-            // Create a unique client name for this WebSocket
-            char client_id[32];
-            snprintf(client_id, sizeof(client_id), "ws_%p", (void*)ws);
-            userData->client_name = std::string(client_id);
-
             // Store this WebSocket connection
             {
               std::lock_guard<std::mutex> lock(this->ws_connections_mutex);
               this->ws_connections[userData->client_name] = (void*)ws;
             }
 
-            // Start a thread to process notifications for this client.
-            // It captures the channel (shared_ptr, by value) and the name --
-            // deliberately NOT userData, which uWS frees at socket destruction
-            // while this thread is still running.
-            {
-              auto channel = userData->channel;
-              std::string client_name = userData->client_name;
-              std::thread([this, ws, channel, client_name]() {
-                this->process_websocket_client_notifications_template(ws, channel,
-								      client_name);
-              }).detach();
-            }
-
           } catch (const std::exception& e) {
             std::cerr << "Exception in WebSocket open handler: " << e.what() << std::endl;
             ws->close();
@@ -1179,7 +1214,7 @@ set www_path /usr/local/dserv/www</code>
               json_t *error_response = json_object();
               json_object_set_new(error_response, "error", json_string("Invalid JSON"));
               char *error_str = json_dumps(error_response, 0);
-              ws->send(error_str, uWS::OpCode::TEXT);
+              this->wsSend(ws, error_str, uWS::OpCode::TEXT);
               free(error_str);
               json_decref(error_response);
               return;
@@ -1190,7 +1225,7 @@ set www_path /usr/local/dserv/www</code>
               json_t *error_response = json_object();
               json_object_set_new(error_response, "error", json_string("Missing 'cmd' field"));
               char *error_str = json_dumps(error_response, 0);
-              ws->send(error_str, uWS::OpCode::TEXT);
+              this->wsSend(ws, error_str, uWS::OpCode::TEXT);
               free(error_str);
               json_decref(error_response);
               json_decref(root);
@@ -1218,6 +1253,7 @@ set www_path /usr/local/dserv/www</code>
                   req.socket_fd = -1;
                   req.websocket_id = userData->client_name;
                   req.request_id = json_string_value(requestId_obj);
+                  req.source = SRC_WEB;
 
                   queue.push_back(req);
                   // Event loop is free — response sent from process_requests
@@ -1231,6 +1267,7 @@ set www_path /usr/local/dserv/www</code>
                   req.script = std::string(script);
                   req.socket_fd = -1;
                   req.websocket_id = userData->client_name;
+                  req.source = SRC_WEB;
 
                   queue.push_back(req);
 
@@ -1249,7 +1286,7 @@ set www_path /usr/local/dserv/www</code>
                   }
 
                   char *response_str = json_dumps(response, 0);
-                  ws->send(response_str, uWS::OpCode::TEXT);
+                  this->wsSend(ws, response_str, uWS::OpCode::TEXT);
                   free(response_str);
                   json_decref(response);
                 }
@@ -1294,7 +1331,7 @@ set www_path /usr/local/dserv/www</code>
                 }
                 
                 char *response_str = json_dumps(response, 0);
-                ws->send(response_str, uWS::OpCode::TEXT);
+                this->wsSend(ws, response_str, uWS::OpCode::TEXT);
                 free(response_str);
                 json_decref(response);
               } else {
@@ -1302,7 +1339,7 @@ set www_path /usr/local/dserv/www</code>
                 json_object_set_new(error_response, "error",
 				    json_string("Missing or invalid 'name' field"));
                 char *error_str = json_dumps(error_response, 0);
-                ws->send(error_str, uWS::OpCode::TEXT);
+                this->wsSend(ws, error_str, uWS::OpCode::TEXT);
                 free(error_str);
                 json_decref(error_response);
               }
@@ -1327,6 +1364,7 @@ set www_path /usr/local/dserv/www</code>
             else if (strcmp(cmd, "subscribe") == 0) {
               json_t *match_obj = json_object_get(root, "match");
               json_t *every_obj = json_object_get(root, "every");
+              json_t *format_obj = json_object_get(root, "format");
               
               if (match_obj && json_is_string(match_obj)) {
                 const char *match = json_string_value(match_obj);
@@ -1334,27 +1372,53 @@ set www_path /usr/local/dserv/www</code>
                 if (every_obj && json_is_integer(every_obj)) {
                   every = json_integer_value(every_obj);
                 }
+
+                // "format":"binary" asks for binary datapoint records
+                // (see WSClientChannel) instead of JSON text
+                bool binary = format_obj && json_is_string(format_obj) &&
+                  !strcmp(json_string_value(format_obj), "binary");
+
+                // "policy": what this client gets when it falls behind
+                // (all[:N], latest, rate:N -- see SendPolicy)
+                json_t *policy_obj = json_object_get(root, "policy");
+                const char *policy = (policy_obj && json_is_string(policy_obj)) ?
+                  json_string_value(policy_obj) : nullptr;
+                SendPolicy parsed;
+                if (policy && !SendPolicy::parse(policy, &parsed)) {
+                  json_t *error_response = json_object();
+                  json_object_set_new(error_response, "error",
+                                      json_string("Invalid policy"));
+                  char *error_str = json_dumps(error_response, 0);
+                  this->wsSend(ws, error_str, uWS::OpCode::TEXT);
+                  free(error_str);
+                  json_decref(error_response);
+                  json_decref(root);
+                  return;
+                }
                 
                 // Store the subscription for this WebSocket client.
-                // Under subs_mutex: the notification thread iterates this
+                // Under subs_mutex: ws_notify iterates this
                 // vector, and a reallocating push_back would invalidate it
                 // mid-iteration.
                 if (userData->channel) {
                   std::lock_guard<std::mutex> lock(userData->channel->subs_mutex);
-                  userData->channel->subscriptions.push_back(std::string(match));
+                  userData->channel->subscriptions.push_back({match, binary});
                 }
 
                 // Register the match with Dataserver so we get notifications
-                ds->client_add_match(userData->dataserver_client_id, (char*)match, every);
+                ds->client_add_match(userData->dataserver_client_id, (char*)match,
+                                     every, policy);
                 
                 // Send confirmation
                 json_t *response = json_object();
                 json_object_set_new(response, "status", json_string("ok"));
                 json_object_set_new(response, "action", json_string("subscribed"));
                 json_object_set_new(response, "match", json_string(match));
+                json_object_set_new(response, "format",
+                                    json_string(binary ? "binary" : "json"));
                 
                 char *response_str = json_dumps(response, 0);
-                ws->send(response_str, uWS::OpCode::TEXT);
+                this->wsSend(ws, response_str, uWS::OpCode::TEXT);
                 free(response_str);
                 json_decref(response);
               }
@@ -1366,11 +1430,14 @@ set www_path /usr/local/dserv/www</code>
                 const char *match = json_string_value(match_obj);
                 
                 // Remove from local subscriptions (see subscribe: the
-                // notification thread reads this under the same mutex)
+                // same mutex as ws_notify)
                 if (userData->channel) {
                   std::lock_guard<std::mutex> lock(userData->channel->subs_mutex);
                   auto &subs = userData->channel->subscriptions;
-                  auto it = std::find(subs.begin(), subs.end(), match);
+                  auto it = std::find_if(subs.begin(), subs.end(),
+                                         [match](const WSSubscription &sub) {
+                                           return sub.match == match;
+                                         });
                   if (it != subs.end()) {
                     subs.erase(it);
                   }
@@ -1386,7 +1453,7 @@ set www_path /usr/local/dserv/www</code>
                 json_object_set_new(response, "match", json_string(match));
                 
                 char *response_str = json_dumps(response, 0);
-                ws->send(response_str, uWS::OpCode::TEXT);
+                this->wsSend(ws, response_str, uWS::OpCode::TEXT);
                 free(response_str);
                 json_decref(response);
               }
@@ -1398,8 +1465,8 @@ set www_path /usr/local/dserv/www</code>
               
               if (userData->channel) {
                 std::lock_guard<std::mutex> lock(userData->channel->subs_mutex);
-                for (const std::string& sub : userData->channel->subscriptions) {
-                  json_array_append_new(subs_array, json_string(sub.c_str()));
+                for (const WSSubscription& sub : userData->channel->subscriptions) {
+                  json_array_append_new(subs_array, json_string(sub.match.c_str()));
                 }
               }
 
@@ -1407,7 +1474,7 @@ set www_path /usr/local/dserv/www</code>
               json_object_set_new(response, "subscriptions", subs_array);
               
               char *response_str = json_dumps(response, 0);
-              ws->send(response_str, uWS::OpCode::TEXT);
+              this->wsSend(ws, response_str, uWS::OpCode::TEXT);
               free(response_str);
               json_decref(response);
             }
@@ -1417,17 +1484,13 @@ set www_path /usr/local/dserv/www</code>
               json_t *name_obj = json_object_get(root, "name");
               if (name_obj && json_is_string(name_obj)) {
                 const char *name = json_string_value(name_obj);
-                ds_datapoint_t *dp = ds->get_datapoint((char *)name);
-
-		if (dp && DPOINT_IS_PRIVATE(dp)) {
-		  dpoint_free(dp);
-		  dp = nullptr;	/* report as not found */
-		}
+		/* private points come back empty: report as not found */
+                DatapointSnapshot dp = ds->get_snapshot((char *)name);
 
 		if (dp) {
-		  char *json_str = dpoint_to_json(dp);
+		  char *json_str = dpoint_to_json((ds_datapoint_t *) dp.get());
 		  if (json_str) {
-		    ws->send(json_str, uWS::OpCode::TEXT);
+		    this->wsSend(ws, json_str, uWS::OpCode::TEXT);
 		    free(json_str);
 		  } else {
 		    // Send error about unsupported datatype
@@ -1435,18 +1498,17 @@ set www_path /usr/local/dserv/www</code>
 		    json_object_set_new(error_response, "error",
 					json_string("Unsupported datapoint type"));
 		    char *error_str = json_dumps(error_response, 0);
-		    ws->send(error_str, uWS::OpCode::TEXT);
+		    this->wsSend(ws, error_str, uWS::OpCode::TEXT);
 		    free(error_str);
 		    json_decref(error_response);
 		  }
-		  dpoint_free(dp);
 		}
                 else {
                   json_t *error_response = json_object();
                   json_object_set_new(error_response, "error",
 				      json_string("Datapoint not found"));
                   char *error_str = json_dumps(error_response, 0);
-                  ws->send(error_str, uWS::OpCode::TEXT);
+                  this->wsSend(ws, error_str, uWS::OpCode::TEXT);
                   free(error_str);
                   json_decref(error_response);
                 }
@@ -1468,7 +1530,7 @@ set www_path /usr/local/dserv/www</code>
                 json_object_set_new(response, "action", json_string("set"));
                   
                 char *response_str = json_dumps(response, 0);
-                ws->send(response_str, uWS::OpCode::TEXT);
+                this->wsSend(ws, response_str, uWS::OpCode::TEXT);
                 free(response_str);
                 json_decref(response);
               }
@@ -1492,6 +1554,7 @@ set www_path /usr/local/dserv/www</code>
             req.script = script;
 	    req.socket_fd = -1;
 	    req.websocket_id = userData->client_name;
+	    req.source = SRC_WEB;
   
             queue.push_back(req);
               
@@ -1499,12 +1562,17 @@ set www_path /usr/local/dserv/www</code>
             userData->rqueue->pop_front();
               
             // For text protocol, send plain response
-            ws->send(result, uWS::OpCode::TEXT);
+            this->wsSend(ws, std::move(result), uWS::OpCode::TEXT);
           }
         },
           
         .dropped = [](auto *ws, std::string_view message, uWS::OpCode opCode) {
           std::cerr << "WebSocket message dropped due to backpressure" << std::endl;
+          /* it may have carried binary stream NAME records: the
+             next delivery sends every name again */
+          WSPerSocketData *userData = (WSPerSocketData *) ws->getUserData();
+          if (opCode == uWS::OpCode::BINARY && userData && userData->channel)
+            userData->channel->names_lost = true;
         },
 
         .drain = [](auto *ws) {
@@ -1515,7 +1583,10 @@ set www_path /usr/local/dserv/www</code>
              and closing mid-send silently killed every large-datapoint
              viewer. The 1MB guard that used to live here did exactly
              that. Slow/runaway clients are already bounded by
-             maxBackpressure (24MB, drops new sends) and idleTimeout. */
+             maxBackpressure (24MB, drops new sends) and idleTimeout.
+             What it is for: handing the next fragments of a large
+             message to the socket as the last ones leave (wsSend). */
+          TclServer::wsFlush(ws);
         },
           
         .ping = [](auto *ws, std::string_view) {
@@ -1540,32 +1611,19 @@ set www_path /usr/local/dserv/www</code>
               this->ws_connections.erase(userData->client_name);
             }
             
-            // Remove from Dataserver's send_table.  The SendClient
-            // thread will push REQ_QUEUE_EOS into our notification
-            // queue as its final act, and the notification thread
-            // frees the queue only after seeing it — the producer
-            // announces end-of-stream, so no sleep/guess is needed.
-            bool producer_active = false;
+            // Remove from Dataserver's send_table.  Deliveries already
+            // queued may still reach the sink; they only find the
+            // socket gone from ws_connections.
             if (!userData->dataserver_client_id.empty()) {
-              producer_active =
-                this->ds->remove_send_client_by_id(userData->dataserver_client_id) != 0;
+              this->ds->remove_send_client_by_id(userData->dataserver_client_id);
             }
 
 	    // Cleanup linked subprocesses
 	    this->cleanup_subprocesses_for_websocket(userData->client_name);
 
-            // If no producer existed (registration failed or already
-            // removed), unblock the notification thread ourselves
-            if (userData->channel && userData->channel->notification_queue &&
-		!producer_active) {
-              client_request_t eos_req;
-              eos_req.type = REQ_QUEUE_EOS;
-              userData->channel->notification_queue->push_back(eos_req);
-            }
-
-            // Drop this socket's reference to the channel. The notification
-            // thread holds the other one and frees the queue when it sees EOS,
-            // so the channel outlives userData by exactly as long as needed.
+            // Drop this socket's reference to the channel.  The sink holds
+            // the other one, so the channel outlives userData for as long
+            // as the SendClient does.
             userData->channel.reset();
 
             // Clean up rqueue
@@ -1625,173 +1683,183 @@ set www_path /usr/local/dserv/www</code>
   }
 }
 
+/*
+ * Append dp to out as binary stream records (see WSClientChannel),
+ * preceded by a name record if this connection hasn't seen its varname
+ * yet (or may have lost it to a dropped message).  Returns false, with out untouched, if the point can't go
+ * binary: its varname would need an id and they've all been handed
+ * out.
+ */
+static bool ws_dpoint_to_binary(WSClientChannel *channel,
+                                ds_datapoint_t *dp, std::string &out)
+{
+  if (channel->names_lost.exchange(false))
+    for (auto &entry : channel->name_ids) entry.second.named = false;
+
+  auto it = channel->name_ids.find(dp->varname);
+  if (it == channel->name_ids.end()) {
+    if (channel->name_ids.size() >= WS_DPOINT_MAX_IDS) return false;
+    uint16_t next = (uint16_t) channel->name_ids.size();
+    it = channel->name_ids.emplace(dp->varname,
+                                   WSClientChannel::name_id_t{ next, false })
+      .first;
+  }
+  uint16_t id = it->second.id;
+
+  if (!it->second.named) {
+    it->second.named = true;
+    uint16_t namelen = dp->varlen;
+    uint8_t head[2] = { WS_DPOINT_NAME, 0 };
+    out.append((const char *) head, sizeof(head));
+    out.append((const char *) &id, sizeof(id));
+    out.append((const char *) &namelen, sizeof(namelen));
+    out.append(dp->varname, namelen);
+  }
+
+  bool event = dp->data.e.dtype == DSERV_EVT;
+  uint8_t head[2] = { WS_DPOINT_DATA,
+                      (uint8_t) (event ? DSERV_EVT : dp->data.type) };
+  uint32_t len = dp->data.len;
+  uint64_t timestamp = dp->timestamp;
+
+  out.reserve(out.size() + 16 + (event ? 4 : 0) + len);
+  out.append((const char *) head, sizeof(head));
+  out.append((const char *) &id, sizeof(id));
+  out.append((const char *) &len, sizeof(len));
+  out.append((const char *) &timestamp, sizeof(timestamp));
+  if (event) {
+    uint8_t e[4] = { dp->data.e.type, dp->data.e.subtype,
+                     dp->data.e.puttype, 0 };
+    out.append((const char *) e, sizeof(e));
+  }
+  if (len) out.append((const char *) dp->data.buf, len);
+  return true;
+}
+
+/*
+ * ws_notify
+ *
+ *  The sink of a websocket's SendClient: called with each point on the
+ * client's fanout worker (one point at a time), so a socket costs no
+ * thread of its own.  Anything matching a subscription is formatted
+ * here and handed to the loop thread to send; the point is freed
+ * either way.
+ */
 template<typename WebSocketType>
-void TclServer::process_websocket_client_notifications_template(
-    WebSocketType* ws, std::shared_ptr<WSClientChannel> channel,
-    std::string client_name) {
-    if (!channel || !channel->notification_queue) {
-        std::cerr << "ERROR: channel is null in notification thread" << std::endl;
-        return;
-    }
+void TclServer::ws_notify(WebSocketType* ws, WSClientChannel *channel,
+                          const std::string& client_name,
+                          ds_datapoint_t *dpoint) {
+    // Check if this datapoint matches any subscriptions
+    bool matches = false;
+    bool binary = false;
+    const char *dpoint_name = dpoint->varname;
+
+    {
+      /* the event loop mutates this vector on subscribe/unsubscribe */
+      std::lock_guard<std::mutex> lock(channel->subs_mutex);
+      for (const WSSubscription& sub : channel->subscriptions) {
+        const std::string& pattern = sub.match;
+        if (pattern == "*") {
+            matches = true;
+        } else if (pattern.back() == '*') {
+            matches = (strncmp(dpoint_name, pattern.c_str(),
+                               pattern.length() - 1) == 0);
+        } else {
+            matches = (strcmp(dpoint_name, pattern.c_str()) == 0);
+        }
 
-    /* Resolved ONCE. The old code re-read this pointer out of the socket's
-       userData on every iteration, and uWS frees userData the moment the socket
-       is destroyed -- so front() could succeed and the pop_front() on the very
-       next line run against a freed (zeroed) pointer. The channel we hold is
-       shared_ptr-owned and cannot be pulled out from under us. */
-    SharedQueue<client_request_t> *queue = channel->notification_queue;
-
-    bool done = false;
-
-    while (!done) {
-      try {
-        client_request_t req = queue->front();
-        queue->pop_front();
-
-        // REQ_QUEUE_EOS is the producer's (SendClient's) final act;
-        // after it, no further pushes can arrive, so the queue
-        // deletion below cannot race the producer
-        if (req.type == REQ_QUEUE_EOS || req.type == REQ_SHUTDOWN) {
-            done = true;
+        if (matches) {
+            binary = sub.binary;
             break;
         }
-        
-        if (req.type == REQ_DPOINT_SCRIPT && req.dpoint) {
-            // Check if this datapoint matches any subscriptions
-            bool matches = false;
-            std::string dpoint_name(req.dpoint->varname);
+      }
+    }
 
-            {
-              /* the event loop mutates this vector on subscribe/unsubscribe */
-              std::lock_guard<std::mutex> lock(channel->subs_mutex);
-              for (const std::string& pattern : channel->subscriptions) {
-                if (pattern == "*") {
-                    matches = true;
-                } else if (pattern.back() == '*') {
-                    std::string prefix = pattern.substr(0, pattern.length() - 1);
-                    matches = (strncmp(dpoint_name.c_str(), prefix.c_str(), prefix.length()) == 0);
-                } else {
-                    matches = (strcmp(dpoint_name.c_str(), pattern.c_str()) == 0);
-                }
+    if (matches) {
+        std::string message;
+        uWS::OpCode opcode = uWS::OpCode::BINARY;
 
-                if (matches) break;
-              }
+        if (!binary || !ws_dpoint_to_binary(channel, dpoint, message)) {
+            // JSON, with the type tag put on as it's built
+            char *json_str = dpoint_to_json_type(dpoint, "datapoint");
+            if (json_str) {
+                message = json_str;
+                free(json_str);
             }
+            opcode = uWS::OpCode::TEXT;
+        }
 
-            if (matches) {
-                // Convert to JSON
-                char *json_str = dpoint_to_json(req.dpoint);
-                if (json_str) {
-                    json_error_t error;
-                    json_t *root = json_loads(json_str, 0, &error);
-                    if (root) {
-                        json_object_set_new(root, "type", json_string("datapoint"));
-                        char *enhanced_json = json_dumps(root, 0);
-                        
-                        std::string message(enhanced_json);
-                        
-                        // Send using ws_loop->defer for thread safety.
-                        // The liveness check is not optional: this lambda runs
-                        // later, on the loop thread, and the socket may have
-                        // been closed and destroyed in between -- ws would then
-                        // dangle. Checking ws_connections IS sufficient because
-                        // .close erases from it on this same loop thread before
-                        // uWS frees the socket, so a hit here means alive.
-                        // (sendLargeMessage already did this; this path didn't.)
-                        if (ws_loop) {
-                            ws_loop->defer([ws, message, client_name, this]() {
-                                if (this->isWebSocketConnected(client_name, ws)) {
-                                    ws->send(message, uWS::OpCode::TEXT);
-                                }
-                            });
-                        }
-
-                        free(enhanced_json);
-                        json_decref(root);
-                    }
-                    free(json_str);
+        // Send using ws_loop->defer for thread safety.
+        // The liveness check is not optional: this lambda runs
+        // later, on the loop thread, and the socket may have
+        // been closed and destroyed in between -- ws would then
+        // dangle. Checking ws_connections IS sufficient because
+        // .close erases from it on this same loop thread before
+        // uWS frees the socket, so a hit here means alive.
+        if (ws_loop && !message.empty()) {
+            ws_loop->defer([ws, message = std::move(message), opcode,
+                            client_name, this]() mutable {
+                if (this->isWebSocketConnected(client_name, ws)) {
+                    this->wsSend(ws, std::move(message), opcode);
                 }
-            }
-            dpoint_free(req.dpoint);
+            });
         }
-      } catch (...) {
-          std::this_thread::sleep_for(std::chrono::milliseconds(10));
-      }
     }
-    
-    // Cleanup. Safe after EOS: that is the producer's final act, so nothing can
-    // still push. We own the queue here -- the socket's reference to the
-    // channel is already gone (dropped in .close).
-    delete queue;
-    channel->notification_queue = nullptr;
+    dpoint_free(dpoint);
 }
 
+/*
+ * wsSend
+ *
+ *  Send a websocket message in order with everything sent before it.
+ * Anything up to LARGE_MESSAGE_THRESHOLD goes straight to uWS when
+ * nothing is waiting.  Larger messages (a stimdg, a camera frame) are
+ * sent as one fragmented websocket message: CHUNK_SIZE slices of the
+ * message itself, so there is no re-encoding and no copy beyond the
+ * one here, and each slice is handed to uWS only once the socket has
+ * drained below WS_HIGH_WATER (.drain calls wsFlush).  Whatever comes
+ * after waits in the socket's outbox, since nothing may be sent in the
+ * middle of a fragmented message.
+ */
 template<typename WebSocketType>
-void TclServer::sendLargeMessage(WebSocketType* ws,
-                               const std::string& message,
-                               const std::string& client_name) {
-    if (message.size() <= LARGE_MESSAGE_THRESHOLD) {
-        // Small message, send directly
-        if (ws_loop) {
-            ws_loop->defer([ws, message, client_name, this]() {
-                std::lock_guard<std::mutex> lock(this->ws_connections_mutex);
-                auto it = this->ws_connections.find(client_name);
-                if (it != this->ws_connections.end() && it->second == ws) {
-                    ws->send(message, uWS::OpCode::TEXT);
-                }
-            });
-        }
+void TclServer::wsSend(WebSocketType* ws, std::string message,
+                       uWS::OpCode opcode)
+{
+    WSPerSocketData *ud = (WSPerSocketData *) ws->getUserData();
+    if (!ud) return;
+
+    if (ud->outbox.empty() && message.size() <= LARGE_MESSAGE_THRESHOLD) {
+        ws->send(message, opcode);
         return;
     }
-    
-    // Large message - chunk it
-    //    std::cout << "Chunking large message: " << (message.size() / 1024) << "KB" << std::endl;
-    
-    // Generate unique message ID
-    auto now = std::chrono::steady_clock::now();
-    std::string messageId = std::to_string(now.time_since_epoch().count());
-    
-    size_t totalChunks = (message.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
-    
-    for (size_t i = 0; i < totalChunks; i++) {
-        size_t start = i * CHUNK_SIZE;
-        size_t end = std::min(start + CHUNK_SIZE, message.size());
-        std::string chunk = message.substr(start, end - start);
-        
-        // Create chunked message
-        json_t *chunked = json_object();
-        json_object_set_new(chunked, "isChunkedMessage", json_true());
-        json_object_set_new(chunked, "messageId", json_string(messageId.c_str()));
-        json_object_set_new(chunked, "chunkIndex", json_integer(i));
-        json_object_set_new(chunked, "totalChunks", json_integer(totalChunks));
-        json_object_set_new(chunked, "data", json_string(chunk.c_str()));
-        json_object_set_new(chunked, "isLastChunk", json_boolean(i == totalChunks - 1));
-        
-        char *chunk_str = json_dumps(chunked, 0);
-        std::string chunk_message(chunk_str);
-        
-        // Send chunk with proper defer
-        if (ws_loop) {
-            ws_loop->defer([ws, chunk_message, client_name, this, i]() {
-                std::lock_guard<std::mutex> lock(this->ws_connections_mutex);
-                auto it = this->ws_connections.find(client_name);
-                if (it != this->ws_connections.end() && it->second == ws) {
-                    bool sent = ws->send(chunk_message, uWS::OpCode::TEXT);
-                    if (!sent) {
-                        std::cerr << "Failed to send chunk " << i << std::endl;
-                    }
-                }
-            });
+    ud->outbox.push_back({ std::move(message), opcode });
+    wsFlush(ws);
+}
+
+template<typename WebSocketType>
+void TclServer::wsFlush(WebSocketType* ws)
+{
+    WSPerSocketData *ud = (WSPerSocketData *) ws->getUserData();
+    if (!ud) return;
+
+    while (!ud->outbox.empty() && ws->getBufferedAmount() < WS_HIGH_WATER) {
+        WSOutMessage &m = ud->outbox.front();
+        size_t left = m.data.size() - m.sent;
+
+        if (!m.sent && left <= LARGE_MESSAGE_THRESHOLD) {
+            ws->send(m.data, m.opcode);
         }
-        
-        free(chunk_str);
-        json_decref(chunked);
-        
-        // Small delay between chunks to prevent overwhelming
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        else {
+            size_t n = left < CHUNK_SIZE ? left : CHUNK_SIZE;
+            bool fin = n == left;
+            ws->send(std::string_view(m.data).substr(m.sent, n),
+                     m.sent ? uWS::OpCode::CONTINUATION : m.opcode,
+                     false, fin);
+            m.sent += n;
+            if (!fin) continue;
+        }
+        ud->outbox.pop_front();
     }
-    
-    //    std::cout << "Sent " << totalChunks << " chunks for message " << messageId << std::endl;
 }
 
 /********************* link subprocess to connection support *******************************/
@@ -2349,9 +2417,120 @@ static int subprocess_exit_cmd(ClientData clientData, Tcl_Interp *interp,
 
 
 /*
- * dservTiming ?on|off|reset|stats?
+ * dservLanes ?source? ?lane?
+ *   The lane each request source's requests go in (ClientRequest.h):
+ *   with no arguments a dict of them all, with a source its lane, with
+ *   a lane as well a new one.  Defaults: dpoint and timer realtime;
+ *   module and local normal; newline, message and web bulk.  A
+ *   connection's requests share a source, so move a source and its
+ *   traffic moves with it -- though anything already queued finishes
+ *   in its old lane, out of order with what follows.
+ */
+static int dserv_lanes_command(ClientData data, Tcl_Interp *interp,
+			       int objc, Tcl_Obj *objv[])
+{
+  TclServer *tclserver = (TclServer *) data;
+  int source, lane;
+
+  if (objc > 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "?source? ?lane?");
+    return TCL_ERROR;
+  }
+  if (objc == 1) {
+    Tcl_Obj *dictObj = Tcl_NewDictObj();
+    for (int i = 0; i < SRC_NSOURCES; i++)
+      Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj(source_names[i], -1),
+		     Tcl_NewStringObj(lane_names[tclserver->source_lane[i]], -1));
+    Tcl_SetObjResult(interp, dictObj);
+    return TCL_OK;
+  }
+
+  if (Tcl_GetIndexFromObj(interp, objv[1], source_names, "source", 0,
+			  &source) != TCL_OK)
+    return TCL_ERROR;
+  if (objc == 3) {
+    if (Tcl_GetIndexFromObj(interp, objv[2], lane_names, "lane", 0,
+			    &lane) != TCL_OK)
+      return TCL_ERROR;
+    tclserver->source_lane[source] = lane;
+  }
+  Tcl_SetObjResult(interp,
+		   Tcl_NewStringObj(lane_names[tclserver->source_lane[source]],
+				    -1));
+  return TCL_OK;
+}
+
+/*
+ * dservLaneBurst ?n?
+ *   How many requests a higher lane may take while a lower one waits
+ *   before the lower one gets a turn (SharedQueue::set_lanes): the
+ *   bound on how long bulk traffic can be held off.
+ */
+static int dserv_lane_burst_command(ClientData data, Tcl_Interp *interp,
+				    int objc, Tcl_Obj *objv[])
+{
+  TclServer *tclserver = (TclServer *) data;
+  int burst;
+
+  if (objc > 2) {
+    Tcl_WrongNumArgs(interp, 1, objv, "?n?");
+    return TCL_ERROR;
+  }
+  if (objc == 2) {
+    if (Tcl_GetIntFromObj(interp, objv[1], &burst) != TCL_OK)
+      return TCL_ERROR;
+    if (burst < 1 || burst > 100000) {
+      Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+		       ": burst must be between 1 and 100000", NULL);
+      return TCL_ERROR;
+    }
+    tclserver->queue.set_burst(burst);
+  }
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(tclserver->queue.burst()));
+  return TCL_OK;
+}
+
+/*
+ * dservScriptCache ?capacity|flush?
+ *   How many client script texts this interp keeps compiled
+ *   (ScriptCache.h); 0 turns the cache off.  flush drops them all.
+ *   Hits and misses are in dservTiming scripts.
+ */
+static int dserv_script_cache_command(ClientData data, Tcl_Interp *interp,
+				      int objc, Tcl_Obj *objv[])
+{
+  TclServer *tclserver = (TclServer *) data;
+  int capacity;
+
+  if (objc > 2) {
+    Tcl_WrongNumArgs(interp, 1, objv, "?capacity|flush?");
+    return TCL_ERROR;
+  }
+  if (objc == 2) {
+    if (!strcmp(Tcl_GetString(objv[1]), "flush")) {
+      tclserver->script_cache.flush();
+    }
+    else {
+      if (Tcl_GetIntFromObj(interp, objv[1], &capacity) != TCL_OK)
+	return TCL_ERROR;
+      if (capacity < 0 || capacity > 100000) {
+	Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+			 ": capacity must be between 0 and 100000", NULL);
+	return TCL_ERROR;
+      }
+      tclserver->script_cache.set_capacity(capacity);
+    }
+  }
+  Tcl_SetObjResult(interp,
+		   Tcl_NewWideIntObj(tclserver->script_cache.capacity()));
+  return TCL_OK;
+}
+
+/*
+ * dservTiming ?on|off|reset|stats|slow|labels|lanes|scripts?
  *   Report timing for this interpreter's serialized request path.
- *   With no argument, equivalent to "stats".
+ *   With no argument, equivalent to "stats".  scripts reports the
+ *   compiled script cache: size, hits, misses and hit rate.
  */
 static int dserv_timing_command(ClientData data, Tcl_Interp *interp,
 				int objc, Tcl_Obj *objv[])
@@ -2368,6 +2547,7 @@ static int dserv_timing_command(ClientData data, Tcl_Interp *interp,
   }
   else if (!strcmp(sub, "reset")) {
     tclserver->timing.reset();
+    tclserver->script_cache.reset_counters();
   }
   else if (!strcmp(sub, "stats")) {
     std::string s = tclserver->timing.report();
@@ -2381,15 +2561,59 @@ static int dserv_timing_command(ClientData data, Tcl_Interp *interp,
     std::string s = tclserver->timing.labels();
     Tcl_SetObjResult(interp, Tcl_NewStringObj(s.c_str(), -1));
   }
+  else if (!strcmp(sub, "lanes")) {
+    std::string s = tclserver->timing.lanes();
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(s.c_str(), -1));
+  }
+  else if (!strcmp(sub, "scripts")) {
+    std::string s = tclserver->script_cache.report();
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(s.c_str(), -1));
+  }
   else {
     Tcl_WrongNumArgs(interp, 1, objv,
-		     "?on|off|reset|stats|slow|labels?");
+		     "?on|off|reset|stats|slow|labels|lanes|scripts?");
     return TCL_ERROR;
   }
 
   return TCL_OK;
 }
 
+/*
+ * dservAllocStats ?reset?
+ *   Process-wide datapoint allocation counters (see Datapoint.c):
+ *   allocs, copies, copy_bytes, refs, frees.  Reset, publish a known
+ *   number of points, and copies/publishes is the per-set copy cost.
+ */
+static int dserv_alloc_stats_command(ClientData data, Tcl_Interp *interp,
+				     int objc, Tcl_Obj *objv[])
+{
+  if (objc > 1) {
+    if (strcmp(Tcl_GetString(objv[1]), "reset")) {
+      Tcl_WrongNumArgs(interp, 1, objv, "?reset?");
+      return TCL_ERROR;
+    }
+    dpoint_alloc_stats_reset();
+    return TCL_OK;
+  }
+
+  ds_dpoint_alloc_stats_t stats;
+  dpoint_alloc_stats(&stats);
+
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("allocs", -1),
+		 Tcl_NewWideIntObj(stats.allocs));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("copies", -1),
+		 Tcl_NewWideIntObj(stats.copies));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("copy_bytes", -1),
+		 Tcl_NewWideIntObj(stats.copy_bytes));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("refs", -1),
+		 Tcl_NewWideIntObj(stats.refs));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("frees", -1),
+		 Tcl_NewWideIntObj(stats.frees));
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
 static int set_priority_command(ClientData data, Tcl_Interp *interp,
                                 int objc, Tcl_Obj *objv[])
 {
@@ -2509,8 +2733,51 @@ static int dserv_logger_clients_command(ClientData data, Tcl_Interp *interp,
   std::string clients;
   
   clients = ds->get_logger_clients();
-  Tcl_SetObjResult(interp, Tcl_NewStringObj(clients.data(), clients.size()));
-    
+  if (objc < 2) {
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(clients.data(), clients.size()));
+    return TCL_OK;
+  }
+
+  if (objc > 2 || strcmp(Tcl_GetString(objv[1]), "-info")) {
+    Tcl_WrongNumArgs(interp, 1, objv, "?-info?");
+    return TCL_ERROR;
+  }
+
+  /* -info: {path {ratio r cpu_ms t ...}} per client */
+  Tcl_Obj *clientsObj = Tcl_NewStringObj(clients.data(), clients.size());
+  Tcl_Obj **names;
+  Tcl_Size nnames;
+  Tcl_IncrRefCount(clientsObj);
+  if (Tcl_ListObjGetElements(interp, clientsObj, &nnames, &names) != TCL_OK) {
+    Tcl_DecrRefCount(clientsObj);
+    return TCL_ERROR;
+  }
+
+  Tcl_Obj *result = Tcl_NewDictObj();
+  for (int i = 0; i < nnames; i++) {
+    log_client_io_t info;
+    if (!ds->logger_client_buffering(Tcl_GetString(names[i]), -1, -1, &info))
+      continue;			/* closed meanwhile */
+    Tcl_Obj *d = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, d, Tcl_NewStringObj("points", -1),
+		   Tcl_NewWideIntObj(info.points));
+    Tcl_DictObjPut(interp, d, Tcl_NewStringObj("bytes", -1),
+		   Tcl_NewWideIntObj(info.bytes));
+    Tcl_DictObjPut(interp, d, Tcl_NewStringObj("raw_bytes", -1),
+		   Tcl_NewWideIntObj(info.raw_bytes));
+    Tcl_DictObjPut(interp, d, Tcl_NewStringObj("compress", -1),
+		   Tcl_NewIntObj(info.compress));
+    Tcl_DictObjPut(interp, d, Tcl_NewStringObj("ratio", -1),
+		   Tcl_NewDoubleObj(info.bytes ?
+				    (double) info.raw_bytes / info.bytes : 1.0));
+    Tcl_DictObjPut(interp, d, Tcl_NewStringObj("cpu_ms", -1),
+		   Tcl_NewDoubleObj(info.cpu_us / 1000.0));
+    Tcl_DictObjPut(interp, d, Tcl_NewStringObj("dropped", -1),
+		   Tcl_NewWideIntObj(info.dropped));
+    Tcl_DictObjPut(interp, result, names[i], d);
+  }
+  Tcl_DecrRefCount(clientsObj);
+  Tcl_SetObjResult(interp, result);
   return TCL_OK;
 }
 
@@ -2522,9 +2789,11 @@ static int dserv_log_open_command(ClientData data, Tcl_Interp *interp,
   Dataserver *ds = tclserver->ds;
   int status;
   int overwrite = 0;
+  int version = 3;
+  int compress = 0;
   
   if (objc < 2) {
-    Tcl_WrongNumArgs(interp, 1, objv, "path [overwrite]");
+    Tcl_WrongNumArgs(interp, 1, objv, "path [overwrite] [version] [compress]");
     return TCL_ERROR;
   }
   
@@ -2532,8 +2801,33 @@ static int dserv_log_open_command(ClientData data, Tcl_Interp *interp,
     if (Tcl_GetIntFromObj(interp, objv[2], &overwrite) != TCL_OK)
       return TCL_ERROR;
   }
+
+  /* 4 adds sync records and a trailing index (see dslog_index.h),
+     5 writes compact records (see dslog_compact.h) */
+  if (objc > 3) {
+    if (Tcl_GetIntFromObj(interp, objv[3], &version) != TCL_OK)
+      return TCL_ERROR;
+    if (version < 3 || version > 5) {
+      Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+		       ": version must be 3, 4 or 5", NULL);
+      return TCL_ERROR;
+    }
+  }
+
+  /* zlib level for compressed blocks (see dslog_block.h), 0 for none;
+     a v4 index holds stream offsets, which the block index maps */
+  if (objc > 4) {
+    if (Tcl_GetIntFromObj(interp, objv[4], &compress) != TCL_OK)
+      return TCL_ERROR;
+    if (compress < 0 || compress > 9) {
+      Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+		       ": compress must be 0-9", NULL);
+      return TCL_ERROR;
+    }
+  }
   
-  status = ds->logger_client_open(Tcl_GetString(objv[1]), overwrite);
+  status = ds->logger_client_open(Tcl_GetString(objv[1]), overwrite,
+				  version, compress);
   return (status > 0) ? TCL_OK : TCL_ERROR;
 }
 
@@ -2585,6 +2879,60 @@ static int dserv_log_start_command(ClientData data, Tcl_Interp *interp,
   return (status > 0) ? TCL_OK : TCL_ERROR;
 }
 
+/*
+ * dservLoggerBuffering path ?stage_bytes? ?flush_ms?
+ *   Writer staging for an open log: how many bytes are collected before
+ *   a write is forced, and the minimum interval between writes (0 writes
+ *   whatever has queued as soon as the writer gets to it).  Returns the
+ *   settings and the points/bytes/writes counters as a dict.
+ */
+static int dserv_log_buffering_command(ClientData data, Tcl_Interp *interp,
+				       int objc, Tcl_Obj * const objv[])
+{
+  TclServer *tclserver = (TclServer *) data;
+  Dataserver *ds = tclserver->ds;
+  int stage_size = -1, flush_ms = -1;
+  log_client_io_t info;
+
+  if (objc < 2 || objc > 4) {
+    Tcl_WrongNumArgs(interp, 1, objv, "path ?stage_bytes? ?flush_ms?");
+    return TCL_ERROR;
+  }
+  if (objc > 2 &&
+      Tcl_GetIntFromObj(interp, objv[2], &stage_size) != TCL_OK)
+    return TCL_ERROR;
+  if (objc > 3 &&
+      Tcl_GetIntFromObj(interp, objv[3], &flush_ms) != TCL_OK)
+    return TCL_ERROR;
+
+  if (!ds->logger_client_buffering(Tcl_GetString(objv[1]),
+				   stage_size, flush_ms, &info)) {
+    Tcl_AppendResult(interp, "logger ", Tcl_GetString(objv[1]),
+		     " not open", NULL);
+    return TCL_ERROR;
+  }
+
+  Tcl_Obj *dictObj = Tcl_NewDictObj();
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("stage_bytes", -1),
+		 Tcl_NewIntObj(info.stage_size));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("flush_ms", -1),
+		 Tcl_NewIntObj(info.flush_ms));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("points", -1),
+		 Tcl_NewWideIntObj(info.points));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("bytes", -1),
+		 Tcl_NewWideIntObj(info.bytes));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("writes", -1),
+		 Tcl_NewWideIntObj(info.writes));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("raw_bytes", -1),
+		 Tcl_NewWideIntObj(info.raw_bytes));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("cpu_ms", -1),
+		 Tcl_NewDoubleObj(info.cpu_us / 1000.0));
+  Tcl_DictObjPut(interp, dictObj, Tcl_NewStringObj("dropped", -1),
+		 Tcl_NewWideIntObj(info.dropped));
+  Tcl_SetObjResult(interp, dictObj);
+  return TCL_OK;
+}
+
 static int dserv_log_add_match_command(ClientData data, Tcl_Interp *interp,
                        int objc, Tcl_Obj * const objv[])
 {
@@ -2594,10 +2942,11 @@ static int dserv_log_add_match_command(ClientData data, Tcl_Interp *interp,
   int obs_limited = 0;
   int buffer_size = 0;
   int every = 1;
+  int columnar = 0;
   
   if (objc < 3) {
     Tcl_WrongNumArgs(interp, 1, objv,
-             "path match [obs_limited buffer_size every]");
+             "path match [obs_limited buffer_size every columnar]");
     return TCL_ERROR;
   }
   
@@ -2616,6 +2965,14 @@ static int dserv_log_add_match_command(ClientData data, Tcl_Interp *interp,
       return TCL_ERROR;
   }
 
+  /* columnar: numeric points go into per-varname blocks of
+     buffer_size bytes of samples, each with its own timestamp
+     (see dslog_column.h) */
+  if (objc > 6) {
+    if (Tcl_GetBooleanFromObj(interp, objv[6], &columnar) != TCL_OK)
+      return TCL_ERROR;
+  }
+
   if (every <= 0) {
     Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
              ": invalid \"every\" argument",
@@ -2630,27 +2987,67 @@ static int dserv_log_add_match_command(ClientData data, Tcl_Interp *interp,
   }
   status = ds->logger_add_match(Tcl_GetString(objv[1]),
                 Tcl_GetString(objv[2]),
-                every, obs_limited, buffer_size);
+                every, obs_limited, buffer_size, columnar);
   return (status > 0) ? TCL_OK : TCL_ERROR;
 }
 
+/*
+ * dpointSetScript ?-latest? varname script
+ *
+ *   With -latest the script only wants varname's newest value: while a
+ *   delivery for a name it covers is still waiting in this interp's
+ *   queue, a newer one takes its place and the older point is freed
+ *   without running anything (SharedQueue::set_conflate).  For displays
+ *   and state mirrors fed faster than they can keep up -- not for
+ *   anything that counts or logs.  Everything that rides the same
+ *   delivery sees only the survivors: the key's dpointAddScript
+ *   siblings and any dservWhen watches on the name.  The flag goes with
+ *   the key, so the next dpointSetScript without it turns it off.
+ */
 static int dpoint_set_script_command (ClientData data, Tcl_Interp *interp,
                       int objc, Tcl_Obj *objv[])
 {
   TclServer *tclserver = (TclServer *) data;
-  Dataserver *ds = tclserver->ds;
-  
-  if (objc < 3) {
-    Tcl_WrongNumArgs(interp, 1, objv, "varname script");
+  bool latest = false;
+
+  if (objc > 1 && !strcmp(Tcl_GetString(objv[1]), "-latest")) {
+    latest = true;
+    objc--; objv++;
+  }
+  if (objc != 3) {
+    Tcl_WrongNumArgs(interp, 1, objv, "?-latest? varname script");
     return TCL_ERROR;
   }
   
   tclserver->dpoint_scripts.insert(std::string(Tcl_GetString(objv[1])),
-                   std::string(Tcl_GetString(objv[2])));
+                   std::string(Tcl_GetString(objv[2])), latest);
   
   return TCL_OK;
 }
 
+/*
+ * dpointLatest
+ *
+ *   The keys registered with dpointSetScript -latest, and how many
+ *   deliveries have been superseded (dropped for a newer one) so far.
+ */
+static int dpoint_latest_command (ClientData data, Tcl_Interp *interp,
+                                  int objc, Tcl_Obj *objv[])
+{
+  TclServer *tclserver = (TclServer *) data;
+
+  Tcl_Obj *keys = Tcl_NewListObj(0, NULL);
+  for (auto const &k : tclserver->dpoint_scripts.latest_keys())
+    Tcl_ListObjAppendElement(interp, keys, Tcl_NewStringObj(k.c_str(), -1));
+
+  Tcl_Obj *d = Tcl_NewDictObj();
+  Tcl_DictObjPut(interp, d, Tcl_NewStringObj("keys", -1), keys);
+  Tcl_DictObjPut(interp, d, Tcl_NewStringObj("superseded", -1),
+                 Tcl_NewWideIntObj(tclserver->queue.superseded()));
+  Tcl_SetObjResult(interp, d);
+  return TCL_OK;
+}
+
 /*
  * dpointAddScript varname script
  *
@@ -3108,6 +3505,7 @@ void TclServer::after_loop(void)
       client_request_t req;
       req.type = REQ_SCRIPT_NOREPLY;
       req.script = script;
+      req.source = SRC_TIMER;
       queue.push_back(req);                // -> process thread evaluates it
       lk.lock();
     } else {
@@ -3217,6 +3615,8 @@ static void add_tcl_commands(Tcl_Interp *interp, TclServer *tserv)
 		       dserv_setdata_command, tserv->ds, NULL);
   Tcl_CreateObjCommand(interp, "dservSetData64",
 		       dserv_setdata64_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservSetBatch",
+		       dserv_setbatch_command, tserv->ds, NULL);
   Tcl_CreateObjCommand(interp, "dservClear",
 		       dserv_clear_command, tserv->ds, NULL);
   Tcl_CreateObjCommand(interp, "dservEval",
@@ -3227,11 +3627,27 @@ static void add_tcl_commands(Tcl_Interp *interp, TclServer *tserv)
 		       dserv_dgdir_command, tserv->ds, NULL);
   Tcl_CreateObjCommand(interp, "dservSendClients",
 		       dserv_send_clients_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservSendClientBuffering",
+		       dserv_send_client_buffering_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservSendClientPolicy",
+		       dserv_send_client_policy_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservIngestInfo",
+		       dserv_ingest_info_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservFanoutInfo",
+		       dserv_fanout_info_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservQueueInfo",
+		       dserv_queue_info_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservShmInfo",
+		       dserv_shm_info_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "dservShmPoll",
+		       dserv_shm_poll_command, tserv->ds, NULL);
 
   Tcl_CreateObjCommand(interp, "processGetParam",
                process_get_param_command, tserv->ds, NULL);
   Tcl_CreateObjCommand(interp, "processSetParam",
                process_set_param_command, tserv->ds, NULL);
+  Tcl_CreateObjCommand(interp, "processStats",
+               process_stats_command, tserv->ds, NULL);
 
   /* these are specific to TclServers */
   Tcl_CreateObjCommand(interp, "now",
@@ -3277,6 +3693,14 @@ static void add_tcl_commands(Tcl_Interp *interp, TclServer *tserv)
                                       
   Tcl_CreateObjCommand(interp, "dservTiming",
                (Tcl_ObjCmdProc *) dserv_timing_command, tserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservLanes",
+               (Tcl_ObjCmdProc *) dserv_lanes_command, tserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservLaneBurst",
+               (Tcl_ObjCmdProc *) dserv_lane_burst_command, tserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservScriptCache",
+               (Tcl_ObjCmdProc *) dserv_script_cache_command, tserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservAllocStats",
+               (Tcl_ObjCmdProc *) dserv_alloc_stats_command, tserv, NULL);
   Tcl_CreateObjCommand(interp, "dservWhen",
                dserv_when_command, tserv, NULL);
   Tcl_CreateObjCommand(interp, "dservWhenCancel",
@@ -3326,6 +3750,8 @@ static void add_tcl_commands(Tcl_Interp *interp, TclServer *tserv)
                dserv_log_start_command, tserv, NULL);
   Tcl_CreateObjCommand(interp, "dservLoggerResume",
                dserv_log_start_command, tserv, NULL);
+  Tcl_CreateObjCommand(interp, "dservLoggerBuffering",
+               dserv_log_buffering_command, tserv, NULL);
   Tcl_CreateObjCommand(interp, "dservLoggerAddMatch",
                dserv_log_add_match_command, tserv, NULL);
   
@@ -3345,6 +3771,8 @@ static void add_tcl_commands(Tcl_Interp *interp, TclServer *tserv)
   Tcl_CreateObjCommand(interp, "dpointRemoveAllScripts",
                (Tcl_ObjCmdProc *) dpoint_remove_all_scripts_command,
                tserv, NULL);
+  Tcl_CreateObjCommand(interp, "dpointLatest",
+               (Tcl_ObjCmdProc *) dpoint_latest_command, tserv, NULL);
 
   Tcl_CreateObjCommand(interp, "www_path", Www_Path_Cmd,
 		       (ClientData)tserv, NULL);
@@ -3372,6 +3800,9 @@ static void add_tcl_commands(Tcl_Interp *interp, TclServer *tserv)
   // SHA256 client commands
   TclSha256_RegisterCommands(interp);  
 
+  // indexed log reader commands
+  TclDslog_RegisterCommands(interp);
+
   return;
 }
 
@@ -3524,12 +3955,37 @@ static Tcl_Interp *setup_tcl(TclServer *tserv)
   return interp;
 }
 
+/*
+ * The lane a request goes in (SharedQueue::set_lanes): its source's, per
+ * dservLanes.  Shutdown goes in the last lane, behind what was already
+ * waiting there, as it was behind everything in the one FIFO.
+ */
+int TclServer::lane_of(const client_request_t &req)
+{
+  if (req.type == REQ_SHUTDOWN) return LANE_NLANES - 1;
+  if (req.source < 0 || req.source >= SRC_NSOURCES) return LANE_NORMAL;
+  return source_lane[req.source].load(std::memory_order_relaxed);
+}
+
 /* queue up a point to be set from other threads */
 void TclServer::set_point(ds_datapoint_t *dp)
 {
   client_request_t req;
   req.type = REQ_DPOINT;
   req.dpoint = dp;
+  req.source = SRC_MODULE;
+  queue.push_back(req);
+}
+
+/* queue up points to be set together (Dataserver::set_batch) */
+void TclServer::set_points(ds_datapoint_t **dps, int n)
+{
+  if (n <= 0) return;
+  client_request_t req;
+  req.type = REQ_DPOINT_BATCH;
+  req.dpoint = dps[0];
+  req.dpoints.assign(dps, dps + n);
+  req.source = SRC_MODULE;
   queue.push_back(req);
 }
 
@@ -3542,36 +3998,14 @@ static int dpoint_tcl_script(Tcl_Interp *interp,
 {
   Tcl_Obj *commandArray[3];
   commandArray[0] = Tcl_NewStringObj(script, -1);
-      
-  /* name of dpoint (special for DSERV_EVTs */
-  if (dpoint->data.e.dtype != DSERV_EVT) {
-    commandArray[1] = Tcl_NewStringObj(dpoint->varname,
-                       dpoint->varlen);
-    /* data as Tcl_Obj */
-    commandArray[2] = dpoint_to_tclobj(interp, dpoint);
-  }
-  else {
-    /* convert eventlog/events -> evt:TYPE:SUBTYPE notation */
-    char evt_namebuf[32];
-    snprintf(evt_namebuf, sizeof(evt_namebuf), "evt:%d:%d",
-         dpoint->data.e.type, dpoint->data.e.subtype);
-    commandArray[1] = Tcl_NewStringObj(evt_namebuf, -1);
-    
-    /* create a placeholder for repackaged dpoint */
-    ds_datapoint_t e_dpoint;
-    e_dpoint.data.type = (ds_datatype_t) dpoint->data.e.puttype;
-    e_dpoint.data.len = dpoint->data.len;
-    e_dpoint.data.buf = dpoint->data.buf;
-    
-    /* data as Tcl_Obj */
-    commandArray[2] = dpoint_to_tclobj(interp, &e_dpoint);
-  }
-  /* incr ref count on command arguments */
-  for (int i = 0; i < 3; i++) { Tcl_IncrRefCount(commandArray[i]); }
-  
+  Tcl_IncrRefCount(commandArray[0]);
+
+  /* name and data (special for DSERV_EVTs), counted for us */
+  dpoint_to_tclargs(interp, dpoint, &commandArray[1]);
+
   /* call command */
   int retcode = Tcl_EvalObjv(interp, 3, commandArray, 3);
-  
+
   /* decr ref count on command arguments */
   for (int i = 0; i < 3; i++) { Tcl_DecrRefCount(commandArray[i]); }
   return retcode;
@@ -3609,28 +4043,29 @@ static int dpoint_tcl_script(Tcl_Interp *interp,
  * and refcounts any subscription it adds so cleanup never removes the caller's.
  */
 
-// Evaluate a when predicate against a delivered dpoint.  1 true, 0 false, -1 err.
-static int when_eval_predicate(Tcl_Interp *interp, const std::string &predicate,
-                               ds_datapoint_t *dpoint)
+// The Tcl form of a predicate: split into operator (first word) + remaining
+// rhs, and run as `::tcl::mathop::<op> $val <rest>` so bareword operands stay
+// strings and $vars resolve in the caller's frame (same rationale as the value
+// comparison in a mathop expression, not an expr which rejects barewords).
+static std::string when_tcl_command(const std::string &predicate)
 {
-  if (predicate.empty()) return 1;               // no predicate -> any update
-
-  Tcl_Obj *v = dpoint_to_tclobj(interp, dpoint);
-  if (!v) v = Tcl_NewObj();
-  Tcl_IncrRefCount(v);
-  Tcl_SetVar2Ex(interp, "__dservWhenVal", NULL, v, TCL_GLOBAL_ONLY);
-
-  // Split the predicate into operator (first word) + remaining rhs, and run it
-  // as `::tcl::mathop::<op> $val <rest>` so bareword operands stay strings and
-  // $vars resolve in the caller's frame (same rationale as the value comparison
-  // in a mathop expression, not an expr which rejects barewords).
   size_t p = 0, n = predicate.size();
   while (p < n && isspace((unsigned char) predicate[p])) p++;
   size_t opstart = p;
   while (p < n && !isspace((unsigned char) predicate[p])) p++;
   std::string op = predicate.substr(opstart, p - opstart);
   std::string rest = (p < n) ? predicate.substr(p) : std::string();
-  std::string cmd = "::tcl::mathop::" + op + " $::__dservWhenVal " + rest;
+  return "::tcl::mathop::" + op + " $::__dservWhenVal " + rest;
+}
+
+// Evaluate a predicate's Tcl form against dpoint.  1 true, 0 false, -1 err.
+static int when_eval_tcl(Tcl_Interp *interp, const std::string &cmd,
+                         ds_datapoint_t *dpoint)
+{
+  Tcl_Obj *v = dpoint_to_tclobj(interp, dpoint);
+  if (!v) v = Tcl_NewObj();
+  Tcl_IncrRefCount(v);
+  Tcl_SetVar2Ex(interp, "__dservWhenVal", NULL, v, TCL_GLOBAL_ONLY);
 
   int b = 0;
   int rc = Tcl_EvalEx(interp, cmd.c_str(), -1, 0);
@@ -3640,19 +4075,234 @@ static int when_eval_predicate(Tcl_Interp *interp, const std::string &predicate,
   return (rc == TCL_OK) ? (b ? 1 : 0) : -1;
 }
 
+// Compile a predicate (see WhenPredicate).  It is parsed with Tcl's own parser,
+// so only a single command of two literal words -- no substitution, no {*} --
+// gets a native form; everything else is left to its Tcl form.
+static WhenPredicate when_compile_predicate(const std::string &predicate)
+{
+  WhenPredicate pred;
+  if (predicate.empty()) return pred;            // no predicate -> any update
+
+  pred.kind = WhenPredicate::TCL;
+  pred.tcl_cmd = when_tcl_command(predicate);
+
+  Tcl_Parse parse;
+  const char *script = predicate.c_str();
+  if (Tcl_ParseCommand(NULL, script, predicate.size(), 0, &parse) != TCL_OK)
+    return pred;
+
+  std::string words[2];
+  bool literal = parse.numWords == 2;
+  const char *end = parse.commandStart + parse.commandSize;
+  while (*end && isspace((unsigned char) *end)) end++;
+  if (*end) literal = false;                     // a second command
+  Tcl_Token *tok = parse.tokenPtr;
+  for (int w = 0; literal && w < 2; w++) {
+    if (tok->type != TCL_TOKEN_SIMPLE_WORD) literal = false;
+    else words[w].assign(tok[1].start, tok[1].size);
+    tok += tok->numComponents + 1;
+  }
+  Tcl_FreeParse(&parse);
+  if (!literal) return pred;
+
+  const std::string &op = words[0], &rhs = words[1];
+  static const std::pair<const char *, WhenPredicate::op_t> numeric_ops[] = {
+    { "==", WhenPredicate::EQ }, { "!=", WhenPredicate::NE },
+    { "<", WhenPredicate::LT }, { "<=", WhenPredicate::LE },
+    { ">", WhenPredicate::GT }, { ">=", WhenPredicate::GE }
+  };
+  for (auto &nop : numeric_ops) {
+    if (op != nop.first) continue;
+
+    // a numeric rhs as Tcl reads it (0x10, 1e3, and 010 per Tcl's version);
+    // a string rhs makes these string comparisons -- left to Tcl
+    Tcl_Obj *o = Tcl_NewStringObj(rhs.c_str(), rhs.size());
+    Tcl_IncrRefCount(o);
+    Tcl_WideInt w;
+    double d;
+    if (Tcl_GetWideIntFromObj(NULL, o, &w) == TCL_OK) {
+      pred.rhs_int = true;
+      pred.rhs_i = w;
+      pred.rhs_d = (double) w;
+      pred.kind = WhenPredicate::NUMERIC;
+    }
+    else if (rhs.find_first_of(".eE") != std::string::npos &&
+             Tcl_GetDoubleFromObj(NULL, o, &d) == TCL_OK && !std::isnan(d)) {
+      pred.rhs_d = d;
+      pred.kind = WhenPredicate::NUMERIC;
+    }
+    Tcl_DecrRefCount(o);
+    pred.op = nop.second;
+    return pred;
+  }
+
+  if (op == "eq" || op == "ne") {
+    pred.kind = WhenPredicate::STRING;
+    pred.op = (op == "eq") ? WhenPredicate::EQ : WhenPredicate::NE;
+    pred.rhs_s = rhs;
+  }
+  else if (op == "in" || op == "ni") {
+    Tcl_Size n;
+    const char **elts;
+    if (Tcl_SplitList(NULL, rhs.c_str(), &n, &elts) == TCL_OK) {
+      for (Tcl_Size i = 0; i < n; i++) pred.set.insert(elts[i]);
+      Tcl_Free((char *) elts);
+      pred.kind = WhenPredicate::SET;
+      pred.negate = (op == "ni");
+    }
+  }
+  return pred;
+}
+
+// A point's value as the native forms see it: an integer, a double, and/or a
+// string -- each only when it is exactly what Tcl would make of the value.
+struct WhenValue {
+  bool is_int = false, is_double = false, is_string = false;
+  int64_t i = 0;
+  double d = 0;
+  std::string_view s;
+  char digits[24];
+};
+
+static void when_value(ds_datapoint_t *dp, WhenValue &v, bool want_string)
+{
+  const unsigned char *buf = dp->data.buf;
+  uint32_t len = dp->data.len;
+
+  if (!len) {                                    // Tcl_NewObj: ""
+    v.is_string = true;
+    return;
+  }
+  switch (dp->data.type) {
+  case DSERV_STRING:
+  case DSERV_JSON:
+    {
+      v.is_string = true;
+      v.s = std::string_view((const char *) buf, len);
+
+      // a plain decimal integer is a number too; anything fancier (a
+      // leading zero, +, spaces, a fraction) is left to Tcl
+      size_t p = (buf[0] == '-') ? 1 : 0, ndig = len - p;
+      if (ndig < 1 || ndig > 18 || (buf[p] == '0' && ndig > 1)) return;
+      for (size_t k = p; k < len; k++)
+        if (buf[k] < '0' || buf[k] > '9') return;
+      v.is_int = true;
+      v.i = strtoll(v.s.data(), NULL, 10);     // ends at len: no digit after
+      if (v.i == 0 && p) v.is_int = false;       // "-0": let Tcl say
+      return;
+    }
+  case DSERV_BYTE:
+    if (len != 1) return;
+    v.i = buf[0];
+    v.is_int = true;
+    break;
+  case DSERV_SHORT:
+    if (len != sizeof(short)) return;
+    { short x; memcpy(&x, buf, sizeof(x)); v.i = x; }
+    v.is_int = true;
+    break;
+  case DSERV_INT:
+    if (len != sizeof(int)) return;
+    { int x; memcpy(&x, buf, sizeof(x)); v.i = x; }
+    v.is_int = true;
+    break;
+  case DSERV_INT64:
+    if (len != sizeof(int64_t)) return;
+    memcpy(&v.i, buf, sizeof(v.i));
+    v.is_int = true;
+    break;
+  case DSERV_FLOAT:
+    if (len != sizeof(float)) return;
+    { float x; memcpy(&x, buf, sizeof(x)); v.d = x; }
+    v.is_double = !std::isnan(v.d);
+    return;
+  case DSERV_DOUBLE:
+    if (len != sizeof(double)) return;
+    memcpy(&v.d, buf, sizeof(v.d));
+    v.is_double = !std::isnan(v.d);
+    return;
+  default:
+    return;
+  }
+
+  // an integer's string rep is its decimal digits
+  if (!want_string) return;
+  int n = snprintf(v.digits, sizeof(v.digits), "%" PRId64, v.i);
+  v.s = std::string_view(v.digits, n);
+  v.is_string = true;
+}
+
+// Judge a compiled predicate natively: 1 true, 0 false, -1 can't (ask Tcl).
+static int when_eval_native(const WhenPredicate &pred, ds_datapoint_t *dp)
+{
+  if (pred.kind == WhenPredicate::ANY) return 1;
+  if (pred.kind == WhenPredicate::TCL) return -1;
+
+  WhenValue v;
+  when_value(dp, v, pred.kind != WhenPredicate::NUMERIC);
+
+  switch (pred.kind) {
+  case WhenPredicate::NUMERIC:
+    {
+      int c;
+      if (v.is_int && pred.rhs_int)
+        c = (v.i > pred.rhs_i) - (v.i < pred.rhs_i);
+      else if (v.is_int || v.is_double) {
+        // an integer only converts exactly within 2^53
+        if (v.is_int && (v.i > (1LL << 53) || v.i < -(1LL << 53))) return -1;
+        if (pred.rhs_int &&
+            (pred.rhs_i > (1LL << 53) || pred.rhs_i < -(1LL << 53))) return -1;
+        double x = v.is_int ? (double) v.i : v.d;
+        c = (x > pred.rhs_d) - (x < pred.rhs_d);
+      }
+      else return -1;                            // a string: Tcl compares
+      switch (pred.op) {
+      case WhenPredicate::EQ: return c == 0;
+      case WhenPredicate::NE: return c != 0;
+      case WhenPredicate::LT: return c < 0;
+      case WhenPredicate::LE: return c <= 0;
+      case WhenPredicate::GT: return c > 0;
+      case WhenPredicate::GE: return c >= 0;
+      }
+      return -1;
+    }
+  case WhenPredicate::STRING:
+    if (!v.is_string) return -1;
+    return (v.s == pred.rhs_s) == (pred.op == WhenPredicate::EQ);
+  case WhenPredicate::SET:
+    if (!v.is_string) return -1;
+    return (pred.set.count(std::string(v.s)) > 0) != pred.negate;
+  default:
+    return -1;
+  }
+}
+
+// Evaluate a when predicate against a delivered dpoint.  1 true, 0 false, -1 err.
+static int when_eval_predicate(Tcl_Interp *interp, const WhenPredicate &pred,
+                               ds_datapoint_t *dpoint)
+{
+  int rc = when_eval_native(pred, dpoint);
+  if (rc >= 0) return rc;
+  return when_eval_tcl(interp, pred.tcl_cmd, dpoint);
+}
+
 // Remove a when registration by id: delete its generated proc (if any), release
 // its subscription refcount (dropping the underlying match once the last owner
 // goes away), and erase it.
 static void when_remove(TclServer *tserv, Tcl_Interp *interp, int id)
 {
-  auto it = std::find_if(tserv->when_callbacks.begin(),
-                         tserv->when_callbacks.end(),
-                         [&](const WhenCallback &c){ return c.id == id; });
-  if (it == tserv->when_callbacks.end()) return;
+  auto found = tserv->when_callbacks.find(id);
+  if (found == tserv->when_callbacks.end()) return;
+  WhenCallback *it = &found->second;
 
   if (it->generated)
     Tcl_DeleteCommand(interp, it->script.c_str());
 
+  auto sit = std::find(tserv->when_special.begin(), tserv->when_special.end(),
+                       id);
+  if (sit != tserv->when_special.end()) tserv->when_special.erase(sit);
+  else tserv->when_index.remove(id, it->pattern);
+
   if (it->owns_match) {
     auto rit = tserv->when_match_refs.find(it->pattern);
     if (rit != tserv->when_match_refs.end() && --rit->second <= 0) {
@@ -3661,7 +4311,7 @@ static void when_remove(TclServer *tserv, Tcl_Interp *interp, int id)
       tserv->when_match_refs.erase(rit);
     }
   }
-  tserv->when_callbacks.erase(it);
+  tserv->when_callbacks.erase(found);
 }
 
 // Dispatch delivered datapoint `dpoint` to matching when-callbacks.  Runs on the
@@ -3673,23 +4323,33 @@ static void run_when_callbacks(TclServer *tserv, Tcl_Interp *interp,
 
   const char *varname = dpoint->varname;
 
+  // The watches on this name, from the index, in registration order.
+  std::vector<int> ids;
+  tserv->when_index.match(varname, ids);
+  for (int id : tserv->when_special) {
+    auto it = tserv->when_callbacks.find(id);
+    if (it != tserv->when_callbacks.end() &&
+        Tcl_StringMatch(varname, it->second.pattern.c_str()))
+      ids.push_back(id);
+  }
+  if (ids.empty()) return;
+  std::sort(ids.begin(), ids.end());
+
   // Collect ids to fire first: a firing script may add/remove callbacks, so we
-  // must not iterate the live vector while firing.
+  // must not iterate the live registry while firing.
   std::vector<int> fire_ids;
-  for (auto &cb : tserv->when_callbacks) {
-    if (Tcl_StringMatch(varname, cb.pattern.c_str())) {
-      if (when_eval_predicate(interp, cb.predicate, dpoint) == 1)
-        fire_ids.push_back(cb.id);
-    }
+  for (int id : ids) {
+    auto it = tserv->when_callbacks.find(id);
+    if (it != tserv->when_callbacks.end() &&
+        when_eval_predicate(interp, it->second.compiled, dpoint) == 1)
+      fire_ids.push_back(id);
   }
 
   for (int id : fire_ids) {
-    auto it = std::find_if(tserv->when_callbacks.begin(),
-                           tserv->when_callbacks.end(),
-                           [&](const WhenCallback &c){ return c.id == id; });
+    auto it = tserv->when_callbacks.find(id);
     if (it == tserv->when_callbacks.end()) continue;   // cancelled meanwhile
-    std::string script = it->script;                   // copy before firing
-    bool once = it->once;
+    std::string script = it->second.script;            // copy before firing
+    bool once = it->second.once;
     dpoint_tcl_script(interp, script.c_str(), dpoint); // runs `script name value`
     if (once) when_remove(tserv, interp, id);
   }
@@ -3763,8 +4423,14 @@ static int dserv_when_command(ClientData data, Tcl_Interp *interp,
     owns = true;
   }
 
-  tserv->when_callbacks.push_back(
-      WhenCallback{ id, key, predicate, callback, once, owns, generated });
+  WhenPredicate compiled = when_compile_predicate(predicate);
+  tserv->when_callbacks.emplace(id,
+      WhenCallback{ id, key, predicate, compiled, callback, once, owns,
+                    generated });
+  if (key.find_first_of("[\\") != std::string::npos)
+    tserv->when_special.push_back(id);
+  else
+    tserv->when_index.insert(id, key, !glob);
 
   // Level check: fire immediately for the current value(s) already satisfying,
   // so a datapoint already present at registration isn't missed.  For a glob
@@ -3776,7 +4442,7 @@ static int dserv_when_command(ClientData data, Tcl_Interp *interp,
     ds_datapoint_t *dp = tserv->ds->get_datapoint((char *) k);
     if (!dp) return;
     if (DPOINT_IS_PRIVATE(dp)) { dpoint_free(dp); return; }
-    if (when_eval_predicate(interp, predicate, dp) == 1) {
+    if (when_eval_predicate(interp, compiled, dp) == 1) {
       dpoint_tcl_script(interp, callback.c_str(), dp);
       if (once) { when_remove(tserv, interp, id); done = true; }
     }
@@ -3816,7 +4482,7 @@ static int dserv_when_cancel_command(ClientData data, Tcl_Interp *interp,
   }
   if (std::string(Tcl_GetString(objv[1])) == "all") {
     while (!tserv->when_callbacks.empty())
-      when_remove(tserv, interp, tserv->when_callbacks.front().id);
+      when_remove(tserv, interp, tserv->when_callbacks.begin()->first);
     return TCL_OK;
   }
   int id;
@@ -3891,6 +4557,7 @@ static int process_requests(TclServer *tserv)
 {
   int retcode;
   client_request_t req;
+  CommandObjCache dpoint_cmds;		// dpoint_scripts' command words
 
   // create a private interpreter for this process
   Tcl_Interp *interp = setup_tcl(tserv);
@@ -3931,6 +4598,11 @@ static int process_requests(TclServer *tserv)
       case REQ_SCRIPT_WS_ASYNC:
 	timing_label = request_timing_script_label(req.script);
 	break;
+      case REQ_SCRIPT_BATCH:
+	timing_label = "script_batch " +
+	  (req.scripts.empty() ? std::string("?") :
+	   request_timing_script_label(req.scripts[0]));
+	break;
       case REQ_DPOINT_SCRIPT:
 	timing_label = "dpoint_script " +
 	  std::string(req.dpoint && req.dpoint->varname ?
@@ -3941,6 +4613,11 @@ static int process_requests(TclServer *tserv)
 	  std::string(req.dpoint && req.dpoint->varname ?
 		      req.dpoint->varname : "?");
 	break;
+      case REQ_DPOINT_BATCH:
+	timing_label = "dpoint_set_batch " +
+	  std::string(req.dpoint && req.dpoint->varname ?
+		      req.dpoint->varname : "?");
+	break;
       case REQ_TIMER:
 	timing_label = "timer";
 	break;
@@ -3956,9 +4633,7 @@ static int process_requests(TclServer *tserv)
     switch (req.type) {
     case REQ_SCRIPT:
       {
-	const char *script = req.script.c_str();
-	
-	retcode = Tcl_Eval(interp, script);
+	retcode = tserv->script_cache.eval(interp, req.script);
 	const char *rcstr = Tcl_GetStringResult(interp);
 	
 	if (retcode == TCL_OK) {
@@ -3979,16 +4654,27 @@ static int process_requests(TclServer *tserv)
 	}
       }
       break;
+    case REQ_SCRIPT_BATCH:
+      {
+	/* one turn for the lot: nothing else runs between them */
+	for (auto &script : req.scripts) {
+	  retcode = tserv->script_cache.eval(interp, script);
+	  const char *rcstr = Tcl_GetStringResult(interp);
+	  if (retcode == TCL_OK)
+	    req.rqueue->push_back(std::string(rcstr ? rcstr : ""));
+	  else
+	    req.rqueue->push_back("!TCL_ERROR " + std::string(rcstr ? rcstr : ""));
+	}
+      }
+      break;
     case REQ_SCRIPT_NOREPLY:
       {
-	const char *script = req.script.c_str();
-	retcode = Tcl_Eval(interp, script);
+	retcode = tserv->script_cache.eval(interp, req.script);
       }
       break;
     case REQ_SCRIPT_WS_ASYNC:
       {
-        const char *script = req.script.c_str();
-        retcode = Tcl_Eval(interp, script);
+        retcode = tserv->script_cache.eval(interp, req.script);
         const char *rcstr = Tcl_GetStringResult(interp);
 
         json_t *response = json_object();
@@ -4020,6 +4706,11 @@ static int process_requests(TclServer *tserv)
 	tserv->ds->set(req.dpoint);
       }
       break;
+    case REQ_DPOINT_BATCH:
+      {
+	tserv->ds->set_batch(req.dpoints);
+      }
+      break;
     case REQ_DPOINT_SCRIPT:
       {
 	ds_datapoint_t *dpoint = req.dpoint;
@@ -4048,15 +4739,26 @@ static int process_requests(TclServer *tserv)
 	// one consumer erroring cannot silence the consumers after it. That
 	// matters now that two unrelated subsystems can share a datapoint --
 	// a broken one must not take the other down with it.
+	//
+	// The command words come from dpoint_cmds, resolved once per
+	// registration rather than per delivery, and `name value` is built
+	// once and handed to every script (a script that changes its copy
+	// of value gets its own: Tcl copies a shared object on write).
 	std::vector<std::string> scripts;
 	if (tserv->dpoint_scripts.find(varname, scripts) ||
 	    tserv->dpoint_scripts.find_match(varname, scripts)) {
+	  uint64_t generation = tserv->dpoint_scripts.generation();
+	  Tcl_Obj *commandArray[3] = { NULL, NULL, NULL };
 	  for (auto const &script : scripts) {
-	    if (!script.empty()) {
-	      ds_datapoint_t *dpoint = req.dpoint;
-	      const char *dpoint_script = script.c_str();
-	      int retcode = dpoint_tcl_script(interp, dpoint_script, dpoint);
-	    }
+	    if (script.empty()) continue;
+	    if (!commandArray[1])
+	      dpoint_to_tclargs(interp, dpoint, &commandArray[1]);
+	    commandArray[0] = dpoint_cmds.get(script, generation);
+	    Tcl_EvalObjv(interp, 3, commandArray, 0);
+	  }
+	  if (commandArray[1]) {
+	    Tcl_DecrRefCount(commandArray[1]);
+	    Tcl_DecrRefCount(commandArray[2]);
 	  }
 	}
 
@@ -4071,7 +4773,7 @@ static int process_requests(TclServer *tserv)
 
     if (tserv->timing.enabled())
       tserv->timing.record(req.type, timing_label, req.t_enqueue, t_dequeue,
-			   request_timing_now_ns());
+			   request_timing_now_ns(), tserv->lane_of(req));
 
     // clear context
     tserv->set_current_request(nullptr);
@@ -4090,6 +4792,8 @@ static int process_requests(TclServer *tserv)
   Tcl_Eval(interp, "if {[info procs ::on_shutdown] ne {}} {::on_shutdown}");
    
   tserv->setInterp(nullptr);
+  dpoint_cmds.clear();
+  tserv->script_cache.flush();
   Tcl_DeleteInterp(interp);
   //  std::cout << "TclServer process thread ended" << std::endl;
 
@@ -4167,6 +4871,7 @@ TclServer::tcp_client_process(TclServer *tserv,
   client_request.type = REQ_SCRIPT;
   client_request.socket_fd = sockfd;
   client_request.websocket_id = "";
+  client_request.source = SRC_NEWLINE;
   std::string script;  
     
   while ((rval = recv(sockfd, buf, sizeof(buf), 0)) > 0) {
@@ -4219,21 +4924,46 @@ TclServer::tcp_client_process(TclServer *tserv,
   tserv->unregister_connection(sockfd);
 }
 
-static void sendMessage(int socket, const std::string& message) {
-  // Convert size to network byte order
-  uint32_t msgSize = htonl(message.size()); 
-  send(socket, (char *) &msgSize, sizeof(msgSize), 0);
-  
-  size_t totalSent = 0;
-  size_t remaining = message.size();
-  const char* data = message.c_str();
-  
-  while (totalSent < message.size()) {
-    ssize_t sent = send(socket, data + totalSent, remaining, 0);
-    if (sent <= 0) break;  // error or connection closed
-    totalSent += sent;
-    remaining -= sent;
+static bool recv_all(int socket, char *buf, size_t n)
+{
+  size_t got = 0;
+  while (got < n) {
+    ssize_t r = recv(socket, buf + got, n - got, 0);
+    if (r <= 0) return false;
+    got += r;
   }
+  return true;
+}
+
+static bool writev_all(int socket, struct iovec *iov, int n)
+{
+  while (n > 0) {
+    int cnt = n < IOV_MAX ? n : IOV_MAX;
+    ssize_t w = writev(socket, iov, cnt);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return false;
+    while (cnt && (size_t) w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+      cnt--;
+    }
+    if (cnt) {
+      iov->iov_base = (char *) iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  return true;
+}
+
+static void sendMessage(int socket, const std::string& message) {
+  // length and body in one write: two sends are two segments with TCP_NODELAY
+  uint32_t msgSize = htonl(message.size());
+  struct iovec iov[2] = {
+    { &msgSize, sizeof(msgSize) },
+    { (void *) message.data(), message.size() }
+  };
+  writev_all(socket, iov, 2);
 }
 
 static std::pair<char*, size_t> receiveMessage(int socket) {
@@ -4262,6 +4992,178 @@ static std::pair<char*, size_t> receiveMessage(int socket) {
     return {buffer, msgSize};
 }
 
+/*
+ * Message protocol 2
+ *
+ *  A client on the message port that sends the v1 frame "%protocol 2"
+ * (reply "2") switches its connection to tagged frames, so it can
+ * pipeline: send any number of requests without waiting and match the
+ * replies by id.  Integers are in network order, as in v1.
+ *
+ *   request:  u32 len | u8 kind | u32 id | body     (len counts kind on)
+ *     'S'  body is a script
+ *     'B'  body is u32 n, then n of (u32 len, script), evaluated in
+ *          order in one turn of the process thread
+ *   reply:    u32 len | u8 kind | u32 id | body
+ *     'S'  u8 status (0 ok, 1 error), result
+ *     'B'  u32 n, then n of (u8 status, u32 len, result)
+ *
+ *  Replies come back in request order.  The connection's thread queues
+ * requests as they arrive; a writer thread collects their results and
+ * writes every reply that is ready with one writev().
+ */
+static const char MSG_PROTOCOL_2[] = "%protocol 2";
+static const uint32_t MSG_V2_MAX = 128 * 1024 * 1024;
+
+/* what the writer is owed: count results for request id (kind 0: stop) */
+typedef struct msg_pending_s {
+  uint8_t kind;
+  uint32_t id;
+  uint32_t count;
+} msg_pending_t;
+
+static void put_u32(std::string &s, uint32_t v)
+{
+  v = htonl(v);
+  s.append((const char *) &v, sizeof(v));
+}
+
+static void message_v2_writer(int sockfd, SharedQueue<std::string> *rqueue,
+                              SharedQueue<msg_pending_t> *pending)
+{
+  /* deques: growing them leaves what iov already points at in place */
+  std::deque<std::string> heads, results;
+  std::vector<struct iovec> iov;
+  bool done = false, ok = true;
+
+  while (!done) {
+    heads.clear();
+    results.clear();
+    iov.clear();
+
+    /* the oldest reply (waiting for it), then any others already in */
+    do {
+      msg_pending_t p = pending->front();
+      if (p.kind && iov.size() && (size_t) rqueue->size() < p.count) break;
+      pending->pop_front();
+      if (!p.kind) {
+        done = true;
+        break;
+      }
+
+      heads.emplace_back();
+      std::string &head = heads.back();
+      put_u32(head, 0);		/* the length, filled in below */
+      head.push_back(p.kind);
+      put_u32(head, p.id);
+      if (p.kind == 'B') put_u32(head, p.count);
+      iov.push_back({ nullptr, 0 });
+      size_t head_iov = iov.size() - 1;
+      size_t len = head.size() - 4;
+
+      for (uint32_t i = 0; i < p.count; i++) {
+        results.push_back(rqueue->front());
+        rqueue->pop_front();
+        std::string &r = results.back();
+        size_t skip = r.starts_with("!TCL_ERROR ") ? 11 : 0;
+
+        std::string *item = &head;
+        if (p.kind == 'B') {
+          heads.emplace_back();
+          item = &heads.back();
+        }
+        item->push_back(skip ? 1 : 0);
+        if (p.kind == 'B') {
+          put_u32(*item, r.size() - skip);
+          iov.push_back({ item->data(), item->size() });
+        }
+        len += 1 + (p.kind == 'B' ? 4 : 0) + r.size() - skip;
+        iov.push_back({ r.data() + skip, r.size() - skip });
+      }
+      uint32_t nlen = htonl(len);
+      memcpy(head.data(), &nlen, sizeof(nlen));
+      iov[head_iov] = { head.data(), head.size() };
+    } while (pending->size() > 0);
+
+    /* a client that has gone away still has its replies drained:
+       rqueue must outlive every request queued against it */
+    if (ok && iov.size()) ok = writev_all(sockfd, iov.data(), iov.size());
+  }
+}
+
+/*
+ * message_v2_process
+ *
+ *  The rest of a connection that has switched to protocol 2: read and
+ * queue requests until the client hangs up or sends something bad,
+ * then wait for the writer to send (or drop) what is still owed.
+ */
+static void message_v2_process(TclServer *tserv, int sockfd,
+                               SharedQueue<client_request_t> *queue)
+{
+  SharedQueue<std::string> rqueue;
+  SharedQueue<msg_pending_t> pending;
+  std::thread writer(message_v2_writer, sockfd, &rqueue, &pending);
+  std::string body;
+  char lenbuf[4];
+
+  while (!tserv->m_bDone && recv_all(sockfd, lenbuf, sizeof(lenbuf))) {
+    uint32_t len;
+    memcpy(&len, lenbuf, sizeof(len));
+    len = ntohl(len);
+    if (len < 5 || len > MSG_V2_MAX) break;
+
+    body.resize(len);
+    if (!recv_all(sockfd, body.data(), len)) break;
+
+    uint8_t kind = body[0];
+    uint32_t id;
+    memcpy(&id, &body[1], sizeof(id));
+    id = ntohl(id);
+
+    client_request_t req;
+    req.rqueue = &rqueue;
+    req.socket_fd = sockfd;
+    req.websocket_id = "";
+    req.source = SRC_MESSAGE;
+
+    if (kind == 'S') {
+      req.type = REQ_SCRIPT;
+      req.script = body.substr(5);
+    }
+    else if (kind == 'B') {
+      size_t off = 5;
+      uint32_t n, slen;
+      if (len < off + 4) break;
+      memcpy(&n, &body[off], sizeof(n));
+      n = ntohl(n);
+      off += 4;
+      for (uint32_t i = 0; i < n; i++) {
+        if (len < off + 4) break;
+        memcpy(&slen, &body[off], sizeof(slen));
+        slen = ntohl(slen);
+        off += 4;
+        if (len - off < slen) break;
+        req.scripts.emplace_back(body, off, slen);
+        off += slen;
+      }
+      if (req.scripts.size() != n) break;
+      req.type = REQ_SCRIPT_BATCH;
+    }
+    else break;
+
+    /* owed before it can be answered, so the writer waits for it */
+    pending.push_back({ kind, id, kind == 'B' ? (uint32_t) req.scripts.size() : 1 });
+    if (kind == 'S' || !req.scripts.empty()) {
+      req.t_enqueue = request_timing_now_ns();
+      queue->push_back(std::move(req));
+    }
+  }
+
+  pending.push_back({ 0, 0, 0 });
+  writer.join();
+}
+
 /*
  * message_client_process is frame oriented with 32 size following by bytes
  *  response is similarly organized
@@ -4281,6 +5183,7 @@ TclServer::message_client_process(TclServer *tserv,
   client_request.type = REQ_SCRIPT;
   client_request.socket_fd = sockfd;
   client_request.websocket_id = "";
+  client_request.source = SRC_MESSAGE;
   
   std::string script;  
 
@@ -4292,6 +5195,14 @@ TclServer::message_client_process(TclServer *tserv,
       // shutdown if main server has shutdown
       if (tserv->m_bDone) break;
 
+      if (msgSize == sizeof(MSG_PROTOCOL_2) - 1 &&
+          !memcmp(buffer, MSG_PROTOCOL_2, msgSize)) {
+        delete[] buffer;
+        sendMessage(sockfd, "2");
+        message_v2_process(tserv, sockfd, queue);
+        break;
+      }
+
       client_request.script = std::string(buffer);
       std::string s;
 
@@ -4356,7 +5267,7 @@ void TclServer::sendAsyncResponse(const std::string& client_name,
                     while (ud->async_responses->size() > 0) {
                         std::string resp = ud->async_responses->front();
                         ud->async_responses->pop_front();
-                        ws->send(resp, uWS::OpCode::TEXT);
+                        wsSend(ws, std::move(resp), uWS::OpCode::TEXT);
                     }
                 }
             } else {
@@ -4366,7 +5277,7 @@ void TclServer::sendAsyncResponse(const std::string& client_name,
                     while (ud->async_responses->size() > 0) {
                         std::string resp = ud->async_responses->front();
                         ud->async_responses->pop_front();
-                        ws->send(resp, uWS::OpCode::TEXT);
+                        wsSend(ws, std::move(resp), uWS::OpCode::TEXT);
                     }
                 }
             }
@@ -35,12 +35,16 @@
 #include "Datapoint.h"
 #include "Dataserver.h"
 #include "ErrorMonitor.h"
+#include "MatchIndex.h"
+#include "ScriptCache.h"
 
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
 #include <set>
 #include <unordered_map>
 #include <map>
+#include <deque>
 #include <utility>
 
 #include <sstream>
@@ -50,62 +54,100 @@
 #include <App.h>
 
 /*
- * Everything the per-client notification thread touches, with a lifetime
- * INDEPENDENT of the uWS socket.
+ * One subscribe: the pattern, and whether matching points go out as
+ * binary datapoint records ("format":"binary") or JSON text.
+ */
+struct WSSubscription {
+  std::string match;
+  bool binary = false;
+};
+
+/*
+ * Binary datapoint stream ("format":"binary" subscriptions)
  *
- * WHY THIS EXISTS. WSPerSocketData lives *inside* the uWS WebSocket object, so
- * uWS frees it the instant the socket is destroyed -- while the detached
- * notification thread started in .open is still running. Anything that thread
- * reaches for through userData is therefore a read of freed memory, and the
- * loop did it twice per iteration:
+ *  Each binary websocket message is a run of records, little endian,
+ * each starting with its kind byte:
  *
- *     client_request_t req = userData->notification_queue->front();
- *     userData->notification_queue->pop_front();
+ *   WS_DPOINT_NAME    u8 kind, u8 0, u16 id, u16 namelen, name
+ *   WS_DPOINT_DATA    u8 kind, u8 dtype, u16 id, u32 len, u64 timestamp,
+ *                     [DSERV_EVT only: u8 e_type, u8 e_subtype,
+ *                      u8 e_puttype, u8 0], data (len bytes, raw)
  *
- * Freed memory reads back zeroed, so pop_front() ran with this == nullptr and
- * locked SharedQueue::mutex_ at its offset of 0x30 -- which is exactly the
- * "KERN_INVALID_ADDRESS at 0x0000000000000030" in the crash reports. The window
- * is only the gap between those two statements and only opens on disconnect,
- * which is why it fires during development (many rapid reconnects) and almost
- * never on a rig where a browser stays connected for hours.
+ *  Names are sent once per connection: the first point for a varname
+ * is preceded, in the same message, by the NAME record that gives it
+ * its id.  Ids are per connection and never reused; once they run out
+ * the remaining new names go out as JSON.  A binary message uWS drops
+ * for backpressure may have carried NAME records, so after one every
+ * name is sent again, with its old id, ahead of its next point.
+ */
+enum { WS_DPOINT_NAME = 1, WS_DPOINT_DATA = 2 };
+#define WS_DPOINT_MAX_IDS (65536)
+
+/*
+ * Everything a websocket's point delivery touches, with a lifetime
+ * INDEPENDENT of the uWS socket.
  *
- * The queue itself was never the problem -- it is a separate heap allocation.
- * Only the struct holding the pointer to it died early. So the thread now holds
- * a shared_ptr to this channel and never dereferences userData at all.
+ * WHY THIS EXISTS. WSPerSocketData lives *inside* the uWS WebSocket object, so
+ * uWS frees it the instant the socket is destroyed -- while points for it may
+ * still be on their way. Deliveries used to run on a detached notification
+ * thread per socket that reached for its queue through userData, and the
+ * read-after-free that caused ("KERN_INVALID_ADDRESS at 0x30" in the crash
+ * reports, on disconnect during rapid reconnects) is why nothing on the
+ * delivery side may touch userData at all.
+ *
+ * Deliveries now run in the sink of the socket's SendClient (TclServer::
+ * ws_notify), on a FanoutServer worker rather than a thread per socket. The
+ * sink holds a shared_ptr to this channel, so it lives until the SendClient
+ * is gone, however long after the socket that is.
  *
- * subscriptions moved in here for a second, independent reason: it is a
- * std::vector mutated by the event-loop thread (subscribe/unsubscribe) while
- * the notification thread iterates it, with no synchronization. A push_back
- * that reallocates during that iteration invalidates it mid-flight. Hence
- * subs_mutex, which both sides now take.
+ * subscriptions is a std::vector mutated by the event-loop thread
+ * (subscribe/unsubscribe) while deliveries iterate it. A push_back that
+ * reallocates during that iteration invalidates it mid-flight. Hence
+ * subs_mutex, which both sides take.
  */
 struct WSClientChannel {
-  SharedQueue<client_request_t> *notification_queue = nullptr;
   std::mutex subs_mutex;
-  std::vector<std::string> subscriptions;
+  std::vector<WSSubscription> subscriptions;
+
+  /* binary stream name ids; only deliveries (one at a time) touch them */
+  struct name_id_t {
+    uint16_t id;
+    bool named;			/* its NAME record has gone out */
+  };
+  std::unordered_map<std::string, name_id_t> name_ids;
+
+  /* set by the event loop when a binary message was dropped */
+  std::atomic<bool> names_lost{false};
 };
 
 // Add WebSocket per-socket data structure
+/*
+ * A websocket message waiting its turn (TclServer::wsSend).  Large ones
+ * go out as a fragmented websocket message -- the browser puts the
+ * fragments back together into one ArrayBuffer or string -- a fragment
+ * at a time as the socket drains, so sent counts what uWS has already
+ * been handed.
+ */
+struct WSOutMessage {
+  std::string data;
+  uWS::OpCode opcode;
+  size_t sent = 0;
+};
+
 struct WSPerSocketData {
   SharedQueue<std::string> *rqueue;
   std::string client_name;
 
-  /* shared with the notification thread; see WSClientChannel */
+  /* shared with its SendClient's sink; see WSClientChannel */
   std::shared_ptr<WSClientChannel> channel;
 
   std::string dataserver_client_id;  // ID for Dataserver registration
 
   // Queue for async eval responses (fed by process thread, drained by event loop)
   SharedQueue<std::string> *async_responses = nullptr;
-};
 
-// To help manage large WebSocket messages (stimdg -> ess/stiminfo)
-struct ChunkedMessage {
-    std::string messageId;
-    size_t chunkIndex;
-    size_t totalChunks;
-    std::string data;
-    bool isLastChunk;
+  // Messages held back for backpressure; event loop thread only
+  std::deque<WSOutMessage> outbox;
 };
 
 class TclServerConfig
@@ -160,10 +202,30 @@ public:
 // never holds the interp thread and can't deadlock a producer.  owns_match
 // records whether this registration added the underlying subscription (refcounted
 // in TclServer::when_match_refs) so cleanup never removes a match the caller set up.
+//
+// The predicate is compiled once, at registration, into a WhenPredicate: the
+// common forms (a numeric comparison, eq/ne, in/ni against literal operands) are
+// judged directly on the point's raw payload; anything else -- a $var or [cmd]
+// operand, several operands, an unknown op -- keeps the Tcl evaluation, as does
+// any value the native form can't judge exactly as Tcl would (a double's string
+// rep, a numeric string with a leading zero, ...).
+struct WhenPredicate {
+  enum kind_t { ANY, NUMERIC, STRING, SET, TCL } kind = ANY;
+  enum op_t { EQ, NE, LT, LE, GT, GE } op = EQ;   // NUMERIC; STRING uses EQ/NE
+  bool rhs_int = false;                 // NUMERIC: rhs_i, else rhs_d
+  int64_t rhs_i = 0;
+  double rhs_d = 0;
+  std::string rhs_s;                    // STRING
+  std::unordered_set<std::string> set;  // SET
+  bool negate = false;                  // SET: ni
+  std::string tcl_cmd;                  // `::tcl::mathop::<op> $::__dservWhenVal ...`
+};
+
 struct WhenCallback {
   int id;
   std::string pattern;
   std::string predicate;
+  WhenPredicate compiled;
   std::string script;      // command name to invoke (`script name value`)
   bool once;
   bool owns_match;
@@ -204,8 +266,11 @@ private:
   std::map<std::string, void*> ws_connections;  // Changed to void* to support both SSL and non-SSL
   uWS::Loop *ws_loop = nullptr;  // Store the loop reference
 
+  /* websocket messages past the threshold are sent in CHUNK_SIZE
+     fragments, each only once less than WS_HIGH_WATER is buffered */
   static const size_t LARGE_MESSAGE_THRESHOLD = 2 * 1024 * 1024; // 2MB
-  static const size_t CHUNK_SIZE = 512 * 1024; // 512KB chunks
+  static const size_t CHUNK_SIZE = 512 * 1024; // 512KB fragments
+  static const size_t WS_HIGH_WATER = 1024 * 1024;
 
   std::string cert_path = "/usr/local/dserv/ssl/cert.pem";
   std::string key_path = "/usr/local/dserv/ssl/key.pem";
@@ -218,10 +283,11 @@ private:
   // Staging area for file exports
   std::string exports_path;
   
+  /* event loop thread only */
   template<typename WebSocketType>
-  void sendLargeMessage(WebSocketType* ws,
-                        const std::string& message,
-                        const std::string& client_name);
+  void wsSend(WebSocketType* ws, std::string message, uWS::OpCode opcode);
+  template<typename WebSocketType>
+  static void wsFlush(WebSocketType* ws);
 
  using CommandRegistrationCallback = std::function<void(Tcl_Interp*, void*)>;
  CommandRegistrationCallback command_callback = nullptr;
@@ -266,7 +332,13 @@ public:
   // dservWhen registrations (predicate-gated one-shot/repeating callbacks) and
   // a per-pattern refcount of subscriptions dservWhen itself added.  Only ever
   // touched on this subprocess's process thread, so no locking is needed.
-  std::vector<WhenCallback> when_callbacks;
+  // Keyed by id, so iteration is registration order.  when_index holds every
+  // pattern MatchIndex can match (owner = id), so a point's name costs one
+  // lookup however many watches there are; patterns it can't ([] classes,
+  // backslashes) are in when_special and still Tcl_StringMatch'ed.
+  std::map<int, WhenCallback> when_callbacks;
+  MatchIndex<int> when_index;
+  std::vector<int> when_special;
   std::map<std::string, int> when_match_refs;
   int when_next_id = 1;
 
@@ -294,9 +366,20 @@ public:
   // for client requests
   SharedQueue<client_request_t> queue;
 
+  // The queue is in lanes (LANE_REALTIME, NORMAL, BULK), so a GUI eval
+  // that takes 200 ms can't hold up the state system's dpoint scripts
+  // and timers behind it.  source_lane is the lane each request source
+  // goes to (dservLanes); lane_of reads it on the producer's thread.
+  std::atomic<int> source_lane[SRC_NSOURCES];
+  int lane_of(const client_request_t &req);
+  static const int DEFAULT_LANE_BURST = 16;
+
   // timing for the serialized request path (owned by the process thread)
   RequestTiming timing;
 
+  // compiled client scripts (REQ_SCRIPT and friends); process thread only
+  ScriptCache script_cache;
+
   const char *PRINT_DPOINT_NAME = "print";
   const char *INTERPS_DPOINT_NAME = "dserv/interps";
   const char *SANDBOXES_DPOINT_NAME = "dserv/sandboxes";
@@ -471,9 +554,8 @@ public:
   }
     
   template<typename WebSocketType>
-  void process_websocket_client_notifications_template(WebSocketType* ws,
-						       std::shared_ptr<WSClientChannel> channel,
-						       std::string client_name);
+  void ws_notify(WebSocketType* ws, WSClientChannel *channel,
+                 const std::string& client_name, ds_datapoint_t *dpoint);
   
   int sourceFile(const char *filename);
   uint64_t now(void) { return ds->now(); }
@@ -482,6 +564,7 @@ public:
   void setPriority(int priority);
   
   void set_point(ds_datapoint_t *dp);
+  void set_points(ds_datapoint_t **dps, int n);
   int queue_size(void);
   void shutdown_message(SharedQueue<client_request_t> *queue);
   std::string eval(const char *s);
@@ -2,9 +2,12 @@
 #define TRIGGERDICT_H
 
 #include <unordered_map>
+#include <string_view>
 #include <mutex>
+#include <atomic>
 #include <algorithm>
 #include "MatchDict.h"
+#include "MatchIndex.h"
 
 #include <vector>
 
@@ -23,20 +26,81 @@
  *   always meant "this is now the script" and callers re-register to change
  *   behaviour. Turning that into an append would silently double-fire every
  *   existing registration. append() (dpointAddScript) is the additive form.
+ *
+ *   Keys are also compiled into a MatchIndex (owner = the key string in
+ *   its map_ node, which stays put until erased) so find_match() is one
+ *   lookup rather than a FastWildCompare per registered key.
+ *
+ *   generation() changes with every edit, so a dispatcher holding
+ *   something derived from the registered scripts (CommandObjCache.h)
+ *   knows when to let it go.
+ *
+ *   A key may be marked latest (dpointSetScript -latest): its scripts
+ *   only want a point's newest value, so a backlog of deliveries for a
+ *   name it covers can be collapsed to one (see TclServer::queue).
  */
 
 class TriggerDict
 {
  private:
-  std::unordered_map<std::string, std::vector<std::string>> map_;
+  struct entry_t {
+    std::vector<std::string> scripts;
+    bool latest = false;
+  };
+  /* transparent, so latest() can look up a point's own varname */
+  struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const noexcept
+    { return std::hash<std::string_view>{}(s); }
+  };
+  std::unordered_map<std::string, entry_t, KeyHash, std::equal_to<>> map_;
   std::mutex mutex_;
+  std::atomic<uint64_t> generation_{0};
+  std::atomic<int> nlatest_{0};			/* keys marked latest */
+
+  MatchIndex<const std::string *> index_;
+  std::vector<const std::string *> hits_;	/* find_match scratch, under mutex_ */
+
+  /* call under mutex_ with a freshly emplaced key */
+  void index_key(decltype(map_)::iterator iter)
+  {
+    index_.insert(&iter->first, iter->first, false);
+  }
+
+  void unindex_key(decltype(map_)::iterator iter)
+  {
+    index_.remove(&iter->first, iter->first);
+    if (iter->second.latest) nlatest_--;
+  }
+
+  void set_latest(entry_t &entry, bool latest)
+  {
+    if (entry.latest != latest) nlatest_ += latest ? 1 : -1;
+    entry.latest = latest;
+  }
+
+  /* call under mutex_: the entry find() or find_match() would use */
+  entry_t *lookup(const char *varname)
+  {
+    auto iter = map_.find(std::string_view(varname));
+    if (iter != map_.end()) return &iter->second;
+    hits_.clear();
+    if (!index_.match(varname, hits_)) return nullptr;
+    iter = map_.find(*hits_.front());
+    return (iter == map_.end()) ? nullptr : &iter->second;
+  }
 
  public:
-  /* Replace whatever is registered for key. dpointSetScript. */
-  void insert(std::string key, std::string script)
+  /* Replace whatever is registered for key, latest with it.
+     dpointSetScript. */
+  void insert(std::string key, std::string script, bool latest = false)
     {
       std::lock_guard<std::mutex> mlock(mutex_);
-      map_[key] = std::vector<std::string>{ script };
+      auto [iter, added] = map_.try_emplace(key);
+      iter->second.scripts = std::vector<std::string>{ script };
+      set_latest(iter->second, latest);
+      if (added) index_key(iter);
+      generation_++;
     }
 
   /* Add a script, keeping any already registered. dpointAddScript.
@@ -45,15 +109,23 @@ class TriggerDict
   void append(std::string key, std::string script)
   {
     std::lock_guard<std::mutex> mlock(mutex_);
-    auto &v = map_[key];
-    if (std::find(v.begin(), v.end(), script) == v.end())
+    auto [iter, added] = map_.try_emplace(key);
+    if (added) index_key(iter);
+    auto &v = iter->second.scripts;
+    if (std::find(v.begin(), v.end(), script) == v.end()) {
       v.push_back(script);
+      generation_++;
+    }
   }
 
   void remove(std::string key)
   {
     std::lock_guard<std::mutex> mlock(mutex_);
-    map_.erase (key);
+    auto iter = map_.find(key);
+    if (iter == map_.end()) return;
+    unindex_key(iter);
+    map_.erase (iter);
+    generation_++;
   }
 
   /* Remove ONE script from key, leaving its siblings. Erases the key when
@@ -64,11 +136,15 @@ class TriggerDict
     std::lock_guard<std::mutex> mlock(mutex_);
     auto iter = map_.find(key);
     if (iter == map_.end()) return false;
-    auto &v = iter->second;
+    auto &v = iter->second.scripts;
     auto pos = std::find(v.begin(), v.end(), script);
     if (pos == v.end()) return false;
     v.erase(pos);
-    if (v.empty()) map_.erase(iter);
+    if (v.empty()) {
+      unindex_key(iter);
+      map_.erase(iter);
+    }
+    generation_++;
     return true;
   }
 
@@ -76,8 +152,13 @@ class TriggerDict
   {
     std::lock_guard<std::mutex> mlock(mutex_);
     map_.clear ();
+    index_.clear();
+    nlatest_ = 0;
+    generation_++;
   }
 
+  uint64_t generation() const { return generation_.load(); }
+
   /* All scripts for key. Returns true if the key is registered AT ALL,
      including with an empty script -- the dispatcher relies on that to keep
      an empty exact entry shadowing a wildcard one. */
@@ -87,7 +168,7 @@ class TriggerDict
     auto iter = map_.find(key);
 
     if (iter != map_.end()) {
-      scripts = iter->second;
+      scripts = iter->second.scripts;
       return true;
     }
     return false;
@@ -101,7 +182,8 @@ class TriggerDict
     auto iter = map_.find(key);
 
     if (iter != map_.end()) {
-      script = iter->second.empty() ? std::string() : iter->second.front();
+      auto &v = iter->second.scripts;
+      script = v.empty() ? std::string() : v.front();
       return true;
     }
     return false;
@@ -117,22 +199,46 @@ class TriggerDict
     return out;
   }
 
+  /* the keys marked latest */
+  std::vector<std::string> latest_keys()
+  {
+    std::lock_guard<std::mutex> mlock(mutex_);
+    std::vector<std::string> out;
+    for (auto const& [ key, value ] : map_)
+      if (value.latest) out.push_back(key);
+    return out;
+  }
+
   /*
    * find_match()
    *
    *   If datapoint matches a registered wildcard key, return true and set
-   *   that key's scripts.
+   *   that key's scripts.  When several keys match, the most specific
+   *   wins, in MatchIndex's order: longest literal lead-in, a glob ahead
+   *   of a bare prefix, so "ess/stat?s" beats "ess/st*" beats "*" -- it
+   *   used to be whichever the hash map happened to visit first.
    */
   bool find_match(std::string varname, std::vector<std::string> &scripts)
   {
     std::lock_guard<std::mutex> mlock(mutex_);
-    for (auto const& [ key, value ] : map_) {
-      if (MatchDict::FastWildCompare((char *) key.c_str(), (char *) varname.c_str())) {
-	scripts = value;
-	return true;
-      }
-    }
-    return false;
+    hits_.clear();
+    if (!index_.match(varname.c_str(), hits_)) return false;
+    auto iter = map_.find(*hits_.front());
+    if (iter == map_.end()) return false;
+    scripts = iter->second.scripts;
+    return true;
+  }
+
+
+  /* Are varname's deliveries conflated: is the key that dispatches it
+     (exact, else the best match) marked latest?  Cheap when no key is,
+     and builds no string when one is: it runs on every queue push. */
+  bool latest(const char *varname)
+  {
+    if (!nlatest_.load(std::memory_order_relaxed)) return false;
+    std::lock_guard<std::mutex> mlock(mutex_);
+    entry_t *entry = lookup(varname);
+    return entry && entry->latest;
   }
 
 };
@@ -19,6 +19,8 @@
 
 #include <math.h>
 #include <dlfcn.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "uthash.h"
 #include "dpoint_process.h"
@@ -55,15 +57,98 @@ typedef struct dpointProcessInfo_s {
   DPOINT_PROCESS_SETPARAM_FUNC  set_param;
   DPOINT_PROCESS_SETPARAM_FUNC  get_param;
   void                         *process_params;
+  atomic_uint_fast64_t          calls;	/* times process() was run */
+  atomic_uint_fast64_t          ns;	/* total time spent in it */
   UT_hash_handle                hh;
 } dpointProcessInfo_t;
 
+/*
+ * Input index: varname -> the processors attached to it, in attach
+ * order.  process_dpoint() is called on every set, almost always for a
+ * point nothing is attached to, so it must not walk processTable; a
+ * point with no entry here costs one hash lookup (none at all while no
+ * processor is attached).
+ */
+typedef struct dpointProcessInput_s {
+  char                         *varname;
+  int                           nprocs;
+  int                           maxprocs;
+  dpointProcessInfo_t         **procs;
+  UT_hash_handle                hh;
+} dpointProcessInput_t;
+
 /* Table of process functions */
 dpointProcessFunctionInfo_t *processFunctionTable = NULL;
 
 /* Table of process mappings */
 dpointProcessInfo_t *processTable = NULL;
 
+/* Table of inputs, built by process_attach() */
+static dpointProcessInput_t *processInputTable = NULL;
+
+/*
+ * process_dpoint() runs on whichever thread did the set -- the
+ * Dataserver's, a TclServer's, an ingest worker -- while attach (and
+ * loading, and parameter changes) come from a Tcl command on another.
+ * The tables and each processor's params are read under processLock
+ * and only changed with it held for writing.  processInputs mirrors
+ * the number of input entries so a set with no processor attached
+ * anywhere still takes no lock at all.
+ */
+static pthread_rwlock_t processLock = PTHREAD_RWLOCK_INITIALIZER;
+static atomic_int processInputs = 0;
+
+static uint64_t process_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void input_add(dpointProcessInfo_t *p)
+{
+  dpointProcessInput_t *in;
+  HASH_FIND_STR(processInputTable, p->varname, in);
+  if (in == NULL) {
+    in = (dpointProcessInput_t *) calloc(1, sizeof *in);
+    if (!in) pabort("calloc");
+    in->varname = strdup(p->varname);
+    HASH_ADD_STR(processInputTable, varname, in);
+    atomic_fetch_add(&processInputs, 1);
+  }
+  if (in->nprocs == in->maxprocs) {
+    in->maxprocs = in->maxprocs ? 2 * in->maxprocs : 2;
+    in->procs = (dpointProcessInfo_t **)
+      realloc(in->procs, in->maxprocs * sizeof(dpointProcessInfo_t *));
+    if (!in->procs) pabort("realloc");
+  }
+  in->procs[in->nprocs++] = p;
+}
+
+static void input_remove(dpointProcessInfo_t *p)
+{
+  int i;
+  dpointProcessInput_t *in;
+  HASH_FIND_STR(processInputTable, p->varname, in);
+  if (in == NULL) return;
+
+  for (i = 0; i < in->nprocs; i++) {
+    if (in->procs[i] == p) {
+      memmove(&in->procs[i], &in->procs[i+1],
+	      (in->nprocs - i - 1) * sizeof(dpointProcessInfo_t *));
+      in->nprocs--;
+      break;
+    }
+  }
+  if (!in->nprocs) {
+    HASH_DEL(processInputTable, in);
+    atomic_fetch_sub(&processInputs, 1);
+    free(in->procs);
+    free(in->varname);
+    free(in);
+  }
+}
+
 void add_process_function_info(char *name,
 			       void *handle,
 			       DPOINT_PROCESS_FUNC pfunc,
@@ -73,6 +158,8 @@ void add_process_function_info(char *name,
 			       DPOINT_PROCESS_SETPARAM_FUNC getparamfunc) {
   dpointProcessFunctionInfo_t *p;
   
+  pthread_rwlock_wrlock(&processLock);
+
   /* check if already exists, otherwise allocate and add to table */
   HASH_FIND_STR(processFunctionTable, name, p);
   if (p == NULL) {
@@ -88,48 +175,117 @@ void add_process_function_info(char *name,
   p->freeparamfunc = freeparamfunc;
   p->setparamfunc = setparamfunc;
   p->getparamfunc = getparamfunc;
+
+  pthread_rwlock_unlock(&processLock);
 }
 
 
-int process_dpoint(ds_datapoint_t *dpoint, ds_datapoint_t **out)
+/*
+ * process_dpoint
+ *
+ *  Run every processor attached to dpoint's name, in attach order, and
+ * hand each point they produce (DPOINT_PROCESS_DSERV) to output, which
+ * is called with the lock still held: the points belong to the
+ * processors and are only valid until each is next called, so output
+ * must copy what it keeps and publish nothing itself.  Returns the
+ * number of points produced.
+ */
+int process_dpoint(ds_datapoint_t *dpoint,
+		   DPOINT_PROCESS_OUTPUT_FUNC output, void *arg)
+{
+  int i, nout = 0;
+  dpointProcessInput_t *in;
+
+  if (!atomic_load_explicit(&processInputs, memory_order_relaxed)) return 0;
+
+  pthread_rwlock_rdlock(&processLock);
+  HASH_FIND_STR(processInputTable, dpoint->varname, in);
+  if (in == NULL) {
+    pthread_rwlock_unlock(&processLock);
+    return 0;
+  }
+
+  for (i = 0; i < in->nprocs; i++) {
+    dpointProcessInfo_t *p = in->procs[i];
+    dpoint_process_info_t pinfo;
+    pinfo.input_dpoint = dpoint;
+
+    uint64_t start = process_now_ns();
+    int rc = p->process(&pinfo, p->process_params);
+    atomic_fetch_add_explicit(&p->ns, process_now_ns() - start,
+			      memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->calls, 1, memory_order_relaxed);
+
+    if (rc == DPOINT_PROCESS_DSERV) {
+      output(pinfo.dpoint, arg);
+      nout++;
+    }
+  }
+
+  pthread_rwlock_unlock(&processLock);
+  return nout;
+}
+
+/*
+ * process_stats
+ *
+ *  Fill in up to max entries (one per attached processor) and return
+ * how many processors there are.  name and varname are copied under
+ * the lock: an attach or detach may free the table's own the moment
+ * it is released.
+ */
+int process_stats(dpoint_process_stats_t *stats, int max)
 {
+  int n = 0;
   dpointProcessInfo_t *p;
 
-  for (p = processTable; p != NULL; p = p->hh.next) {
-    if (!strcmp(p->varname, dpoint->varname)) {
-      dpoint_process_info_t pinfo;
-      pinfo.input_dpoint = dpoint;
-
-      int rc = p->process(&pinfo, p->process_params);
-      
-      if (rc == DPOINT_PROCESS_DSERV) {
-	*out = pinfo.dpoint;
-      }
-      return rc;
-    }
+  pthread_rwlock_rdlock(&processLock);
+  for (p = processTable; p != NULL; p = p->hh.next, n++) {
+    if (n >= max) continue;
+    snprintf(stats[n].name, sizeof(stats[n].name), "%s", p->name);
+    snprintf(stats[n].varname, sizeof(stats[n].varname), "%s", p->varname);
+    stats[n].calls = atomic_load_explicit(&p->calls, memory_order_relaxed);
+    stats[n].ns = atomic_load_explicit(&p->ns, memory_order_relaxed);
   }
+  pthread_rwlock_unlock(&processLock);
+  return n;
+}
 
-  return DPOINT_PROCESS_IGNORE;
+void process_stats_reset(void)
+{
+  dpointProcessInfo_t *p;
+  pthread_rwlock_rdlock(&processLock);
+  for (p = processTable; p != NULL; p = p->hh.next) {
+    atomic_store(&p->calls, 0);
+    atomic_store(&p->ns, 0);
+  }
+  pthread_rwlock_unlock(&processLock);
 }
 
 int process_attach(char *name,
 		   char *varname,
 		   char *processfuncname) {
   
+  pthread_rwlock_wrlock(&processLock);
+
   /* find processfunc info */
   dpointProcessFunctionInfo_t *pfunc;
   HASH_FIND_STR(processFunctionTable, processfuncname, pfunc);
-  if (pfunc == NULL) return -1;
+  if (pfunc == NULL) {
+    pthread_rwlock_unlock(&processLock);
+    return -1;
+  }
 
   /* check if already entry exists, otherwise allocate and add to table */
   dpointProcessInfo_t *p;
   HASH_FIND_STR(processTable, name, p);
   if (p == NULL) {
-    p = (dpointProcessInfo_t *) malloc(sizeof *p);
+    p = (dpointProcessInfo_t *) calloc(1, sizeof *p);
     p->name = strdup(name);
     HASH_ADD_STR(processTable, name, p);
   }
   else {
+    input_remove(p);
     if (p->varname) free(p->varname);
     if (p->process_params)
       p->free_params(p->process_params);
@@ -141,7 +297,11 @@ int process_attach(char *name,
   p->set_param = pfunc->setparamfunc;
   p->get_param = pfunc->getparamfunc;
   p->process_params = pfunc->newparamfunc();
+  atomic_store(&p->calls, 0);
+  atomic_store(&p->ns, 0);
+  input_add(p);
 
+  pthread_rwlock_unlock(&processLock);
   return 0;
 }
 
@@ -149,10 +309,13 @@ int process_set_param(char *name, char *pname, char *pval, int index,
 		      uint64_t timestamp, ds_datapoint_t **out)
 {
   dpointProcessInfo_t *p;
+  pthread_rwlock_rdlock(&processLock);
   HASH_FIND_STR(processTable, name, p);
-  if (p == NULL) return -1;
+  if (p == NULL) {
+    pthread_rwlock_unlock(&processLock);
+    return -1;
+  }
 
-  
   dpoint_process_param_setting_t psetting;
   psetting.timestamp = timestamp;
   psetting.pval = &pval;
@@ -162,9 +325,11 @@ int process_set_param(char *name, char *pname, char *pval, int index,
 
   int rc;
   rc = p->set_param(&psetting);
+  /* copied while the processor can't be re-attached under us */
   if (rc == DPOINT_PROCESS_DSERV) {
-    *out = psetting.dpoint;
+    *out = dpoint_copy(psetting.dpoint);
   }
+  pthread_rwlock_unlock(&processLock);
   return rc;
 }
 
@@ -173,8 +338,10 @@ char *process_get_param(char *name, char *pname, int index)
   dpointProcessInfo_t *p;
 
 
+  pthread_rwlock_rdlock(&processLock);
   HASH_FIND_STR(processTable, name, p);
   if (p == NULL) {
+    pthread_rwlock_unlock(&processLock);
     return NULL;
   }
 
@@ -186,7 +353,9 @@ char *process_get_param(char *name, char *pname, int index)
   psetting.pname = pname;
 
   
-  if (!p->get_param(&psetting)) return NULL;
+  int rc = p->get_param(&psetting);
+  pthread_rwlock_unlock(&processLock);
+  if (!rc) return NULL;
   else return pval;
 }
 
@@ -200,8 +369,6 @@ int process_load(char *shared_object_name, char *pname)
   DPOINT_PROCESS_SETPARAM_FUNC setpfunc;
   DPOINT_PROCESS_SETPARAM_FUNC getpfunc;
 
-  dpointProcessFunctionInfo_t *pinfo;
-  
   /* Open a shared library. */
   handle = dlopen( shared_object_name,  RTLD_NOW);
   if (!handle) return DPOINT_PROCESS_NOT_FOUND;
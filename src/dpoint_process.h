@@ -30,7 +30,16 @@ typedef struct dpoint_process_param_setting_s {
   ds_datapoint_t *dpoint;
 } dpoint_process_param_setting_t;
   
+/* per-processor counters, see process_stats(); the names are copies */
+typedef struct dpoint_process_stats_s {
+  char name[DSERV_MAX_VARNAME_LEN];
+  char varname[DSERV_MAX_VARNAME_LEN];
+  uint64_t calls;
+  uint64_t ns;
+} dpoint_process_stats_t;
+
 typedef int (*DPOINT_PROCESS_FUNC)(dpoint_process_info_t *info, void *);
+typedef void (*DPOINT_PROCESS_OUTPUT_FUNC)(ds_datapoint_t *dpoint, void *arg);
 typedef void * (*DPOINT_PROCESS_NEWPARAM_FUNC)(void);
 typedef void * (*DPOINT_PROCESS_FREEPARAM_FUNC)(void *);
 typedef int (*DPOINT_PROCESS_SETPARAM_FUNC)(dpoint_process_param_setting_t *p);
@@ -46,7 +55,10 @@ extern "C" {
   int process_set_param(char *name, char *pname, char *pval, int index,
 			uint64_t timestamp, ds_datapoint_t **out);
   char *process_get_param(char *name, char *pname, int index);
-  int process_dpoint(ds_datapoint_t *dpoint, ds_datapoint_t **out);
+  int process_dpoint(ds_datapoint_t *dpoint,
+		     DPOINT_PROCESS_OUTPUT_FUNC output, void *arg);
+  int process_stats(dpoint_process_stats_t *stats, int max);
+  void process_stats_reset(void);
 #ifdef __cplusplus
 }
 #endif
@@ -46,6 +46,12 @@ extern "C" {
 	{
 	  ((TclServer *) tclserver)->set_point(dp);
 	}
+
+	void tclserver_set_points(tclserver_t *tclserver, ds_datapoint_t **dps,
+				  int n)
+	{
+	  ((TclServer *) tclserver)->set_points(dps, n);
+	}
 	
 	uint64_t tclserver_now(tclserver_t *tclserver)
 	{
@@ -70,6 +76,7 @@ extern "C" {
 	  client_request_t req;
 	  req.type = (request_t) (no_reply ? REQ_SCRIPT_NOREPLY : REQ_SCRIPT);
 	  req.script = std::string(script);
+	  req.source = SRC_MODULE;	/* behind the module's own points */
 	  
 	  ts->queue.push_back(req);
 	}
@@ -274,6 +281,9 @@ int main(int argc, char *argv[])
   std::string trigger_script;
   std::string configuration_script;
   std::string www_path;
+  int ingest_threads = DSERV_INGEST_THREADS;
+  int fanout_threads = DSERV_FANOUT_THREADS;
+  int shm_ingest = DSERV_SHM_INGEST;
   
   cxxopts::Options options("dserv", "Data server");
   options.add_options()
@@ -284,7 +294,16 @@ int main(int argc, char *argv[])
      cxxopts::value<std::string>(configuration_script))
     ("v,version", "Version", cxxopts::value<bool>(version))
     ("w,www", "Static file serving directory",
-     cxxopts::value<std::string>(www_path));    
+     cxxopts::value<std::string>(www_path))
+    ("ingest-threads",
+     "epoll threads serving producers on port 4620 (0: thread per connection)",
+     cxxopts::value<int>(ingest_threads))
+    ("fanout-threads",
+     "epoll threads writing to subscribers (0: thread per subscriber)",
+     cxxopts::value<int>(fanout_threads))
+    ("shm-ingest",
+     "offer same-host producers shared memory rings (0: off)",
+     cxxopts::value<int>(shm_ingest));
 
   try {
     auto result = options.parse(argc, argv);
@@ -322,7 +341,8 @@ int main(int argc, char *argv[])
   Tcl_SetExitProc(dserv_exit_proc);
 
   // Create core dserv components
-  dserver = new Dataserver(argc, argv);
+  dserver = new Dataserver(argc, argv, 4620, ingest_threads,
+			   fanout_threads, shm_ingest);
 
   TclServerConfig tclserver_config("dserv", 2570, 2560, 2565);
 
@@ -0,0 +1,129 @@
+/*
+ * dslog_block.c - decode compressed dserv logs (see dslog_block.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#include "dslog_index.h"
+#include "dslog_block.h"
+
+/* offset of the next block magic after off, or -1 */
+static off_t next_magic(FILE *in, off_t off)
+{
+  int matched = 0, c;
+
+  if (fseeko(in, off, SEEK_SET)) return -1;
+  while ((c = getc(in)) != EOF) {
+    off++;
+    if (c == DSLOG_BLOCK_MAGIC[matched]) {
+      if (++matched == DSLOG_BLOCK_MAGIC_LEN)
+	return off - DSLOG_BLOCK_MAGIC_LEN;
+    }
+    else matched = (c == DSLOG_BLOCK_MAGIC[0]);
+  }
+  return -1;
+}
+
+/* grow *buf to hold n bytes */
+static int reserve(unsigned char **buf, size_t *size, size_t n)
+{
+  if (n <= *size) return 0;
+  unsigned char *nb = (unsigned char *) realloc(*buf, n);
+  if (!nb) return -1;
+  *buf = nb;
+  *size = n;
+  return 0;
+}
+
+int dslog_inflate(const char *in_path, const char *out_path,
+		  dslog_inflate_stats_t *stats)
+{
+  unsigned char header[DSLOG_HEADER_SIZE];
+  unsigned char bheader[DSLOG_BLOCK_HEADER];
+  unsigned char *comp = NULL, *raw = NULL;
+  size_t comp_size = 0, raw_size = 0;
+  dslog_inflate_stats_t st;
+  FILE *out = NULL;
+  int rc = DSLOG_ERR_OPEN;
+  off_t pos;
+
+  memset(&st, 0, sizeof(st));
+
+  FILE *in = fopen(in_path, "rb");
+  if (!in) return DSLOG_ERR_OPEN;
+
+  rc = DSLOG_ERR_FORMAT;
+  if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+      memcmp(header, "dslog", 5) ||
+      !(header[5] & DSLOG_FLAG_COMPRESSED) ||
+      header[6] != DSLOG_CODEC_ZLIB)
+    goto done;
+
+  rc = DSLOG_ERR_OPEN;
+  if (!(out = fopen(out_path, "wb"))) goto done;
+  header[5] &= ~DSLOG_FLAG_COMPRESSED;
+  header[6] = DSLOG_CODEC_NONE;
+  if (fwrite(header, 1, sizeof(header), out) != sizeof(header)) goto done;
+  st.bytes_out = sizeof(header);
+
+  pos = DSLOG_HEADER_SIZE;
+  while (fseeko(in, pos, SEEK_SET) == 0 &&
+	 fread(bheader, 1, 1, in) == 1) {
+    uint32_t raw_len, comp_len, crc;
+    uLongf got;
+    int ok = 0;
+
+    size_t nread = fread(&bheader[1], 1, sizeof(bheader) - 1, in);
+
+    /* the block index follows the last block */
+    if (nread >= DSLOG_BLOCK_MAGIC_LEN - 1 &&
+	!memcmp(bheader, DSLOG_BLOCKIDX_MAGIC, DSLOG_BLOCK_MAGIC_LEN))
+      break;
+
+    if (nread == sizeof(bheader) - 1 &&
+	!memcmp(bheader, DSLOG_BLOCK_MAGIC, DSLOG_BLOCK_MAGIC_LEN)) {
+      memcpy(&raw_len, &bheader[4], sizeof(uint32_t));
+      memcpy(&comp_len, &bheader[8], sizeof(uint32_t));
+      memcpy(&crc, &bheader[12], sizeof(uint32_t));
+      if (raw_len <= DSLOG_BLOCK_MAX && comp_len <= DSLOG_BLOCK_MAX) {
+	rc = DSLOG_ERR_NOMEM;
+	if (reserve(&comp, &comp_size, comp_len) ||
+	    reserve(&raw, &raw_size, raw_len ? raw_len : 1))
+	  goto done;
+	got = raw_len;
+	ok = (fread(comp, 1, comp_len, in) == comp_len &&
+	      crc32(0L, comp, comp_len) == crc &&
+	      uncompress(raw, &got, comp, comp_len) == Z_OK &&
+	      got == raw_len);
+      }
+    }
+
+    if (!ok) {
+      /* torn or corrupt: drop it and pick up at the next block */
+      st.damaged++;
+      if ((pos = next_magic(in, pos + 1)) < 0) break;
+      continue;
+    }
+
+    rc = DSLOG_ERR_OPEN;
+    if (raw_len && fwrite(raw, 1, raw_len, out) != raw_len) goto done;
+    st.blocks++;
+    st.bytes_out += raw_len;
+    pos += DSLOG_BLOCK_HEADER + comp_len;
+  }
+  if (fseeko(in, 0, SEEK_END) == 0) st.bytes_in = ftello(in);
+  rc = DSLOG_OK;
+
+ done:
+  if (out && fclose(out) && rc == DSLOG_OK) rc = DSLOG_ERR_OPEN;
+  fclose(in);
+  free(comp);
+  free(raw);
+  if (stats) *stats = st;
+  return rc;
+}
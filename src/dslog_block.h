@@ -0,0 +1,84 @@
+#ifndef DSLOG_BLOCK_H_
+#define DSLOG_BLOCK_H_
+
+#include <stdint.h>
+
+/*
+ * dslog_block - compressed dserv logs
+ *
+ * A compressed log has the usual 16 byte header with
+ * DSLOG_FLAG_COMPRESSED or'd into the version byte (so readers that
+ * don't know about it refuse the file instead of misparsing it) and
+ * the codec at [6].  The record stream it would otherwise contain
+ * (version 3 or 5) follows as a sequence of independent blocks:
+ *
+ *   DSLOG_BLOCK_MAGIC  u32 raw_len  u32 comp_len  u32 crc  data
+ *
+ * data is comp_len bytes that inflate to raw_len bytes of record
+ * stream; crc is the zlib crc32 of data.  Each block is one writer
+ * flush of whole records and is compressed on its own, so a block can
+ * be decoded without anything before it.  A block cut short by a power
+ * failure, or one that fails its crc, is dropped and decoding carries
+ * on at the next block magic; what is left is still a valid record
+ * stream, short the dropped block's records.  (Not so for a compact
+ * stream, whose ids and timestamp deltas carry across blocks: there
+ * dslog_expand() stops at the gap.)  The writer starts a new block
+ * rather than let one pass DSLOG_BLOCK_MAX.
+ *
+ * A log closed cleanly ends with a block index after the last block,
+ * not compressed:
+ *
+ *   DSLOG_BLOCKIDX_MAGIC  u32 nblocks
+ *     per block: u64 offset of its header in the file,
+ *                u64 stream offset of its first record,
+ *                u64 timestamp of its first record
+ *   u64 length of the record stream (the header included)
+ *   u64 offset of DSLOG_BLOCKIDX_MAGIC, DSLOG_BLOCKIDX_TAIL
+ *
+ * so that dslog_open() (dslog_index.h) can find the block holding any
+ * stream offset without inflating what comes before it.  Stream
+ * offsets are what a plain log's file offsets would be, so a version
+ * 4 stream's own index works through the blocks unchanged.  Without
+ * the block index (a log that was never closed) dslog_open() walks
+ * the block headers instead, which reads 16 bytes a block.
+ */
+
+#define DSLOG_FLAG_COMPRESSED  0x80
+#define DSLOG_CODEC_NONE       0
+#define DSLOG_CODEC_ZLIB       1
+
+#define DSLOG_BLOCK_MAGIC      "DSLZ"
+#define DSLOG_BLOCK_MAGIC_LEN  4
+#define DSLOG_BLOCK_HEADER     16
+
+/* the writer splits at this; anything bigger is damage */
+#define DSLOG_BLOCK_MAX        (256*1024*1024)
+
+#define DSLOG_BLOCKIDX_MAGIC   "DSLX"
+#define DSLOG_BLOCKIDX_TAIL    "DSLGBIX1"
+#define DSLOG_BLOCKIDX_ENTRY   24
+
+typedef struct dslog_inflate_stats_s {
+  uint64_t blocks;		/* blocks decoded */
+  uint64_t damaged;		/* blocks dropped */
+  uint64_t bytes_in;		/* compressed file size */
+  uint64_t bytes_out;		/* log written, header included */
+} dslog_inflate_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * inflate compressed log in_path to the plain log it holds (same
+   * version, without the flag) at out_path; returns DSLOG_OK or a
+   * DSLOG_ERR_* (dslog_index.h)
+   */
+  int dslog_inflate(const char *in_path, const char *out_path,
+		    dslog_inflate_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DSLOG_BLOCK_H_ */
@@ -0,0 +1,43 @@
+#ifndef DSLOG_COLUMN_H_
+#define DSLOG_COLUMN_H_
+
+#include <stdint.h>
+
+/*
+ * dslog_column - columnar sample blocks in dserv logs
+ *
+ * A logger match added with columnar set (dservLoggerAddMatch ...
+ * columnar) collects each matching varname's SHORT, INT, FLOAT or
+ * DOUBLE points into blocks instead of writing a record per point.  A
+ * block is one ordinary record:
+ *
+ *   varname    the points' varname
+ *   timestamp  the first sample's
+ *   flags      DSERV_DPOINT_COLUMNAR_FLAG
+ *   type       DSERV_BYTE (so readers that don't know blocks see bytes)
+ *   data       dslog_column_header_t
+ *              u64 timestamp[nsamples]
+ *              samples[nsamples], sample_len bytes each, back to back
+ *
+ * Every sample in a block has the same type and length; a point whose
+ * shape differs ends the block and starts a new one.  The timestamps
+ * start 8 byte aligned relative to the payload, and the sample matrix
+ * is nsamples x (sample_len / element size) in row order, so both
+ * columns can be handed to a list/array constructor as they are.
+ */
+
+#define DSLOG_COLUMN_MAGIC     "DSCB"
+
+typedef struct dslog_column_header_s {
+  char magic[4];		/* DSLOG_COLUMN_MAGIC */
+  uint32_t type;		/* ds_datatype_t of the samples */
+  uint32_t nsamples;
+  uint32_t sample_len;		/* bytes per sample */
+  uint32_t elsize;		/* bytes per element */
+  uint32_t reserved;
+} dslog_column_header_t;
+
+#define DSLOG_COLUMN_PAYLOAD(n, sample_len) \
+  (sizeof(dslog_column_header_t) + (uint64_t) (n) * (8 + (sample_len)))
+
+#endif /* DSLOG_COLUMN_H_ */
@@ -0,0 +1,145 @@
+/*
+ * dslog_compact.c - expand compact (v5) dserv logs (see dslog_compact.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "Datapoint.h"
+#include "dslog_index.h"
+#include "dslog_compact.h"
+
+typedef struct {
+  char *name;
+  uint16_t len;
+} compact_name_t;
+
+static int get_varint(FILE *in, uint64_t *v)
+{
+  uint64_t result = 0;
+  int c;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if ((c = getc(in)) == EOF) return -1;
+    result |= (uint64_t) (c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      *v = result;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int get_u32(FILE *in, uint32_t *v)
+{
+  uint64_t v64;
+  if (get_varint(in, &v64) || v64 > UINT32_MAX) return -1;
+  *v = (uint32_t) v64;
+  return 0;
+}
+
+static int get_name(FILE *in, char *name, uint16_t *len)
+{
+  if (fread(len, sizeof(uint16_t), 1, in) != 1) return -1;
+  if (!*len || *len > DSERV_MAX_VARNAME_LEN) return -1;
+  if (fread(name, 1, *len, in) != *len) return -1;
+  name[*len] = '\0';
+  return 0;
+}
+
+int64_t dslog_expand(const char *in_path, const char *out_path)
+{
+  unsigned char header[DSLOG_HEADER_SIZE];
+  compact_name_t *names = NULL;
+  unsigned char *data = NULL;
+  size_t data_size = 0;
+  char literal[DSERV_MAX_VARNAME_LEN + 1];
+  uint64_t timestamp = 0;
+  int64_t nrecords = 0;
+  int64_t rc = DSLOG_ERR_OPEN;
+  FILE *out = NULL;
+  int c;
+
+  FILE *in = fopen(in_path, "rb");
+  if (!in) return DSLOG_ERR_OPEN;
+
+  rc = DSLOG_ERR_FORMAT;
+  if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+      memcmp(header, "dslog", 5) || header[5] != DSLOG_VERSION_COMPACT)
+    goto done;
+
+  rc = DSLOG_ERR_NOMEM;
+  names = (compact_name_t *) calloc(DSLOG_COMPACT_MAX_IDS, sizeof(*names));
+  if (!names) goto done;
+
+  rc = DSLOG_ERR_OPEN;
+  if (!(out = fopen(out_path, "wb"))) goto done;
+  header[5] = 3;
+  if (fwrite(header, 1, sizeof(header), out) != sizeof(header)) goto done;
+
+  /* a record cut short at the end (log never closed) ends the file */
+  while ((c = getc(in)) != EOF) {
+    const char *varname;
+    uint16_t varlen, id;
+    uint64_t delta;
+    uint32_t flags, type, len;
+
+    rc = DSLOG_ERR_READ;
+    if (c == DSLOG_COMPACT_DEF) {
+      if (fread(&id, sizeof(id), 1, in) != 1 ||
+	  get_name(in, literal, &varlen))
+	break;
+      free(names[id].name);
+      if (!(names[id].name = strdup(literal))) { rc = DSLOG_ERR_NOMEM; goto done; }
+      names[id].len = varlen;
+      continue;
+    }
+    else if (c == DSLOG_COMPACT_POINT) {
+      if (fread(&id, sizeof(id), 1, in) != 1) break;
+      if (!names[id].name) goto done;	/* used before defined */
+      varname = names[id].name;
+      varlen = names[id].len;
+    }
+    else if (c == DSLOG_COMPACT_LITERAL) {
+      if (get_name(in, literal, &varlen)) break;
+      varname = literal;
+    }
+    else goto done;
+
+    if (get_varint(in, &delta) || get_u32(in, &flags) ||
+	get_u32(in, &type) || get_u32(in, &len))
+      break;
+    if (len > DSERV_MAX_DATA_LEN) goto done;
+    if (len > data_size) {
+      unsigned char *nd = (unsigned char *) realloc(data, len);
+      if (!nd) { rc = DSLOG_ERR_NOMEM; goto done; }
+      data = nd;
+      data_size = len;
+    }
+    if (len && fread(data, 1, len, in) != len) break;
+    timestamp += (uint64_t) dslog_unzigzag(delta);
+
+    rc = DSLOG_ERR_OPEN;
+    if (fwrite(&varlen, sizeof(varlen), 1, out) != 1 ||
+	fwrite(varname, 1, varlen, out) != varlen ||
+	fwrite(&timestamp, sizeof(timestamp), 1, out) != 1 ||
+	fwrite(&flags, sizeof(flags), 1, out) != 1 ||
+	fwrite(&type, sizeof(type), 1, out) != 1 ||
+	fwrite(&len, sizeof(len), 1, out) != 1 ||
+	(len && fwrite(data, 1, len, out) != len))
+      goto done;
+    nrecords++;
+  }
+  rc = nrecords;
+
+ done:
+  if (out && fclose(out) && rc >= 0) rc = DSLOG_ERR_OPEN;
+  fclose(in);
+  if (names) {
+    for (int i = 0; i < DSLOG_COMPACT_MAX_IDS; i++) free(names[i].name);
+    free(names);
+  }
+  free(data);
+  return rc;
+}
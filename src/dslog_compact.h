@@ -0,0 +1,75 @@
+#ifndef DSLOG_COMPACT_H_
+#define DSLOG_COMPACT_H_
+
+#include <stdint.h>
+
+/*
+ * dslog_compact - the compact (version 5) dserv log encoding
+ *
+ * Same 16 byte header as every .ds file, with version 5.  A v3 record
+ * spends 22 bytes plus the whole varname on every point, which for a
+ * 1 kHz ain/vals with an 8 byte payload is most of the file.  Here each
+ * record starts with a tag byte:
+ *
+ *   DSLOG_COMPACT_DEF      u16 id, u16 varlen, varname
+ *                          (id stands for varname from here on; no point)
+ *   DSLOG_COMPACT_POINT    u16 id, then the point fields below
+ *   DSLOG_COMPACT_LITERAL  u16 varlen, varname, then the point fields
+ *                          (only once all 65536 ids are taken)
+ *
+ * followed by
+ *
+ *   varint zigzag(timestamp - previous record's timestamp)
+ *   varint flags, varint type, varint len, data
+ *
+ * Varints are LEB128 (7 bits a byte, low first).  The first timestamp
+ * is relative to 0.  Decoding is strictly sequential; dslog_expand()
+ * rewrites a compact log as a plain version 3 log.
+ */
+
+#define DSLOG_VERSION_COMPACT   5
+
+#define DSLOG_COMPACT_DEF       0x01
+#define DSLOG_COMPACT_POINT     0x02
+#define DSLOG_COMPACT_LITERAL   0x03
+
+#define DSLOG_COMPACT_MAX_IDS   65536
+
+/* largest point header: tag, id, 10 byte delta, 3 x 5 byte u32 */
+#define DSLOG_COMPACT_MAX_HEAD  (1 + 2 + 10 + 3*5)
+
+static inline unsigned char *dslog_put_varint(unsigned char *p, uint64_t v)
+{
+  while (v >= 0x80) {
+    *p++ = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (unsigned char) v;
+  return p;
+}
+
+static inline uint64_t dslog_zigzag(int64_t v)
+{
+  return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t dslog_unzigzag(uint64_t v)
+{
+  return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * expand compact log in_path to a version 3 log at out_path; returns
+   * the number of records written or a DSLOG_ERR_* (dslog_index.h)
+   */
+  int64_t dslog_expand(const char *in_path, const char *out_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DSLOG_COMPACT_H_ */
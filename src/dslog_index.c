@@ -0,0 +1,758 @@
+/*
+ * dslog_index.c - seekable reader for dserv log files (see dslog_index.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "uthash.h"
+#include "Datapoint.h"
+#include "dslog_index.h"
+#include "dslog_compact.h"
+#include "dslog_block.h"
+
+#define WINDOW_SIZE (1024*1024)
+
+typedef struct dslog_var_s {
+  char *name;
+  int id;
+  int n, max;
+  uint64_t *offsets;
+  UT_hash_handle hh;
+} dslog_var_t;
+
+/* a compressed log's block: where it is and what part of the stream */
+typedef struct dslog_block_s {
+  uint64_t file_off;		/* of its header */
+  uint64_t raw_off;		/* stream offset of its first record */
+  uint64_t raw_len;		/* 0 until known */
+} dslog_block_t;
+
+struct dslog_file_s {
+  int fd;
+  uint64_t size;		/* of the record stream */
+  int version;
+  uint64_t start_time;
+  int indexed;
+  int bad_trailer;
+  int damaged;
+
+  dslog_var_t *byname;		/* hash on name */
+  dslog_var_t **vars;		/* by id, in order of first appearance */
+  int nvars, maxvars;
+
+  uint64_t *obs;		/* begin/end pairs */
+  int nobs, maxobs;
+
+  /* read window: scans and nearby seeks are served from here */
+  unsigned char *win;
+  uint64_t win_off;
+  size_t win_len;
+
+  /* the current record's varname and data */
+  unsigned char *rbuf;
+  size_t rbuf_size;
+
+  /* compressed logs: the stream is read a block at a time, the block
+     last inflated kept in blk (so it plays the read window's part) */
+  int compressed;
+  uint64_t file_size;
+  dslog_block_t *blocks;
+  int nblocks, maxblocks;
+  int blk_cur;
+  unsigned char *blk, *comp;
+  size_t blk_size, comp_size;
+};
+
+static int grow(void **p, int *max, int need, size_t elsize)
+{
+  if (need <= *max) return 0;
+  int newmax = *max ? *max : 16;
+  while (newmax < need) newmax *= 2;
+  void *np = realloc(*p, newmax * elsize);
+  if (!np) return -1;
+  *p = np;
+  *max = newmax;
+  return 0;
+}
+
+static int pread_all(int fd, void *dst, size_t n, uint64_t off)
+{
+  size_t got = 0;
+  while (got < n) {
+    ssize_t r = pread(fd, (char *) dst + got, n - got, off + got);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return -1;
+    got += r;
+  }
+  return 0;
+}
+
+static int reserve(unsigned char **buf, size_t *size, size_t n)
+{
+  if (n <= *size) return 0;
+  unsigned char *nb = (unsigned char *) realloc(*buf, n);
+  if (!nb) return -1;
+  *buf = nb;
+  *size = n;
+  return 0;
+}
+
+/*
+ * read the block header at file offset off: its stream and compressed
+ * lengths and crc; -1 if there is no sound one there
+ */
+static int block_header(dslog_file_t *f, uint64_t off, uint32_t *raw_len,
+			uint32_t *comp_len, uint32_t *crc)
+{
+  unsigned char h[DSLOG_BLOCK_HEADER];
+  if (off + sizeof(h) > f->file_size || pread_all(f->fd, h, sizeof(h), off) ||
+      memcmp(h, DSLOG_BLOCK_MAGIC, DSLOG_BLOCK_MAGIC_LEN))
+    return -1;
+  memcpy(raw_len, &h[4], sizeof(uint32_t));
+  memcpy(comp_len, &h[8], sizeof(uint32_t));
+  memcpy(crc, &h[12], sizeof(uint32_t));
+  if (*raw_len > DSLOG_BLOCK_MAX || *comp_len > DSLOG_BLOCK_MAX ||
+      off + sizeof(h) + *comp_len > f->file_size)
+    return -1;
+  return 0;
+}
+
+/* inflate block b into f->blk, unless it is there already */
+static int load_block(dslog_file_t *f, int b)
+{
+  uint32_t raw_len, comp_len, crc;
+  uLongf got;
+
+  if (b == f->blk_cur) return 0;
+  f->blk_cur = -1;
+  if (block_header(f, f->blocks[b].file_off, &raw_len, &comp_len, &crc) ||
+      reserve(&f->comp, &f->comp_size, comp_len ? comp_len : 1) ||
+      reserve(&f->blk, &f->blk_size, raw_len ? raw_len : 1) ||
+      pread_all(f->fd, f->comp, comp_len,
+		f->blocks[b].file_off + DSLOG_BLOCK_HEADER) ||
+      crc32(0L, f->comp, comp_len) != crc)
+    return DSLOG_ERR_READ;
+  got = raw_len;
+  if (uncompress(f->blk, &got, f->comp, comp_len) != Z_OK || got != raw_len)
+    return DSLOG_ERR_READ;
+  f->blocks[b].raw_len = raw_len;
+  f->blk_cur = b;
+  return 0;
+}
+
+/* the block holding stream offset off (the last one starting at or
+   before it), or -1 */
+static int find_block(dslog_file_t *f, uint64_t off)
+{
+  int lo = 0, hi = f->nblocks - 1, found = -1;
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (f->blocks[mid].raw_off <= off) { found = mid; lo = mid + 1; }
+    else hi = mid - 1;
+  }
+  return found;
+}
+
+/* read_bytes for a compressed log: the header is as it is in the file,
+   the rest comes out of the blocks */
+static int read_stream(dslog_file_t *f, uint64_t off, size_t n, void *dst)
+{
+  unsigned char *d = (unsigned char *) dst;
+
+  while (n) {
+    size_t k;
+    if (off < DSLOG_HEADER_SIZE) {
+      k = DSLOG_HEADER_SIZE - off;
+      if (k > n) k = n;
+      if (pread_all(f->fd, d, k, off)) return DSLOG_ERR_READ;
+    }
+    else {
+      int b = find_block(f, off);
+      if (b < 0 || load_block(f, b)) return DSLOG_ERR_READ;
+      uint64_t in = off - f->blocks[b].raw_off;
+      if (in >= f->blocks[b].raw_len) return DSLOG_ERR_READ;
+      k = f->blocks[b].raw_len - in;
+      if (k > n) k = n;
+      memcpy(d, f->blk + in, k);
+    }
+    d += k;
+    off += k;
+    n -= k;
+  }
+  return 0;
+}
+
+/*
+ * read n bytes at off into dst, through the window unless the read is
+ * bigger than it; returns 0 or DSLOG_ERR_READ
+ */
+static int read_bytes(dslog_file_t *f, uint64_t off, size_t n, void *dst)
+{
+  if (off + n > f->size) return DSLOG_ERR_READ;
+  if (f->compressed) return read_stream(f, off, n, dst);
+
+  if (n > WINDOW_SIZE / 2) {
+    size_t got = 0;
+    while (got < n) {
+      ssize_t r = pread(f->fd, (char *) dst + got, n - got, off + got);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) return DSLOG_ERR_READ;
+      got += r;
+    }
+    return 0;
+  }
+
+  if (off < f->win_off || off + n > f->win_off + f->win_len) {
+    size_t want = WINDOW_SIZE;
+    if (off + want > f->size) want = f->size - off;
+    size_t got = 0;
+    while (got < want) {
+      ssize_t r = pread(f->fd, f->win + got, want - got, off + got);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) break;
+      got += r;
+    }
+    f->win_off = off;
+    f->win_len = got;
+    if (got < n) return DSLOG_ERR_READ;
+  }
+  memcpy(dst, f->win + (off - f->win_off), n);
+  return 0;
+}
+
+/*
+ * read_record
+ *
+ *  Parse the record at off into rec (varname and data live in f->rbuf
+ * until the next call).  Returns the record's total size, or
+ * DSLOG_ERR_READ if it runs past EOF or its lengths are impossible.
+ */
+static int64_t read_record(dslog_file_t *f, uint64_t off, dslog_record_t *rec)
+{
+  uint16_t varlen;
+  unsigned char fixed[8+4+4+4];
+  uint32_t len;
+
+  if (read_bytes(f, off, sizeof(varlen), &varlen)) return DSLOG_ERR_READ;
+  if (!varlen || varlen > DSERV_MAX_VARNAME_LEN) return DSLOG_ERR_READ;
+  if (read_bytes(f, off + 2 + varlen, sizeof(fixed), fixed))
+    return DSLOG_ERR_READ;
+  memcpy(&len, &fixed[16], sizeof(len));
+  if (len > DSERV_MAX_DATA_LEN) return DSLOG_ERR_READ;
+
+  uint64_t total = DSLOG_RECORD_HEADER(varlen) + (uint64_t) len;
+  if (off + total > f->size) return DSLOG_ERR_READ;
+
+  size_t need = varlen + 1 + len;
+  if (need > f->rbuf_size) {
+    unsigned char *nb = (unsigned char *) realloc(f->rbuf, need);
+    if (!nb) return DSLOG_ERR_READ;
+    f->rbuf = nb;
+    f->rbuf_size = need;
+  }
+  if (read_bytes(f, off + 2, varlen, f->rbuf)) return DSLOG_ERR_READ;
+  f->rbuf[varlen] = '\0';
+  if (len && read_bytes(f, off + DSLOG_RECORD_HEADER(varlen), len,
+			f->rbuf + varlen + 1))
+    return DSLOG_ERR_READ;
+
+  rec->offset = off;
+  rec->varname = (const char *) f->rbuf;
+  rec->varlen = varlen;
+  memcpy(&rec->timestamp, &fixed[0], sizeof(uint64_t));
+  memcpy(&rec->flags, &fixed[8], sizeof(uint32_t));
+  memcpy(&rec->type, &fixed[12], sizeof(uint32_t));
+  rec->len = len;
+  rec->data = f->rbuf + varlen + 1;
+  return (int64_t) total;
+}
+
+static int is_internal(const dslog_record_t *rec)
+{
+  return (!strcmp(rec->varname, DSLOG_SYNC_VARNAME) ||
+	  !strcmp(rec->varname, DSLOG_INDEX_VARNAME));
+}
+
+static dslog_var_t *add_var(dslog_file_t *f, const char *name, size_t len)
+{
+  dslog_var_t *v;
+  HASH_FIND(hh, f->byname, name, len, v);
+  if (v) return v;
+
+  if (grow((void **) &f->vars, &f->maxvars, f->nvars + 1,
+	   sizeof(dslog_var_t *)))
+    return NULL;
+  v = (dslog_var_t *) calloc(1, sizeof *v);
+  if (!v) return NULL;
+  v->name = (char *) malloc(len + 1);
+  if (!v->name) { free(v); return NULL; }
+  memcpy(v->name, name, len);
+  v->name[len] = '\0';
+  v->id = f->nvars;
+  f->vars[f->nvars++] = v;
+  HASH_ADD_KEYPTR(hh, f->byname, v->name, len, v);
+  return v;
+}
+
+static int add_offset(dslog_var_t *v, uint64_t off)
+{
+  if (grow((void **) &v->offsets, &v->max, v->n + 1, sizeof(uint64_t)))
+    return DSLOG_ERR_NOMEM;
+  v->offsets[v->n++] = off;
+  return 0;
+}
+
+static int add_obs(dslog_file_t *f, uint64_t begin, uint64_t end)
+{
+  if (grow((void **) &f->obs, &f->maxobs, 2 * (f->nobs + 1),
+	   sizeof(uint64_t)))
+    return DSLOG_ERR_NOMEM;
+  f->obs[2*f->nobs] = begin;
+  f->obs[2*f->nobs+1] = end;
+  f->nobs++;
+  return 0;
+}
+
+/*
+ * after a bad record, find the next sync record at or after off: look
+ * for its magic and check that a sync record really starts where one
+ * would have to.  Returns its offset, or 0 if there is none.
+ */
+static uint64_t resync(dslog_file_t *f, uint64_t off)
+{
+  const uint64_t lead = DSLOG_RECORD_HEADER(sizeof(DSLOG_SYNC_VARNAME) - 1);
+  unsigned char chunk[64*1024];
+  dslog_record_t rec;
+
+  for (uint64_t pos = off + lead; pos + DSLOG_MAGIC_LEN <= f->size; ) {
+    size_t n = sizeof(chunk);
+    if (pos + n > f->size) n = f->size - pos;
+    if (read_bytes(f, pos, n, chunk)) return 0;
+
+    for (size_t i = 0; i + DSLOG_MAGIC_LEN <= n; i++) {
+      if (chunk[i] != DSLOG_SYNC_MAGIC[0] ||
+	  memcmp(&chunk[i], DSLOG_SYNC_MAGIC, DSLOG_MAGIC_LEN)) continue;
+      uint64_t start = pos + i - lead;
+      if (read_record(f, start, &rec) > 0 &&
+	  !strcmp(rec.varname, DSLOG_SYNC_VARNAME))
+	return start;
+    }
+    if (n < DSLOG_MAGIC_LEN) break;
+    pos += n - (DSLOG_MAGIC_LEN - 1);
+  }
+  return 0;
+}
+
+/* no trailer: index the file the slow way, one pass over every record */
+static int scan(dslog_file_t *f)
+{
+  dslog_record_t rec;
+  uint64_t off = DSLOG_HEADER_SIZE;
+
+  while (off < f->size) {
+    int64_t n = read_record(f, off, &rec);
+    if (n < 0) {
+      uint64_t next = resync(f, off);
+      if (!next) break;		/* a torn last record, most likely */
+      f->damaged++;
+      off = next;
+      continue;
+    }
+
+    if (!is_internal(&rec)) {
+      dslog_var_t *v = add_var(f, rec.varname, rec.varlen);
+      if (!v || add_offset(v, off)) return DSLOG_ERR_NOMEM;
+
+      if (!strcmp(rec.varname, DSLOG_BEGINOBS_VARNAME)) {
+	if (add_obs(f, off, 0)) return DSLOG_ERR_NOMEM;
+      }
+      else if (!strcmp(rec.varname, DSLOG_ENDOBS_VARNAME)) {
+	if (f->nobs && !f->obs[2*f->nobs-1]) f->obs[2*f->nobs-1] = off;
+      }
+    }
+    off += n;
+  }
+  return DSLOG_OK;
+}
+
+/* pull fields out of the index payload, failing on any overrun */
+typedef struct {
+  const unsigned char *p, *end;
+} cursor_t;
+
+static int take(cursor_t *c, void *dst, size_t n)
+{
+  if ((size_t) (c->end - c->p) < n) return -1;
+  memcpy(dst, c->p, n);
+  c->p += n;
+  return 0;
+}
+
+static int parse_index(dslog_file_t *f, cursor_t *c)
+{
+  uint32_t count, i, j;
+
+  if (take(c, &count, sizeof(count))) return -1;
+  for (i = 0; i < count; i++) {
+    uint16_t namelen;
+    uint32_t noffsets;
+    const char *name;
+    if (take(c, &namelen, sizeof(namelen))) return -1;
+    name = (const char *) c->p;
+    if ((size_t) (c->end - c->p) < namelen) return -1;
+    c->p += namelen;
+    dslog_var_t *v = add_var(f, name, namelen);
+    if (!v) return -1;
+    if (take(c, &noffsets, sizeof(noffsets))) return -1;
+    if ((size_t) (c->end - c->p) / sizeof(uint64_t) < noffsets) return -1;
+    if (grow((void **) &v->offsets, &v->max, v->n + noffsets,
+	     sizeof(uint64_t)))
+      return -1;
+    memcpy(&v->offsets[v->n], c->p, noffsets * sizeof(uint64_t));
+    v->n += noffsets;
+    c->p += noffsets * sizeof(uint64_t);
+  }
+
+  if (take(c, &count, sizeof(count))) return -1;
+  for (j = 0; j < count; j++) {
+    uint64_t begin, end;
+    if (take(c, &begin, sizeof(begin)) || take(c, &end, sizeof(end)))
+      return -1;
+    if (add_obs(f, begin, end)) return -1;
+  }
+  /* sync offsets and the self offset follow; the reader doesn't need
+     them once it has the index */
+  return 0;
+}
+
+/*
+ * load_trailer
+ *
+ *  Read the index from the logger:index records that end the file.
+ * Returns 0 if it was read, 1 if the file has no trailer (a log that
+ * was never closed), and -1 if it claims one that can't be read.
+ */
+static int load_trailer(dslog_file_t *f)
+{
+  unsigned char tail[8 + DSLOG_MAGIC_LEN];
+  uint64_t idx_off, off;
+  dslog_record_t rec;
+  unsigned char *blob = NULL;
+  size_t blob_len = 0;
+  cursor_t c;
+  int rc = -1;
+
+  if (f->size < DSLOG_HEADER_SIZE + sizeof(tail)) return 1;
+  if (read_bytes(f, f->size - sizeof(tail), sizeof(tail), tail)) return 1;
+  if (memcmp(&tail[8], DSLOG_INDEX_MAGIC, DSLOG_MAGIC_LEN)) return 1;
+  memcpy(&idx_off, tail, sizeof(idx_off));
+  if (idx_off < DSLOG_HEADER_SIZE || idx_off >= f->size) return -1;
+
+  /* the index runs over one or more records, to the end of the file */
+  for (off = idx_off; off < f->size; ) {
+    int64_t n = read_record(f, off, &rec);
+    if (n < 0 || strcmp(rec.varname, DSLOG_INDEX_VARNAME)) goto done;
+    unsigned char *nb = (unsigned char *) realloc(blob, blob_len + rec.len);
+    if (!nb) goto done;
+    blob = nb;
+    memcpy(blob + blob_len, rec.data, rec.len);
+    blob_len += rec.len;
+    off += n;
+  }
+  if (off != f->size) goto done;
+
+  c.p = blob;
+  c.end = blob + blob_len;
+  rc = parse_index(f, &c);
+
+ done:
+  free(blob);
+  return rc;
+}
+
+static int add_block(dslog_file_t *f, uint64_t file_off, uint64_t raw_off,
+		     uint64_t raw_len)
+{
+  if (grow((void **) &f->blocks, &f->maxblocks, f->nblocks + 1,
+	   sizeof(dslog_block_t)))
+    return DSLOG_ERR_NOMEM;
+  f->blocks[f->nblocks].file_off = file_off;
+  f->blocks[f->nblocks].raw_off = raw_off;
+  f->blocks[f->nblocks].raw_len = raw_len;
+  f->nblocks++;
+  return 0;
+}
+
+/*
+ * map_blocks
+ *
+ *  Find a compressed log's blocks and so the length of its stream:
+ * from the block index if it was closed cleanly, else by walking the
+ * block headers up to the first that isn't whole (a torn end).
+ */
+static int map_blocks(dslog_file_t *f)
+{
+  unsigned char tail[8 + DSLOG_MAGIC_LEN];
+  unsigned char head[DSLOG_BLOCK_MAGIC_LEN + sizeof(uint32_t)];
+  uint64_t idx_off, stream_len;
+  uint32_t count, i, raw_len, comp_len, crc;
+
+  f->nblocks = 0;
+  if (f->file_size >= DSLOG_HEADER_SIZE + sizeof(tail) + sizeof(head) &&
+      !pread_all(f->fd, tail, sizeof(tail), f->file_size - sizeof(tail)) &&
+      !memcmp(&tail[8], DSLOG_BLOCKIDX_TAIL, DSLOG_MAGIC_LEN)) {
+    memcpy(&idx_off, tail, sizeof(idx_off));
+    if (idx_off >= DSLOG_HEADER_SIZE &&
+	idx_off + sizeof(head) <= f->file_size &&
+	!pread_all(f->fd, head, sizeof(head), idx_off) &&
+	!memcmp(head, DSLOG_BLOCKIDX_MAGIC, DSLOG_BLOCK_MAGIC_LEN)) {
+      memcpy(&count, &head[DSLOG_BLOCK_MAGIC_LEN], sizeof(count));
+      uint64_t len = sizeof(head) + (uint64_t) count * DSLOG_BLOCKIDX_ENTRY +
+	sizeof(stream_len) + sizeof(tail);
+      unsigned char *entries = NULL;
+      if (idx_off + len == f->file_size &&
+	  (entries = (unsigned char *) malloc(len - sizeof(head))) &&
+	  !pread_all(f->fd, entries, len - sizeof(head),
+		     idx_off + sizeof(head))) {
+	int rc = 0;
+	for (i = 0; i < count && !rc; i++) {
+	  uint64_t e[3];
+	  memcpy(e, entries + i * DSLOG_BLOCKIDX_ENTRY, sizeof(e));
+	  if (i && e[1] < f->blocks[i-1].raw_off) rc = -1;
+	  else rc = add_block(f, e[0], e[1], 0);
+	}
+	memcpy(&stream_len, entries + count * DSLOG_BLOCKIDX_ENTRY,
+	       sizeof(stream_len));
+	free(entries);
+	if (!rc) {
+	  f->size = stream_len;
+	  return 0;
+	}
+      }
+      else free(entries);
+    }
+    f->bad_trailer = 1;		/* claimed, but unreadable: walk instead */
+    f->nblocks = 0;
+  }
+
+  uint64_t pos = DSLOG_HEADER_SIZE, raw = DSLOG_HEADER_SIZE;
+  while (pos < f->file_size &&
+	 !block_header(f, pos, &raw_len, &comp_len, &crc)) {
+    if (add_block(f, pos, raw, raw_len)) return DSLOG_ERR_NOMEM;
+    pos += DSLOG_BLOCK_HEADER + comp_len;
+    raw += raw_len;
+  }
+  if (pos < f->file_size && !f->bad_trailer) {
+    /* stopped short of the end: torn, unless it is the block index */
+    if (f->file_size - pos < DSLOG_BLOCK_MAGIC_LEN ||
+	pread_all(f->fd, head, DSLOG_BLOCK_MAGIC_LEN, pos) ||
+	memcmp(head, DSLOG_BLOCKIDX_MAGIC, DSLOG_BLOCK_MAGIC_LEN))
+      f->damaged++;
+  }
+  f->size = raw;
+  return 0;
+}
+
+static void free_index(dslog_file_t *f)
+{
+  dslog_var_t *v, *tmp;
+  HASH_ITER(hh, f->byname, v, tmp) {
+    HASH_DEL(f->byname, v);
+    free(v->offsets);
+    free(v->name);
+    free(v);
+  }
+  free(f->vars);
+  f->vars = NULL;
+  f->nvars = f->maxvars = 0;
+  free(f->obs);
+  f->obs = NULL;
+  f->nobs = f->maxobs = 0;
+}
+
+dslog_file_t *dslog_open(const char *path, int *err)
+{
+  unsigned char header[DSLOG_HEADER_SIZE];
+  struct stat st;
+  int rc = DSLOG_ERR_NOMEM;
+  int trailer = 1;
+
+  dslog_file_t *f = (dslog_file_t *) calloc(1, sizeof *f);
+  if (!f) goto fail;
+  f->fd = -1;
+  f->win = (unsigned char *) malloc(WINDOW_SIZE);
+  if (!f->win) goto fail;
+
+  f->fd = open(path, O_RDONLY);
+  if (f->fd < 0 || fstat(f->fd, &st) < 0) {
+    rc = DSLOG_ERR_OPEN;
+    goto fail;
+  }
+  f->size = st.st_size;
+
+  rc = DSLOG_ERR_FORMAT;
+  if (read_bytes(f, 0, sizeof(header), header) ||
+      memcmp(header, "dslog", 5))
+    goto fail;
+  f->version = header[5];
+  memcpy(&f->start_time, &header[8], sizeof(uint64_t));
+
+  /* a compressed log is read through its blocks, as the stream it
+     holds; compact logs can only be decoded in order: dslog_expand()
+     them (after dslog_inflate() if need be) */
+  if (f->version & DSLOG_FLAG_COMPRESSED) {
+    if (header[6] != DSLOG_CODEC_ZLIB) goto fail;
+    f->version &= ~DSLOG_FLAG_COMPRESSED;
+    f->compressed = 1;
+    f->file_size = f->size;
+    f->blk_cur = -1;
+    if ((rc = map_blocks(f)) != DSLOG_OK) goto fail;
+    rc = DSLOG_ERR_FORMAT;
+  }
+  if (f->version == DSLOG_VERSION_COMPACT)
+    goto fail;
+
+  if (f->version >= DSLOG_VERSION_INDEXED &&
+      (trailer = load_trailer(f)) == 0) {
+    f->indexed = 1;
+  }
+  else {
+    /* still readable, the slow way, but say the trailer was bad */
+    if (trailer < 0) f->bad_trailer = 1;
+    if (f->compressed) f->blk_cur = -1;
+    free_index(f);		/* a partly parsed trailer */
+    if ((rc = scan(f)) != DSLOG_OK) goto fail;
+  }
+
+  if (err) *err = DSLOG_OK;
+  return f;
+
+ fail:
+  if (err) *err = rc;
+  dslog_close(f);
+  return NULL;
+}
+
+void dslog_close(dslog_file_t *f)
+{
+  if (!f) return;
+  if (f->fd >= 0) close(f->fd);
+  free_index(f);
+  free(f->win);
+  free(f->rbuf);
+  free(f->blocks);
+  free(f->blk);
+  free(f->comp);
+  free(f);
+}
+
+int dslog_version(dslog_file_t *f) { return f->version; }
+uint64_t dslog_start_time(dslog_file_t *f) { return f->start_time; }
+int dslog_indexed(dslog_file_t *f) { return f->indexed; }
+int dslog_bad_trailer(dslog_file_t *f) { return f->bad_trailer; }
+int dslog_compressed(dslog_file_t *f) { return f->compressed; }
+int dslog_damaged(dslog_file_t *f) { return f->damaged; }
+int dslog_nvars(dslog_file_t *f) { return f->nvars; }
+int dslog_nobs(dslog_file_t *f) { return f->nobs; }
+
+const char *dslog_varname(dslog_file_t *f, int var)
+{
+  if (var < 0 || var >= f->nvars) return NULL;
+  return f->vars[var]->name;
+}
+
+int dslog_var_find(dslog_file_t *f, const char *varname)
+{
+  dslog_var_t *v;
+  HASH_FIND_STR(f->byname, varname, v);
+  return v ? v->id : DSLOG_ERR_RANGE;
+}
+
+int dslog_var_count(dslog_file_t *f, int var)
+{
+  if (var < 0 || var >= f->nvars) return DSLOG_ERR_RANGE;
+  return f->vars[var]->n;
+}
+
+int dslog_obs_range(dslog_file_t *f, int obs, uint64_t *begin, uint64_t *end)
+{
+  if (obs < 0 || obs >= f->nobs) return DSLOG_ERR_RANGE;
+  if (begin) *begin = f->obs[2*obs];
+  if (end) *end = f->obs[2*obs+1];
+  return DSLOG_OK;
+}
+
+/*
+ * dslog_read_var
+ *
+ *  Call func for every record of one variable, in file order, reading
+ * only those records.
+ */
+int dslog_read_var(dslog_file_t *f, int var,
+		   DSLOG_RECORD_FUNC func, void *clientdata)
+{
+  dslog_record_t rec;
+  if (var < 0 || var >= f->nvars) return DSLOG_ERR_RANGE;
+
+  dslog_var_t *v = f->vars[var];
+  for (int i = 0; i < v->n; i++) {
+    if (read_record(f, v->offsets[i], &rec) < 0) return DSLOG_ERR_READ;
+    if (func(&rec, clientdata)) break;
+  }
+  return DSLOG_OK;
+}
+
+/*
+ * dslog_read_range
+ *
+ *  Call func for every record starting in [begin, end] (end of 0: to
+ * the end of the file), skipping sync and index records.
+ */
+int dslog_read_range(dslog_file_t *f, uint64_t begin, uint64_t end,
+		     DSLOG_RECORD_FUNC func, void *clientdata)
+{
+  dslog_record_t rec;
+  uint64_t off = begin;
+  if (!end) end = f->size;
+
+  while (off < f->size && off <= end) {
+    int64_t n = read_record(f, off, &rec);
+    if (n < 0) {
+      uint64_t next = resync(f, off);
+      if (!next) return DSLOG_ERR_READ;
+      off = next;
+      continue;
+    }
+    if (!is_internal(&rec) && func(&rec, clientdata)) break;
+    off += n;
+  }
+  return DSLOG_OK;
+}
+
+/*
+ * dslog_read_obs
+ *
+ *  Every record from an obs period's logger:beginobs to its
+ * logger:endobs, both included.  An obs that never ended runs to the
+ * next beginobs (or the end of the file).
+ */
+int dslog_read_obs(dslog_file_t *f, int obs,
+		   DSLOG_RECORD_FUNC func, void *clientdata)
+{
+  uint64_t begin, end;
+  if (obs < 0 || obs >= f->nobs) return DSLOG_ERR_RANGE;
+
+  begin = f->obs[2*obs];
+  end = f->obs[2*obs+1];
+  if (!end && obs + 1 < f->nobs) end = f->obs[2*(obs+1)] - 1;
+  return dslog_read_range(f, begin, end, func, clientdata);
+}
@@ -0,0 +1,127 @@
+#ifndef DSLOG_INDEX_H_
+#define DSLOG_INDEX_H_
+
+#include <stdint.h>
+
+/*
+ * dslog_index - seekable access to dserv log (.ds) files
+ *
+ * A log file is a 16 byte header ("dslog", version byte at [5],
+ * creation timestamp at [8]) followed by records:
+ *
+ *   varlen(u16) varname timestamp(u64) flags(u32) type(u32) len(u32) data
+ *
+ * Version 4 keeps that record stream unchanged and adds two kinds of
+ * records the writer makes itself:
+ *
+ *   logger:sync   every DSLOG_SYNC_INTERVAL bytes; payload is
+ *                 DSLOG_SYNC_MAGIC and the number of records before it,
+ *                 so a reader that hits damage can search forward for
+ *                 the magic and carry on from the next sync record
+ *
+ *   logger:index  the last records, written on close; their payloads,
+ *                 joined, are
+ *                   u32 nvars, then per variable:
+ *                     u16 namelen, name, u32 n, u64 offset[n]
+ *                   u32 nobs, then per obs: u64 begin, u64 end
+ *                   u32 nsync, then u64 offset[nsync]
+ *                   u64 offset of the first index record,
+ *                   DSLOG_INDEX_MAGIC
+ *                 so the file's last 16 bytes (never split between
+ *                 records) locate the index.  Each
+ *                 record carries at most DSLOG_INDEX_CHUNK bytes of it
+ *                 (8 per logged record, so a long log needs several:
+ *                 one record can't exceed DSERV_MAX_DATA_LEN)
+ *
+ * Offsets are of the start of a record.  An obs runs from its
+ * logger:beginobs record to its logger:endobs record (end is 0 if the
+ * log closed mid-obs).  The index doesn't list sync/index records.
+ *
+ * The reader takes any version.  Without a trailer (version 3, or a
+ * version 4 log that was never closed) dslog_open() builds the same
+ * index with one scan, so everything below works on every file; only
+ * indexed files avoid reading the whole thing.  A trailer that is
+ * there but can't be read is scanned past the same way, and
+ * dslog_bad_trailer() says so.
+ *
+ * A compressed log (dslog_block.h) is read as the stream its blocks
+ * hold, offsets and all, inflating only the blocks a read touches; its
+ * block index says where they are.  Compact (version 5) logs are the
+ * exception: expand them (dslog_compact.h) first.
+ */
+
+#define DSLOG_HEADER_SIZE      16
+#define DSLOG_VERSION_INDEXED  4
+#define DSLOG_SYNC_VARNAME     "logger:sync"
+#define DSLOG_INDEX_VARNAME    "logger:index"
+#define DSLOG_BEGINOBS_VARNAME "logger:beginobs"
+#define DSLOG_ENDOBS_VARNAME   "logger:endobs"
+#define DSLOG_SYNC_MAGIC       "DSLGSYNC"
+#define DSLOG_INDEX_MAGIC      "DSLGIDX4"
+#define DSLOG_MAGIC_LEN        8
+#define DSLOG_SYNC_INTERVAL    (1024*1024)
+#define DSLOG_INDEX_CHUNK      (16*1024*1024)
+
+/* bytes before the data in a record with a varname of varlen bytes */
+#define DSLOG_RECORD_HEADER(varlen) (2 + (varlen) + 8 + 4 + 4 + 4)
+
+enum {
+  DSLOG_OK = 0,
+  DSLOG_ERR_OPEN = -1,		/* can't open/read the file */
+  DSLOG_ERR_FORMAT = -2,	/* not a dslog file */
+  DSLOG_ERR_RANGE = -3,		/* no such variable/obs */
+  DSLOG_ERR_READ = -4,		/* record beyond EOF or malformed */
+  DSLOG_ERR_NOMEM = -5
+};
+
+typedef struct dslog_record_s {
+  uint64_t offset;		/* of the record in the file */
+  const char *varname;		/* NUL terminated */
+  uint16_t varlen;
+  uint64_t timestamp;
+  uint32_t flags;
+  uint32_t type;		/* ds_datatype_t (or event info) */
+  uint32_t len;
+  const unsigned char *data;	/* valid only during the callback */
+} dslog_record_t;
+
+/* return nonzero to stop */
+typedef int (*DSLOG_RECORD_FUNC)(const dslog_record_t *rec, void *clientdata);
+
+typedef struct dslog_file_s dslog_file_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  dslog_file_t *dslog_open(const char *path, int *err);
+  void dslog_close(dslog_file_t *f);
+
+  int dslog_version(dslog_file_t *f);
+  uint64_t dslog_start_time(dslog_file_t *f);
+  int dslog_indexed(dslog_file_t *f);	/* 1 if read from a trailer */
+  int dslog_bad_trailer(dslog_file_t *f); /* 1 if it had to be scanned */
+  int dslog_compressed(dslog_file_t *f);	/* 1 if read through blocks */
+  int dslog_damaged(dslog_file_t *f);	/* records skipped by resync */
+
+  int dslog_nvars(dslog_file_t *f);
+  const char *dslog_varname(dslog_file_t *f, int var);
+  int dslog_var_find(dslog_file_t *f, const char *varname);
+  int dslog_var_count(dslog_file_t *f, int var);
+
+  int dslog_nobs(dslog_file_t *f);
+  int dslog_obs_range(dslog_file_t *f, int obs,
+		      uint64_t *begin, uint64_t *end);
+
+  int dslog_read_var(dslog_file_t *f, int var,
+		     DSLOG_RECORD_FUNC func, void *clientdata);
+  int dslog_read_obs(dslog_file_t *f, int obs,
+		     DSLOG_RECORD_FUNC func, void *clientdata);
+  int dslog_read_range(dslog_file_t *f, uint64_t begin, uint64_t end,
+		       DSLOG_RECORD_FUNC func, void *clientdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DSLOG_INDEX_H_ */
@@ -0,0 +1,439 @@
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * MPSCRing
+ *
+ *  Multi-producer, SINGLE-consumer queue with the same interface as
+ * SharedQueue (front/pop_front/push_back/size) plus pop_all() for
+ * batched drains.  It exists for the per-datapoint fan-out paths
+ * (notify_queue, logger_queue, each client's dpoint_queue), where a
+ * SharedQueue push -- lock, deque node allocation, notify_one under the
+ * lock -- was paid several times for every set at kHz rates.
+ *
+ * The fast path is a bounded ring of sequence-numbered cells (Vyukov's
+ * bounded queue): a producer claims a slot with one CAS on tail_,
+ * writes the item, and publishes it by storing the cell's sequence.
+ * No allocation, no lock, and no syscall unless the consumer is asleep.
+ *
+ * Wakeups: the consumer only sleeps once it has found the queue empty,
+ * and it advertises that in sleeping_ before a final recheck.  A
+ * producer only wakes it if sleeping_ is set, so there is at most one
+ * futex wake (std::atomic::wait/notify, futex-backed on Linux, ulock on
+ * macOS) per empty -> non-empty transition, however many items follow.
+ * The seq_cst fences on both sides are the usual Dekker pairing: either
+ * the producer sees sleeping_ or the consumer's recheck sees the item.
+ *
+ * Full ring: producers never block.  Blocking would let one wedged
+ * consumer (a send client parked in a 5 s write) stall the thread that
+ * feeds every other client, which is exactly what these queues must
+ * not do.  Instead the item goes to a mutex-protected
+ * overflow deque and overflowing_ is set; while it is set every push
+ * takes the overflow path, so each producer's items stay in order.  The
+ * consumer only takes the overflow once the ring is completely empty
+ * (head == tail, so no claimed-but-unpublished slot can be older), then
+ * clears the flag.  In steady state the overflow is never touched.
+ *
+ * The overflow is bounded too (set_overflow_limit): past the limit an
+ * item is offered to discard, which frees it and says so, and is
+ * counted in dropped().  Items discard won't take -- end-of-stream and
+ * control markers -- are queued whatever the limit, so a consumer that
+ * does come back still sees them.  Without a discard nothing can be
+ * dropped and the overflow grows as before.
+ *
+ * Lifetime: as with SharedQueue, the consumer may free the queue right
+ * after popping an end-of-stream item.  inflight_ counts producers still
+ * inside push_back(); its decrement is a producer's last touch and the
+ * destructor waits for it to drain, so a late wake() can't land on
+ * freed memory.
+ */
+template <typename T>
+class MPSCRing
+{
+public:
+  explicit MPSCRing(size_t capacity = 4096);
+  ~MPSCRing();
+
+  MPSCRing(const MPSCRing &) = delete;
+  MPSCRing &operator=(const MPSCRing &) = delete;
+
+  T front();
+  void pop_front();
+  static const size_t DRAIN_MAX = 1024;
+  static const size_t OVERFLOW_LIMIT = 1 << 20;	/* a default for owners */
+  int pop_all(std::vector<T> &items, size_t max = DRAIN_MAX);
+  int try_pop_all(std::vector<T> &items, size_t max);
+
+  void push_back(const T& item);
+  void push_back(T&& item);
+  void push_batch(std::vector<T> &items);
+
+  int size();
+  uint64_t overflows() { return overflow_count_.load(std::memory_order_relaxed); }
+  uint64_t dropped() { return dropped_count_.load(std::memory_order_relaxed); }
+
+  void set_overflow_limit(size_t limit, std::function<bool(T&)> discard);
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  bool try_push(T &item);
+  size_t try_push_run(T *items, size_t n);
+  void overflow(T &item);
+  void push(T &item);
+  void wake();
+
+  T *try_peek();
+  T *peek();
+  void advance();
+  bool refill();
+
+  Cell *cells_;
+  size_t mask_;
+  size_t capacity_;
+
+  alignas(64) std::atomic<size_t> tail_;	/* next slot to claim */
+  alignas(64) std::atomic<size_t> head_;	/* consumer only writes */
+  alignas(64) std::atomic<uint32_t> sleeping_;
+  std::atomic<int> inflight_;
+
+  std::atomic<bool> overflowing_;
+  std::mutex overflow_mutex_;
+  std::deque<T> overflow_;
+  std::atomic<uint64_t> overflow_count_;
+  size_t overflow_limit_;
+  std::function<bool(T&)> discard_;
+  std::atomic<uint64_t> dropped_count_;
+
+  /* overflow items handed to the consumer, served before the ring */
+  std::deque<T> spill_;
+  std::atomic<int> spill_size_;
+};
+
+template <typename T>
+MPSCRing<T>::MPSCRing(size_t capacity):
+  tail_(0), head_(0), sleeping_(0), inflight_(0),
+  overflowing_(false), overflow_count_(0), overflow_limit_(SIZE_MAX),
+  dropped_count_(0), spill_size_(0)
+{
+  capacity_ = 2;
+  while (capacity_ < capacity) capacity_ <<= 1;
+  mask_ = capacity_ - 1;
+  cells_ = new Cell[capacity_];
+  for (size_t i = 0; i < capacity_; i++)
+    cells_[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template <typename T>
+MPSCRing<T>::~MPSCRing()
+{
+  while (inflight_.load(std::memory_order_acquire))
+    std::this_thread::yield();
+  delete[] cells_;
+}
+
+/*
+ * claim and fill one slot, moving from item only on success
+ */
+template <typename T>
+bool MPSCRing<T>::try_push(T &item)
+{
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  for (;;) {
+    Cell &cell = cells_[pos & mask_];
+    size_t seq = cell.seq.load(std::memory_order_acquire);
+    intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+    if (dif == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+				      std::memory_order_relaxed))
+	break;
+    }
+    else if (dif < 0) {
+      return false;		/* full */
+    }
+    else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+
+  Cell &cell = cells_[pos & mask_];
+  cell.data = std::move(item);
+  cell.seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+/*
+ * claim up to n consecutive free slots with one CAS and fill them from
+ * items; returns how many were taken (0: full)
+ */
+template <typename T>
+size_t MPSCRing<T>::try_push_run(T *items, size_t n)
+{
+  size_t pos, k;
+  do {
+    pos = tail_.load(std::memory_order_relaxed);
+    for (k = 0; k < n; k++) {
+      size_t seq = cells_[(pos + k) & mask_].seq.load(std::memory_order_acquire);
+      if (seq != pos + k) break;
+    }
+    if (!k) {
+      /* full, unless another producer just moved tail */
+      if (tail_.load(std::memory_order_relaxed) == pos) return 0;
+      continue;
+    }
+  } while (!tail_.compare_exchange_weak(pos, pos + k,
+					 std::memory_order_relaxed));
+
+  for (size_t i = 0; i < k; i++) {
+    Cell &cell = cells_[(pos + i) & mask_];
+    cell.data = std::move(items[i]);
+    cell.seq.store(pos + i + 1, std::memory_order_release);
+  }
+  return k;
+}
+
+template <typename T>
+void MPSCRing<T>::wake()
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed) &&
+      sleeping_.exchange(0)) {
+    sleeping_.notify_one();
+  }
+}
+
+/*
+ * Set up before the queue is in use.  discard runs on the producer's
+ * thread under the overflow lock, so it must be quick and must not
+ * push to this queue.
+ */
+template <typename T>
+void MPSCRing<T>::set_overflow_limit(size_t limit,
+				     std::function<bool(T&)> discard)
+{
+  std::lock_guard<std::mutex> mlock(overflow_mutex_);
+  overflow_limit_ = limit;
+  discard_ = discard;
+}
+
+/* call with overflow_mutex_ held: the ring is full (or overflowing) */
+template <typename T>
+void MPSCRing<T>::overflow(T &item)
+{
+  if (overflow_.size() >= overflow_limit_ && discard_ && discard_(item)) {
+    dropped_count_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  overflow_.push_back(std::move(item));
+  overflowing_.store(true, std::memory_order_release);
+  overflow_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+void MPSCRing<T>::push(T &item)
+{
+  inflight_.fetch_add(1);
+
+  if (overflowing_.load(std::memory_order_acquire) || !try_push(item)) {
+    std::lock_guard<std::mutex> mlock(overflow_mutex_);
+    /* the consumer may have drained the overflow since we looked */
+    if (overflowing_.load(std::memory_order_relaxed) || !try_push(item))
+      overflow(item);
+  }
+
+  wake();
+  inflight_.fetch_sub(1, std::memory_order_release);
+}
+
+template <typename T>
+void MPSCRing<T>::push_back(const T& item)
+{
+  T copy(item);
+  push(copy);
+}
+
+template <typename T>
+void MPSCRing<T>::push_back(T&& item)
+{
+  push(item);
+}
+
+/*
+ * push_batch
+ *
+ *  push_back() every item, in order, as one operation: runs of slots
+ * are claimed a CAS at a time rather than an item at a time, and the
+ * consumer is woken once for the lot.  items are moved from and the
+ * vector is left empty.
+ */
+template <typename T>
+void MPSCRing<T>::push_batch(std::vector<T> &items)
+{
+  size_t i = 0, n = items.size();
+  if (!n) return;
+
+  inflight_.fetch_add(1);
+
+  if (!overflowing_.load(std::memory_order_acquire)) {
+    size_t k;
+    while (i < n && (k = try_push_run(&items[i], n - i))) i += k;
+  }
+  if (i < n) {
+    std::lock_guard<std::mutex> mlock(overflow_mutex_);
+    for (; i < n; i++) {
+      if (!overflowing_.load(std::memory_order_relaxed) &&
+	  try_push(items[i]))
+	continue;
+      overflow(items[i]);
+    }
+  }
+  items.clear();
+
+  wake();
+  inflight_.fetch_sub(1, std::memory_order_release);
+}
+
+/*
+ * consumer side: hand the whole overflow over in one swap, but only
+ * when the ring is empty so nothing older is still in it
+ */
+template <typename T>
+bool MPSCRing<T>::refill()
+{
+  std::lock_guard<std::mutex> mlock(overflow_mutex_);
+  spill_.swap(overflow_);
+  overflowing_.store(false, std::memory_order_release);
+  spill_size_.store((int) spill_.size(), std::memory_order_relaxed);
+  return !spill_.empty();
+}
+
+template <typename T>
+T *MPSCRing<T>::try_peek()
+{
+  if (!spill_.empty()) return &spill_.front();
+
+  size_t head = head_.load(std::memory_order_relaxed);
+  Cell &cell = cells_[head & mask_];
+  if (cell.seq.load(std::memory_order_acquire) == head + 1)
+    return &cell.data;
+
+  if (overflowing_.load(std::memory_order_acquire) &&
+      tail_.load(std::memory_order_acquire) == head &&
+      refill())
+    return &spill_.front();
+
+  return nullptr;
+}
+
+template <typename T>
+T *MPSCRing<T>::peek()
+{
+  T *item;
+  while (!(item = try_peek())) {
+    sleeping_.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((item = try_peek())) {
+      sleeping_.store(0, std::memory_order_relaxed);
+      break;
+    }
+    sleeping_.wait(1);
+  }
+  return item;
+}
+
+/* drop the item try_peek()/peek() last returned */
+template <typename T>
+void MPSCRing<T>::advance()
+{
+  if (!spill_.empty()) {
+    spill_.pop_front();
+    spill_size_.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+  size_t head = head_.load(std::memory_order_relaxed);
+  Cell &cell = cells_[head & mask_];
+  cell.data = T();
+  cell.seq.store(head + capacity_, std::memory_order_release);
+  head_.store(head + 1, std::memory_order_relaxed);
+}
+
+template <typename T>
+T MPSCRing<T>::front()
+{
+  // Return a COPY, same as SharedQueue
+  return *peek();
+}
+
+template <typename T>
+void MPSCRing<T>::pop_front()
+{
+  peek();
+  advance();
+}
+
+/*
+ * pop_all
+ *
+ *  Block until at least one item is available, then move what is
+ * currently queued, up to max, onto the end of items.  Returns the
+ * number added.  The cap keeps one drain from holding the consumer for
+ * as long as producers keep up with it; what is left is there for the
+ * next call.
+ */
+template <typename T>
+int MPSCRing<T>::pop_all(std::vector<T> &items, size_t max)
+{
+  int n = 0;
+  T *item = peek();
+  do {
+    items.push_back(std::move(*item));
+    advance();
+    n++;
+  } while ((size_t) n < max && (item = try_peek()));
+  return n;
+}
+
+/*
+ * try_pop_all
+ *
+ *  pop_all() for a consumer that mustn't block (an event loop): move
+ * up to max items currently queued onto the end of items, or none.
+ */
+template <typename T>
+int MPSCRing<T>::try_pop_all(std::vector<T> &items, size_t max)
+{
+  int n = 0;
+  T *item;
+  while ((size_t) n < max && (item = try_peek())) {
+    items.push_back(std::move(*item));
+    advance();
+    n++;
+  }
+  return n;
+}
+
+template <typename T>
+int MPSCRing<T>::size()
+{
+  /* head first: tail never trails a head read before it */
+  size_t head = head_.load(std::memory_order_acquire);
+  size_t queued = tail_.load(std::memory_order_acquire) - head;
+  std::unique_lock<std::mutex> mlock(overflow_mutex_);
+  queued += overflow_.size();
+  mlock.unlock();
+  return (int) queued + spill_size_.load(std::memory_order_relaxed);
+}
+
+#endif
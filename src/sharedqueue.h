@@ -4,6 +4,12 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 /*
  * SharedQueue
@@ -12,6 +18,25 @@
  * idiom is front() (blocks until an item is available, returns a
  * copy) followed by pop_front(); that two-call sequence is only
  * atomic because exactly one thread ever consumes a given queue.
+ *
+ *  Lanes (set_lanes) split the queue into n FIFOs in priority order,
+ * lane 0 first; lane_of picks an item's lane as it is pushed.  The
+ * consumer takes from the first non-empty lane, except that a lane
+ * passed over burst times while it had something waiting goes next
+ * -- so a busy lane 0 delays lane 2 by at most burst items, never
+ * starves it.  Order is kept within a lane, not across lanes.  A
+ * queue that never calls set_lanes is the one plain FIFO it was.
+ *
+ *  Conflation (set_conflate) keeps at most one waiting item per key:
+ * key_of names an item's key ("" for none), and an item pushed while
+ * another with its key is still waiting takes that one's place in line
+ * -- the old one is handed to release and counted in superseded().
+ * Once front() has returned an item it is the consumer's, and a later
+ * push with its key queues behind it as usual.
+ *
+ *  wait_size is for a producer that would rather hold back than run
+ * far ahead of the consumer: it sleeps until pop_front brings the
+ * count down to n, or the timeout passes.
  */
 template <typename T>
 class SharedQueue
@@ -27,43 +52,131 @@ public:
   void push_back(T&& item);
 
   int size();
+  bool wait_size(int n, std::chrono::milliseconds timeout);
+
+  void set_lanes(int n, std::function<int(const T&)> lane_of, int burst);
+  void set_burst(int burst);
+  int burst();
+  int lanes();
+  int size(int lane);
+
+  void set_conflate(std::function<std::string(const T&)> key_of,
+		    std::function<void(T&)> release);
+  uint64_t superseded();
 
 private:
-  std::deque<T> queue_;
+  std::vector<std::deque<T>> lanes_;
+  std::vector<int> passed_;	/* times each lane was passed over, waiting */
+  std::function<int(const T&)> lane_of_;
+  int burst_ = 0;
+  int next_ = -1;		/* the lane front() last returned from */
+  int count_ = 0;
+  std::function<std::string(const T&)> key_of_;
+  std::function<void(T&)> release_;
+  std::unordered_map<std::string, T*> slots_;	/* key -> its waiting item */
+  std::unordered_map<const T*, std::string> keyed_; /* and back */
+  uint64_t superseded_ = 0;
   std::mutex mutex_;
   std::condition_variable cond_;
+  std::condition_variable drained_;	/* for wait_size */
+  int size_waiters_ = 0;
+
+  int lane_of(const T& item);
+  int pick_lane();
+  void push(T&& item, std::string key);
+  void unslot(const T& item);
 };
 
 template <typename T>
-SharedQueue<T>::SharedQueue(){}
+SharedQueue<T>::SharedQueue() : lanes_(1), passed_(1, 0) {}
 
 template <typename T>
 SharedQueue<T>::~SharedQueue(){}
 
+/* call with mutex_ held */
+template <typename T>
+int SharedQueue<T>::lane_of(const T& item)
+{
+  if (lanes_.size() == 1) return 0;
+  int lane = lane_of_(item);
+  if (lane < 0) return 0;
+  if (lane >= (int) lanes_.size()) return lanes_.size() - 1;
+  return lane;
+}
+
+/* call with mutex_ held: item is leaving the queue or the consumer has it */
+template <typename T>
+void SharedQueue<T>::unslot(const T& item)
+{
+  if (keyed_.empty()) return;
+  auto iter = keyed_.find(&item);
+  if (iter == keyed_.end()) return;
+  slots_.erase(iter->second);
+  keyed_.erase(iter);
+}
+
+/* call with mutex_ held and count_ > 0 */
+template <typename T>
+int SharedQueue<T>::pick_lane()
+{
+  int pick = -1;
+  for (int i = 0; i < (int) lanes_.size(); i++) {
+    if (lanes_[i].empty()) continue;
+    if (pick < 0) pick = i;
+    else if (passed_[i] >= burst_) { pick = i; break; }
+  }
+  return pick;
+}
+
 template <typename T>
 T SharedQueue<T>::front()
 {
   std::unique_lock<std::mutex> mlock(mutex_);
-  while (queue_.empty())
+  while (!count_)
     {
       cond_.wait(mlock);
     }
   // Return a COPY made while the lock is held.
-  return queue_.front();
+  next_ = pick_lane();
+  unslot(lanes_[next_].front());
+  return lanes_[next_].front();
 }
 
 template <typename T>
 void SharedQueue<T>::pop_front()
 {
   std::unique_lock<std::mutex> mlock(mutex_);
-  while (queue_.empty())
+  while (!count_)
     {
       cond_.wait(mlock);
     }
-  queue_.pop_front();
+  // pop what front() returned, even if a higher lane has filled since
+  int lane = (next_ >= 0 && !lanes_[next_].empty()) ? next_ : pick_lane();
+  next_ = -1;
+  unslot(lanes_[lane].front());
+  lanes_[lane].pop_front();
+  count_--;
+  passed_[lane] = 0;
+  for (int i = lane + 1; i < (int) lanes_.size(); i++)
+    if (!lanes_[i].empty()) passed_[i]++;
+  if (size_waiters_) drained_.notify_all();
   mlock.unlock();     // unlock before notificiation to minimize mutex con
 }     
 
+template <typename T>
+void SharedQueue<T>::push_back(const T& item)
+{
+  push_back(T(item));
+}
+
+template <typename T>
+void SharedQueue<T>::push_back(T&& item)
+{
+  // the key is worked out before taking the lock: key_of may take others
+  std::string key = key_of_ ? key_of_(item) : std::string();
+  push(std::move(item), std::move(key));
+}
+
 /*
  * push_back notifies while still holding the lock.  With
  * unlock-then-notify, a consumer could wake on the unlock, pop the
@@ -72,30 +185,129 @@ void SharedQueue<T>::pop_front()
  * under the lock makes the unlock the producer's last touch, so a
  * consumer that frees the queue after popping an end-of-stream item
  * is safe.
+ *
+ * Deque elements stay put under push_back and pop_front, so slots_ can
+ * point into the lanes; an item is unslotted before it is popped.
  */
 template <typename T>
-void SharedQueue<T>::push_back(const T& item)
+void SharedQueue<T>::push(T&& item, std::string key)
 {
   std::unique_lock<std::mutex> mlock(mutex_);
-  queue_.push_back(item);
+  if (!key.empty()) {
+    auto iter = slots_.find(key);
+    if (iter != slots_.end()) {
+      release_(*iter->second);
+      *iter->second = std::move(item);
+      superseded_++;
+      return;			/* nothing new to wake the consumer for */
+    }
+  }
+  auto &lane = lanes_[lane_of(item)];
+  lane.push_back(std::move(item));
+  count_++;
+  if (!key.empty()) {
+    keyed_[&lane.back()] = key;
+    slots_.emplace(std::move(key), &lane.back());
+  }
   cond_.notify_one(); // notify one waiting thread
 }
 
 template <typename T>
-void SharedQueue<T>::push_back(T&& item)
+int SharedQueue<T>::size()
 {
   std::unique_lock<std::mutex> mlock(mutex_);
-  queue_.push_back(std::move(item));
-  cond_.notify_one(); // notify one waiting thread
+  int size = count_;
+  mlock.unlock();
+  return size;
 }
 
+/* true if the count is down to n, false if timeout passed first */
 template <typename T>
-int SharedQueue<T>::size()
+bool SharedQueue<T>::wait_size(int n, std::chrono::milliseconds timeout)
 {
   std::unique_lock<std::mutex> mlock(mutex_);
-  int size = queue_.size();
-  mlock.unlock();
-  return size;
+  size_waiters_++;
+  bool down = drained_.wait_for(mlock, timeout,
+				[this, n] { return count_ <= n; });
+  size_waiters_--;
+  return down;
+}
+
+/*
+ * Lanes are set up before the queue is in use (items already queued
+ * would be in the wrong place); lane_of runs on the producer's thread,
+ * under the queue's lock, so it must be quick and must not push.
+ */
+template <typename T>
+void SharedQueue<T>::set_lanes(int n, std::function<int(const T&)> lane_of,
+			       int burst)
+{
+  std::unique_lock<std::mutex> mlock(mutex_);
+  if (n < 1) n = 1;
+  while ((int) lanes_.size() > n) {	/* fold any extras into the last */
+    auto &last = lanes_[lanes_.size() - 2];
+    for (auto &item : lanes_.back()) last.push_back(std::move(item));
+    lanes_.pop_back();
+  }
+  lanes_.resize(n);
+  passed_.assign(n, 0);
+  slots_.clear();		/* the fold above may have moved them */
+  keyed_.clear();
+  lane_of_ = lane_of;
+  burst_ = burst < 1 ? 1 : burst;
+  next_ = -1;
+}
+
+template <typename T>
+void SharedQueue<T>::set_burst(int burst)
+{
+  std::unique_lock<std::mutex> mlock(mutex_);
+  burst_ = burst < 1 ? 1 : burst;
+}
+
+template <typename T>
+int SharedQueue<T>::burst()
+{
+  std::unique_lock<std::mutex> mlock(mutex_);
+  return burst_;
+}
+
+template <typename T>
+int SharedQueue<T>::lanes()
+{
+  std::unique_lock<std::mutex> mlock(mutex_);
+  return lanes_.size();
+}
+
+template <typename T>
+int SharedQueue<T>::size(int lane)
+{
+  std::unique_lock<std::mutex> mlock(mutex_);
+  if (lane < 0 || lane >= (int) lanes_.size()) return 0;
+  return lanes_[lane].size();
+}
+
+/*
+ * Like set_lanes, set up before the queue is in use.  key_of runs on
+ * the producer's thread before the lock is taken; release runs under
+ * it, so it must be quick and must not push.
+ */
+template <typename T>
+void SharedQueue<T>::set_conflate(std::function<std::string(const T&)> key_of,
+				  std::function<void(T&)> release)
+{
+  std::unique_lock<std::mutex> mlock(mutex_);
+  key_of_ = key_of;
+  release_ = release;
+  slots_.clear();
+  keyed_.clear();
+}
+
+template <typename T>
+uint64_t SharedQueue<T>::superseded()
+{
+  std::unique_lock<std::mutex> mlock(mutex_);
+  return superseded_;
 }
 
 #endif
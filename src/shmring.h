@@ -0,0 +1,138 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * shmring
+ *
+ *  Single-producer, single-consumer ring of datapoint records in shared
+ * memory, for producers on the same host as dserv (ShmIngestServer.h).
+ * dserv creates the memory and a doorbell eventfd and hands both to the
+ * producer over a unix socket; from then on a point costs the producer
+ * two memcpy's into the mapping and a store of head -- no syscall --
+ * and dserv copies it out into the table.  Plain C, so api/dservapi.c
+ * and the server share this one description of the layout.
+ *
+ *  The positions are free-running byte counts (size is a power of two,
+ * so head & (size - 1) is the offset).  A record never straddles the
+ * end of the data: if it won't fit before the end the producer writes
+ * a pad record over what's left and starts again at offset 0.
+ *
+ *  Wakeups are the same Dekker pairing as MPSCRing's: the consumer sets
+ * sleeping and rechecks head before it waits on the eventfd; the
+ * producer publishes head and only then looks at sleeping, so either
+ * the consumer sees the record or the producer sees it asleep and
+ * rings the doorbell -- once per empty -> non-empty, however many
+ * records follow.
+ *
+ *  A full ring drops the record and counts it in dropped: the
+ * producers this is for (eye trackers, cameras) would rather lose a
+ * sample than stall their acquisition loop waiting on dserv.
+ */
+
+#define DSERV_SHMRING_MAGIC   0x64736872	/* "dshr" */
+#define DSERV_SHMRING_VERSION 1
+
+#define DSERV_SHMRING_MIN_SIZE (64 * 1024)
+#define DSERV_SHMRING_MAX_SIZE (64 * 1024 * 1024)
+#define DSERV_SHMRING_DEFAULT_SIZE (1024 * 1024)
+
+/* record: reclen, padded to 8; DSERV_SHMRING_PAD set on a pad record */
+#define DSERV_SHMRING_PAD 0x80000000u
+
+typedef struct dserv_shmring_s {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;		/* bytes of data after the header */
+  uint64_t dropped;		/* producer: records the ring had no room for */
+  char pad0[40];
+  uint64_t head;		/* producer: bytes written */
+  char pad1[56];
+  uint64_t tail;		/* consumer: bytes taken */
+  uint32_t sleeping;		/* consumer: waiting on the doorbell */
+  char pad2[52];
+} dserv_shmring_t;
+
+typedef struct dserv_shmrec_s {
+  uint32_t reclen;		/* header, name and data, padded to 8 */
+  uint16_t varlen;
+  uint16_t reserved;
+  uint32_t type;
+  uint32_t datalen;
+  uint64_t timestamp;		/* 0: stamped by dserv */
+  uint64_t posted;		/* CLOCK_MONOTONIC ns when written */
+} dserv_shmrec_t;		/* followed by varname, then data */
+
+static inline unsigned char *dserv_shmring_data(dserv_shmring_t *ring)
+{
+  return (unsigned char *) ring + sizeof(dserv_shmring_t);
+}
+
+static inline uint32_t dserv_shmring_reclen(uint32_t varlen, uint32_t datalen)
+{
+  return (uint32_t) ((sizeof(dserv_shmrec_t) + varlen + datalen + 7) & ~7u);
+}
+
+static inline uint64_t dserv_shmring_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * producer: append a record.  Returns 0 if it can't go in (too big for
+ * the ring, or no room now: counted in dropped), 1 if it went in, 2 if
+ * it went in and the consumer is asleep -- the caller rings the
+ * doorbell.
+ */
+static inline int dserv_shmring_put(dserv_shmring_t *ring,
+				    const char *varname, uint16_t varlen,
+				    uint32_t type, uint32_t datalen,
+				    const void *data, uint64_t timestamp)
+{
+  uint64_t size = ring->size;
+  uint64_t head = ring->head;	/* only we write it */
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint32_t reclen = dserv_shmring_reclen(varlen, datalen);
+  uint64_t off = head & (size - 1);
+  uint64_t pad = (off + reclen > size) ? size - off : 0;
+  unsigned char *p;
+  dserv_shmrec_t rec;
+
+  if ((uint64_t) reclen > size / 4 || size - (head - tail) < pad + reclen) {
+    __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  if (pad) {
+    uint32_t padlen = (uint32_t) pad | DSERV_SHMRING_PAD;
+    memcpy(dserv_shmring_data(ring) + off, &padlen, sizeof(padlen));
+    head += pad;
+    off = 0;
+  }
+
+  rec.reclen = reclen;
+  rec.varlen = varlen;
+  rec.reserved = 0;
+  rec.type = type;
+  rec.datalen = datalen;
+  rec.timestamp = timestamp;
+  rec.posted = dserv_shmring_clock();
+  p = dserv_shmring_data(ring) + off;
+  memcpy(p, &rec, sizeof(rec));
+  memcpy(p + sizeof(rec), varname, varlen);
+  if (datalen) memcpy(p + sizeof(rec) + varlen, data, datalen);
+
+  __atomic_store_n(&ring->head, head + reclen, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_ACQ_REL))
+    return 2;
+  return 1;
+}
+
+#endif
@@ -26,9 +26,20 @@ extern "C" {
   int64_t tclserver_clock_epoch_offset_us(void);
 
   void tclserver_set_point(tclserver_t *tclserver, ds_datapoint_t *dp);
+
+  /* Set n points as one batch, in order, each keeping its own
+     timestamp: one trip through the table, processors, trigger, notify
+     and logger instead of n.  For modules that produce points in bursts
+     (a block of ain samples, a sampler's outputs, end-of-trial events).
+     Takes ownership of the points, as tclserver_set_point does; the
+     array itself stays the caller's. */
+  void tclserver_set_points(tclserver_t *tclserver, ds_datapoint_t **dps,
+			    int n);
   tclserver_t* tclserver_get_from_interp(Tcl_Interp *interp);
   
-  // Add new function for queuing Tcl scripts from modules
+  /* Queue a script to run in the interp.  Scripts and points from
+     modules share one queue lane, so a script runs after any point the
+     module set before queueing it (and points set after it wait). */
   void tclserver_queue_script(tclserver_t *tclserver, const char *script, int no_reply);
   
 #ifdef __cplusplus
@@ -0,0 +1,84 @@
+#
+# test_dpoint_script.tcl
+#
+#  dpoint scripts run from cached command objects, and array values are
+#  passed as typed vectors under Tcl 9:
+#  - a proc redefined after its script has run: the new body runs
+#  - a point's script re-registered, to another proc and to the same
+#    one redefined: the new script and the new body run
+#  - an int array value is a list to the script (llength, lindex,
+#    lrange, lreverse, foreach, in, its string), a changed copy
+#    leaves the value alone, and a float array reads as its doubles
+#
+#  Scripts run once this script has returned, so each step is a script
+#  on test/script/step, run behind the points set before it.
+#
+#  Run as: dserv --cscript tests/test_dpoint_script.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+set ran {}
+proc h1 { name value } { lappend ::ran [list h1 $value] }
+proc h2 { name value } { lappend ::ran [list h2 $value] }
+
+proc on_array { name value } {
+    set ::array_seen [list [llength $value] [lindex $value 2] \
+                          [lrange $value 1 2] [lreverse $value] \
+                          [expr { 3 in $value }] $value]
+    set sum 0
+    foreach v $value { incr sum $v }
+    lappend ::array_seen $sum
+    set copy $value
+    lappend copy 5
+    lset copy 0 9
+    lappend ::array_seen $copy $value
+}
+proc on_floats { name value } { set ::floats_seen $value }
+
+proc step { name n } {
+    switch $n {
+        1 {
+            check "first body" {{h1 1}} $::ran
+            proc h1 { name value } { lappend ::ran [list h1-new $value] }
+            dservSet test/script/p 2
+        }
+        2 {
+            check "redefined proc runs its new body" {h1-new 2} \
+                [lindex $::ran end]
+            dpointSetScript test/script/p h2
+            dservSet test/script/p 3
+        }
+        3 {
+            check "re-registered script runs" {h2 3} [lindex $::ran end]
+            proc h2 { name value } { lappend ::ran [list h2-new $value] }
+            dpointSetScript test/script/p h2
+            dservSet test/script/p 4
+        }
+        4 {
+            check "same script re-registered, new body" {h2-new 4} \
+                [lindex $::ran end]
+            check "each delivery ran once" 4 [llength $::ran]
+            dservSetData test/script/a 0 5 [binary format i4 {1 2 3 4}]
+            dservSetData test/script/f 0 2 [binary format f2 {1.5 2.25}]
+        }
+        5 {
+            check "array as a list" \
+                {4 3 {2 3} {4 3 2 1} 1 {1 2 3 4} 10 {9 2 3 4 5} {1 2 3 4}} \
+                $::array_seen
+            check "floats" {1.5 2.25} $::floats_seen
+            done
+            return
+        }
+    }
+    dservSet test/script/step [expr { $n + 1 }]
+}
+
+foreach p { p a f step } { dservAddExactMatch test/script/$p }
+dpointSetScript test/script/p h1
+dpointSetScript test/script/a on_array
+dpointSetScript test/script/f on_floats
+dpointSetScript test/script/step step
+
+dservSet test/script/p 1
+dservSet test/script/step 1
@@ -0,0 +1,105 @@
+#
+# test_fanout.tcl
+#
+#  Send clients served by the fanout workers rather than a thread each:
+#  - dservFanoutInfo reports the engine and counts the clients it serves
+#  - a subscriber that stops reading fills its socket and waits there,
+#    without being reaped and without holding up the others
+#  - unregistering hands the clients back
+#  - a websocket is one more client of the workers (no thread of its
+#    own), gets what it subscribes to in order, and is handed back
+#    when it closes
+#
+#  Run as: dserv --cscript tests/test_fanout.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+proc fanout_clients {} { dict get [dservFanoutInfo] clients }
+
+# the shutdowns are handled on the workers' next pass
+proc wait_clients { n } {
+    for { set i 0 } { $i < 50 } { incr i } {
+        if { [fanout_clients] == $n } break
+        after 20
+    }
+    return [fanout_clients]
+}
+
+check "engine" epoll [dict get [dservFanoutInfo] engine]
+set before [fanout_clients]
+
+subscriber 4695
+
+# accepts, never reads
+proc stall { chan addr port } { set ::stalled $chan }
+set stall_listener [socket -server stall 4694]
+
+set s [dserv_socket]
+request $s "%reg 127.0.0.1 4695 0"
+request $s "%match 127.0.0.1 4695 test/fanout/* 1"
+request $s "%reg 127.0.0.1 4694 0 all"
+request $s "%match 127.0.0.1 4694 test/fanout/* 1"
+check "clients added" [expr { $before + 2 }] [fanout_clients]
+
+# well past what a socket buffers
+set big [string repeat x 4000]
+set pairs {}
+set expected {}
+for { set i 0 } { $i < 2000 } { incr i } {
+    lappend pairs test/fanout/v "$i $big"
+    lappend expected $i
+}
+dservSetBatch $pairs
+
+check "reader gets all" 2000 [wait_lines 4695 2000 5000]
+check "in order" $expected [lmap l $lines(4695) { lindex $l end 0 }]
+
+set slow [lsearch -inline -index 1 [dservSendClients] 127.0.0.1:4694]
+check "stalled client kept" 1 [dict get $slow active]
+check "stalled client behind" 1 [expr { [dict get $slow points] < 2000 }]
+
+request $s "%unreg 127.0.0.1 4695"
+request $s "%unreg 127.0.0.1 4694"
+close $stalled
+close $s
+close $stall_listener
+check "clients removed" $before [wait_clients $before]
+
+if { [dservGet system/ssl] } {
+    done
+    return
+}
+
+set w [ws_socket]
+check "websocket added" [expr { $before + 1 }] [wait_clients [expr { $before + 1 }]]
+check "websocket sink" 1 \
+    [expr { [lsearch -index 1 -glob [dservSendClients] sink_*] >= 0 }]
+
+ws_send $w {{"cmd":"subscribe","match":"test/fanout/ws"}}
+check "subscribed" 1 \
+    [string match {*"subscribed"*} [lindex [ws_recv $w] 1]]
+
+set pairs {}
+set expected {}
+for { set i 0 } { $i < 200 } { incr i } {
+    lappend pairs test/fanout/ws $i test/fanout/other $i
+    lappend expected $i
+}
+dservSetBatch $pairs
+
+set got {}
+while { [llength $got] < 200 } {
+    set m [ws_recv $w]
+    if { $m eq {} } break
+    if { [regexp {"name":\s*"([^"]*)".*"data":\s*"?([^",\}]*)} \
+              [lindex $m 1] -> name value] && $name eq "test/fanout/ws" } {
+        lappend got $value
+    }
+}
+check "websocket gets its points in order" $expected $got
+
+close $w
+check "websocket removed" $before [wait_clients $before]
+
+done
@@ -0,0 +1,61 @@
+#
+# test_ingest.tcl
+#
+#  Talk to our own dataserver port the way producers do and check what
+#  lands in the table:
+#  - a '%' command gets its reply
+#  - on the epoll engine, a '%' line that arrives in pieces is taken
+#    once, when its newline is in, not as the piece a read happened to
+#    return (the thread engine still takes what one read gives it)
+#  - '>' frames and a '}' message sent in one write are all taken in
+#  - a '%reg' gets its reply, in order with what follows it on that
+#    connection, while other connections are answered meanwhile, and
+#    the registered client is connected to
+#  - the default engine on Linux is epoll (dservIngestInfo)
+#
+#  Run as: dserv --cscript tests/test_ingest.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+set epoll [expr { $tcl_platform(os) eq "Linux" &&
+                   [dict get [dservIngestInfo] engine] eq "epoll" }]
+
+set s [dserv_socket]
+check "version" "1 3.0" [request $s %version]
+
+if { $epoll } {
+    puts -nonewline $s "%vers"
+    after 200
+    check "split line, one reply" "1 3.0" [request $s ion]
+    check "nothing left over" "1 3.0" [request $s %version]
+}
+
+set data [binary format i3 {7 8 9}]
+puts -nonewline $s "[fixed_frame test/ingest/a 1][fixed_frame test/ingest/b 2][var_frame test/ingest/c 5 $data]"
+after 200
+check "binary pushes" {1 2 {7 8 9}} \
+    [list [dservGet test/ingest/a] [dservGet test/ingest/b] \
+         [dservGet test/ingest/c]]
+
+# a '%reg' and a command behind it, sent together
+subscriber 4691
+set r [dserv_socket]
+puts -nonewline $r "%reg 127.0.0.1 4691\n%version\n"
+check "other connections answered meanwhile" "1 3.0" [request $s %version]
+check "reg reply" 1 [string trim [gets $r]]
+check "then the command behind it" "1 3.0" [gets $r]
+
+puts -nonewline $r "%match 127.0.0.1 4691 test/ingest/reg 1\n"
+gets $r
+dservSet test/ingest/reg 5
+check "registered client gets points" 1 [expr {[wait_lines 4691 1] >= 1}]
+request $r "%unreg 127.0.0.1 4691"
+close $r
+close $s
+
+if { $tcl_platform(os) eq "Linux" } {
+    check "engine" 1 $epoll
+}
+
+done
@@ -0,0 +1,109 @@
+#
+# test_lanes.tcl
+#
+#  The request queue's lanes:
+#  - dservLanes reports and moves the lane each request source uses,
+#    and rejects unknown sources and lanes
+#  - dservLaneBurst sets how long a lower lane can be held off, and
+#    rejects a burst under 1
+#  - dservTiming lanes reports residency per lane
+#  - priority: message port scripts (bulk) queued ahead of dservAfter
+#    scripts (realtime) run after them
+#  - no starvation: under a long realtime backlog, a bulk script still
+#    runs after at most burst realtime ones
+#
+#  The queued scripts run once the script queueing them returns, so
+#  each phase queues its bulk scripts, then its realtime ones, and
+#  sleeps (after ms) to let them all arrive before returning.  Each
+#  script records its tag in ::order, and the last one in checks it.
+#
+#  Run as: dserv --cscript tests/test_lanes.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+check "lanes" {local normal dpoint realtime timer realtime module normal newline bulk message bulk web bulk} [dservLanes]
+check "web" bulk [dservLanes web]
+check "move" normal [dservLanes web normal]
+check "back" bulk [dservLanes web bulk]
+check "bad source" 1 [catch { dservLanes nosuch }]
+check "bad lane" 1 [catch { dservLanes web fast }]
+
+check "burst" 16 [dservLaneBurst]
+check "burst set" 4 [dservLaneBurst 4]
+check "bad burst" 1 [catch { dservLaneBurst 0 }]
+dservLaneBurst 16
+
+check "timing lanes" 0 [catch { dservTiming lanes }]
+
+proc v2_frame { kind id body } {
+    return [binary format Ia1Ia* [expr { 5 + [string length $body] }] \
+                $kind $id $body]
+}
+
+# a message port connection in protocol 2, so scripts can be sent
+# without waiting for their replies
+proc v2_socket {} {
+    set s [dserv_socket 2560]
+    set hello "%protocol 2"
+    puts -nonewline $s [binary format Ia* [string length $hello] $hello]
+    binary scan [read $s 4] Iu n
+    read $s $n
+    return $s
+}
+
+# queue nbulk bulk scripts, then nrt realtime ones, and let them arrive
+proc queue_phase { nbulk nrt } {
+    set ::order {}
+    set ::expect [expr { $nbulk + $nrt }]
+    for { set i 1 } { $i <= $nbulk } { incr i } {
+        puts -nonewline $::s [v2_frame S $i [list lane_ran b$i]]
+    }
+    after 100
+    for { set i 1 } { $i <= $nrt } { incr i } {
+        dservAfter 0 [list lane_ran r$i]
+    }
+    after 200
+}
+
+proc lane_ran { tag } {
+    lappend ::order $tag
+    if { [llength $::order] == $::expect } {
+        {*}[lindex $::phases 0]
+        set ::phases [lrange $::phases 1 end]
+    }
+}
+
+proc check_priority {} {
+    check "realtime ahead of bulk queued before it" \
+        {r1 r2 r3 b1 b2 b3} $::order
+    # the next phase queues from a realtime script, as this one did
+    dservAfter 0 {
+        dservLaneBurst 4
+        queue_phase 3 12
+    }
+}
+
+proc check_burst {} {
+    # realtime scripts run ahead of each bulk one, and after the last
+    set runs {}
+    set n 0
+    foreach tag $::order {
+        if { [string index $tag 0] eq "b" } { lappend runs $n; set n 0 } \
+            else { incr n }
+    }
+    lappend runs $n
+    check "bulk in order" {b1 b2 b3} [lsearch -all -inline $::order b*]
+    check "at most burst realtime ahead of each bulk" 1 \
+        [expr { [tcl::mathfunc::max {*}[lrange $runs 0 end-1]] <= 4 }]
+    check "bulk not held until realtime is done" 1 [expr { [lindex $runs end] > 0 }]
+    dservLaneBurst 16
+    dservAfterCancel $::timeout
+    close $::s
+    done
+}
+
+set phases { check_priority check_burst }
+set timeout [dservAfter 10000 { fail "lanes: order '$::order'"; done }]
+set s [v2_socket]
+queue_phase 3 3
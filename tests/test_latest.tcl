@@ -0,0 +1,72 @@
+#
+# test_latest.tcl
+#
+#  dpointSetScript -latest:
+#  - marks the key, and dpointLatest lists it
+#  - the script is registered as usual (dpointGetScript)
+#  - setting the key again without -latest clears the mark, and
+#    removing the key drops it
+#  - bad arguments are rejected
+#  - a backlog of deliveries for a -latest point collapses: its script
+#    runs once, with the newest value, and the ones it replaced are
+#    counted as superseded; a point without -latest still gets every
+#    value
+#
+#  The backlog builds while this script holds the process thread; a
+#  script on test/latest/step, set last, checks what ran.
+#
+#  Run as: dserv --cscript tests/test_latest.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+proc show {name value} {}
+
+dpointSetScript -latest latest/xy show
+dpointSetScript latest/other show
+check "keys" latest/xy [dict get [dpointLatest] keys]
+check "script" show [dpointGetScript latest/xy]
+check "superseded" 1 [string is integer [dict get [dpointLatest] superseded]]
+
+dpointSetScript latest/xy show
+check "cleared" 0 [llength [dict get [dpointLatest] keys]]
+
+dpointSetScript -latest latest/* show
+check "glob" latest/* [dict get [dpointLatest] keys]
+dpointRemoveScript latest/*
+check "removed" 0 [llength [dict get [dpointLatest] keys]]
+
+check "bad args" 1 [catch { dpointSetScript -latest latest/xy }]
+check "bad option" 1 [catch { dpointSetScript -newest latest/xy show }]
+
+dpointRemoveScript latest/xy
+dpointRemoveScript latest/other
+
+set newest {}
+set every {}
+proc on_newest { name value } { lappend ::newest $value }
+proc on_every { name value } { lappend ::every $value }
+
+proc step { name value } {
+    set n [expr { [dict get [dpointLatest] superseded] - $::superseded }]
+    check "backlog superseded" 1 [expr { $n > 0 }]
+    check "each waiting value replaced once" 19 $n
+    check "only the newest delivered" 20 $::newest
+    check "without -latest, every value" $::values $::every
+    done
+}
+
+foreach p { newest every step } { dservAddExactMatch test/latest/$p }
+dpointSetScript -latest test/latest/newest on_newest
+dpointSetScript test/latest/every on_every
+dpointSetScript test/latest/step step
+
+set superseded [dict get [dpointLatest] superseded]
+set values {}
+for { set i 1 } { $i <= 20 } { incr i } {
+    lappend values $i
+    dservSet test/latest/newest $i
+    dservSet test/latest/every $i
+}
+after 200
+dservSet test/latest/step 1
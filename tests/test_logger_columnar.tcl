@@ -0,0 +1,69 @@
+#
+# test_logger_columnar.tcl
+#
+#  Log a SHORT point through a columnar match and read it back as
+#  columns with dslogColumns:
+#  - every sample keeps its own timestamp (not just one per block)
+#  - samples come back in order, across block boundaries
+#  - the records are columnar blocks, not one record per point
+#
+#  Run as: dserv --cscript tests/test_logger_columnar.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+set filename /tmp/test_logger_columnar.ds
+file delete $filename
+
+dservLoggerOpen $filename 1
+# 64 bytes of samples per block: 16 four-channel SHORT samples
+dservLoggerAddMatch $filename test/col/vals 0 64 1 1
+dservLoggerResume $filename
+
+# DSERV_SHORT is 4
+for { set i 0 } { $i < 100 } { incr i } {
+    dservSetData test/col/vals [expr {1000 + $i}] 4 \
+        [binary format s4 [list $i [expr {$i+1}] [expr {$i+2}] [expr {$i+3}]]]
+}
+
+after 50
+dservAddExactMatch test/col/done
+dpointSetScript test/col/done close_and_check
+dservSet test/col/done 1
+
+proc close_and_check { name data } {
+    global filename
+    dservLoggerClose $filename
+
+    # poll until every sample is on disk
+    set n 0
+    set records 0
+    set cols {type -1 sample_len 0 timestamps {} samples {}}
+    for { set i 0 } { $i < 50 && $n < 100 } { incr i } {
+        after 40
+        if { ![catch {dslogOpen $filename} h] } {
+            set cols [dslogColumns $h test/col/vals]
+            set n [llength [dict get $cols timestamps]]
+            set records [llength [dslogVar $h test/col/vals]]
+            dslogClose $h
+        }
+    }
+
+    set ts [dict get $cols timestamps]
+    set samples [dict get $cols samples]
+    check "every sample" 100 $n
+    check "a timestamp per sample" {1000 1050 1099} \
+        [list [lindex $ts 0] [lindex $ts 50] [lindex $ts end]]
+    check "timestamps in order" [lsort -integer $ts] $ts
+    check "type and sample_len" {4 8} \
+        [list [dict get $cols type] [dict get $cols sample_len]]
+    set expect {}
+    for { set i 0 } { $i < 100 } { incr i } {
+        lappend expect $i [expr {$i+1}] [expr {$i+2}] [expr {$i+3}]
+    }
+    check "samples in order across blocks" $expect $samples
+    check "columnar blocks, not a record per point" 13 $records
+
+    file delete $filename
+    done
+}
@@ -0,0 +1,72 @@
+#
+# test_logger_compact.tcl
+#
+#  Open a compact (version 5) log, write two variables, close it, then
+#  expand it back to version 3 with dslogExpand and read that:
+#  - the compact file itself is version 5
+#  - the expanded file has every record, names and values intact
+#
+#  Run as: dserv --cscript tests/test_logger_compact.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+set filename /tmp/test_logger_compact.ds
+set expanded /tmp/test_logger_compact_v3.ds
+file delete $filename $expanded
+
+dservLoggerOpen $filename 1 5
+dservLoggerAddMatch $filename test/compact/a
+dservLoggerAddMatch $filename test/compact/b
+dservLoggerResume $filename
+
+for { set i 0 } { $i < 100 } { incr i } {
+    dservSet test/compact/a $i
+    if { $i % 10 == 0 } { dservSet test/compact/b "b$i" }
+}
+
+after 50
+dservAddExactMatch test/compact/done
+dpointSetScript test/compact/done close_and_check
+dservSet test/compact/done 1
+
+proc close_and_check { name data } {
+    global filename expanded
+    dservLoggerClose $filename
+
+    # the close flows through the logger queues; poll until all 110
+    # points have been written
+    set n 0
+    for { set i 0 } { $i < 50 } { incr i } {
+        after 40
+        if { ![catch {dslogExpand $filename $expanded} n] && $n >= 110 } break
+    }
+    check "expanded every point" 1 [expr {[string is integer $n] && $n >= 110}]
+
+    set f [open $filename rb]
+    binary scan [read $f 6] a5c magic version
+    close $f
+    check "compact version" 5 $version
+
+    set h [dslogOpen $expanded]
+    set info [dslogInfo $h]
+    check "expanded version" 3 [dict get $info version]
+    set counts {}
+    foreach v [dict get $info vars] {
+        lassign $v varname count
+        if { [string match test/compact/* $varname] } {
+            dict set counts $varname $count
+        }
+    }
+    check "counts" {test/compact/a 100 test/compact/b 10} $counts
+    set a [dslogVar $h test/compact/a]
+    check "a in order" [lsort -integer [lmap r $a {lindex $r 3}]] \
+        [lmap r $a {lindex $r 3}]
+    check "a first and last" {0 99} [list [lindex $a 0 3] [lindex $a end 3]]
+    set b [dslogVar $h test/compact/b]
+    check "b first and last" {b0 b90} [list [lindex $b 0 3] [lindex $b end 3]]
+    dslogClose $h
+
+    file delete $filename $expanded
+    done
+}
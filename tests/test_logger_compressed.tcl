@@ -0,0 +1,97 @@
+#
+# test_logger_compressed.tcl
+#
+#  Open a zlib compressed version 4 log, write two variables, close it,
+#  then read it both in place and after dslogInflate:
+#  - the file has the compressed flag in its version byte
+#  - dservLoggerClients -info reports the client while it is open
+#  - the closed file ends with its block index, and dslogOpen reads
+#    it as it is: compressed, indexed, every record intact
+#  - the inflated file has the same records
+#
+#  Run as: dserv --cscript tests/test_logger_compressed.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+set filename /tmp/test_logger_compressed.ds
+set inflated /tmp/test_logger_compressed_v4.ds
+file delete $filename $inflated
+
+dservLoggerOpen $filename 1 4 1
+dservLoggerAddMatch $filename test/zlog/a
+dservLoggerAddMatch $filename test/zlog/b
+dservLoggerResume $filename
+
+for { set i 0 } { $i < 100 } { incr i } {
+    dservSet test/zlog/a $i
+    if { $i % 10 == 0 } { dservSet test/zlog/b "b$i" }
+}
+
+after 50
+dservAddExactMatch test/zlog/done
+dpointSetScript test/zlog/done close_and_check
+dservSet test/zlog/done 1
+
+proc tail_magic { path } {
+    set f [open $path rb]
+    seek $f -8 end
+    set magic [read $f 8]
+    close $f
+    return $magic
+}
+
+proc check_log { label path compressed } {
+    set h [dslogOpen $path]
+    set info [dslogInfo $h]
+    check "$label version" 4 [dict get $info version]
+    check "$label compressed" $compressed [dict get $info compressed]
+    check "$label indexed" 1 [dict get $info indexed]
+    check "$label damaged" 0 [dict get $info damaged]
+    set counts {}
+    foreach v [dict get $info vars] {
+        lassign $v varname count
+        if { [string match test/zlog/* $varname] } {
+            dict set counts $varname $count
+        }
+    }
+    check "$label counts" {test/zlog/a 100 test/zlog/b 10} $counts
+    set a [dslogVar $h test/zlog/a]
+    check "$label a values" [lsort -integer [lmap r $a {lindex $r 3}]] \
+        [lmap r $a {lindex $r 3}]
+    check "$label a first and last" {0 99} \
+        [list [lindex $a 0 3] [lindex $a end 3]]
+    set b [dslogVar $h test/zlog/b]
+    check "$label b first and last" {b0 b90} \
+        [list [lindex $b 0 3] [lindex $b end 3]]
+    dslogClose $h
+}
+
+proc close_and_check { name data } {
+    global filename inflated
+    set info [dict get [dservLoggerClients -info] $filename]
+    check "client compress" 1 [dict get $info compress]
+    dservLoggerClose $filename
+
+    # the close flows through the logger queues; the block index is the
+    # last thing written
+    for { set i 0 } { $i < 50 } { incr i } {
+        after 40
+        if { [tail_magic $filename] eq "DSLGBIX1" } break
+    }
+    check "block index written" DSLGBIX1 [tail_magic $filename]
+
+    set f [open $filename rb]
+    binary scan [read $f 7] a5cucu magic version codec
+    close $f
+    check "version byte" {4 1} [list [expr {$version & 0x7f}] \
+                                    [expr {$version >> 7}]]
+    check "codec" 1 $codec
+
+    check_log "in place" $filename 1
+    dslogInflate $filename $inflated
+    check_log "inflated" $inflated 0
+
+    file delete $filename $inflated
+    done
+}
@@ -0,0 +1,49 @@
+#
+# test_match_order.tcl
+#
+#  When several dpointSetScript keys match a point, only the most
+#  specific one's script runs: an exact key, else the longest literal
+#  lead-in, with a glob ahead of a bare prefix that has the same
+#  lead-in.  A root '*' used to win over everything else it overlapped.
+#
+#  Run as: dserv --cscript tests/test_match_order.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+foreach key { root prefix stem glob rootglob exact } {
+    proc on_$key { name value } "set ::ran(\$name) $key"
+}
+
+dpointSetScript *            on_root
+dpointSetScript order/*      on_prefix
+dpointSetScript order/st*    on_stem
+dpointSetScript order/stat?s on_glob
+dpointSetScript */mode       on_rootglob
+dpointSetScript order/state  on_exact
+
+proc which_ran { name } {
+    if { ![info exists ::ran($name)] } { return none }
+    return $::ran($name)
+}
+
+# the scripts run once this script returns, in the order of the sets
+proc finish { name value } {
+    check "glob beats shorter prefixes and *" glob [which_ran order/status]
+    check "longer prefix beats shorter"       stem [which_ran order/stamps]
+    check "prefix beats *"                    prefix [which_ran order/x]
+    check "exact beats every pattern"         exact [which_ran order/state]
+    check "glob beats prefix with same lead-in" rootglob [which_ran other/mode]
+    check "* alone"                           root [which_ran other/x]
+    done
+}
+dpointSetScript order_done finish
+
+dservAddMatch order/*
+dservAddMatch other/*
+dservAddExactMatch order_done
+foreach name { order/status order/stamps order/x order/state
+    other/mode other/x } {
+    dservSet $name 1
+}
+dservSet order_done 1
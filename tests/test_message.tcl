@@ -0,0 +1,119 @@
+#
+# test_message.tcl
+#
+#  The message port (2560), in both framings:
+#  - v1: one length-prefixed script, one reply; an error comes back as
+#    "!TCL_ERROR " and the message
+#  - "%protocol 2" switches a connection to tagged frames, and requests
+#    sent together without waiting ('S' scripts and a 'B' batch) are
+#    answered in order, each under its own id, errors flagged by the
+#    status byte rather than the "!TCL_ERROR " prefix
+#
+#  The scripts run in this interp, and so only once this script has
+#  returned.  Nothing runs the event loop then, so a dservAfter script
+#  polls it: the fileevents collect the replies, and the poll checks
+#  them once all are in.
+#
+#  Run as: dserv --cscript tests/test_message.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+proc v1_frame { script } {
+    return [binary format Ia* [string length $script] $script]
+}
+proc v2_frame { kind id body } {
+    return [binary format Ia1Ia* [expr { 5 + [string length $body] }] \
+                $kind $id $body]
+}
+proc batch_body { scripts } {
+    set b [binary format I [llength $scripts]]
+    foreach s $scripts { append b [binary format Ia* [string length $s] $s] }
+    return $b
+}
+
+# each whole frame in ::buf($s) is passed to handler, as it comes in
+proc on_readable { s handler } {
+    append ::buf($s) [read $s]
+    while { [binary scan $::buf($s) Iu n] &&
+            [string length $::buf($s)] >= 4 + $n } {
+        set frame [string range $::buf($s) 4 [expr { 3 + $n }]]
+        set ::buf($s) [string range $::buf($s) [expr { 4 + $n }] end]
+        {*}$handler $frame
+    }
+    if { [eof $s] } { close $s }
+}
+
+# a v2 reply as {kind id {status result} ...}
+proc v2_reply { frame } {
+    binary scan $frame a1Iu kind id
+    if { $kind eq "S" } {
+        binary scan $frame x5cu status
+        lappend ::v2 [list S $id [list $status [string range $frame 6 end]]]
+    } else {
+        binary scan $frame x5Iu n
+        set items {}
+        set off 9
+        for { set i 0 } { $i < $n } { incr i } {
+            binary scan $frame x${off}cuIu status len
+            incr off 5
+            lappend items [list $status \
+                               [string range $frame $off [expr { $off + $len - 1 }]]]
+            incr off $len
+        }
+        lappend ::v2 [list B $id {*}$items]
+    }
+}
+
+proc v1_reply { frame } {
+    set ::v1 $frame
+}
+
+set v1 {}
+set v2 {}
+proc poll {} {
+    update
+    if { $::v1 ne {} && [llength $::v2] == 5 } {
+        finish
+    } elseif { [clock milliseconds] > $::deadline } {
+        fail "replies: v1 '$::v1', v2 '$::v2'"
+        done
+    } else {
+        dservAfter 20 poll
+    }
+}
+
+proc finish {} {
+    check "v1 error" "!TCL_ERROR boom" $::v1
+    check "pipelined, in order, by id" [list \
+        {S 1 {0 1}} \
+        {S 2 {0 42}} \
+        {S 3 {1 boom}} \
+        {B 4 {0 5} {0 6} {1 {invalid command name "nosuch_msg_cmd"}}} \
+        {S 5 {0 6}}] $::v2
+    done
+}
+
+set v1s [dserv_socket 2560]
+puts -nonewline $v1s [v1_frame "error boom"]
+
+set s [dserv_socket 2560]
+puts -nonewline $s [v1_frame "%protocol 2"]
+binary scan [read $s 4] Iu n
+check "protocol 2" 2 [read $s $n]
+
+# all of it at once, nothing waited for
+puts -nonewline $s [join [list \
+    [v2_frame S 1 {set ::msg_a 1}] \
+    [v2_frame S 2 {expr {6*7}}] \
+    [v2_frame S 3 {error boom}] \
+    [v2_frame B 4 [batch_body {{set ::msg_x 5} {incr ::msg_x} {nosuch_msg_cmd}}]] \
+    [v2_frame S 5 {set ::msg_x}]] ""]
+
+foreach { chan handler } [list $v1s v1_reply $s v2_reply] {
+    set buf($chan) {}
+    fconfigure $chan -blocking 0
+    fileevent $chan readable [list on_readable $chan $handler]
+}
+set deadline [expr { [clock milliseconds] + 5000 }]
+dservAfter 20 poll
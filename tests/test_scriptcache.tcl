@@ -0,0 +1,81 @@
+#
+# test_scriptcache.tcl
+#
+#  The compiled script cache for client requests:
+#  - dservScriptCache reports and sets its capacity, flushes, and
+#    rejects bad capacities
+#  - dservTiming scripts reports its counters
+#  - a script sent again is run from the kept object: the first time
+#    is a miss, the second compiles, and each one after is a hit
+#  - a proc redefined after a kept script has called it: the next run
+#    of that script calls the new body
+#  - hit_rate is hits / (hits + misses)
+#
+#  Client scripts run once this script has returned, so they are sent
+#  down one message port connection (protocol 2, in order, replies not
+#  waited for), and the last one checks what the others saw.
+#
+#  Run as: dserv --cscript tests/test_scriptcache.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+check "capacity" 256 [dservScriptCache]
+check "capacity set" 16 [dservScriptCache 16]
+check "flush" 16 [dservScriptCache flush]
+check "bad capacity" 1 [catch { dservScriptCache -1 }]
+check "bad arg" 1 [catch { dservScriptCache lots }]
+dservScriptCache 256
+
+set stats [dservTiming scripts]
+check "stats" {capacity compiles evictions hit_rate hits misses size} \
+    [lsort [dict keys $stats]]
+check "size" 0 [dict get $stats size]
+
+proc v2_frame { kind id body } {
+    return [binary format Ia1Ia* [expr { 5 + [string length $body] }] \
+                $kind $id $body]
+}
+
+proc cache_probe {} { return old }
+proc hits {} { return [dict get [dservTiming scripts] hits] }
+
+proc finish {} {
+    dservAfterCancel $::timeout
+    check "same script: miss, compile, then hits" 2 \
+        [expr { $::h1 - $::h0 }]
+    check "redefined proc runs its new body" {old old old old new} $::probe
+    check "the new body from the kept script" 1 [expr { $::h2 - $::h1 }]
+    set stats [dservTiming scripts]
+    dict with stats {
+        check "hit_rate" [format %.3f [expr { double($hits) /
+                                              ($hits + $misses) }]] $hit_rate
+    }
+    close $::s
+    done
+}
+
+set probe {}
+set scripts {
+    {set ::h0 [hits]}
+    {lappend ::probe [cache_probe]}
+    {lappend ::probe [cache_probe]}
+    {lappend ::probe [cache_probe]}
+    {lappend ::probe [cache_probe]}
+    {set ::h1 [hits]}
+    {proc cache_probe {} { return new }}
+    {lappend ::probe [cache_probe]}
+    {set ::h2 [hits]}
+    finish
+}
+
+set timeout [dservAfter 5000 { fail "scripts ran: '$::probe'"; done }]
+set s [dserv_socket 2560]
+set hello "%protocol 2"
+puts -nonewline $s [binary format Ia* [string length $hello] $hello]
+binary scan [read $s 4] Iu n
+read $s $n
+set id 0
+foreach script $scripts {
+    puts -nonewline $s [v2_frame S [incr id] $script]
+}
@@ -0,0 +1,47 @@
+#
+# test_send_batch.tcl
+#
+#  Subscribe a socket of our own as a send client and check that the
+#  points set in one go reach it, and that the writer counters and
+#  flush interval do what they say:
+#  - every point arrives, in order
+#  - points and bytes count exactly what the subscriber received, in
+#    fewer writes than points
+#  - with dservSendClientBuffering's flush_us set, a lone point still
+#    arrives (flush_us bounds the wait); unknown ids are errors
+#
+#  Run as: dserv --cscript tests/test_send_batch.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+subscriber 4698
+set s [dserv_socket]
+request $s "%reg 127.0.0.1 4698 0"
+request $s "%match 127.0.0.1 4698 test/send/* 1"
+
+set pairs {}
+for { set i 0 } { $i < 50 } { incr i } { lappend pairs test/send/p $i }
+dservSetBatch $pairs
+
+check "every point" 50 [wait_lines 4698 50]
+set expected {}
+for { set i 0 } { $i < 50 } { incr i } { lappend expected $i }
+check "in order" $expected [lmap l $lines(4698) { lindex $l end }]
+
+set id 127.0.0.1:4698
+set info [lsearch -inline -index 1 [dservSendClients] $id]
+set received 0
+foreach l $lines(4698) { incr received [expr { [string length $l] + 1 }] }
+check "points counted" 50 [dict get $info points]
+check "bytes counted" $received [dict get $info bytes]
+check "fewer writes than points" 1 [expr { [dict get $info batches] < 50 }]
+
+check "flush_us set" 500 [dict get [dservSendClientBuffering $id 500] flush_us]
+dservSet test/send/p last
+check "a lone point within flush_us" 51 [wait_lines 4698 51 500]
+check "unknown id refused" 1 [catch { dservSendClientBuffering nosuch:0 }]
+
+request $s "%unreg 127.0.0.1 4698"
+close $s
+done
@@ -0,0 +1,77 @@
+#
+# test_send_policy.tcl
+#
+#  Delivery policies for send clients that fall behind:
+#  - rate:5 passes the first of a burst per varname at once, holds
+#    the newest of the rest, and sends it once 200 ms are up: the last
+#    value of the burst arrives, the ones between are conflated
+#  - latest may conflate, but every point is either sent or replaced,
+#    and the newest value of each name always arrives
+#  - policies are reported by dservSendClients/dservSendClientPolicy,
+#    and a bad one is refused
+#
+#  Run as: dserv --cscript tests/test_send_policy.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+subscriber 4697
+subscriber 4696
+
+set s [dserv_socket]
+request $s "%reg 127.0.0.1 4697 0 rate:5"
+request $s "%match 127.0.0.1 4697 test/policy/* 1"
+request $s "%reg 127.0.0.1 4696 0"
+request $s "%match 127.0.0.1 4696 test/policy/* 1 latest"
+
+set pairs {}
+for { set i 0 } { $i < 50 } { incr i } {
+    lappend pairs test/policy/a $i test/policy/b $i
+}
+dservSetBatch $pairs
+
+proc client { id } {
+    return [lsearch -inline -index 1 [dservSendClients] 127.0.0.1:$id]
+}
+
+# latest: wait for the newest of both names
+proc newest { port name } {
+    set last {}
+    foreach l $::lines($port) {
+        if { [string match $name* $l] } { set last [lindex $l end] }
+    }
+    return $last
+}
+set deadline [expr { [clock milliseconds] + 2000 }]
+while { ([newest 4696 test/policy/a] ne 49 || [newest 4696 test/policy/b] ne 49)
+        && [clock milliseconds] < $deadline } {
+    wait_lines 4696 [expr { [llength $lines(4696)] + 1 }] 50
+}
+wait_lines 4697 4 1000
+
+proc values { port name } {
+    return [lmap l [lsearch -all -inline $::lines($port) $name*] {
+        lindex $l end }]
+}
+set rate [client 4697]
+check "rate policy" rate:5 [dict get $rate policy]
+check "rate: first and last of a" {0 49} [values 4697 test/policy/a]
+check "rate: first and last of b" {0 49} [values 4697 test/policy/b]
+check "rate: the ones between conflated" 96 [dict get $rate conflated]
+check "rate: none dropped" 0 [dict get $rate dropped]
+
+set latest [client 4696]
+check "latest policy" latest [dict get $latest policy]
+check "latest: sent or replaced" 100 \
+    [expr { [llength $lines(4696)] + [dict get $latest conflated] }]
+check "latest: newest a" 49 [newest 4696 test/policy/a]
+check "latest: newest b" 49 [newest 4696 test/policy/b]
+
+check "policy set" all:100 [dservSendClientPolicy 127.0.0.1:4696 all:100]
+check "bad policy refused" 1 \
+    [catch { dservSendClientPolicy 127.0.0.1:4696 rate:0 }]
+
+request $s "%unreg 127.0.0.1 4697"
+request $s "%unreg 127.0.0.1 4696"
+close $s
+done
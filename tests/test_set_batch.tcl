@@ -0,0 +1,50 @@
+#
+# test_set_batch.tcl
+#
+#  Set several points in one dservSetBatch and check they all land:
+#  - varname/value pairs
+#  - -data entries with a timestamp and a binary payload
+#  - a bad entry is an error, and sets nothing
+#  - scripts run per point, in batch order, and each finds the whole
+#    batch already in the table
+#
+#  Run as: dserv --cscript tests/test_set_batch.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+dservSetBatch {test/batch/a 1 test/batch/b 2 test/batch/c hello}
+check "pairs" {1 2 hello} [list [dservGet test/batch/a] \
+                               [dservGet test/batch/b] [dservGet test/batch/c]]
+
+dservSetBatch -data [list \
+    [list test/batch/d 1000 5 [binary format i3 {7 8 9}]] \
+    [list test/batch/e 2000 2 [binary format f 1.5]]]
+check "-data" {{7 8 9} 1.5 1000} [list [dservGet test/batch/d] \
+                                      [dservGet test/batch/e] \
+                                      [dservTimestamp test/batch/d]]
+
+check "odd list refused" 1 [catch { dservSetBatch {test/batch/f} }]
+check "bad entry refused" 1 [catch {
+    dservSetBatch -data [list [list test/batch/g 0 5 [binary format i 1]] \
+                             {test/batch/h 0}]
+}]
+check "and nothing set" 0 [dservExists test/batch/g]
+
+# each run records its point and what the table held for the last one
+set seen {}
+proc on_point { name value } {
+    lappend ::seen [list $name $value [dservGet test/order/z]]
+}
+proc finish { name value } {
+    check "a script per point, in order, each seeing the whole batch" \
+        {{test/order/x 1 3} {test/order/y 2 3} {test/order/z 3 3}} $::seen
+    done
+}
+dservAddMatch test/order/*
+dpointSetScript test/order/* on_point
+dservAddExactMatch test/batch_done
+dpointSetScript test/batch_done finish
+
+dservSetBatch {test/order/x 1 test/order/y 2 test/order/z 3}
+dservSet test/batch_done 1
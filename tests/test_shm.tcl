@@ -0,0 +1,59 @@
+#
+# test_shm.tcl
+#
+#  The shared memory ring server for same-host producers:
+#  - dservShmInfo names the socket producers connect to, keyed on the
+#    dataserver port, and starts with no rings and nothing taken
+#  - dservShmPoll sets and reports the polling window, within bounds
+#  - with a producer (test_shm_ring, api/dservapi.c): every record it
+#    wrote is taken, in order, a full ring's drop is counted here too,
+#    and no ring is left open once it has gone
+#
+#  The producer is run when SHM_RING_TEST names it (ctest does); see
+#  also scripts/timing/shm_load.c to drive one.
+#
+#  Run as: dserv --cscript tests/test_shm.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+set info [dservShmInfo]
+check "socket" @dserv-shm.4620 [dict get $info socket]
+check "no rings" {} [dict get $info rings]
+check "nothing taken" 0 [dict get $info records]
+
+check "poll default" 0 [dservShmPoll]
+check "poll set" 200 [dservShmPoll 200]
+check "bad poll refused" 1 [catch { dservShmPoll -1 }]
+check "poll off" 0 [dservShmPoll 0]
+
+if { ![info exists env(SHM_RING_TEST)] } {
+    puts "SHM_RING_TEST not set: no producer run"
+    done
+    return
+}
+
+# the ring worker needs nothing of this interp, so the producer can
+# run while we wait for it
+if { [catch { exec $env(SHM_RING_TEST) 2>@ stderr } out] } {
+    fail "producer: $out"
+}
+puts $out
+if { [string match "*FAIL*" $out] } { set FAIL 1 }
+
+if { [regexp {records (\d+) dropped (\d+) full (\d+)} $out -> \
+          records dropped full] } {
+    # the rings are let go on the worker's next pass
+    for { set i 0 } { $i < 50 } { incr i } {
+        if { [dict get [dservShmInfo] rings] eq {} } break
+        after 20
+    }
+    set info [dservShmInfo]
+    check "every record taken" $records [dict get $info records]
+    check "drop counted" $dropped [dict get $info dropped]
+    check "rings closed" {} [dict get $info rings]
+    check "last that fit" $full [dservGet test/shm/full]
+    check "last wrap, whole" [lrepeat 25 1999] [dservGet test/shm/wrap]
+}
+
+done
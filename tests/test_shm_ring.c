@@ -0,0 +1,121 @@
+/*
+ * test_shm_ring.c
+ *
+ *  The producer's side of the shared memory rings (api/dservapi.c,
+ * src/shmring.h), against a running dserv on port 4620:
+ *  - a second ring under a name already open is refused
+ *  - a full ring drops the record that doesn't fit and counts it, and
+ *    what did fit is taken once the doorbell rings
+ *  - records keep going through as the ring wraps, pad records and all
+ *  - a ring whose positions make no sense is closed by dserv
+ *
+ *  dservapi.c is included rather than linked so the test can reach the
+ * ring itself: to fill it without ringing, and to corrupt it.  Run by
+ * test_shm.tcl, which checks what dserv made of it (dservShmInfo and
+ * the points).  Prints the checks like testlib.tcl and exits 1 if any
+ * failed.
+ */
+#include <poll.h>
+
+#include "dservapi.c"
+
+#define PORT 4620
+#define RING_BYTES DSERV_SHMRING_MIN_SIZE
+#define WRAP_RECORDS 2000
+#define WRAP_BURST 100
+
+static int failed = 0;
+
+static void check(const char *label, int ok)
+{
+  printf("  %s %s\n", ok ? "ok  " : "FAIL", label);
+  if (!ok) failed = 1;
+}
+
+static void doorbell(dservapi_shm_t *shm)
+{
+  uint64_t one = 1;
+  if (write(shm->evfd, &one, sizeof(one)) < 0) {}
+}
+
+/* 1 once dserv has taken everything written, 0 after two seconds */
+static int drained(dservapi_shm_t *shm)
+{
+  int i;
+  for (i = 0; i < 2000; i++) {
+    if (__atomic_load_n(&shm->ring->tail, __ATOMIC_ACQUIRE) ==
+	shm->ring->head)
+      return 1;
+    usleep(1000);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  dservapi_shm_t *shm, *dup, *bad;
+  const char *full = "test/shm/full", *wrap = "test/shm/wrap";
+  int records = 0, fit = 0, i, j, v;
+  unsigned long dropped;
+  int vals[25];
+  struct pollfd pfd;
+  char c;
+
+  shm = dservapi_shm_open(PORT, "test_ring", RING_BYTES);
+  check("ring opened", shm != NULL);
+  if (!shm) return 1;
+
+  dup = dservapi_shm_open(PORT, "test_ring", RING_BYTES);
+  check("name in use refused", dup == NULL);
+  dservapi_shm_close(dup);
+
+  /* the doorbell unrung, dserv leaves the ring alone until it fills */
+  for (v = 0; dserv_shmring_put(shm->ring, full, strlen(full), DSERV_INT,
+				sizeof(v), &v, 0); v++)
+    fit++;
+  check("full ring fits size / reclen",
+	fit == RING_BYTES / dserv_shmring_reclen(strlen(full), sizeof(v)));
+  check("no room: dropped and counted", dservapi_shm_dropped(shm) == 1);
+  records += fit;
+
+  doorbell(shm);
+  check("full ring taken", drained(shm));
+
+  /* 160 byte records: they don't divide the ring, so some ends pad */
+  for (i = 0; i < WRAP_RECORDS; i += WRAP_BURST) {
+    for (j = 0; j < WRAP_BURST; j++) {
+      for (v = 0; v < 25; v++) vals[v] = i + j;
+      if (!dservapi_shm_write(shm, wrap, DSERV_INT, sizeof(vals), vals))
+	break;
+      records++;
+    }
+    if (j < WRAP_BURST || !drained(shm)) break;
+  }
+  check("wrapped, every record taken",
+	i == WRAP_RECORDS && shm->ring->head > 4 * RING_BYTES);
+  dropped = dservapi_shm_dropped(shm);
+  check("nothing more dropped", dropped == 1);
+
+  pfd.fd = shm->sock;
+  pfd.events = POLLIN;
+  check("still open", poll(&pfd, 1, 0) == 0);
+  dservapi_shm_close(shm);
+
+  bad = dservapi_shm_open(PORT, "test_corrupt", RING_BYTES);
+  check("second ring opened", bad != NULL);
+  if (bad) {
+    /* more written than the ring holds */
+    __atomic_store_n(&bad->ring->head, 2 * (uint64_t) RING_BYTES,
+		     __ATOMIC_RELEASE);
+    doorbell(bad);
+    pfd.fd = bad->sock;
+    pfd.events = POLLIN;
+    check("corrupt ring closed",
+	  poll(&pfd, 1, 2000) == 1 && recv(bad->sock, &c, 1, 0) == 0);
+    dservapi_shm_close(bad);
+  }
+
+  printf("shm_ring: records %d dropped %lu full %d\n", records, dropped,
+	 fit - 1);
+  return failed;
+}
@@ -0,0 +1,44 @@
+#
+# test_websocket.tcl
+#
+#  Replies and pushes on one websocket share a single ordered stream:
+#  - a push past LARGE_MESSAGE_THRESHOLD (2 MB) goes out as one
+#    fragmented message, and arrives whole
+#  - a request answered while that push is still going out is replied
+#    to after it, not in the middle of its fragments
+#
+#  Run as: dserv --cscript tests/test_websocket.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+if { [dservGet system/ssl] } {
+    puts "wss only here: nothing to test"
+    done
+    return
+}
+
+dservSet test/ws/small 7
+set big [string repeat x [expr { 3 * 1024 * 1024 }]]
+
+set w [ws_socket]
+ws_send $w {{"cmd":"subscribe","match":"test/ws/big"}}
+check "subscribed" 1 \
+    [string match {*"subscribed"*} [lindex [ws_recv $w] 1]]
+
+# not reading: the push fills the socket and the rest waits for it
+dservSet test/ws/big $big
+after 200
+ws_send $w {{"cmd":"get","name":"test/ws/small"}}
+
+set push [ws_recv $w 5000]
+check "push first" 1 [string match {*"test/ws/big"*} [lindex $push 1]]
+check "push whole" 1 [string match "*\"$big\"*" [lindex $push 1]]
+check "push fragmented" 1 [expr { [ws_frames $w] > 1 }]
+
+set reply [ws_recv $w]
+check "then the reply" 1 [string match {*"test/ws/small"*} [lindex $reply 1]]
+check "nothing else" {} [ws_recv $w 200]
+
+close $w
+done
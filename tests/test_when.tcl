@@ -0,0 +1,56 @@
+#
+# test_when.tcl
+#
+#  dservWhen predicates, compiled at registration.  Each is registered
+#  against a point that already has a value, so the level check at
+#  registration decides it -- the same test run_when_callbacks applies
+#  to every delivered point:
+#  - numeric comparisons against int, byte, double and string values
+#  - eq/ne and in/ni, compared as Tcl would
+#  - forms with substitution still go through Tcl
+#  - a byte value reads as its one byte
+#
+#  Run as: dserv --cscript tests/test_when.tcl
+#
+
+source [file join [file dirname [info script]] testlib.tcl]
+
+set ::fired {}
+proc fired { name value } { lappend ::fired $value }
+
+# whether pred holds for key's value now: 1 if it fired, 0 if not
+proc when_fires { key pred } {
+    set ::fired {}
+    dservWhen $key $pred fired
+    return [llength $::fired]
+}
+
+dservSetData when/i 0 5 [binary format i 42]
+dservSetData when/b 0 0 [binary format c 200]
+dservSetData when/d 0 3 [binary format d 2.5]
+dservSet when/s 42
+dservSet when/name left
+
+check "int > 40" 1 [when_fires when/i {> 40}]
+check "int < 40" 0 [when_fires when/i {< 40}]
+check "int == 42.0" 1 [when_fires when/i {== 42.0}]
+check "int eq 42" 1 [when_fires when/i {eq 42}]
+check "int in" 1 [when_fires when/i {in {1 42}}]
+check "byte == 200" 1 [when_fires when/b {== 200}]
+check "double <= 2.5" 1 [when_fires when/d {<= 2.5}]
+check "double != 2.5" 0 [when_fires when/d {!= 2.5}]
+check "string == 0x2a" 1 [when_fires when/s {== 0x2a}]
+check "string >= 43" 0 [when_fires when/s {>= 43}]
+check "name eq left" 1 [when_fires when/name {eq left}]
+check "name ni" 1 [when_fires when/name {ni {right up}}]
+check "name < m" 1 [when_fires when/name {< m}]
+
+set limit 40
+check "int > \$limit" 1 [when_fires when/i {> $limit}]
+check "glob > 40" 1 [when_fires when/* {> 40}]
+
+check "byte reads as its byte" 200 [dservGet when/b]
+when_fires when/i {== 42}
+check "callback gets the value" 42 $::fired
+
+done
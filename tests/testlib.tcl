@@ -0,0 +1,179 @@
+#
+# testlib.tcl
+#
+#  Shared by the dserv --cscript tests: the same check/ok/fail as the
+#  module unit tests, and done to report and leave.
+#
+#  A cscript runs in the main interp, where exit is refused ("Cannot
+#  exit main dserv process"), so done asks the Dataserver interp to
+#  exit instead.  Callbacks (dpoint scripts, fileevents) only run once
+#  the cscript itself has returned, so a test that waits on them calls
+#  done from the last one rather than falling off the end.
+#
+#  Source it with
+#    source [file join [file dirname [info script]] testlib.tcl]
+#
+
+set FAIL 0
+proc ok   { label } { puts "  ok   $label" }
+proc fail { label } { puts "  FAIL $label"; set ::FAIL 1 }
+proc check { label expected actual } {
+    if { $expected eq $actual } {
+        ok $label
+    } else {
+        fail "$label -- expected '$expected', got '$actual'"
+    }
+}
+
+proc done {} {
+    if { $::FAIL } {
+        puts "FAILURES"
+    } else {
+        puts "all checks passed"
+    }
+    flush stdout
+    dservEval exit
+}
+
+#
+# Sockets: a client of our own dataserver port, and subscribers for it
+# to send to.
+#
+#   set s [dserv_socket]            binary, unbuffered, to port 4620
+#   request $s "%version"           send a line, return its reply line
+#   fixed_frame name value          a '>' frame setting an int
+#   var_frame name type data        a '}' message
+#   subscriber port                 listen on port; every line a client
+#                                   sends there is appended to
+#                                   ::lines($port)
+#   wait_lines port n ?ms?          run the event loop until n lines are
+#                                   in (or ms pass); returns the count
+#   wait_until cond ?ms?            run the event loop until the expr
+#                                   cond holds (or ms pass); 1 if it did
+#
+proc dserv_socket { { port 4620 } } {
+    set s [socket 127.0.0.1 $port]
+    fconfigure $s -translation binary -buffering none
+    return $s
+}
+
+proc request { s line } {
+    puts -nonewline $s "$line\n"
+    return [string trimright [gets $s] \r]
+}
+
+proc fixed_frame { name value } {
+    set f [binary format a1sa*wiii > [string length $name] $name 0 5 4 $value]
+    return [binary format a128 $f]
+}
+
+proc var_frame { name type data } {
+    return [binary format a1siiwa*a* \} [string length $name] $type \
+                [string length $data] 0 $name $data]
+}
+
+proc subscriber { port } {
+    set ::lines($port) {}
+    set ::listeners($port) [socket -server [list subscriber_accept $port] $port]
+}
+proc subscriber_accept { port chan addr rport } {
+    fconfigure $chan -buffering line -blocking 0
+    fileevent $chan readable [list subscriber_read $port $chan]
+}
+proc subscriber_read { port chan } {
+    while { [gets $chan line] >= 0 } { lappend ::lines($port) $line }
+    if { [eof $chan] } { close $chan }
+}
+
+proc wait_lines { port n { ms 2000 } } {
+    wait_until "\[llength \$::lines($port)\] >= $n" $ms
+    return [llength $::lines($port)]
+}
+
+# Service fileevents until cond (an expr, evaluated at global level)
+# holds or ms pass; 1 if it held.  This polls with update: `after ms
+# script` is refused here, since nothing would run the timer.
+proc wait_until { cond { ms 2000 } } {
+    set deadline [expr { [clock milliseconds] + $ms }]
+    while { 1 } {
+        update
+        if { [uplevel #0 [list expr $cond]] } { return 1 }
+        if { [clock milliseconds] >= $deadline } { return 0 }
+        after 10
+    }
+}
+
+#
+# Websockets: a client of the /ws endpoint, enough of RFC 6455 to
+# drive it (plain ws only -- a rig with certificates serves wss).
+#
+#   set w [ws_socket]               upgraded connection, port 2565
+#   ws_send $w text                 one masked text frame
+#   ws_recv $w ?ms?                 the next whole message, its
+#                                   fragments joined, as {opcode data}
+#                                   (1 text, 2 binary); {} if nothing
+#                                   comes within ms
+#   ws_frames $w                    frames that made up the last message
+#
+proc ws_socket { { port 2565 } } {
+    set s [socket 127.0.0.1 $port]
+    fconfigure $s -translation binary -buffering none
+    puts -nonewline $s "GET /ws HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n"
+    set status [gets $s]
+    while { [string trimright [gets $s] \r] ne "" } {}
+    if { [lindex $status 1] ne 101 } {
+        error "websocket upgrade refused: $status"
+    }
+    return $s
+}
+
+proc ws_send { s text } {
+    set text [encoding convertto utf-8 $text]
+    set n [string length $text]
+    # a zero mask leaves the payload as it is
+    if { $n < 126 } {
+        set head [binary format cc 0x81 [expr { 0x80 | $n }]]
+    } elseif { $n < 65536 } {
+        set head [binary format ccS 0x81 [expr { 0x80 | 126 }] $n]
+    } else {
+        set head [binary format ccW 0x81 [expr { 0x80 | 127 }] $n]
+    }
+    puts -nonewline $s "$head[binary format I 0]$text"
+}
+
+# the handler takes itself off: until the frame is read the socket
+# stays readable, and update would run it forever
+proc ws_readable { s ms } {
+    set ::ws_ready 0
+    fileevent $s readable "fileevent $s readable {}; set ::ws_ready 1"
+    wait_until {$::ws_ready} $ms
+    fileevent $s readable {}
+    return $::ws_ready
+}
+
+proc ws_recv { s { ms 2000 } } {
+    set message {}
+    set opcode 0
+    set ::ws_frames($s) 0
+    while { [ws_readable $s $ms] } {
+        if { [binary scan [read $s 2] cucu b0 b1] < 2 } break
+        set n [expr { $b1 & 0x7f }]
+        if { $n == 126 } {
+            binary scan [read $s 2] Su n
+        } elseif { $n == 127 } {
+            binary scan [read $s 8] Wu n
+        }
+        append message [read $s $n]
+        incr ::ws_frames($s)
+        if { $b0 & 0x0f } { set opcode [expr { $b0 & 0x0f }] }
+        if { $b0 & 0x80 } {
+            if { $opcode == 1 } {
+                set message [encoding convertfrom utf-8 $message]
+            }
+            return [list $opcode $message]
+        }
+    }
+    return {}
+}
+
+proc ws_frames { s } { return $::ws_frames($s) }
@@ -15,6 +15,8 @@ class DatapointManager {
         this.options = {
             autoGetKeys: options.autoGetKeys !== false,
             updateInterval: options.updateInterval || 1, // every N updates
+            format: options.format || 'json', // or 'binary' (compact framed points)
+            policy: options.policy || null,   // when behind: 'all', 'latest', 'rate:N'
             ...options
         };
         
@@ -299,7 +301,9 @@ class DatapointManager {
             this.connection.send({
                 cmd: 'subscribe',
                 match: pattern,
-                every: every
+                every: every,
+                format: this.options.format,
+                ...(this.options.policy ? { policy: this.options.policy } : {})
             });
         } else {
             console.error('Connection does not support send method');
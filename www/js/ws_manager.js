@@ -28,8 +28,8 @@ class DservConnection {
         this.requestId = 0;
         this.linkedSubprocess = null;
 
-        // Chunked message reassembly
-        this._chunks = new Map(); // messageId -> { chunks: [], totalChunks, timer }
+        // Binary datapoint stream: id -> varname, per connection
+        this._dpointNames = new Map();
         
         // Event handlers for event emitter pattern
         this.eventHandlers = new Map();
@@ -128,6 +128,8 @@ class DservConnection {
             
             try {
                 this.ws = new WebSocket(url);
+                this.ws.binaryType = 'arraybuffer';
+                this._dpointNames.clear();
             } catch (e) {
                 settled = true;
                 clearTimeout(connectTimeout);
@@ -239,42 +241,111 @@ class DservConnection {
         }, delay);
     }
 
-    handleMessage(rawData) {
-        // Parse JSON if possible
-        let data;
-        try {
-            data = JSON.parse(rawData);
-        } catch (e) {
-            data = rawData;
-        }
+    /**
+     * Decode a binary datapoint stream message (subscribe with
+     * format: 'binary'; layout in TclServer.h) into the same objects
+     * the JSON stream delivers.  Numeric data comes back as numbers or
+     * arrays of them, strings as strings, and everything else (dg,
+     * arrow, jpeg, ...) as a Uint8Array rather than base64.  Data for
+     * an id with no name record yet is skipped.
+     */
+    decodeBinaryDatapoints(buffer) {
+        const view = new DataView(buffer);
+        const bytes = new Uint8Array(buffer);
+        const text = new TextDecoder();
+        const points = [];
+        let off = 0;
+
+        const numbers = (dtype, start, len) => {
+            const n = (size) => Math.floor(len / size);
+            const read = {
+                0: [1, (o) => view.getUint8(o)],
+                2: [4, (o) => view.getFloat32(o, true)],
+                3: [8, (o) => view.getFloat64(o, true)],
+                4: [2, (o) => view.getUint16(o, true)],
+                5: [4, (o) => view.getUint32(o, true)],
+                16: [8, (o) => Number(view.getBigUint64(o, true))],
+            }[dtype];
+            if (!read) return undefined;
+            const [size, get] = read;
+            const vals = [];
+            for (let i = 0; i < n(size); i++) vals.push(get(start + i * size));
+            return vals;
+        };
 
-        // Chunked message reassembly (server splits messages > 2MB)
-        if (typeof data === 'object' && data.isChunkedMessage) {
-            const { messageId, chunkIndex, totalChunks } = data;
-            if (!this._chunks.has(messageId)) {
-                this._chunks.set(messageId, {
-                    chunks: new Array(totalChunks),
-                    totalChunks,
-                    received: 0,
-                    timer: setTimeout(() => {
-                        console.warn('Chunk reassembly timeout for', messageId);
-                        this._chunks.delete(messageId);
-                    }, 60000),
-                });
+        while (off < bytes.length) {
+            const kind = view.getUint8(off);
+            if (kind === 1) {            // name: u8 kind, u8 0, u16 id, u16 len, name
+                const id = view.getUint16(off + 2, true);
+                const len = view.getUint16(off + 4, true);
+                this._dpointNames.set(id, text.decode(bytes.subarray(off + 6, off + 6 + len)));
+                off += 6 + len;
+            } else if (kind === 2) {     // data: u8 kind, u8 dtype, u16 id, u32 len, u64 ts
+                const dtype = view.getUint8(off + 1);
+                const id = view.getUint16(off + 2, true);
+                const len = view.getUint32(off + 4, true);
+                const timestamp = Number(view.getBigUint64(off + 8, true));
+                let start = off + 16;
+                const name = this._dpointNames.get(id);
+                if (name === undefined) {
+                    // no name record seen for this id: nothing to deliver it as
+                    console.warn('Binary datapoint for unknown id', id);
+                    off = start + (dtype === 9 ? 4 : 0) + len;
+                    continue;
+                }
+                const point = { type: 'datapoint', name, timestamp, dtype };
+
+                if (dtype === 9) {
+                    // events: u8 e_type, u8 e_subtype, u8 e_puttype, u8 0
+                    point.e_type = view.getUint8(start);
+                    point.e_subtype = view.getUint8(start + 1);
+                    point.e_dtype = view.getUint8(start + 2);
+                    start += 4;
+                    point.e_params = point.e_dtype === 1 ?
+                        text.decode(bytes.subarray(start, start + len)) :
+                        (numbers(point.e_dtype, start, len) || []);
+                } else if (dtype === 1 || dtype === 7 || dtype === 8 || dtype === 11) {
+                    point.data = text.decode(bytes.subarray(start, start + len));
+                } else if (dtype === 10) {
+                    point.data = null;
+                } else {
+                    const vals = numbers(dtype, start, len);
+                    point.data = vals === undefined ? bytes.slice(start, start + len) :
+                        (vals.length === 1 ? vals[0] : vals);
+                }
+                points.push(point);
+                off = start + len;
+            } else {
+                console.warn('Unknown binary datapoint record', kind);
+                break;
             }
-            const entry = this._chunks.get(messageId);
-            entry.chunks[chunkIndex] = data.data;
-            entry.received++;
+        }
+        return points;
+    }
 
-            if (entry.received < entry.totalChunks) {
-                return; // Wait for remaining chunks
+    handleMessage(rawData) {
+        // Messages over 2MB arrive as websocket fragments, which the
+        // browser has already put back together: rawData is always a
+        // whole message.
+        // Binary datapoint stream: each record goes through as if it
+        // had arrived as JSON
+        if (rawData instanceof ArrayBuffer) {
+            for (const point of this.decodeBinaryDatapoints(rawData)) {
+                this.handleMessage(point);
             }
+            return;
+        }
 
-            // All chunks received - reassemble and re-enter handleMessage
-            clearTimeout(entry.timer);
-            const assembled = entry.chunks.join('');
-            this._chunks.delete(messageId);
-            return this.handleMessage(assembled);
+        // Parse JSON if possible
+        let data;
+        if (typeof rawData !== 'string') {
+            data = rawData;
+        } else {
+            try {
+                data = JSON.parse(rawData);
+            } catch (e) {
+                data = rawData;
+            }
         }
 
         // requestId-matched responses (evalAsync): resolve exactly the